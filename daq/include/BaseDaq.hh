@@ -7,13 +7,15 @@
 #ifndef BASEDAQ_h
 #define BASEDAQ_h
 
-#include <queue>
 #include <string>
 #include <stdexcept>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
+#include <atomic>
 #include "RawEvent.hh"
+#include "RingBuffer.hh"
+#include "BufferPool.hh"
 
 
 /** @class BaseDaq
@@ -23,6 +25,11 @@
  *  underlying subprocesses which handle threads, etc. 
  *  Throws error if instantiated more than once at a time.
  *
+ *  Events are handed from the acquisition thread to the consumers through 
+ *  a lock-free RingBuffer.  Either side that has to wait spins for a short 
+ *  time before sleeping on a condition variable, so bursts of triggers 
+ *  don't immediately put threads to sleep.
+ *
  *  @ingroup daqman
 */
 class BaseDaq 
@@ -40,8 +47,11 @@ public:
   };
   
 
-  ///Default constructor. Throws exception if more than one constructed     
-  BaseDaq() throw(std::runtime_error);
+  /** Default constructor. Throws exception if more than one exclusive 
+      instance is constructed.  Backends which don't own any hardware,
+      like the simulation, can pass exclusive=false.
+  */
+  BaseDaq(bool exclusive=true) throw(std::runtime_error);
   
   /// Virtual destructor
   virtual ~BaseDaq();
@@ -88,7 +98,37 @@ public:
   RawEventPtr GetNextEvent(int timeout=-1);
   
   ///Queries how many events are waiting in the memory buffer
-  int GetEventsReady(){ return _events_queue.size(); }
+  int GetEventsReady(){ return _events_queue.GetSize(); }
+  
+  /** Set the size of the event queue.  Only takes effect between runs.
+      @param max_events  number of events the queue can hold
+      @param max_bytes   total data size allowed in the queue, 0 for no limit
+      @param spin_us     how long to poll before sleeping when waiting
+      @param warn        print a warning the first time the queue fills
+  */
+  int SetQueueLimits(size_t max_events, long max_bytes, int spin_us=50,
+		     bool warn=true);
+  
+  /** Preallocate event buffers instead of allocating one per event.  Only
+      takes effect between runs.
+      @param buffer_size  largest data block an event needs
+      @param budget       total memory for the pool, 0 to disable it
+      @param hugepages    try to back the pool with huge pages
+      @param lock         lock the pool in RAM
+  */
+  int SetBufferPool(size_t buffer_size, long budget, bool hugepages=false,
+		    bool lock=false);
+  /// Get the pool of event buffers
+  const BufferPool& GetBufferPool() const { return _buffer_pool; }
+  
+  /// Most events that were waiting in the queue at once this run
+  size_t GetQueueHighWater() const { return _queue_high_water; }
+  /// Most bytes that were waiting in the queue at once this run
+  long GetQueueHighWaterBytes() const { return _queue_high_water_bytes; }
+  /// Number of times the acquisition thread found the queue full
+  long GetQueueBlockedPosts() const { return _queue_blocked_posts; }
+  /// Total time in seconds the acquisition thread waited for space
+  double GetQueueBlockedTime() const { return _queue_blocked_us / 1.e6; }
   
   /**
      Run is aborted. 
@@ -114,18 +154,40 @@ protected:
   virtual void DataAcquisitionLoop()=0;
   /// Send a new RawEvent to whoever is waiting
   void PostEvent(RawEventPtr event);
+  /// Add a block of <size> bytes to <event>, from the pool if possible
+  int AddEventBuffer(RawEventPtr& event, uint32_t blocktype, uint32_t size);
   
   static bool _is_constructed; ///< does an instance already exist?
+  bool _exclusive;             ///< does this instance own the hardware?
   STATUS _status; ///< the status of the daq
   
-  bool _is_running; ///< is the daq running?
+  std::atomic<bool> _is_running; ///< is the daq running?
   std::thread _daq_thread; ///< thread controlling the daq
-  std::queue<RawEventPtr> _events_queue; ///< queue of raw events
-  std::mutex _queue_mutex; ///< mutex governing the events queue
+  RingBuffer<RawEventPtr> _events_queue; ///< queue of raw events
+  std::atomic<long> _queue_bytes; ///< data size of the events in the queue
+  long _max_queue_bytes;   ///< limit on _queue_bytes, 0 for none
+  int _queue_spin_us;      ///< how long to poll before sleeping
+  bool _queue_warn;        ///< warn when the queue fills?
+  
+  std::mutex _queue_mutex; ///< only used to sleep on the conditions
   std::condition_variable _event_ready; ///<  condition signalling new event
   std::condition_variable _event_taken; ///< signal a spot ready in queue
-  static const size_t MAX_QUEUE_SIZE = 10; ///< max events allowed in queue
+  std::atomic<int> _consumers_waiting;  ///< threads asleep on _event_ready
+  std::atomic<int> _producers_waiting;  ///< threads asleep on _event_taken
   int _n_queuesize_warnings;   ///< number of queue overflow warnings generated
+  
+  std::atomic<size_t> _queue_high_water; ///< most events queued at once
+  std::atomic<long> _queue_high_water_bytes; ///< most bytes queued at once
+  std::atomic<long> _queue_blocked_posts; ///< times PostEvent found it full
+  std::atomic<long long> _queue_blocked_us; ///< time PostEvent spent waiting
+  
+  BufferPool _buffer_pool; ///< preallocated event buffers
+  
+private:
+  /// Try once to put <event> in the queue
+  bool TryPost(const RawEventPtr& event, long bytes);
+  /// Wake any consumers sleeping in GetNextEvent
+  void NotifyConsumers();
 };
 
 #endif
@@ -0,0 +1,57 @@
+/** @file BlockCodec.hh
+    @brief Defines the BlockCodec class to compress raw datablocks on disk
+    @author bloer
+    @ingroup daqman
+*/
+
+#ifndef BLOCKCODEC_h
+#define BLOCKCODEC_h
+
+#include <stdint.h>
+#include <cstddef>
+#include <iostream>
+
+/** @class BlockCodec
+    @brief Compress and expand raw event datablocks with a choice of algorithm
+
+    The codec used for each block is stored in its datablock_header, so a
+    file may mix codecs freely.  LZ4 and ZSTD are only available if the
+    libraries were found at compile time (HAVE_LZ4, HAVE_ZSTD).  V172X is a
+    lossless codec for CAEN digitizer blocks (see V172X_Codec).
+    @ingroup daqman
+*/
+class BlockCodec{
+public:
+  /** @enum CODEC
+      @brief available compression algorithms; values are stored on disk
+  */
+  enum CODEC { STORED=0, ZLIB=1, LZ4=2, ZSTD=3, V172X=4 };
+
+  /// Was support for this codec compiled in?
+  static bool IsAvailable(CODEC codec);
+  /// Get a printable name for the codec
+  static const char* GetName(CODEC codec);
+  /// Maximum size of the encoded data for <srclen> input bytes
+  static size_t GetMaxEncodedSize(CODEC codec, size_t srclen);
+
+  /** Compress <srclen> bytes from <src> into <dest>, which has room for
+      <destlen> bytes.  On success returns 0 and sets <destlen> to the
+      encoded size.  <level> is the zlib or zstd compression level; it is
+      ignored by the other codecs.
+  */
+  static int Encode(CODEC codec, int level, const unsigned char* src,
+		    size_t srclen, unsigned char* dest, size_t& destlen);
+  /** Expand <srclen> bytes from <src> into <dest>, which has room for
+      <destlen> bytes. On success returns 0 and sets <destlen> to the
+      decoded size.
+  */
+  static int Decode(CODEC codec, const unsigned char* src, size_t srclen,
+		    unsigned char* dest, size_t& destlen);
+};
+
+/// CODEC ostream overload
+std::ostream& operator<<(std::ostream& out, const BlockCodec::CODEC& codec);
+/// CODEC istream overload
+std::istream& operator>>(std::istream& in, BlockCodec::CODEC& codec);
+
+#endif
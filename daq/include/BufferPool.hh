@@ -0,0 +1,76 @@
+/** @file BufferPool.hh
+    @brief Defines the BufferPool of preallocated event buffers
+    @author bloer
+    @ingroup daqman
+*/
+
+#ifndef BUFFERPOOL_h
+#define BUFFERPOOL_h
+
+#include <memory>
+#include <cstddef>
+
+/** @class BufferPool
+    @brief Fixed set of page-aligned buffers lent out for raw event data
+
+    All the buffers are carved out of one anonymous memory map, optionally
+    backed by huge pages and locked into RAM, which is touched once when it
+    is allocated so the daq never waits on page faults or zero-fills memory
+    it is about to overwrite.  Borrow hands out a free buffer together with
+    an owner pointer; give the owner to RawEvent::AddDataBlockView and the
+    buffer returns to the pool when the event is destroyed.  The memory
+    stays mapped until the last borrowed buffer comes back, even if the
+    pool is reallocated or destroyed first.
+
+    Borrow never blocks: when every buffer is out it returns null and
+    counts the miss, and the caller should fall back to the heap.
+    @ingroup daqman
+*/
+class BufferPool{
+public:
+  BufferPool();
+  ~BufferPool();
+
+  /** Allocate as many buffers of at least <buffer_size> bytes as fit in
+      <budget> bytes, replacing any previous allocation.  Returns 0 on
+      success; failing to get huge pages or to lock the memory only
+      generates a warning.
+  */
+  int Allocate(size_t buffer_size, size_t budget, bool hugepages=false,
+	       bool lock=false);
+  /// Give up the pool; borrowed buffers are freed when they are returned
+  void Release();
+  /// Is there memory to lend out?
+  bool IsAllocated() const { return (bool)_region; }
+
+  /// Usable size of each buffer
+  size_t GetBufferSize() const;
+  /// Number of buffers in the pool
+  size_t GetNBuffers() const;
+
+  /** Borrow a buffer.  Returns null if the pool is empty, otherwise
+      <owner> is set to a pointer that returns the buffer when released.
+  */
+  unsigned char* Borrow(std::shared_ptr<void>& owner);
+
+  /// Number of buffers lent out since the stats were reset
+  long GetBorrowed() const;
+  /// Number of times Borrow found no free buffer
+  long GetExhausted() const;
+  /// Number of buffers out right now
+  size_t GetInUse() const;
+  /// Most buffers out at the same time
+  size_t GetHighWater() const;
+  /// Reset the statistics
+  void ResetStats();
+
+private:
+  BufferPool(const BufferPool&);
+  BufferPool& operator=(const BufferPool&);
+
+  struct region;
+  struct returner;
+  std::shared_ptr<region> _region; ///< the current allocation
+};
+
+#endif
@@ -34,8 +34,14 @@ public:
     uint32_t datasize;
     uint32_t type;
     std::vector<unsigned char> data;
-    datablock(uint32_t Type, uint32_t Size=0) : datasize(Size), type(Type) 
+    unsigned char* external; ///< data stored outside the event, if not null
+    uint32_t external_size;  ///< space available at external
+    std::shared_ptr<void> owner; ///< keeps the external data alive
+    datablock(uint32_t Type, uint32_t Size=0) : datasize(Size), type(Type),
+						external(0), external_size(0)
     {data.resize(Size); }
+    /// Get a pointer to the start of the data, wherever it is stored
+    unsigned char* buffer(){ return external ? external : &data[0]; }
   };
   /** @enum datablock_type
       @brief lists pre-defined types of datablock
@@ -50,6 +56,10 @@ public:
   size_t GetNumDataBlocks() const { return _datablocks.size(); }
   /// Add new block at end of event, return index of that block (-1 if error)
   int AddDataBlock(uint32_t blocktype, uint32_t datasize=0);
+  /// Add a block viewing <datasize> bytes at <data> which is kept alive by
+  /// <owner>. The data is copied into the event if the block must grow
+  int AddDataBlockView(uint32_t blocktype, unsigned char* data, 
+		       uint32_t datasize, std::shared_ptr<void> owner);
   /// Remove the data block number n, return 0 if success
   int RemoveDataBlock(size_t block_n);
   
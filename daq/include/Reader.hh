@@ -9,12 +9,28 @@
 
 #include <zlib.h>
 #include <string>
+#include <vector>
+#include <deque>
+#ifndef SINGLETHREAD
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
 #include "RawEvent.hh"
 #include "VParameterNode.hh"
 
 
 /** @class Reader
     @brief reads raw events from a data file for processing
+    
+    Random access by index or id uses a table of event offsets, built on the
+    first such request.  Files written with global header version 2 carry
+    the table in a trailer after the last event; for older files it is built
+    by scanning and cached next to each raw file as <file>.idx 
+    
+    In prefetch mode, compressed events are read ahead on a separate thread
+    and their datablocks inflated by a pool of workers.  GetNextEvent still
+    returns events in file order.
 */
 class Reader{
 public:
@@ -27,7 +43,7 @@ public:
   ///Check if we're ok to read
   bool IsOk(){ return _ok; } 
   ///Check if we've reached the end of the file
-  bool eof(){ return _end_last_file || ( gzeof(_fin) && OpenNextFile() ); }
+  bool eof();
   //All event getters return null pointer if error
   /// Get the next event in the file
   RawEventPtr GetNextEvent(bool read_header = true);   
@@ -39,6 +55,29 @@ public:
   RawEventPtr GetLastEvent();
   /// Return the index of the current event in the file
   int GetCurrentIndex(){ return _current_index; }
+  /// Get the total number of events in the file series (builds the index)
+  long GetTotalEvents();
+  
+  /** Get the next event without inflating it.  <buf> is filled with the
+      event_header followed by the datablocks as stored on disk, converted 
+      to the latest event version, ready for RawWriter::WriteCompressedEvent.
+      Returns 0 on success.
+  */
+  int GetNextCompressedEvent(std::vector<char>& buf, bool read_header = true);
+  /// Get the still-compressed event with id <id>; returns 0 on success
+  int GetCompressedEventWithID(uint32_t id, std::vector<char>& buf);
+  
+  /// Read up to <queue_depth> events ahead using <nworkers> inflate threads
+  int EnablePrefetch(int queue_depth = 16, int nworkers = 2);
+  /// Go back to reading events on the caller's thread
+  void DisablePrefetch();
+  /// Is prefetch mode enabled?
+  bool IsPrefetchEnabled() const { return _prefetch_enabled; }
+  /// Number of times GetNextEvent had to wait for the prefetch queue
+  long GetPrefetchStalls() const { return _prefetch_stalls; }
+  /// Map block-compressed files into memory rather than reading them (default)
+  void SetUseMmap(bool use_mmap){ _use_mmap = use_mmap; }
+  
   /// Load the parameter <par> from the saved config file
   bool GetAssociatedParameter(VParameterNode* par, 
 			      std::string key="");
@@ -46,8 +85,8 @@ public:
   // headers for version control
 public:
   static const uint32_t magic_number = 0xdec0ded1; 
-  static const uint32_t latest_global_version = 1;
-  static const uint32_t latest_event_version = 1;
+  static const uint32_t latest_global_version = 2;
+  static const uint32_t latest_event_version = 2;
   struct global_header{
     uint32_t magic_num_check;
     uint32_t global_header_size;
@@ -66,7 +105,7 @@ public:
 		      global_header_size(sizeof(global_header)),
 		      global_header_version(1),
 		      event_header_size(sizeof(event_header)),
-		      event_header_version(1) {}
+		      event_header_version(latest_event_version) {}
     
   };
   struct event_header{
@@ -78,10 +117,39 @@ public:
     void reset(){ event_size=0; event_id=0; timestamp=0; nblocks=0; }
   };
 
+  /** Since global header version 2, file_size marks the end of the events,
+      and a file_trailer followed by nevents trailer_entry's comes after.
+      Files that were never closed properly keep version 1.
+  */
+  static const uint32_t trailer_magic_number = 0xdec0ded3;
+  struct file_trailer{
+    uint32_t magic_num_check;
+    uint32_t trailer_size;  ///< including the offset table
+    uint32_t nevents;
+    uint32_t event_id_min;
+    uint32_t event_id_max;
+    uint32_t start_time;
+    uint32_t end_time;
+    uint32_t run_id;
+    file_trailer() : magic_num_check(trailer_magic_number), 
+		     trailer_size(sizeof(file_trailer)) {}
+  };
+  struct trailer_entry{
+    uint32_t offset;    ///< byte offset of the event header in the file
+    uint32_t event_id;
+  };
+  
   struct datablock_header{
     uint32_t total_blocksize_disk;
     uint32_t datasize;
     uint32_t type;
+    uint32_t codec; ///< BlockCodec::CODEC used to store the data
+  };
+  
+  struct datablock_header_v1{
+    uint32_t total_blocksize_disk;
+    uint32_t datasize;
+    uint32_t type;
   };
   
   struct event_header_v0{
@@ -89,8 +157,54 @@ public:
     uint32_t event_id;
     uint32_t timestamp;
   };
+  
+  /// Sidecar index files are stored next to each raw file as <file>.idx
+  static const uint32_t index_magic_number = 0xdec0ded2;
+  static const uint32_t latest_index_version = 1;
+  struct index_header{
+    uint32_t magic_num_check;
+    uint32_t index_version;
+    uint64_t source_file_size; ///< size on disk of the indexed file
+    uint64_t nentries;
+    index_header() : magic_num_check(index_magic_number), 
+		     index_version(latest_index_version),
+		     source_file_size(0), nentries(0) {}
+  };
+  /// Location of a single event within the file series
+  struct index_entry{
+    uint64_t offset;     ///< byte offset of the event header in its file
+    uint32_t event_id;   ///< id stored in the event header
+    uint32_t file_slot;  ///< position of the file in the series
+  };
 
 private:
+  /// A compressed datablock waiting to be inflated
+  struct pending_block{
+    int blockn;          ///< index of the block in the event
+    const char* zipped;  ///< compressed data, in a buffer or mapped file
+    uint32_t size;       ///< size of the compressed data
+    uint32_t codec;      ///< how the data was compressed
+  };
+  /// An event whose datablocks have been read but not yet inflated
+  struct pending_event{
+    event_header head;  ///< header for this event
+    RawEventPtr event;  ///< destination for the inflated data
+    std::vector<pending_block> blocks; ///< blocks that still need inflating
+    std::vector<std::vector<char> > buffers; ///< storage for unmapped blocks
+    std::shared_ptr<void> mapping; ///< keeps mapped blocks alive
+    bool inflated;      ///< has the data been inflated into event yet?
+    bool ok;            ///< were there any errors inflating?
+    pending_event() : inflated(false), ok(true) {}
+  };
+  /// A raw file mapped into memory, unmapped when the last user is done
+  struct mapped_file{
+    char* base;
+    size_t size;
+    mapped_file() : base(0), size(0) {}
+    ~mapped_file();
+  };
+  typedef std::shared_ptr<pending_event> PendingEventPtr;
+  
   const std::string _filename; ///< raw filename
   gzFile _fin; ///< gzip file that we are reading from 
   bool _ok; ///< status of the reader/file
@@ -104,6 +218,48 @@ private:
   static const uint32_t _unset_file_index = 0xFFFFFFFF;
   bool _end_last_file; ///< have we reached the end of the last file?
   
+  std::vector<index_entry> _index; ///< offsets of every event in the series
+  std::vector<std::string> _index_files; ///< filenames for each file slot
+  bool _index_built; ///< have we tried to build the index yet?
+  bool _index_sorted; ///< are event ids monotonically increasing?
+  
+  std::shared_ptr<mapped_file> _map; ///< current file, if mapped in memory
+  size_t _map_pos;  ///< read position within _map
+  bool _map_eof;    ///< has a read run off the end of _map?
+  size_t _map_end;  ///< end of the event data within _map
+  uint32_t _data_end; ///< end of the events in the current file, 0 if unknown
+  bool _use_mmap;   ///< map block-compressed files instead of using gzread
+  
+  bool _prefetch_enabled;  ///< should GetNextEvent use the prefetch queue?
+  bool _prefetch_running;  ///< are the prefetch threads active?
+  int _prefetch_depth;     ///< maximum number of events read ahead
+  int _prefetch_workers;   ///< number of threads inflating datablocks
+  long _prefetch_stalls;   ///< times the consumer waited for an event
+  event_header _prefetch_head; ///< header of last event handed out
+#ifndef SINGLETHREAD
+  std::deque<PendingEventPtr> _ready_queue;   ///< read-ahead events in order
+  std::deque<PendingEventPtr> _inflate_queue; ///< events waiting for workers
+  std::mutex _prefetch_mutex;  ///< protects the queues and flags
+  std::condition_variable _event_ready;  ///< front of ready queue inflated
+  std::condition_variable _space_ready;  ///< room in the ready queue
+  std::condition_variable _work_ready;   ///< new event to inflate
+  std::thread _io_thread;                ///< thread reading from the file
+  std::vector<std::thread> _inflate_threads; ///< workers inflating blocks
+  bool _prefetch_stop;  ///< tell the prefetch threads to exit
+  bool _io_done;        ///< the io thread has reached the end or an error
+  
+  /// Get the next event from the prefetch queue, starting threads if needed
+  RawEventPtr GetNextPrefetchedEvent();
+  /// Main loop for the io thread
+  void PrefetchLoop();
+  /// Main loop for the inflate threads
+  void InflateLoop();
+  /// Launch the prefetch threads from the current file position
+  int StartPrefetch();
+#endif
+  /// Stop any prefetch threads and resynchronize the file position
+  int StopPrefetch();
+  
   /// See if the last read operation completed successfully
   bool ErrorCheck(int bytes_read, int bytes_requested); 
   
@@ -113,11 +269,53 @@ private:
   int ReadNextHeader();
   /// Skip over this event to the next one
   z_off_t SkipNextEvent(bool skip_header = true);
+  /// Check for the end of the current file, opening the next if needed
+  bool FileEof(){ return _end_last_file || (FileAtEnd() && OpenNextFile()); }
+  
+  //low level access to the current file, either mapped or through zlib
+  /// Copy the next <len> bytes into <buf>, return the number copied
+  int FileRead(void* buf, unsigned len);
+  /// Get a pointer to the next <len> bytes of a mapped file and skip them
+  char* FileView(unsigned len);
+  /// Move the read position, same semantics as gzseek
+  z_off_t FileSeek(z_off_t offset, int whence);
+  /// Get the read position in the current file
+  z_off_t FileTell();
+  /// Has a read run past the end of the current file?
+  bool FileAtEnd();
+  /// Map the current file into memory; returns 0 on success
+  int MapCurrentFile();
+  /// Copy <len> bytes at <offset> in the current file, ignoring _data_end
+  int FileReadAt(uint64_t offset, void* buf, unsigned len);
+  /// Fill the index for the current file from its trailer, if it has one
+  bool ReadTrailer(uint32_t slot);
+  
+  /// Read the compressed data for the event whose header is in _ehead
+  int ReadEventData(pending_event& pending);
+  /// Inflate the compressed blocks of an event read with ReadEventData
+  int InflateEvent(pending_event& pending);
+  /// Put the file back to just after the event at <index> 
+  int RestorePosition(long index);
+  /// Look up the index entry for event <id>; returns -1 if not found
+  long FindIndexEntry(uint32_t id);
   
   /// Open the next file in the series
   int OpenNextFile();
   /// Close the current file
   int CloseCurrentFile();
+  /// Read and validate the global header of the file just opened
+  int ReadGlobalHeader();
+  
+  /// Build the event index, loading or creating sidecar files as needed
+  int BuildIndex();
+  /// Fill the index for the currently open file, which has slot <slot>
+  int IndexCurrentFile(uint32_t slot);
+  /// Try to load a saved index for the current file
+  bool LoadIndexFile(uint32_t slot, uint64_t source_size);
+  /// Save the index entries for the current file for next time
+  bool SaveIndexFile(size_t first_entry, uint64_t source_size);
+  /// Position the reader at event <entry> of the index
+  int SeekToEntry(size_t entry);
   
 };
 
@@ -0,0 +1,81 @@
+/** @file ReplayDaq.hh
+    @brief Defines ReplayDaq, which plays back a raw file at its recorded pace
+    @author bloer
+    @ingroup daqman
+*/
+#ifndef ReplayDaq_h
+#define ReplayDaq_h
+
+#include "BaseDaq.hh"
+#include "V172X_Params.hh"
+#include <string>
+#include <memory>
+#include <atomic>
+
+class Reader;
+
+/** @class ReplayDaq
+    @brief BaseDaq backend which posts the events of a raw file
+
+    Events are read on the daq thread and handed out through the usual event
+    queue, so consumers see the same threading as with real hardware.  The
+    time of each event is rebuilt from the coarse RawEvent timestamp and the
+    trigger time tag of the first digitizer board, using the clock rate
+    from the configuration saved with the file, and events are posted at
+    those times divided by the speed factor.  A speed of 0 posts them as
+    fast as the queue accepts them.  Events are never dropped; if the
+    consumers fall behind, the replay runs late and reports by how much.
+
+    @ingroup daqman
+*/
+class ReplayDaq : public BaseDaq
+{
+public:
+  /// Constructor; <params> supply the queue settings, usually V172X_Daq's
+  ReplayDaq(V172X_Params* params, const std::string& filename="");
+  ~ReplayDaq();
+
+  /// Set the raw file to replay
+  void SetFilename(const std::string& filename){ _filename = filename; }
+  /// Get the raw file being replayed
+  const std::string& GetFilename() const { return _filename; }
+  /// Replay at <speed> times the recorded rate; 0 for as fast as possible
+  void SetSpeed(double speed){ _speed = speed; }
+  double GetSpeed() const { return _speed; }
+  /// Read up to <depth> events ahead in the background, 0 to disable
+  void SetPrefetch(int depth){ _prefetch = depth; }
+
+  /// Open the file and load the clock rates saved with it
+  int Initialize();
+  /// Set up the event queue
+  int Update();
+
+  /// Have all the events in the file been posted?
+  bool IsFinished() const { return _finished; }
+  /// Number of events posted in the last run
+  long GetEventsReplayed() const { return _events_replayed; }
+
+private:
+  /// Post events until the file or the run ends
+  void DataAcquisitionLoop();
+  /// Nanoseconds between <event> and the previous one as recorded
+  uint64_t GetRecordedDelta(const RawEventPtr& event);
+
+  V172X_Params* _params;          ///< queue settings
+  V172X_Params _file_params;      ///< board setup saved with the file
+  bool _have_file_params;         ///< did we find the saved setup?
+  std::string _filename;          ///< raw file to replay
+  double _speed;                  ///< replay speed relative to recorded
+  int _prefetch;                  ///< reader prefetch depth
+  std::unique_ptr<Reader> _reader; ///< source of the events
+  std::atomic<bool> _finished;    ///< reached the end of the file?
+  long _events_replayed;          ///< events posted this run
+
+  //previous event, for the recorded time between events
+  bool _have_last;                ///< have we seen an event yet?
+  uint32_t _last_timestamp;       ///< RawEvent timestamp in s
+  int _last_board;                ///< board id of the trigger time tag
+  uint32_t _last_ticks;           ///< board trigger time tag
+};
+
+#endif
@@ -0,0 +1,132 @@
+/** @file RingBuffer.hh
+    @brief Defines the RingBuffer lock-free bounded queue
+    @author bloer
+    @ingroup daqman
+*/
+
+#ifndef RINGBUFFER_h
+#define RINGBUFFER_h
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <utility>
+
+/** @class RingBuffer
+    @brief Bounded multi-producer, multi-consumer queue without locks
+
+    Each slot carries a sequence number which tells producers and consumers
+    whether it is free or filled for the current lap around the ring, so
+    Push and Pop only need one compare-and-swap on the shared position.
+    Neither ever blocks: Push returns false when the ring is full and Pop
+    returns false when it is empty, and the caller decides how to wait.
+
+    The slots are allocated in a power of 2 so positions wrap with a mask,
+    but Push refuses entries beyond the exact capacity asked for.  Resize
+    and Clear are not thread safe and may only be called while no one else
+    uses the ring.
+    @ingroup daqman
+*/
+template<class T> class RingBuffer{
+public:
+  explicit RingBuffer(size_t capacity=16){ Resize(capacity); }
+
+  /// Set the capacity, discarding anything in the ring
+  void Resize(size_t capacity)
+  {
+    size_t size = 2;
+    while(size < capacity)
+      size <<= 1;
+    _cells.reset(new cell[size]);
+    _mask = size-1;
+    _capacity = capacity < 1 ? 1 : capacity;
+    for(size_t i=0; i<size; ++i)
+      _cells[i].seq.store(i, std::memory_order_relaxed);
+    _head.store(0, std::memory_order_relaxed);
+    _tail.store(0, std::memory_order_relaxed);
+  }
+
+  /// Remove everything from the ring
+  void Clear(){ Resize(GetCapacity()); }
+
+  /// Maximum number of entries
+  size_t GetCapacity() const { return _capacity; }
+
+  /// Number of entries, only approximate if other threads are active
+  size_t GetSize() const
+  {
+    size_t tail = _tail.load(std::memory_order_acquire);
+    size_t head = _head.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+  }
+
+  bool IsEmpty() const { return GetSize() == 0; }
+
+  /// Add <val> to the ring; returns false if it is full
+  bool Push(T val)
+  {
+    size_t pos = _tail.load(std::memory_order_relaxed);
+    cell* c;
+    while(true){
+      c = &_cells[pos & _mask];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      long diff = (long)seq - (long)pos;
+      if(diff == 0){
+	//the slot is free, but the ring may already hold <capacity> entries
+	if(pos - _head.load(std::memory_order_acquire) >= _capacity)
+	  return false;
+	if(_tail.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+	  break;
+      }
+      else if(diff < 0)
+	return false;
+      else
+	pos = _tail.load(std::memory_order_relaxed);
+    }
+    c->data = std::move(val);
+    c->seq.store(pos+1, std::memory_order_release);
+    return true;
+  }
+
+  /// Take the oldest entry into <val>; returns false if the ring is empty
+  bool Pop(T& val)
+  {
+    size_t pos = _head.load(std::memory_order_relaxed);
+    cell* c;
+    while(true){
+      c = &_cells[pos & _mask];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      long diff = (long)seq - (long)(pos+1);
+      if(diff == 0){
+	if(_head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+	  break;
+      }
+      else if(diff < 0)
+	return false;
+      else
+	pos = _head.load(std::memory_order_relaxed);
+    }
+    val = std::move(c->data);
+    //don't hold on to the entry until the slot is reused
+    c->data = T();
+    c->seq.store(pos+_mask+1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  RingBuffer(const RingBuffer&);
+  RingBuffer& operator=(const RingBuffer&);
+
+  struct cell{
+    std::atomic<size_t> seq;
+    T data;
+  };
+  std::unique_ptr<cell[]> _cells;
+  size_t _mask;
+  size_t _capacity;                       ///< entries allowed, <= _mask+1
+  //keep producers and consumers on separate cache lines
+  alignas(64) std::atomic<size_t> _tail;  ///< next slot to fill
+  alignas(64) std::atomic<size_t> _head;  ///< next slot to empty
+};
+
+#endif
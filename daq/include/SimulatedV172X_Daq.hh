@@ -0,0 +1,109 @@
+/** @file SimulatedV172X_Daq.hh
+    @brief Defines SimulatedV172X_Daq, which fakes V172X digitizer data
+    @author bloer
+    @ingroup daqman
+*/
+#ifndef SimulatedV172X_Daq_h
+#define SimulatedV172X_Daq_h
+
+#include "BaseDaq.hh"
+#include "V172X_Params.hh"
+#include "ParameterList.hh"
+#include <vector>
+#include <random>
+#include <iostream>
+
+/** @enum RATE_DISTRIBUTION
+    @brief how simulated triggers are spread out in time
+*/
+enum RATE_DISTRIBUTION { PERIODIC=0, ///< evenly spaced triggers
+			 POISSON=1,  ///< exponential time between triggers
+			 BURST=2     ///< bursts of back-to-back triggers
+};
+/// RATE_DISTRIBUTION ostream overload
+std::ostream& operator<<(std::ostream& out, const RATE_DISTRIBUTION& dist);
+/// RATE_DISTRIBUTION istream overload
+std::istream& operator>>(std::istream& in, RATE_DISTRIBUTION& dist);
+
+/** @class V172X_SimParams
+    @brief parameters controlling the simulated digitizer signals
+*/
+class V172X_SimParams : public ParameterList
+{
+public:
+  V172X_SimParams();
+  ~V172X_SimParams(){}
+
+  double trigger_rate;            ///< mean trigger rate in Hz, 0 for max
+  RATE_DISTRIBUTION distribution; ///< time structure of the triggers
+  int burst_size;                 ///< triggers per burst for BURST
+  double pulses_per_event;        ///< mean number of pulses per channel
+  double pulse_amplitude;         ///< mean pulse height in counts
+  double pulse_decay_ns;          ///< exponential decay time of the pulses
+  double noise_rms;               ///< gaussian baseline noise in counts
+  double baseline;                ///< baseline in counts, <0 for automatic
+  unsigned int seed;              ///< random seed, 0 to use the time
+};
+
+/** @class SimulatedV172X_Daq
+    @brief BaseDaq backend producing V172X data without any hardware
+
+    Uses the same V172X_Params as V172X_Daq to decide the boards, channels,
+    record length, zero suppression and sample packing, and generates
+    board blocks laid out exactly as the digitizers send them: exponential
+    pulses on a noisy baseline, ZLE encoded if zs_type is ZLE, and packed
+    3 samples per word for 10-bit boards.  Triggers arrive according to
+    V172X_SimParams; any that come while the event queue is full are lost
+    and counted as deadtime, as with real boards.
+
+    @ingroup daqman
+*/
+class SimulatedV172X_Daq : public BaseDaq
+{
+public:
+  /// Constructor; <params> are owned elsewhere, usually by V172X_Daq
+  SimulatedV172X_Daq(V172X_Params* params);
+  ~SimulatedV172X_Daq();
+
+  ///Get the parameters for the simulated boards
+  V172X_Params* GetParameters(){ return _params; }
+  ///Get the parameters for the simulated signals
+  V172X_SimParams* GetSimParameters(){ return &_sim; }
+
+  /// Check the board setup and compute the event size
+  int Initialize();
+  /// Recompute the event size and set up the event queue
+  int Update();
+
+  /// Number of triggers generated in the last run
+  long GetTriggers() const { return _triggers; }
+  /// Number of triggers lost because the queue was full
+  long GetLostTriggers() const { return _lost_triggers; }
+
+private:
+  /// Generate events until the run ends
+  void DataAcquisitionLoop();
+  /// Write one board's data for trigger <counter>; returns bytes written
+  long FillBoard(int boardnum, unsigned char* buffer, uint32_t counter,
+		 uint32_t timestamp);
+  /// Generate the samples for one channel into _samples
+  void GenerateWaveform(const V172X_BoardParams& board, int nsamps);
+  /// Seconds until the next trigger
+  double NextTriggerInterval();
+
+  V172X_Params* _params;    ///< board setup
+  V172X_SimParams _sim;     ///< signal setup
+  bool _initialized;        ///< have we checked the boards?
+  long _triggers;           ///< triggers generated this run
+  long _lost_triggers;      ///< triggers lost to deadtime this run
+  int _burst_count;         ///< triggers so far in the current burst
+  long _max_event_size;     ///< largest possible event in bytes
+  double _record_seconds;   ///< length of the acquisition window
+  double _pulse_rate;       ///< sample rate _pulse was made for
+  std::mt19937 _rng;        ///< random number source
+  std::vector<double> _noise;     ///< precomputed gaussian noise table
+  std::vector<double> _pulse;     ///< pulse template for the current board
+  std::vector<int> _samples;      ///< scratch waveform buffer
+};
+
+#endif
@@ -0,0 +1,52 @@
+/** @file V172X_Codec.hh
+    @brief Defines the V172X_Codec lossless compressor for digitizer data
+    @author bloer
+    @ingroup daqman
+*/
+
+#ifndef V172X_CODEC_h
+#define V172X_CODEC_h
+
+#include <stdint.h>
+#include <cstddef>
+
+/** @class V172X_Codec
+    @brief Lossless compression of V172X datablocks using the waveform layout
+
+    The block is split into boards and channels using the same header layout
+    as V172X_BoardData, but with every size checked against the block.  Board
+    headers, ZLE control words and anything that can't be parsed are copied
+    verbatim; each run of samples is delta encoded and the residuals are
+    Rice coded in groups of 32.  The encoded block is a sequence of
+    self-describing segments, so decoding does not need the board layout:
+
+    [uint8 type][raw length][encoded length][payload]
+
+    with the lengths written as varints; RAW segments store only one length.
+
+    @ingroup daqman
+*/
+class V172X_Codec{
+public:
+  /** @enum SEGMENT_TYPE
+      @brief how the payload of one segment is stored
+  */
+  enum SEGMENT_TYPE { RAW=0,     ///< copied verbatim
+		      DELTA8=1,  ///< 8-bit samples, Rice coded differences
+		      DELTA16=2, ///< 16-bit samples, Rice coded differences
+		      DEFLATE=3  ///< zlib, for data we couldn't parse
+  };
+  /// largest possible segment header
+  static const size_t segment_header_size = 11;
+
+  /// Maximum encoded size for <srclen> bytes of input
+  static size_t GetMaxEncodedSize(size_t srclen);
+  /// Encode a V172X datablock; returns 0 on success and sets destlen
+  static int Encode(const unsigned char* src, size_t srclen,
+		    unsigned char* dest, size_t& destlen);
+  /// Decode a V172X datablock; returns 0 on success and sets destlen
+  static int Decode(const unsigned char* src, size_t srclen,
+		    unsigned char* dest, size_t& destlen);
+};
+
+#endif
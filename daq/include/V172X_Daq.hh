@@ -10,6 +10,13 @@
 #include "V172X_Params.hh"
 #include "stdint.h"
 #include "CAENVMElib.h"
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 //forward declaration
 namespace std{
@@ -40,6 +47,52 @@ public:
   private:
   /// Acquire the data from the hardware and store in _events_queue
   void DataAcquisitionLoop();
+  
+  /** @struct board_event
+      @brief One board's part of a trigger from a multi-event transfer
+  */
+  struct board_event{
+    std::shared_ptr<std::vector<unsigned char> > buffer; ///< whole transfer
+    size_t offset;     ///< start of this event within buffer
+    long size;         ///< size of this event in bytes
+    uint32_t counter;  ///< the board's event counter
+  };
+  /// Download up to events_per_blt events from board <boardnum> into 
+  /// _pending; returns the number of events or -1 on error
+  int DownloadEvents(int boardnum);
+  /// Build and post a RawEvent for each trigger all boards have sent;
+  /// returns 0 unless the event counters disagree
+  int PostMatchedEvents();
+  
+  /** @struct board_readout
+      @brief Where one board's data goes and how long it took to get it
+  */
+  struct board_readout{
+    unsigned char* dest; ///< where to put the next event
+    long offset;         ///< start of this board's slice in parallel mode
+    long size;           ///< size of the last event read
+    uint32_t counter;    ///< event counter of the last event read
+    int status;          ///< 0 if ok, 1 if no trigger, -1 on error
+    long reads;          ///< number of transfers this run
+    double total_us;     ///< total time spent in transfers
+    double max_us;       ///< longest single transfer
+    board_readout() : dest(0), offset(0), size(0), counter(0), status(0),
+		      reads(0), total_us(0), max_us(0) {}
+  };
+  /// Read a single event from board <boardnum> into <buffer>; returns 0 on 
+  /// success, 1 if the board has no event, -1 on error
+  int ReadBoardEvent(int boardnum, unsigned char* buffer, long& ev_size,
+		     uint32_t& counter);
+  /// Read the next event(s) from one board into _readout, timing it
+  int ReadBoard(int boardnum);
+  /// Launch one reader thread per enabled board
+  void StartBoardReaders();
+  /// Stop and join the reader threads
+  void StopBoardReaders();
+  /// Main loop of the reader thread for one board
+  void BoardReaderLoop(int boardnum);
+  /// Have all the reader threads read out their boards, and wait for them
+  void ReadBoardsParallel(unsigned char* buffer);
     
   /// Initialize parameters for a single board
   int InitializeBoard(int boardnum);
@@ -100,6 +153,16 @@ public:
   V172X_Params _params;      ///< parameters for the boards
   long _triggers;            ///< total triggers received so far
   std::mutex _vme_mutex;   ///< mutex protecting write access to VME
+  /// board events waiting for the other boards when events_per_blt > 1
+  std::deque<board_event> _pending[V172X_Params::nboards];
+  board_readout _readout[V172X_Params::nboards]; ///< per-board transfer info
+  std::vector<std::thread> _reader_threads; ///< one per board if parallel
+  std::mutex _reader_mutex;                 ///< guards the reader handshake
+  std::condition_variable _reader_start;    ///< tells the readers to go
+  std::condition_variable _reader_done;     ///< last reader finished
+  uint64_t _reader_generation;              ///< counts readout requests
+  std::atomic<int> _readers_busy;           ///< readers still transferring
+  bool _readers_stop;                       ///< tell the readers to exit
   //std::vector<uint8_t*> raw_buffer;
   //std::vector<std::mutex*> buffer_mutex;
   
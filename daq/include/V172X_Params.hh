@@ -195,6 +195,14 @@ public:
   int trigger_timeout_ms;         ///< how long to wait for trigger interrupt
   long max_mem_size;              ///< total system memory we're allowed to use
   bool no_low_mem_warn;           ///< suppress warning about low memory? 
+  int event_queue_depth;          ///< max events waiting to be processed
+  int queue_spin_us;              ///< time to poll the queue before sleeping
+  long pool_mem_size;             ///< memory for preallocated event buffers
+  bool pool_hugepages;            ///< back the buffer pool with huge pages?
+  bool pool_mlock;                ///< lock the buffer pool in RAM?
+  int events_per_blt;             ///< max events per board in one transfer
+  int irq_on_events;              ///< events stored before boards interrupt
+  bool parallel_readout;          ///< read each board in its own thread?
   bool send_start_pulse;          ///< synchronize start of run on all boards?
   bool auto_trigger;              ///< allow computer to generate triggers?
   //caluclated values
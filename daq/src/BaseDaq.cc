@@ -19,16 +19,29 @@
 
 bool BaseDaq::_is_constructed = false;
 typedef std::unique_lock<std::mutex> scoped_lock;
+typedef std::chrono::steady_clock steady_clock;
 
-BaseDaq::BaseDaq() throw(std::runtime_error): 
-  _status(NORMAL), _is_running(false)
+/// Raise <val> to at least <newval>
+template<class T> static void UpdateMax(std::atomic<T>& val, T newval)
 {
-  if(_is_constructed){
+  T old = val.load(std::memory_order_relaxed);
+  while(old < newval && !val.compare_exchange_weak(old, newval)) {}
+}
+
+BaseDaq::BaseDaq(bool exclusive) throw(std::runtime_error): 
+  _exclusive(exclusive), _status(NORMAL), _is_running(false), 
+  _events_queue(10), _queue_bytes(0), 
+  _max_queue_bytes(0), _queue_spin_us(50), _queue_warn(true),
+  _consumers_waiting(0), _producers_waiting(0), _queue_high_water(0), 
+  _queue_high_water_bytes(0), _queue_blocked_posts(0), _queue_blocked_us(0)
+{
+  if(_exclusive && _is_constructed){
     //only one instance allowed!
     Message(EXCEPTION)<<"BaseDaq constructor called, but only one instance is allowed!"<<std::endl;
     throw std::runtime_error("multiple BaseDaq construction");
   }
-  _is_constructed=true;
+  if(_exclusive)
+    _is_constructed=true;
   _n_queuesize_warnings = 0;
 }
 
@@ -36,7 +49,8 @@ BaseDaq::~BaseDaq()
 {
 //what needs to be deleted here??
   if(_is_running) EndRun();
-  _is_constructed=false;
+  if(_exclusive)
+    _is_constructed=false;
 }
 
 
@@ -51,8 +65,13 @@ int BaseDaq::StartRun()
     _is_running = true;
   
   _n_queuesize_warnings = 0;
-  while(!_events_queue.empty())
-    _events_queue.pop();
+  _events_queue.Clear();
+  _queue_bytes = 0;
+  _queue_high_water = 0;
+  _queue_high_water_bytes = 0;
+  _queue_blocked_posts = 0;
+  _queue_blocked_us = 0;
+  _buffer_pool.ResetStats();
   //start new thread and run collect data
   Message(DEBUG)<<"Starting daq thread..."<<std::endl;
   _daq_thread = std::thread(std::ref(*this));
@@ -70,6 +89,21 @@ int BaseDaq::EndRun(bool force)
     else _is_running = false;
     //if(force) _daq_thread.interrupt(); //no way to interrupt c++11 threads...
     _daq_thread.join();
+    //wake anyone still waiting for a new event
+    {
+      scoped_lock lock(_queue_mutex);
+    }
+    _event_ready.notify_all();
+    Message(INFO)<<"Event queue held at most "<<_queue_high_water
+		 <<" events ("<<_queue_high_water_bytes/1024/1024<<" MiB); "
+		 <<"the daq waited "<<GetQueueBlockedTime()<<" s for space "
+		 <<_queue_blocked_posts<<" times.\n";
+    if(_buffer_pool.IsAllocated()){
+      Message(INFO)<<"Buffer pool lent "<<_buffer_pool.GetBorrowed()
+		   <<" buffers, at most "<<_buffer_pool.GetHighWater()<<" of "
+		   <<_buffer_pool.GetNBuffers()<<" at once; it was empty "
+		   <<_buffer_pool.GetExhausted()<<" times.\n";
+    }
     /*while(!_events_queue.empty()){
       RawEventPtr next = _events_queue.front();
       next->GetThreadPointer()->join();
@@ -79,51 +113,162 @@ int BaseDaq::EndRun(bool force)
     return 0;    
 }
 
+int BaseDaq::SetQueueLimits(size_t max_events, long max_bytes, int spin_us,
+			   bool warn)
+{
+  if(_is_running){
+    Message(ERROR)<<"Cannot change the event queue size during a run!\n";
+    return 1;
+  }
+  if(max_events < 1)
+    max_events = 1;
+  _events_queue.Resize(max_events);
+  _max_queue_bytes = max_bytes;
+  _queue_spin_us = spin_us;
+  _queue_warn = warn;
+  Message(DEBUG)<<"Event queue holds "<<_events_queue.GetCapacity()
+		<<" events, "<<max_bytes<<" bytes.\n";
+  return 0;
+}
+
+int BaseDaq::SetBufferPool(size_t buffer_size, long budget, bool hugepages,
+			   bool lock)
+{
+  if(_is_running){
+    Message(ERROR)<<"Cannot change the buffer pool during a run!\n";
+    return 1;
+  }
+  if(budget <= 0){
+    _buffer_pool.Release();
+    return 0;
+  }
+  return _buffer_pool.Allocate(buffer_size, budget, hugepages, lock);
+}
+
+int BaseDaq::AddEventBuffer(RawEventPtr& event, uint32_t blocktype,
+			    uint32_t size)
+{
+  if(size <= _buffer_pool.GetBufferSize()){
+    std::shared_ptr<void> owner;
+    unsigned char* buf = _buffer_pool.Borrow(owner);
+    if(buf)
+      return event->AddDataBlockView(blocktype, buf, size, owner);
+  }
+  return event->AddDataBlock(blocktype, size);
+}
+
 RawEventPtr BaseDaq::GetNextEvent(int timeout)
 {
   if(GetStatus() != NORMAL){
     return RawEventPtr();
   }
-  //lock the mutex guarding the processed event queue
-  scoped_lock lock(_queue_mutex);
-  if(!_is_running && _events_queue.empty())
-    return RawEventPtr();
-  //loop until an event is ready
-  while(_events_queue.empty() ){
-    if(timeout < 0)
-      _event_ready.wait(lock);
-    else{
-      if(_event_ready.wait_for(lock,std::chrono::microseconds(timeout)) ==
-         std::cv_status::timeout)
-	return RawEventPtr();
+  steady_clock::time_point start = steady_clock::now();
+  steady_clock::time_point deadline = start + 
+    std::chrono::microseconds(timeout < 0 ? 0 : timeout);
+  steady_clock::time_point spin_until = start + 
+    std::chrono::microseconds(timeout < 0 || timeout > _queue_spin_us ? 
+			      _queue_spin_us : timeout);
+  RawEventPtr next;
+  while(true){
+    //check whether the daq stopped before looking, so we can't miss
+    //an event posted just before the end
+    bool running = _is_running;
+    if(_events_queue.Pop(next))
+      break;
+    if(!running)
+      return RawEventPtr();
+    steady_clock::time_point now = steady_clock::now();
+    if(timeout >= 0 && now >= deadline)
+      return RawEventPtr();
+    if(now < spin_until){
+      std::this_thread::yield();
+      continue;
     }
+    //nothing arrived while spinning, so go to sleep
+    scoped_lock lock(_queue_mutex);
+    ++_consumers_waiting;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(_events_queue.IsEmpty() && _is_running){
+      //wake up now and then in case the daq thread stopped on its own
+      steady_clock::time_point wake = now + std::chrono::milliseconds(100);
+      if(timeout >= 0 && deadline < wake)
+	wake = deadline;
+      _event_ready.wait_until(lock, wake);
+    }
+    --_consumers_waiting;
+  }
+  _queue_bytes -= next->GetDataSize();
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(_producers_waiting > 0){
+    scoped_lock lock(_queue_mutex);
+    _event_taken.notify_all();
   }
-  RawEventPtr next(_events_queue.front());
-  _events_queue.pop();
-  lock.unlock();
-  _event_taken.notify_all();
   return next;
 }
 
+bool BaseDaq::TryPost(const RawEventPtr& event, long bytes)
+{
+  //always allow one event, no matter how large
+  if(_max_queue_bytes > 0 && !_events_queue.IsEmpty() && 
+     _queue_bytes + bytes > _max_queue_bytes)
+    return false;
+  _queue_bytes += bytes;
+  if(!_events_queue.Push(event)){
+    _queue_bytes -= bytes;
+    return false;
+  }
+  UpdateMax(_queue_high_water, _events_queue.GetSize());
+  UpdateMax(_queue_high_water_bytes, _queue_bytes.load());
+  return true;
+}
+
+void BaseDaq::NotifyConsumers()
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(_consumers_waiting > 0){
+    scoped_lock lock(_queue_mutex);
+    _event_ready.notify_all();
+  }
+}
+
 void BaseDaq::PostEvent(RawEventPtr event)
 {
-  scoped_lock lock(_queue_mutex);
-  do{
-    if(_events_queue.size() < MAX_QUEUE_SIZE){
-      _events_queue.push(event);
-      _event_ready.notify_all();
+  long bytes = event->GetDataSize();
+  if(TryPost(event, bytes)){
+    NotifyConsumers();
+    return;
+  }
+  //if we get here, the event queue is full
+  ++_queue_blocked_posts;
+  if(_queue_warn && _n_queuesize_warnings++ < 1){
+    Message(WARNING)<<_events_queue.GetSize()<<" events waiting "
+		    <<"to be processed; trigger rate may be too high.\n"
+		    <<"\tThere will be deadtime in this run.\n";
+  }
+  steady_clock::time_point start = steady_clock::now();
+  steady_clock::time_point spin_until = start + 
+    std::chrono::microseconds(_queue_spin_us);
+  while(_is_running){
+    if(TryPost(event, bytes)){
+      NotifyConsumers();
       break;
     }
-    //if we get here, the event queue is full
-    if(_n_queuesize_warnings++ < 1){
-      Message(WARNING)<<_events_queue.size()<<" events waiting "
-		      <<"to be processed; trigger rate may be too high.\n"
-		      <<"\tThere will be deadtime in this run.\n";
+    if(steady_clock::now() < spin_until){
+      std::this_thread::yield();
+      continue;
+    }
+    scoped_lock lock(_queue_mutex);
+    ++_producers_waiting;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    //a consumer may have made room before it saw us waiting
+    if(TryPost(event, bytes)){
+      --_producers_waiting;
+      _event_ready.notify_all();
+      break;
     }
     _event_taken.wait_for(lock, std::chrono::microseconds(1000));
-    
-  }while(_is_running);
-    
-  
+    --_producers_waiting;
+  }
+  _queue_blocked_us += std::chrono::duration_cast<std::chrono::microseconds>
+    (steady_clock::now() - start).count();
 }
-
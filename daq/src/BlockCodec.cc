@@ -0,0 +1,217 @@
+#include "BlockCodec.hh"
+#include "V172X_Codec.hh"
+#include "Message.hh"
+#include <zlib.h>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+bool BlockCodec::IsAvailable(CODEC codec)
+{
+  switch(codec){
+  case STORED:
+  case ZLIB:
+  case V172X:
+    return true;
+  case LZ4:
+#ifdef HAVE_LZ4
+    return true;
+#else
+    return false;
+#endif
+  case ZSTD:
+#ifdef HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+const char* BlockCodec::GetName(CODEC codec)
+{
+  switch(codec){
+  case STORED: return "STORED";
+  case ZLIB: return "ZLIB";
+  case LZ4: return "LZ4";
+  case ZSTD: return "ZSTD";
+  case V172X: return "V172X";
+  }
+  return "UNKNOWN";
+}
+
+size_t BlockCodec::GetMaxEncodedSize(CODEC codec, size_t srclen)
+{
+  switch(codec){
+  case STORED:
+    return srclen;
+  case ZLIB:
+    return compressBound(srclen);
+  case LZ4:
+#ifdef HAVE_LZ4
+    return LZ4_compressBound(srclen);
+#else
+    break;
+#endif
+  case ZSTD:
+#ifdef HAVE_ZSTD
+    return ZSTD_compressBound(srclen);
+#else
+    break;
+#endif
+  case V172X:
+    return V172X_Codec::GetMaxEncodedSize(srclen);
+  }
+  return 0;
+}
+
+int BlockCodec::Encode(CODEC codec, int level, const unsigned char* src,
+		       size_t srclen, unsigned char* dest, size_t& destlen)
+{
+  switch(codec){
+  case STORED:
+    if(destlen < srclen)
+      return 1;
+    memcpy(dest, src, srclen);
+    destlen = srclen;
+    return 0;
+  case ZLIB:{
+    uLongf zlen = destlen;
+    int err = 0;
+    if(level == Z_DEFAULT_COMPRESSION)
+      err = compress(dest, &zlen, src, srclen);
+    else
+      err = compress2(dest, &zlen, src, srclen, level);
+    if(err != Z_OK){
+      Message(ERROR)<<"zlib compress returned error "<<err<<"\n";
+      return err;
+    }
+    destlen = zlen;
+    return 0;
+  }
+  case LZ4:{
+#ifdef HAVE_LZ4
+    int zlen = LZ4_compress_default((const char*)src, (char*)dest,
+				    srclen, destlen);
+    if(zlen <= 0){
+      Message(ERROR)<<"LZ4 compression failed\n";
+      return 1;
+    }
+    destlen = zlen;
+    return 0;
+#else
+    break;
+#endif
+  }
+  case ZSTD:{
+#ifdef HAVE_ZSTD
+    //reuse one context per thread rather than allocating every block
+    static thread_local ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    size_t zlen = ZSTD_compressCCtx(cctx, dest, destlen, src, srclen, level);
+    if(ZSTD_isError(zlen)){
+      Message(ERROR)<<"zstd compression failed: "<<ZSTD_getErrorName(zlen)
+		    <<"\n";
+      return 1;
+    }
+    destlen = zlen;
+    return 0;
+#else
+    break;
+#endif
+  }
+  case V172X:
+    return V172X_Codec::Encode(src, srclen, dest, destlen);
+  }
+  Message(ERROR)<<"Compression codec "<<codec<<" is not available\n";
+  return -1;
+}
+
+int BlockCodec::Decode(CODEC codec, const unsigned char* src, size_t srclen,
+		       unsigned char* dest, size_t& destlen)
+{
+  switch(codec){
+  case STORED:
+    if(destlen < srclen)
+      return 1;
+    memcpy(dest, src, srclen);
+    destlen = srclen;
+    return 0;
+  case ZLIB:{
+    uLongf len = destlen;
+    int err = uncompress(dest, &len, src, srclen);
+    if(err != Z_OK){
+      Message(ERROR)<<"uncompress function returned "<<err<<"\n";
+      return err;
+    }
+    destlen = len;
+    return 0;
+  }
+  case LZ4:{
+#ifdef HAVE_LZ4
+    int len = LZ4_decompress_safe((const char*)src, (char*)dest,
+				  srclen, destlen);
+    if(len < 0){
+      Message(ERROR)<<"LZ4 decompression returned "<<len<<"\n";
+      return 1;
+    }
+    destlen = len;
+    return 0;
+#else
+    break;
+#endif
+  }
+  case ZSTD:{
+#ifdef HAVE_ZSTD
+    static thread_local ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    size_t len = ZSTD_decompressDCtx(dctx, dest, destlen, src, srclen);
+    if(ZSTD_isError(len)){
+      Message(ERROR)<<"zstd decompression failed: "<<ZSTD_getErrorName(len)
+		    <<"\n";
+      return 1;
+    }
+    destlen = len;
+    return 0;
+#else
+    break;
+#endif
+  }
+  case V172X:
+    return V172X_Codec::Decode(src, srclen, dest, destlen);
+  }
+  Message(ERROR)<<"Compression codec "<<codec<<" is not available\n";
+  return -1;
+}
+
+std::ostream& operator<<(std::ostream& out, const BlockCodec::CODEC& codec)
+{
+  return out<<BlockCodec::GetName(codec);
+}
+
+std::istream& operator>>(std::istream& in, BlockCodec::CODEC& codec)
+{
+  std::string temp;
+  in>>temp;
+  if(temp == "STORED" || temp == "stored")
+    codec = BlockCodec::STORED;
+  else if(temp == "ZLIB" || temp == "zlib")
+    codec = BlockCodec::ZLIB;
+  else if(temp == "LZ4" || temp == "lz4")
+    codec = BlockCodec::LZ4;
+  else if(temp == "ZSTD" || temp == "zstd")
+    codec = BlockCodec::ZSTD;
+  else if(temp == "V172X" || temp == "v172x")
+    codec = BlockCodec::V172X;
+  else{
+    Message e(EXCEPTION);
+    e<<temp<<" is not a valid value for CODEC"<<std::endl;
+    throw std::invalid_argument(e.str());
+  }
+  return in;
+}
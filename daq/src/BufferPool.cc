@@ -0,0 +1,198 @@
+#include "BufferPool.hh"
+#include "Message.hh"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//huge pages are 2 MiB on every machine we run on
+static const size_t huge_page_size = 2*1024*1024;
+
+static size_t RoundUp(size_t val, size_t unit)
+{
+  return (val + unit - 1) / unit * unit;
+}
+
+/// One mapping holding all the buffers, shared by everyone borrowing them
+struct BufferPool::region{
+  unsigned char* base;
+  size_t mapped_size;
+  size_t buffer_size;
+  size_t nbuffers;
+  bool locked;
+  std::mutex free_mutex;
+  std::vector<unsigned char*> free; ///< used as a stack to reuse warm buffers
+  std::atomic<long> borrowed;
+  std::atomic<long> exhausted;
+  std::atomic<size_t> in_use;
+  std::atomic<size_t> high_water;
+
+  region() : base(0), mapped_size(0), buffer_size(0), nbuffers(0),
+	     locked(false), borrowed(0), exhausted(0), in_use(0),
+	     high_water(0) {}
+  ~region()
+  {
+    if(!base)
+      return;
+    if(locked)
+      munlock(base, mapped_size);
+    munmap(base, mapped_size);
+  }
+};
+
+/// Deleter for the owner pointer; puts the buffer back in the pool
+struct BufferPool::returner{
+  std::shared_ptr<region> pool;
+  void operator()(unsigned char* buf)
+  {
+    --pool->in_use;
+    std::lock_guard<std::mutex> lock(pool->free_mutex);
+    pool->free.push_back(buf);
+  }
+};
+
+BufferPool::BufferPool() : _region() {}
+
+BufferPool::~BufferPool() {}
+
+int BufferPool::Allocate(size_t buffer_size, size_t budget, bool hugepages,
+			 bool lock)
+{
+  Release();
+  const size_t page = sysconf(_SC_PAGESIZE);
+  buffer_size = RoundUp(buffer_size ? buffer_size : 1, page);
+  size_t nbuffers = budget / buffer_size;
+  if(nbuffers < 1){
+    Message(ERROR)<<"Buffer pool budget of "<<budget<<" bytes can't hold an "
+		  <<"event of "<<buffer_size<<" bytes.\n";
+    return 1;
+  }
+
+  std::shared_ptr<region> reg(new region);
+  reg->buffer_size = buffer_size;
+  reg->nbuffers = nbuffers;
+  reg->mapped_size = nbuffers*buffer_size;
+  void* mem = MAP_FAILED;
+  bool huge_mapped = false;
+#ifdef MAP_HUGETLB
+  if(hugepages){
+    size_t huge_size = RoundUp(reg->mapped_size, huge_page_size);
+    mem = mmap(0, huge_size, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(mem != MAP_FAILED){
+      reg->mapped_size = huge_size;
+      huge_mapped = true;
+    }
+  }
+#endif
+  if(mem == MAP_FAILED){
+    if(hugepages)
+      Message(WARNING)<<"Unable to get huge pages for the buffer pool; "
+		      <<"using normal pages.\n";
+    mem = mmap(0, reg->mapped_size, PROT_READ | PROT_WRITE,
+	       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if(mem == MAP_FAILED){
+    Message(ERROR)<<"Unable to map "<<reg->mapped_size<<" bytes for the "
+		  <<"buffer pool: "<<strerror(errno)<<"\n";
+    return 2;
+  }
+  reg->base = (unsigned char*)mem;
+#ifdef MADV_HUGEPAGE
+  //let transparent huge pages back the map if we couldn't get real ones
+  if(hugepages && !huge_mapped)
+    madvise(mem, reg->mapped_size, MADV_HUGEPAGE);
+#endif
+  if(lock){
+    if(mlock(mem, reg->mapped_size) == 0)
+      reg->locked = true;
+    else
+      Message(WARNING)<<"Unable to lock the buffer pool in memory: "
+		      <<strerror(errno)<<"; check ulimit -l.\n";
+  }
+  //fault every page in now instead of during the run
+  if(!reg->locked){
+    for(size_t offset = 0; offset < reg->mapped_size; offset += page)
+      reg->base[offset] = 0;
+  }
+
+  reg->free.reserve(nbuffers);
+  for(size_t i=nbuffers; i>0; --i)
+    reg->free.push_back(reg->base + (i-1)*buffer_size);
+  _region = reg;
+  Message(DEBUG)<<"Buffer pool holds "<<nbuffers<<" buffers of "
+		<<buffer_size/1024<<" kiB.\n";
+  return 0;
+}
+
+void BufferPool::Release()
+{
+  _region.reset();
+}
+
+size_t BufferPool::GetBufferSize() const
+{
+  return _region ? _region->buffer_size : 0;
+}
+
+size_t BufferPool::GetNBuffers() const
+{
+  return _region ? _region->nbuffers : 0;
+}
+
+unsigned char* BufferPool::Borrow(std::shared_ptr<void>& owner)
+{
+  if(!_region)
+    return 0;
+  unsigned char* buf = 0;
+  {
+    std::lock_guard<std::mutex> lock(_region->free_mutex);
+    if(!_region->free.empty()){
+      buf = _region->free.back();
+      _region->free.pop_back();
+    }
+  }
+  if(!buf){
+    ++_region->exhausted;
+    return 0;
+  }
+  ++_region->borrowed;
+  size_t in_use = ++_region->in_use;
+  size_t old = _region->high_water;
+  while(old < in_use &&
+	!_region->high_water.compare_exchange_weak(old, in_use)) {}
+  owner = std::shared_ptr<unsigned char>(buf, returner{_region});
+  return buf;
+}
+
+long BufferPool::GetBorrowed() const
+{
+  return _region ? _region->borrowed.load() : 0;
+}
+
+long BufferPool::GetExhausted() const
+{
+  return _region ? _region->exhausted.load() : 0;
+}
+
+size_t BufferPool::GetInUse() const
+{
+  return _region ? _region->in_use.load() : 0;
+}
+
+size_t BufferPool::GetHighWater() const
+{
+  return _region ? _region->high_water.load() : 0;
+}
+
+void BufferPool::ResetStats()
+{
+  if(!_region)
+    return;
+  _region->borrowed = 0;
+  _region->exhausted = 0;
+  _region->high_water = _region->in_use.load();
+}
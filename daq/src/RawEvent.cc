@@ -33,11 +33,26 @@ int RawEvent::AddDataBlock(uint32_t blocktype, uint32_t datasize)
   return _datablocks.size() - 1;  
 }
 
+int RawEvent::AddDataBlockView(uint32_t blocktype, unsigned char* data,
+				uint32_t datasize, std::shared_ptr<void> owner)
+{
+  _datablocks.push_back(datablock(blocktype));
+  datablock& block = _datablocks.back();
+  block.datasize = datasize;
+  block.external = data;
+  block.external_size = datasize;
+  block.owner = owner;
+  _buffer_size += datasize;
+  _total_buffer_size += datasize;
+  return _datablocks.size() - 1;  
+}
+
 int RawEvent::RemoveDataBlock(size_t block_n)
 {
   if(block_n >= _datablocks.size())
     return -1;
-  uint32_t blocksize = _datablocks[block_n].data.size();
+  const datablock& block = _datablocks[block_n];
+  uint32_t blocksize = block.external ? block.external_size : block.data.size();
   _datablocks.erase(_datablocks.begin()+block_n);
   _buffer_size -= blocksize;
   _total_buffer_size -= blocksize;
@@ -51,7 +66,7 @@ const RawEvent::datablock* RawEvent::GetDataBlock(size_t block_n) const
 
 unsigned char* RawEvent::GetRawDataBlock(size_t block_n) 
 {
-  return &(_datablocks.at(block_n).data[0]);
+  return _datablocks.at(block_n).buffer();
 }
 
 uint32_t RawEvent::GetDataBlockSize(size_t block_n) const
@@ -64,9 +79,16 @@ int RawEvent::SetDataBlockSize(size_t block_n, uint32_t newsize)
   if(block_n >= _datablocks.size()) 
     return -1;
   datablock& block = _datablocks[block_n];
-  uint32_t bufsize = block.data.size();
+  uint32_t bufsize = block.external ? block.external_size : block.data.size();
   // expand the buffer if we need to, but don't bother shrinking
   if(newsize > bufsize){
+    if(block.external){
+      //take a private copy of the external data
+      block.data.assign(block.external, block.external + block.datasize);
+      block.external = 0;
+      block.external_size = 0;
+      block.owner.reset();
+    }
     block.data.resize(newsize);
     _buffer_size += newsize-bufsize;
     _total_buffer_size += newsize-bufsize;
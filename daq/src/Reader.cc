@@ -1,16 +1,30 @@
 #include "Reader.hh"
+#include "BlockCodec.hh"
 #include "Message.hh"
 #include "ConfigHandler.hh"
 #include "EventHandler.hh"
 #include <fstream>
 #include <stdexcept>
 #include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef SINGLETHREAD
+typedef std::unique_lock<std::mutex> scoped_lock;
+#endif
 
 Reader::Reader(const std::string& filename) : 
   _filename(filename), _fin(0),  _ok(true),
   _current_index(-1), _current_event(), _current_file_index(_unset_file_index),
   _current_file_name(""),
-  _end_last_file(false)
+  _end_last_file(false), _index_built(false), _index_sorted(true),
+  _map_pos(0), _map_eof(false), _map_end(0), _data_end(0), _use_mmap(true),
+  _prefetch_enabled(false), _prefetch_running(false), _prefetch_depth(0),
+  _prefetch_workers(0), _prefetch_stalls(0)
 {
   
   if(!OpenNextFile()){
@@ -45,11 +59,28 @@ Reader::Reader(const std::string& filename) :
 
 }
 
+static bool IndexIdLess(const Reader::index_entry& entry, uint32_t id)
+{
+  return entry.event_id < id;
+}
+
 Reader::~Reader()
 {
+  StopPrefetch();
   if(_fin) CloseCurrentFile();
 }
 
+bool Reader::eof()
+{
+#ifndef SINGLETHREAD
+  if(_prefetch_running){
+    scoped_lock lock(_prefetch_mutex);
+    return _io_done && _ready_queue.empty();
+  }
+#endif
+  return FileEof();
+}
+
 bool Reader::ErrorCheck(int bytes_read, int bytes_requested)
 {
   //returns true if error encountered
@@ -78,7 +109,7 @@ int Reader::ReadNextHeader()
     return 1;
   }
   //see if we need to open the next file
-  if(eof()){
+  if(FileEof()){
     Message(DEBUG)<<"Reached end of files to search.\n";
     return 1;
   }
@@ -87,7 +118,7 @@ int Reader::ReadNextHeader()
   case 0:
     //use the legacy header
     event_header_v0 head;
-    bytes_read = gzread(_fin, &head, sizeof(event_header_v0));
+    bytes_read = FileRead(&head, sizeof(event_header_v0));
     if(ErrorCheck(bytes_read, sizeof(event_header_v0)))
       return 1;
     // copy legacy header info into the latest header version
@@ -96,9 +127,10 @@ int Reader::ReadNextHeader()
     _ehead.timestamp = head.timestamp;
     _ehead.nblocks = 1;
     break;
+  case 1:
   case latest_event_version:
     //use the current header
-    bytes_read = gzread(_fin, &_ehead, sizeof(_ehead));
+    bytes_read = FileRead(&_ehead, sizeof(_ehead));
     if(ErrorCheck(bytes_read, sizeof(_ehead))){
       if(bytes_read==0) //could just be EOF, not actual error; try again
 	return ReadNextHeader();
@@ -115,7 +147,7 @@ int Reader::ReadNextHeader()
 z_off_t Reader::SkipNextEvent(bool skip_header)
 {
   //see if we need to open the next file
-  if(gzeof(_fin) && OpenNextFile()){
+  if(FileAtEnd() && OpenNextFile()){
     Message(DEBUG)<<"Reached end of files to search.\n";
     return 0;
   }
@@ -124,17 +156,17 @@ z_off_t Reader::SkipNextEvent(bool skip_header)
   if(skip_header){
     //first byte is event size
     uint32_t esize = 0;
-    int bytes_read = gzread(_fin, &esize, sizeof(uint32_t));
+    int bytes_read = FileRead(&esize, sizeof(uint32_t));
     if(ErrorCheck(bytes_read, sizeof(uint32_t)))
       return 0;
     z_off_t seek_length = esize - sizeof(uint32_t);
-    seekpos =  gzseek(_fin, seek_length, SEEK_CUR);
+    seekpos = FileSeek(seek_length, SEEK_CUR);
   }
   else{
     z_off_t seek_length = _ehead.event_size - sizeof(event_header);
     if(_ghead.event_header_version == 0)
       seek_length = _ehead.event_size - sizeof(event_header_v0);
-    seekpos =  gzseek(_fin, seek_length, SEEK_CUR);
+    seekpos = FileSeek(seek_length, SEEK_CUR);
   }
   _current_index++;
   return seekpos;
@@ -143,95 +175,453 @@ z_off_t Reader::SkipNextEvent(bool skip_header)
 
 RawEventPtr Reader::GetNextEvent(bool read_header)
 {
+#ifndef SINGLETHREAD
+  if(read_header && _prefetch_enabled)
+    return GetNextPrefetchedEvent();
+#endif
   if(read_header) 
     ReadNextHeader();
   if(!_ok){
     Message(ERROR)<<"Attempt to read from file in bad state.\n";
     return RawEventPtr();
   }
-  if(eof()){
+  if(FileEof()){
     return RawEventPtr();
   }
+  pending_event pending;
+  pending.head = _ehead;
+  if(ReadEventData(pending) || InflateEvent(pending))
+    return RawEventPtr();
+  
+  _current_index++;
+  _current_event = pending.event;
+  return pending.event;
+}
+
+int Reader::ReadEventData(pending_event& pending)
+{
   //read depends on file version
   RawEventPtr next(new RawEvent);
+  pending.event = next;
+  const event_header& ehead = pending.head;
   
   switch(_ghead.event_header_version){
   case 0:{
     //event data in this generation of file is not internally zipped
     //consists only of V172X blocks after the legacy header
-    uint32_t evsize = _ehead.event_size - sizeof(event_header_v0);
+    uint32_t evsize = ehead.event_size - sizeof(event_header_v0);
     int blockn = next->AddDataBlock(RawEvent::CAEN_V172X, evsize);
-    int bytes_read = gzread(_fin, next->GetRawDataBlock(blockn), evsize);
+    int bytes_read = FileRead(next->GetRawDataBlock(blockn), evsize);
     if(ErrorCheck(bytes_read, evsize))
-      return RawEventPtr();
+      return 1;
     break;
   }
+  case 1:
   case latest_event_version: {
     //this event structure has individually zipped data blocks
     datablock_header bh;
     uint32_t thisblock = 0;
     int bytes_read = 0;
-    while(thisblock < _ehead.nblocks && 
-	  (uint32_t)bytes_read<_ehead.event_size-sizeof(event_header)){
-      int head_read = gzread(_fin, &bh, sizeof(bh));
-      if(ErrorCheck(head_read, sizeof(bh)))
-	return RawEventPtr();
-      //create datablock in the raw event
-      int blockn = next->AddDataBlock(bh.type, bh.datasize);
-      //read the compressed block into a temporary buffer
-      std::vector<char> buf(bh.total_blocksize_disk);
-      int block_read = gzread(_fin, &(buf[0]), 
-			      bh.total_blocksize_disk-sizeof(bh));
-      if(ErrorCheck(block_read, bh.total_blocksize_disk-sizeof(bh))){
-	Message(ERROR)<<"Incorrect blocksize for block "<<thisblock<<" in event "
-		      <<_ehead.event_id;
-	return RawEventPtr();
+    pending.blocks.reserve(ehead.nblocks);
+    pending.buffers.reserve(ehead.nblocks);
+    while(thisblock < ehead.nblocks && 
+	  (uint32_t)bytes_read<ehead.event_size-sizeof(event_header)){
+      int head_read = 0;
+      if(_ghead.event_header_version == 1){
+	//version 1 blocks were always compressed with zlib
+	datablock_header_v1 bh1;
+	head_read = FileRead(&bh1, sizeof(bh1));
+	if(ErrorCheck(head_read, sizeof(bh1)))
+	  return 1;
+	bh.total_blocksize_disk = bh1.total_blocksize_disk + 
+	  sizeof(bh) - sizeof(bh1);
+	bh.datasize = bh1.datasize;
+	bh.type = bh1.type;
+	bh.codec = BlockCodec::ZLIB;
+      }
+      else{
+	head_read = FileRead(&bh, sizeof(bh));
+	if(ErrorCheck(head_read, sizeof(bh)))
+	  return 1;
+      }
+      //don't trust the sizes in the header to fit the buffers they fill
+      if(bh.total_blocksize_disk < sizeof(bh) ||
+	 (bh.codec == BlockCodec::STORED && 
+	  bh.total_blocksize_disk - sizeof(bh) != bh.datasize)){
+	Message(ERROR)<<"Corrupt header for block "<<thisblock<<" in event "
+		      <<ehead.event_id<<"\n";
+	_ok = false;
+	return 1;
+      }
+      uint32_t zipsize = bh.total_blocksize_disk - sizeof(bh);
+      //in a mapped file, point straight at the data on disk
+      char* view = FileView(zipsize);
+      int block_read = zipsize;
+      if(view && bh.codec == BlockCodec::STORED){
+	//block was stored without compression, so just refer to it
+	next->AddDataBlockView(bh.type, (unsigned char*)view, bh.datasize, _map);
       }
-      //unzip the buffer into the RawEvent
-      uLongf decomp = bh.datasize;
-      int err = uncompress(next->GetRawDataBlock(blockn), &decomp,
-			   (Bytef*)(&(buf[0])), block_read);
-      if(err != Z_OK){
-	Message(ERROR)<<"uncompress function returned "<<err
-		      <<" while reading event!\n";
-	return RawEventPtr();
+      else if(view){
+	pending_block block = { next->AddDataBlock(bh.type, bh.datasize), 
+				view, zipsize, bh.codec };
+	pending.blocks.push_back(block);
+	pending.mapping = _map;
+      }
+      else if(bh.codec == BlockCodec::STORED){
+	int blockn = next->AddDataBlock(bh.type, bh.datasize);
+	block_read = FileRead(next->GetRawDataBlock(blockn), zipsize);
+      }
+      else{
+	//read the compressed block into a temporary buffer
+	int blockn = next->AddDataBlock(bh.type, bh.datasize);
+	pending.buffers.push_back(std::vector<char>(zipsize));
+	std::vector<char>& buf = pending.buffers.back();
+	block_read = FileRead(&(buf[0]), zipsize);
+	pending_block block = { blockn, &(buf[0]), zipsize, bh.codec };
+	pending.blocks.push_back(block);
+      }
+      if(ErrorCheck(block_read, zipsize)){
+	Message(ERROR)<<"Incorrect blocksize for block "<<thisblock<<" in event "
+		      <<ehead.event_id;
+	return 1;
       }
-      next->SetDataBlockSize(blockn,decomp);
       //done with this block
       thisblock++;
       bytes_read += head_read + block_read;
     }
     //make sure everything got read
-    if((uint32_t)bytes_read != _ehead.event_size-sizeof(event_header) || 
-       thisblock != _ehead.nblocks){
-      Message(ERROR)<<"The event with id "<<_ehead.event_id
+    if((uint32_t)bytes_read != ehead.event_size-sizeof(event_header) || 
+       thisblock != ehead.nblocks){
+      Message(ERROR)<<"The event with id "<<ehead.event_id
 		    <<" was not fully read out!\n";
-      return RawEventPtr();
+      return 1;
     }
     break;
   }
   default:
     Message(CRITICAL)<<"Unknown event header version number!\n";
-    return RawEventPtr();
+    return 1;
   }//end switch on event head version
   
-  //if we get here everything seems ok
-  next->SetID(_ehead.event_id);
-  next->SetTimestamp(_ehead.timestamp);
+  next->SetID(ehead.event_id);
+  next->SetTimestamp(ehead.timestamp);
   if(_ghead.global_header_version > 0)
     next->SetRunID(_ghead.run_id);
+  return 0;
+}
+
+int Reader::InflateEvent(pending_event& pending)
+{
+  RawEventPtr next = pending.event;
+  for(size_t i = 0; i < pending.blocks.size(); ++i){
+    const pending_block& block = pending.blocks[i];
+    //unzip the buffer into the RawEvent
+    size_t decomp = next->GetDataBlockSize(block.blockn);
+    int err = BlockCodec::Decode((BlockCodec::CODEC)block.codec, 
+				 (const unsigned char*)block.zipped, 
+				 block.size, 
+				 next->GetRawDataBlock(block.blockn), decomp);
+    if(err){
+      Message(ERROR)<<"Unable to decode block "<<block.blockn<<" of event "
+		    <<pending.head.event_id<<"\n";
+      pending.ok = false;
+      return 1;
+    }
+    next->SetDataBlockSize(block.blockn,decomp);
+  }
+  //don't hold on to the compressed data any longer than necessary
+  pending.blocks.clear();
+  pending.buffers.clear();
+  pending.mapping.reset();
+  return 0;
+}
+
+int Reader::FileRead(void* buf, unsigned len)
+{
+  if(!_map){
+    if(_data_end){
+      //don't read the trailer as if it were an event
+      z_off_t pos = gztell(_fin);
+      if(pos >= (z_off_t)_data_end)
+	return 0;
+      if(len > _data_end - pos)
+	len = _data_end - pos;
+    }
+    return gzread(_fin, buf, len);
+  }
+  if(_map_pos >= _map_end){
+    _map_eof = true;
+    return 0;
+  }
+  if(len > _map_end - _map_pos){
+    len = _map_end - _map_pos;
+    _map_eof = true;
+  }
+  memcpy(buf, _map->base + _map_pos, len);
+  _map_pos += len;
+  return len;
+}
+
+char* Reader::FileView(unsigned len)
+{
+  if(!_map)
+    return 0;
+  if(_map_pos >= _map_end || len > _map_end - _map_pos){
+    _map_pos = _map_end;
+    _map_eof = true;
+    return 0;
+  }
+  char* view = _map->base + _map_pos;
+  _map_pos += len;
+  return view;
+}
+
+z_off_t Reader::FileSeek(z_off_t offset, int whence)
+{
+  if(!_map)
+    return gzseek(_fin, offset, whence);
+  if(whence == SEEK_CUR)
+    offset += _map_pos;
+  if(offset < 0)
+    return -1;
+  _map_pos = offset;
+  _map_eof = false;
+  return offset;
+}
+
+z_off_t Reader::FileTell()
+{
+  return _map ? (z_off_t)_map_pos : gztell(_fin);
+}
+
+bool Reader::FileAtEnd()
+{
+  if(_map)
+    return _map_eof;
+  return gzeof(_fin) || (_data_end && gztell(_fin) >= (z_off_t)_data_end);
+}
+
+Reader::mapped_file::~mapped_file()
+{
+  if(base)
+    munmap(base, size);
+}
+
+int Reader::MapCurrentFile()
+{
+  int fd = open(_current_file_name.c_str(), O_RDONLY);
+  if(fd < 0)
+    return 1;
+  struct stat filestat;
+  void* addr = MAP_FAILED;
+  //map privately and writable so that views can be modified in place
+  if(fstat(fd, &filestat) == 0 && filestat.st_size > 0)
+    addr = mmap(0, filestat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		fd, 0);
+  close(fd);
+  if(addr == MAP_FAILED){
+    Message(DEBUG)<<"Unable to map file "<<_current_file_name
+		  <<" into memory; using buffered reads.\n";
+    return 1;
+  }
+  madvise(addr, filestat.st_size, MADV_SEQUENTIAL);
+  std::shared_ptr<mapped_file> mapping(new mapped_file);
+  mapping->base = (char*)addr;
+  mapping->size = filestat.st_size;
+  _map_pos = gztell(_fin);
+  _map_eof = false;
+  _map_end = mapping->size;
+  if(_data_end && _data_end < _map_end)
+    _map_end = _data_end;
+  _map = mapping;
+  Message(DEBUG2)<<"Mapped "<<_map->size<<" bytes of "<<_current_file_name
+		 <<" into memory.\n";
+  return 0;
+}
+
+int Reader::FileReadAt(uint64_t offset, void* buf, unsigned len)
+{
+  if(_map){
+    if(offset > _map->size || len > _map->size - offset)
+      return 0;
+    memcpy(buf, _map->base + offset, len);
+    return len;
+  }
+  if(gzseek(_fin, offset, SEEK_SET) != (z_off_t)offset)
+    return 0;
+  return gzread(_fin, buf, len);
+}
+
+int Reader::EnablePrefetch(int queue_depth, int nworkers)
+{
+#ifdef SINGLETHREAD
+  Message(WARNING)<<"Reader prefetch requested with multithreading disabled!\n";
+  return 1;
+#else
+  if(queue_depth < 1 || nworkers < 1){
+    Message(ERROR)<<"Invalid prefetch settings: queue depth "<<queue_depth
+		  <<", "<<nworkers<<" workers.\n";
+    return 1;
+  }
+  StopPrefetch();
+  _prefetch_depth = queue_depth;
+  _prefetch_workers = nworkers;
+  _prefetch_enabled = true;
+  return 0;
+#endif
+}
+
+void Reader::DisablePrefetch()
+{
+  StopPrefetch();
+  _prefetch_enabled = false;
+}
+
+int Reader::StopPrefetch()
+{
+  if(!_prefetch_running)
+    return 0;
+#ifndef SINGLETHREAD
+  {
+    scoped_lock lock(_prefetch_mutex);
+    _prefetch_stop = true;
+    _space_ready.notify_all();
+    _work_ready.notify_all();
+  }
+  _io_thread.join();
+  for(size_t i=0; i<_inflate_threads.size(); ++i)
+    _inflate_threads[i].join();
+  _inflate_threads.clear();
+  _ready_queue.clear();
+  _inflate_queue.clear();
+  Message(DEBUG)<<"Stopped prefetching from "<<_filename<<" after "
+		<<_current_index+1<<" events; consumer stalled "
+		<<_prefetch_stalls<<" times.\n";
+#endif
+  _prefetch_running = false;
+  //the io thread has read past the last event handed out, so go back
+  RawEventPtr current = _current_event;
+  _end_last_file = false;
+  int err = RestorePosition(_current_index);
+  _current_event = current;
+  _ehead = _prefetch_head;
+  return err;
+}
+
+#ifndef SINGLETHREAD
+int Reader::StartPrefetch()
+{
+  if(!_ok)
+    return 1;
+  _ready_queue.clear();
+  _inflate_queue.clear();
+  _prefetch_stop = false;
+  _io_done = false;
+  _prefetch_head = _ehead;
+  _prefetch_running = true;
+  _io_thread = std::thread(&Reader::PrefetchLoop, this);
+  for(int i=0; i<_prefetch_workers; ++i)
+    _inflate_threads.push_back(std::thread(&Reader::InflateLoop, this));
+  Message(DEBUG)<<"Prefetching up to "<<_prefetch_depth<<" events from "
+		<<_filename<<" with "<<_prefetch_workers<<" inflate threads.\n";
+  return 0;
+}
+
+RawEventPtr Reader::GetNextPrefetchedEvent()
+{
+  if(!_prefetch_running && StartPrefetch())
+    return RawEventPtr();
+  scoped_lock lock(_prefetch_mutex);
+  bool stalled = false;
+  while(_ready_queue.empty() || !_ready_queue.front()->inflated){
+    if(_ready_queue.empty() && _io_done)
+      return RawEventPtr();
+    stalled = true;
+    _event_ready.wait(lock);
+  }
+  if(stalled)
+    ++_prefetch_stalls;
+  PendingEventPtr next = _ready_queue.front();
+  _ready_queue.pop_front();
+  _space_ready.notify_one();
+  lock.unlock();
   
+  _prefetch_head = next->head;
+  if(!next->ok)
+    return RawEventPtr();
   _current_index++;
-  _current_event = next;
-  return next;
+  _current_event = next->event;
+  return next->event;
+}
+
+void Reader::PrefetchLoop()
+{
+  while(true){
+    {
+      scoped_lock lock(_prefetch_mutex);
+      while(!_prefetch_stop && _ready_queue.size() >= (size_t)_prefetch_depth)
+	_space_ready.wait(lock);
+      if(_prefetch_stop)
+	break;
+    }
+    PendingEventPtr next(new pending_event);
+    if(ReadNextHeader() || !_ok)
+      break;
+    next->head = _ehead;
+    if(ReadEventData(*next))
+      break;
+    
+    scoped_lock lock(_prefetch_mutex);
+    _ready_queue.push_back(next);
+    if(next->blocks.empty()){
+      next->inflated = true;
+      _event_ready.notify_all();
+    }
+    else{
+      _inflate_queue.push_back(next);
+      _work_ready.notify_one();
+    }
+  }
+  //either end of file, an error, or we were told to stop
+  scoped_lock lock(_prefetch_mutex);
+  _io_done = true;
+  _event_ready.notify_all();
+}
+
+void Reader::InflateLoop()
+{
+  scoped_lock lock(_prefetch_mutex);
+  while(!_prefetch_stop){
+    if(_inflate_queue.empty()){
+      _work_ready.wait(lock);
+      continue;
+    }
+    PendingEventPtr next = _inflate_queue.front();
+    _inflate_queue.pop_front();
+    lock.unlock();
+    InflateEvent(*next);
+    lock.lock();
+    next->inflated = true;
+    _event_ready.notify_all();
+  }
 }
+#endif
 
 RawEventPtr Reader::GetLastEvent()
 {
+  StopPrefetch();
   if(!_ok){
     Message(ERROR)<<"Attempt to read from file in bad state.\n";
     return RawEventPtr();
   }
+  if(!BuildIndex()){
+    if(_index.empty())
+      return RawEventPtr();
+    if(SeekToEntry(_index.size()-1))
+      return RawEventPtr();
+    return GetNextEvent();
+  }
+  //no index available, so scan the whole series
   int last_id=0;
   while(!ReadNextHeader()){
     last_id = _ehead.event_id;
@@ -252,6 +642,22 @@ RawEventPtr Reader::GetEventWithIndex(int index)
   }
   if(index == _current_index) 
     return _current_event;
+  if(index < 0)
+    return RawEventPtr();
+  //reading forward one at a time doesn't need to interrupt the prefetch
+  if(_prefetch_running && index == _current_index+1)
+    return GetNextEvent();
+  StopPrefetch();
+  if(!BuildIndex()){
+    if((size_t)index >= _index.size()){
+      Message(ERROR)<<"There is no event with index "<<index
+		    <<" in this file set.\n";
+      return RawEventPtr();
+    }
+    if(SeekToEntry(index))
+      return RawEventPtr();
+    return GetNextEvent();
+  }
   //we can't read backward one event at a time, so if requested index
   //is lower than current, we have to rewind the whole file
   if(index < _current_index){
@@ -281,12 +687,30 @@ RawEventPtr Reader::GetEventWithID(uint32_t id)
     Message(ERROR)<<"Attempt to read from file in bad state.\n";
     return RawEventPtr();
   }
+  StopPrefetch();
   if(id == 0){
     Reset();
     return GetNextEvent();
   }
   if(id == _ehead.event_id)
     return _current_event;
+  if(!BuildIndex()){
+    long entry = FindIndexEntry(id);
+    if(entry < 0){
+      Message(ERROR)<<"Event with id "<<id
+		    <<" is not present in this file set.\n";
+      return RawEventPtr();
+    }
+    if(SeekToEntry(entry))
+      return RawEventPtr();
+    RawEventPtr next = GetNextEvent();
+    if(next && next->GetID() != id){
+      Message(ERROR)<<"Event index for "<<_current_file_name
+		    <<" does not match the file contents!\n";
+      return RawEventPtr();
+    }
+    return next;
+  }
   //we can't read backward one event at a time, so if requested id
   //is lower than current, we have to rewind the whole file
   if(id != 0 && id < _ehead.event_id ){
@@ -325,23 +749,407 @@ RawEventPtr Reader::GetEventWithID(uint32_t id)
   return _current_event;
 }
 
+long Reader::FindIndexEntry(uint32_t id)
+{
+  if(_index_sorted){
+    std::vector<index_entry>::iterator it = 
+      std::lower_bound(_index.begin(), _index.end(), id, IndexIdLess);
+    if(it != _index.end() && it->event_id == id)
+      return it - _index.begin();
+    return -1;
+  }
+  for(size_t entry = 0; entry < _index.size(); ++entry){
+    if(_index[entry].event_id == id)
+      return entry;
+  }
+  return -1;
+}
+
+int Reader::GetNextCompressedEvent(std::vector<char>& buf, bool read_header)
+{
+  StopPrefetch();
+  if(read_header && ReadNextHeader())
+    return 1;
+  if(!_ok){
+    Message(ERROR)<<"Attempt to read from file in bad state.\n";
+    return 1;
+  }
+  if(FileEof())
+    return 1;
+  
+  event_header ehead = _ehead;
+  buf.resize(sizeof(event_header));
+  switch(_ghead.event_header_version){
+  case 0:{
+    //legacy events are a single unzipped V172X block; give it a header
+    uint32_t evsize = _ehead.event_size - sizeof(event_header_v0);
+    buf.resize(sizeof(event_header) + sizeof(datablock_header) + evsize);
+    datablock_header* bh = (datablock_header*)(&buf[sizeof(event_header)]);
+    bh->total_blocksize_disk = sizeof(datablock_header) + evsize;
+    bh->datasize = evsize;
+    bh->type = RawEvent::CAEN_V172X;
+    bh->codec = BlockCodec::STORED;
+    int bytes_read = FileRead(&buf[sizeof(event_header) + 
+				   sizeof(datablock_header)], evsize);
+    if(ErrorCheck(bytes_read, evsize))
+      return 1;
+    ehead.nblocks = 1;
+    break;
+  }
+  case 1:{
+    //add the codec to each block header
+    uint32_t bytes_read = 0;
+    uint32_t datasize = _ehead.event_size - sizeof(event_header);
+    for(uint32_t block = 0; block < _ehead.nblocks; ++block){
+      datablock_header_v1 bh1;
+      if(bytes_read + sizeof(bh1) > datasize ||
+	 ErrorCheck(FileRead(&bh1, sizeof(bh1)), sizeof(bh1)) ||
+	 bh1.total_blocksize_disk < sizeof(bh1)){
+	Message(ERROR)<<"Unable to read block "<<block<<" of event "
+		      <<_ehead.event_id<<"\n";
+	return 1;
+      }
+      uint32_t zipsize = bh1.total_blocksize_disk - sizeof(bh1);
+      size_t start = buf.size();
+      buf.resize(start + sizeof(datablock_header) + zipsize);
+      datablock_header* bh = (datablock_header*)(&buf[start]);
+      bh->total_blocksize_disk = sizeof(datablock_header) + zipsize;
+      bh->datasize = bh1.datasize;
+      bh->type = bh1.type;
+      bh->codec = BlockCodec::ZLIB;
+      if(ErrorCheck(FileRead(&buf[start+sizeof(datablock_header)], zipsize),
+		    zipsize))
+	return 1;
+      bytes_read += bh1.total_blocksize_disk;
+    }
+    if(bytes_read != datasize){
+      Message(ERROR)<<"The event with id "<<_ehead.event_id
+		    <<" was not fully read out!\n";
+      return 1;
+    }
+    break;
+  }
+  case latest_event_version:{
+    //already in the right format; copy it straight through
+    uint32_t datasize = _ehead.event_size - sizeof(event_header);
+    buf.resize(sizeof(event_header) + datasize);
+    if(ErrorCheck(FileRead(&buf[sizeof(event_header)], datasize), datasize))
+      return 1;
+    break;
+  }
+  default:
+    Message(CRITICAL)<<"Unknown event header version number!\n";
+    return 1;
+  }
+  ehead.event_size = buf.size();
+  memcpy(&buf[0], &ehead, sizeof(event_header));
+  _current_index++;
+  _current_event = RawEventPtr();
+  return 0;
+}
+
+int Reader::GetCompressedEventWithID(uint32_t id, std::vector<char>& buf)
+{
+  if(!_ok){
+    Message(ERROR)<<"Attempt to read from file in bad state.\n";
+    return 1;
+  }
+  StopPrefetch();
+  if(!BuildIndex()){
+    long entry = FindIndexEntry(id);
+    if(entry < 0){
+      Message(ERROR)<<"Event with id "<<id
+		    <<" is not present in this file set.\n";
+      return 1;
+    }
+    if(SeekToEntry(entry))
+      return 1;
+    return GetNextCompressedEvent(buf);
+  }
+  //no index, so search forward through the headers
+  if(_current_index >= 0 && id <= _ehead.event_id && Reset())
+    return 1;
+  while(_ok && !ReadNextHeader()){
+    if(_ehead.event_id == id)
+      return GetNextCompressedEvent(buf, false);
+    if(_ehead.event_id > id)
+      break;
+    SkipNextEvent(false);
+  }
+  Message(ERROR)<<"Event with id "<<id<<" is not present in this file set.\n";
+  return 1;
+}
+
+long Reader::GetTotalEvents()
+{
+  StopPrefetch();
+  if(BuildIndex())
+    return -1;
+  return _index.size();
+}
+
+int Reader::BuildIndex()
+{
+  if(_index_built)
+    return _index_files.empty();
+  _index_built = true;
+  if(!_ok)
+    return 1;
+  //remember where we were so sequential reading can continue afterwards
+  long saved_index = _current_index;
+  RawEventPtr saved_event = _current_event;
+  event_header saved_head = _ehead;
+  
+  Message(DEBUG)<<"Building event index for "<<_filename<<"...\n";
+  if(Reset())
+    return 1;
+  uint32_t slot = 0;
+  while(_ok && !_end_last_file){
+    if(IndexCurrentFile(slot++)){
+      Message(WARNING)<<"Unable to index file "<<_current_file_name
+		      <<"; falling back to sequential search.\n";
+      _index.clear();
+      _index_files.clear();
+      break;
+    }
+    if(OpenNextFile())
+      break;
+  }
+  for(size_t i=1; i<_index.size(); ++i){
+    if(_index[i].event_id < _index[i-1].event_id){
+      _index_sorted = false;
+      break;
+    }
+  }
+  Message(DEBUG)<<"Indexed "<<_index.size()<<" events in "
+		<<_index_files.size()<<" files.\n";
+  
+  RestorePosition(saved_index);
+  _current_event = saved_event;
+  _ehead = saved_head;
+  return _index_files.empty();
+}
+
+int Reader::RestorePosition(long index)
+{
+  if(index < 0)
+    return Reset();
+  if(!BuildIndex() && !_index.empty()){
+    if((size_t)index+1 < _index.size())
+      return SeekToEntry(index+1);
+    //we were at the end of the last file
+    if(SeekToEntry(_index.size()-1))
+      return 1;
+    SkipNextEvent();
+    return 0;
+  }
+  //no index, so we have to skip forward from the beginning
+  if(Reset())
+    return 1;
+  while(_ok && !_end_last_file && _current_index < index)
+    SkipNextEvent();
+  return _current_index != index;
+}
+
+int Reader::IndexCurrentFile(uint32_t slot)
+{
+  uint64_t source_size = 0;
+  struct stat filestat;
+  if(stat(_current_file_name.c_str(), &filestat) == 0)
+    source_size = filestat.st_size;
+  _index_files.push_back(_current_file_name);
+  if(ReadTrailer(slot) || LoadIndexFile(slot, source_size))
+    return 0;
+  
+  size_t first_entry = _index.size();
+  bool complete = true;
+  z_off_t pos = FileTell();
+  while(true){
+    //every header version starts with the event size and id
+    uint32_t head[2];
+    int bytes_read = FileRead(head, sizeof(head));
+    if(bytes_read == 0)
+      break;
+    else if(bytes_read < 0){
+      Message(ERROR)<<"Error encountered when reading from file.\n";
+      return 1;
+    }
+    else if(bytes_read < (int)sizeof(head) || head[0] < sizeof(head) ||
+	    ((_map || gzdirect(_fin)) && pos + head[0] > (z_off_t)source_size)){
+      Message(WARNING)<<"Incomplete event at end of file "<<_current_file_name
+		      <<"; it will not be indexed.\n";
+      complete = false;
+      break;
+    }
+    index_entry entry;
+    entry.offset = pos;
+    entry.event_id = head[1];
+    entry.file_slot = slot;
+    _index.push_back(entry);
+    pos = FileSeek(pos + head[0], SEEK_SET);
+    if(pos < 0){
+      Message(ERROR)<<"Unable to seek within file "<<_current_file_name<<"\n";
+      return 1;
+    }
+  }
+  //don't save an index for a file that is still being written
+  if(complete)
+    SaveIndexFile(first_entry, source_size);
+  return 0;
+}
+
+bool Reader::ReadTrailer(uint32_t slot)
+{
+  //seeking around a gzip'ed file would mean inflating all of it
+  if(_ghead.global_header_version < 2 || !_data_end || !(_map || gzdirect(_fin)))
+    return false;
+  z_off_t pos = FileTell();
+  file_trailer trailer;
+  std::vector<trailer_entry> table;
+  bool ok = FileReadAt(_data_end, &trailer, sizeof(trailer)) == 
+    sizeof(trailer) && trailer.magic_num_check == trailer_magic_number &&
+    trailer.trailer_size == sizeof(trailer) + 
+    (uint64_t)trailer.nevents * sizeof(trailer_entry) &&
+    trailer.nevents == _ghead.nevents;
+  if(ok && trailer.nevents > 0){
+    table.resize(trailer.nevents);
+    unsigned len = table.size() * sizeof(trailer_entry);
+    ok = FileReadAt(_data_end + sizeof(trailer), &table[0], len) == (int)len;
+  }
+  for(size_t i=0; ok && i < table.size(); ++i){
+    //offsets must increase and stay within the event data
+    if(table[i].offset >= _data_end || 
+       (i > 0 && table[i].offset <= table[i-1].offset))
+      ok = false;
+  }
+  if(!_map && FileSeek(pos, SEEK_SET) != pos){
+    Message(ERROR)<<"Unable to seek within file "<<_current_file_name<<"\n";
+    _ok = false;
+    return false;
+  }
+  if(!ok){
+    Message(WARNING)<<"File trailer in "<<_current_file_name
+		    <<" is invalid; scanning the file instead.\n";
+    return false;
+  }
+  for(size_t i=0; i < table.size(); ++i){
+    index_entry entry;
+    entry.offset = table[i].offset;
+    entry.event_id = table[i].event_id;
+    entry.file_slot = slot;
+    _index.push_back(entry);
+  }
+  Message(DEBUG2)<<"Read "<<table.size()<<" event offsets from the trailer of "
+		 <<_current_file_name<<"\n";
+  return true;
+}
+
+bool Reader::LoadIndexFile(uint32_t slot, uint64_t source_size)
+{
+  std::string idxname = _current_file_name + ".idx";
+  std::ifstream fin(idxname.c_str(), std::ios::in | std::ios::binary);
+  if(!fin.is_open())
+    return false;
+  index_header ihead;
+  ihead.magic_num_check = 0;
+  fin.read((char*)(&ihead), sizeof(ihead));
+  if(!fin || ihead.magic_num_check != index_magic_number ||
+     ihead.index_version != latest_index_version ||
+     ihead.source_file_size != source_size){
+    Message(DEBUG)<<"Index file "<<idxname<<" is out of date; rebuilding.\n";
+    return false;
+  }
+  size_t first_entry = _index.size();
+  _index.resize(first_entry + ihead.nentries);
+  if(ihead.nentries > 0)
+    fin.read((char*)(&_index[first_entry]), 
+	     ihead.nentries * sizeof(index_entry));
+  if(!fin){
+    Message(WARNING)<<"Index file "<<idxname<<" is corrupt; rebuilding.\n";
+    _index.resize(first_entry);
+    return false;
+  }
+  for(size_t i = first_entry; i < _index.size(); ++i)
+    _index[i].file_slot = slot;
+  Message(DEBUG2)<<"Loaded "<<ihead.nentries<<" index entries from "
+		 <<idxname<<"\n";
+  return true;
+}
+
+bool Reader::SaveIndexFile(size_t first_entry, uint64_t source_size)
+{
+  if(source_size == 0)
+    return false;
+  std::string idxname = _current_file_name + ".idx";
+  std::ofstream fout(idxname.c_str(), std::ios::out | std::ios::binary |
+		     std::ios::trunc);
+  if(!fout.is_open()){
+    Message(DEBUG)<<"Unable to save event index to "<<idxname<<"\n";
+    return false;
+  }
+  index_header ihead;
+  ihead.source_file_size = source_size;
+  ihead.nentries = _index.size() - first_entry;
+  fout.write((const char*)(&ihead), sizeof(ihead));
+  if(ihead.nentries > 0)
+    fout.write((const char*)(&_index[first_entry]), 
+	       ihead.nentries * sizeof(index_entry));
+  if(!fout){
+    Message(WARNING)<<"Error writing event index to "<<idxname<<"\n";
+    fout.close();
+    remove(idxname.c_str());
+    return false;
+  }
+  return true;
+}
+
+int Reader::SeekToEntry(size_t entry)
+{
+  const index_entry& target = _index.at(entry);
+  const std::string& fname = _index_files.at(target.file_slot);
+  if(!_fin || fname != _current_file_name){
+    CloseCurrentFile();
+    _current_file_name = fname;
+    _fin = gzopen(_current_file_name.c_str(),"rb");
+    if(!_fin){
+      Message(ERROR)<<"Unable to reopen file "<<_current_file_name<<"\n";
+      _ok = false;
+      return 1;
+    }
+    ReadGlobalHeader();
+  }
+  if(FileSeek(target.offset, SEEK_SET) < 0){
+    Message(ERROR)<<"Unable to seek to event "<<entry<<" in file "
+		  <<_current_file_name<<"\n";
+    _ok = false;
+    return 1;
+  }
+  _end_last_file = false;
+  _current_index = entry-1;
+  _current_event = RawEventPtr();
+  _ehead.reset();
+  return 0;
+}
+
 bool Reader::GetAssociatedParameter(VParameterNode* par, std::string key)
 {	
   if(key == "") 
     key = par->GetDefaultKey();
-  bool cfg_found = true;
-  if(!(par->ReadFromFile((_filename+".cfg").c_str(),key,true))){
-    //ok, that didn't work, try removing a possible .gz suffix
-    std::string fnamecopy(_filename);
-    fnamecopy.resize(fnamecopy.size()-3);
-    if(!(par->ReadFromFile((fnamecopy+".cfg").c_str(),
-			   key, true))){
-      //that still didn't work.  Print a message and give up
-      Message(INFO)<<"Unable to find associated config file.\n";
-      cfg_found = false;
+  //try the filename with successively fewer suffixes, as in the constructor
+  std::string cfgfile = _filename+".";
+  size_t pos;
+  while( (pos = cfgfile.rfind('.')) != std::string::npos){
+    cfgfile.resize(pos);
+    std::string testfile = cfgfile+".cfg";
+    std::ifstream cfgfin(testfile.c_str());
+    if(cfgfin.is_open()){
+      cfgfin.close();
+      //ReadFromFile returns true on failure
+      return !(par->ReadFromFile(testfile.c_str(), key, true));
     }
   }
-  return cfg_found;
+  Message(INFO)<<"Unable to find associated config file.\n";
+  return false;
 }
 
 int Reader::Reset()
@@ -363,6 +1171,7 @@ int Reader::CloseCurrentFile()
   if(_fin)
     gzclose(_fin);
   _fin = 0;
+  _map.reset();
   return 0;
 }
 
@@ -471,10 +1280,16 @@ int Reader::OpenNextFile()
     return 1;
   }
   
+  return ReadGlobalHeader();
+}
+
+int Reader::ReadGlobalHeader()
+{
   _ehead.reset();
+  _data_end = 0;
   //read in the global file header
   //assume we're using the latest header, then check to make sure
-  gzread(_fin, &_ghead, _ghead.global_header_size);
+  gzread(_fin, &_ghead, sizeof(global_header));
   //check the magic number in the first 4 bytes
   if(_ghead.magic_num_check != magic_number){
     //we are in a legacy (pre-header) file
@@ -488,8 +1303,8 @@ int Reader::OpenNextFile()
     gzrewind(_fin);
   }
   else{ 
-    if(_ghead.global_header_version != latest_global_version || 
-       _ghead.event_header_version != latest_event_version){
+    if(_ghead.global_header_version > latest_global_version || 
+       _ghead.event_header_version > latest_event_version){
       //handle future version number updates here
       Message(CRITICAL)<<"Header version number stored in this file is larger"
 		       <<" than latest version!\n";
@@ -517,6 +1332,12 @@ int Reader::OpenNextFile()
 		  <<"\n\tMax Event: "<<_ghead.event_id_max
 		  <<std::endl;
     _current_file_index = _ghead.file_index;
+    //newer files have a trailer after the last event
+    if(_ghead.global_header_version >= 2)
+      _data_end = _ghead.file_size;
+    //block-compressed files are plain on disk, so we can map them directly
+    if(_use_mmap && gzdirect(_fin))
+      MapCurrentFile();
   }
   return 0;
 }
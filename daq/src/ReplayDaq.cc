@@ -0,0 +1,164 @@
+#include "ReplayDaq.hh"
+#include "Reader.hh"
+#include "RawEvent.hh"
+#include "V172X_Event.hh"
+#include "Message.hh"
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+
+typedef std::chrono::steady_clock steady_clock;
+
+//board trigger time tags are 31 bits
+static const uint64_t ticks_range = 0x80000000ULL;
+static const uint64_t ns_per_s = 1000000000ULL;
+
+ReplayDaq::ReplayDaq(V172X_Params* params, const std::string& filename) :
+  BaseDaq(false), _params(params), _file_params(), _have_file_params(false),
+  _filename(filename), _speed(1), _prefetch(0), _reader(), _finished(false),
+  _events_replayed(0), _have_last(false), _last_timestamp(0),
+  _last_board(-1), _last_ticks(0)
+{}
+
+ReplayDaq::~ReplayDaq()
+{
+  if(_is_running) EndRun();
+}
+
+int ReplayDaq::Initialize()
+{
+  if(_filename == ""){
+    Message(ERROR)<<"No file given to replay!"<<std::endl;
+    _status = INIT_FAILURE;
+    return -1;
+  }
+  _reader.reset(new Reader(_filename));
+  if(!_reader->IsOk()){
+    Message(ERROR)<<"Unable to open "<<_filename<<" for replay."<<std::endl;
+    _status = INIT_FAILURE;
+    return -1;
+  }
+  if(_prefetch > 0)
+    _reader->EnablePrefetch(_prefetch);
+
+  //the board clocks give the trigger times to the tick
+  _have_file_params = _reader->GetAssociatedParameter(&_file_params);
+  if(_have_file_params){
+    for(int i=0; i < _file_params.nboards; i++){
+      if(_file_params.board[i].enabled)
+	_file_params.board[i].UpdateBoardSpecificVariables();
+    }
+  }
+  else{
+    Message(WARNING)<<"No saved configuration for "<<_filename
+		    <<"; replay times will only be good to 1 s."<<std::endl;
+  }
+  _finished = false;
+  _have_last = false;
+  return Update();
+}
+
+int ReplayDaq::Update()
+{
+  if(_is_running){
+    Message(ERROR)<<"Attempt to update parameters while in run."
+		  <<std::endl;
+    return -2;
+  }
+  return SetQueueLimits(_params->event_queue_depth, _params->max_mem_size,
+			_params->queue_spin_us, !_params->no_low_mem_warn);
+}
+
+uint64_t ReplayDaq::GetRecordedDelta(const RawEventPtr& event)
+{
+  uint32_t timestamp = event->GetTimestamp();
+  //find the trigger time tag of the first board
+  int board = -1;
+  uint32_t ticks = 0;
+  for(size_t i=0; i<event->GetNumDataBlocks() && _have_file_params; ++i){
+    if(event->GetDataBlockType(i) != RawEvent::CAEN_V172X ||
+       event->GetDataBlockSize(i) < 16)
+      continue;
+    V172X_BoardData data(event->GetRawDataBlock(i));
+    if(data.board_id < (uint32_t)_file_params.nboards){
+      board = data.board_id;
+      ticks = data.timestamp;
+    }
+    break;
+  }
+
+  uint64_t delta = 0;
+  if(_have_last){
+    //the coarse timestamps are in whole seconds and never go backward
+    uint64_t coarse = (timestamp > _last_timestamp ?
+		       (uint64_t)(timestamp - _last_timestamp) * ns_per_s : 0);
+    delta = coarse;
+    if(board >= 0 && board == _last_board){
+      const uint64_t ns_per_tick = _file_params.board[board].ns_per_clocktick;
+      const uint64_t range = ticks_range * ns_per_tick;
+      uint64_t fine = ((ticks - _last_ticks) & (ticks_range-1)) * ns_per_tick;
+      //add however many clock rollovers best match the coarse time
+      uint64_t rollovers = 0;
+      if(coarse > fine)
+	rollovers = (uint64_t)std::floor((double)(coarse - fine)/range + 0.5);
+      delta = fine + rollovers * range;
+    }
+  }
+  _have_last = true;
+  _last_timestamp = timestamp;
+  _last_board = board;
+  _last_ticks = ticks;
+  return delta;
+}
+
+void ReplayDaq::DataAcquisitionLoop()
+{
+  _events_replayed = 0;
+  const steady_clock::time_point start = steady_clock::now();
+  const steady_clock::duration max_sleep = std::chrono::milliseconds(100);
+  //recorded time of the current event since the first one
+  double recorded_ns = 0;
+  steady_clock::duration max_lag = steady_clock::duration::zero();
+
+  while(_is_running){
+    RawEventPtr event = _reader->GetNextEvent();
+    if(!event){
+      if(!_reader->IsOk()){
+	Message(ERROR)<<"Error reading "<<_filename<<" during replay."
+		      <<std::endl;
+	_status = GENERIC_ERROR;
+      }
+      _finished = true;
+      break;
+    }
+    recorded_ns += GetRecordedDelta(event);
+    if(_speed > 0){
+      steady_clock::time_point due = start +
+	std::chrono::duration_cast<steady_clock::duration>
+	(std::chrono::nanoseconds((int64_t)(recorded_ns / _speed)));
+      steady_clock::time_point now = steady_clock::now();
+      //don't sleep so long that we miss the end of the run
+      while(_is_running && now < due){
+	std::this_thread::sleep_until(std::min(due, now+max_sleep));
+	now = steady_clock::now();
+      }
+      if(!_is_running)
+	break;
+      max_lag = std::max(max_lag, now - due);
+    }
+    PostEvent(event);
+    _events_replayed++;
+  }
+
+  double elapsed = std::chrono::duration<double>(steady_clock::now() -
+						 start).count();
+  Message m(INFO);
+  m<<"Replayed "<<_events_replayed<<" events spanning "
+   <<recorded_ns/ns_per_s<<" s in "<<elapsed<<" s";
+  if(_speed > 0){
+    m<<"; at most "<<std::chrono::duration<double, std::milli>(max_lag).count()
+     <<" ms behind schedule";
+  }
+  m<<"."<<std::endl;
+}
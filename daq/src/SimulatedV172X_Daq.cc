@@ -0,0 +1,386 @@
+#include "SimulatedV172X_Daq.hh"
+#include "RawEvent.hh"
+#include "Message.hh"
+#include "ConfigHandler.hh"
+#include "EventHandler.hh"
+#include "runinfo.hh"
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+typedef std::chrono::steady_clock steady_clock;
+
+//size of the precomputed noise table
+static const size_t noise_table_size = 65536;
+
+V172X_SimParams::V172X_SimParams() : ParameterList("V172X_SimParams")
+{
+  RegisterParameter("trigger_rate", trigger_rate = 100,
+		    "Mean rate of simulated triggers in Hz; 0 triggers as fast as events can be generated");
+  RegisterParameter("distribution", distribution = POISSON,
+		    "Time structure of the triggers: PERIODIC, POISSON, or BURST");
+  RegisterParameter("burst_size", burst_size = 10,
+		    "Number of back-to-back triggers in each burst for BURST");
+  RegisterParameter("pulses_per_event", pulses_per_event = 1,
+		    "Mean number of pulses per channel per event");
+  RegisterParameter("pulse_amplitude", pulse_amplitude = 200,
+		    "Mean pulse height in counts");
+  RegisterParameter("pulse_decay_ns", pulse_decay_ns = 50,
+		    "Exponential decay time of the pulses in ns");
+  RegisterParameter("noise_rms", noise_rms = 2,
+		    "RMS of the gaussian baseline noise in counts");
+  RegisterParameter("baseline", baseline = -1,
+		    "Baseline in counts; negative puts it near the edge of the range opposite the trigger polarity");
+  RegisterParameter("seed", seed = 0,
+		    "Random seed; 0 uses the current time");
+}
+
+std::ostream& operator<<(std::ostream& out, const RATE_DISTRIBUTION& dist)
+{
+  if(dist == PERIODIC)
+    return out<<"PERIODIC";
+  else if(dist == POISSON)
+    return out<<"POISSON";
+  else
+    return out<<"BURST";
+}
+
+std::istream& operator>>(std::istream& in, RATE_DISTRIBUTION& dist)
+{
+  std::string temp;
+  in>>temp;
+  if(temp == "PERIODIC" || temp == "periodic")
+    dist = PERIODIC;
+  else if(temp == "POISSON" || temp == "poisson")
+    dist = POISSON;
+  else if(temp == "BURST" || temp == "burst")
+    dist = BURST;
+  else{
+    Message e(EXCEPTION);
+    e<<temp<<" is not a valid value for RATE_DISTRIBUTION"<<std::endl;
+    throw std::invalid_argument(e.str());
+  }
+  return in;
+}
+
+SimulatedV172X_Daq::SimulatedV172X_Daq(V172X_Params* params) :
+  BaseDaq(false), _params(params), _sim(), _initialized(false),
+  _triggers(0), _lost_triggers(0), _burst_count(0), _max_event_size(0),
+  _record_seconds(0), _pulse_rate(0)
+{
+  ConfigHandler::GetInstance()->RegisterParameter(_sim.GetDefaultKey(), _sim);
+}
+
+SimulatedV172X_Daq::~SimulatedV172X_Daq()
+{
+  if(_is_running) EndRun();
+}
+
+int SimulatedV172X_Daq::Initialize()
+{
+  for(int i=0; i < _params->nboards; i++){
+    V172X_BoardParams& board = _params->board[i];
+    if(!board.enabled)
+      continue;
+    if(board.UpdateBoardSpecificVariables()){
+      Message(CRITICAL)<<"Board "<<i<<" has unknown type "<<board.board_type
+		       <<"; can't simulate it!"<<std::endl;
+      _status = INIT_FAILURE;
+      return -2;
+    }
+    if(board.zs_type == ZLE && board.sample_bits == 10){
+      Message(WARNING)<<"ZLE is not simulated for 10-bit board "<<i
+		      <<"; sending full waveforms."<<std::endl;
+    }
+  }
+  if(_params->GetEnabledBoards() == 0){
+    Message(ERROR)<<"No boards are enabled for the simulation!"<<std::endl;
+    _status = INIT_FAILURE;
+    return -1;
+  }
+
+  unsigned int seed = _sim.seed;
+  if(seed == 0)
+    seed = std::chrono::system_clock::now().time_since_epoch().count();
+  _rng.seed(seed);
+  Message(DEBUG)<<"Simulating V172X data with random seed "<<seed<<std::endl;
+
+  //generating gaussians for every sample is far too slow, so pick a random
+  //place to start in a table for each channel
+  std::normal_distribution<double> gaus(0, _sim.noise_rms);
+  _noise.resize(noise_table_size);
+  for(size_t i=0; i<_noise.size(); ++i)
+    _noise[i] = gaus(_rng);
+  _pulse_rate = 0;
+
+  _initialized = true;
+  return Update();
+}
+
+int SimulatedV172X_Daq::Update()
+{
+  if(!_initialized){
+    Message(ERROR)<<"Attempt to update parameters before initializations!"
+		  <<std::endl;
+    return -1;
+  }
+  if(_is_running){
+    Message(ERROR)<<"Attempt to update parameters while in run."
+		  <<std::endl;
+    return -2;
+  }
+
+  _params->GetEventSize();
+  _max_event_size = 0;
+  _record_seconds = 0;
+  runinfo* info = EventHandler::GetInstance()->GetRunInfo();
+  for(int i=0; i < _params->nboards; i++){
+    V172X_BoardParams& board = _params->board[i];
+    if(!board.enabled)
+      continue;
+    if(info){
+      std::stringstream ss;
+      ss<<"board"<<i<<"__pre_trigger_time_us";
+      info->SetMetadata(ss.str(), board.pre_trigger_time_us);
+      ss.str("");
+      ss<<"board"<<i<<"__post_trigger_time_us";
+      info->SetMetadata(ss.str(), board.post_trigger_time_us);
+    }
+    _record_seconds = std::max(_record_seconds, 1.e-6 *
+			       (board.pre_trigger_time_us +
+				board.post_trigger_time_us));
+    //worst case for ZLE is every other word kept, with a control word each
+    long nwords = board.GetTotalNSamps() * board.bytes_per_sample / 4 + 1;
+    long chansize = board.zs_type == ZLE ? 4*(2*nwords + 2) : 4*nwords;
+    _max_event_size += 16;
+    for(int j=0; j<board.nchans; j++){
+      if(board.channel[j].enabled)
+	_max_event_size += chansize;
+    }
+  }
+
+  if(SetBufferPool(_max_event_size, _params->pool_mem_size,
+		   _params->pool_hugepages, _params->pool_mlock))
+    return -4;
+  return SetQueueLimits(_params->event_queue_depth, _params->max_mem_size,
+			_params->queue_spin_us, !_params->no_low_mem_warn);
+}
+
+double SimulatedV172X_Daq::NextTriggerInterval()
+{
+  if(_sim.trigger_rate <= 0)
+    return 0;
+  double mean = 1./_sim.trigger_rate;
+  switch(_sim.distribution){
+  case PERIODIC:
+    return mean;
+  case POISSON:
+    return std::exponential_distribution<double>(_sim.trigger_rate)(_rng);
+  case BURST:
+  default:
+    //triggers in a burst are spaced by the acquisition window; the gap
+    //between bursts keeps the mean rate right
+    if(++_burst_count < _sim.burst_size)
+      return _record_seconds;
+    _burst_count = 0;
+    return std::max(0., _sim.burst_size*mean -
+		    (_sim.burst_size-1)*_record_seconds);
+  }
+}
+
+void SimulatedV172X_Daq::GenerateWaveform(const V172X_BoardParams& board,
+					  int nsamps)
+{
+  const double maxval = (1<<board.sample_bits) - 1;
+  const bool falling = (board.trigger_polarity == TP_FALLING);
+  const double sign = falling ? -1 : 1;
+  double base = _sim.baseline;
+  if(base < 0)
+    base = falling ? 0.9*maxval : 0.1*maxval;
+
+  //rebuild the pulse template if the sample rate changed
+  double rate = board.GetSampleRate();
+  if(rate != _pulse_rate){
+    _pulse_rate = rate;
+    double tau = std::max(_sim.pulse_decay_ns * rate / 1000., 0.1);
+    int npulse = std::min((int)(7*tau)+2, std::max(nsamps, 2));
+    _pulse.resize(npulse);
+    _pulse[0] = 0.5;
+    for(int i=1; i<npulse; ++i)
+      _pulse[i] = std::exp(-(i-1)/tau);
+  }
+
+  std::vector<double> wave(nsamps);
+  size_t noise = std::uniform_int_distribution<size_t>(0,_noise.size()-1)(_rng);
+  for(int i=0; i<nsamps; ++i){
+    wave[i] = base + _noise[noise];
+    if(++noise == _noise.size())
+      noise = 0;
+  }
+
+  int npulses = 0;
+  if(_sim.pulses_per_event > 0)
+    npulses = std::poisson_distribution<int>(_sim.pulses_per_event)(_rng);
+  std::uniform_real_distribution<double> flat(0,1);
+  for(int p=0; p<npulses; ++p){
+    //the first pulse is the one that caused the trigger
+    int start = (p == 0 ? board.GetTriggerIndex() : (int)(flat(_rng)*nsamps));
+    double amp = sign * _sim.pulse_amplitude * (0.5 + flat(_rng));
+    int n = std::min((int)_pulse.size(), nsamps - start);
+    for(int i=0; i<n; ++i)
+      wave[start+i] += amp * _pulse[i];
+  }
+
+  _samples.resize(nsamps);
+  for(int i=0; i<nsamps; ++i)
+    _samples[i] = (int)std::max(0., std::min(maxval, std::floor(wave[i]+0.5)));
+}
+
+long SimulatedV172X_Daq::FillBoard(int boardnum, unsigned char* buffer,
+				   uint32_t counter, uint32_t timestamp)
+{
+  const V172X_BoardParams& board = _params->board[boardnum];
+  const int nsamps = board.GetTotalNSamps();
+  const bool tenbit = (board.sample_bits == 10);
+  const bool zle = (board.zs_type == ZLE && !tenbit);
+  const int bps = board.bytes_per_sample;
+  const int samps_per_word = 4/bps;
+  uint32_t* words = (uint32_t*)buffer;
+  long pos = 4; //in words, after the header
+  uint32_t mask = 0;
+
+  for(int ch=0; ch<board.nchans; ++ch){
+    const V172X_ChannelParams& channel = board.channel[ch];
+    if(!channel.enabled)
+      continue;
+    mask |= (1<<ch);
+    GenerateWaveform(board, nsamps);
+    if(tenbit){
+      //3 samples per word, with the number of valid samples on top
+      for(int i=0; i<nsamps; i+=3){
+	uint32_t n = std::min(3, nsamps-i);
+	uint32_t word = (n<<30);
+	for(uint32_t j=0; j<n; ++j)
+	  word |= (_samples[i+j] & 0x3FF) << (10*j);
+	words[pos++] = word;
+      }
+      continue;
+    }
+    //pack the samples into words
+    const int nwords = nsamps / samps_per_word;
+    std::vector<uint32_t> packed(nwords, 0);
+    for(int i=0; i<nsamps; ++i){
+      packed[i/samps_per_word] |=
+	(uint32_t)_samples[i] << (8*bps*(i%samps_per_word));
+    }
+    if(!zle){
+      std::copy(packed.begin(), packed.end(), words+pos);
+      pos += nwords;
+      continue;
+    }
+    //find which words to keep, with pre and post samples around each
+    std::vector<int> keep(nwords+1, 0);
+    const int npre = (channel.zs_pre_samps + samps_per_word-1)/samps_per_word;
+    const int npost = (channel.zs_post_samps + samps_per_word-1)/samps_per_word;
+    for(int w=0; w<nwords; ++w){
+      bool over = false;
+      for(int j=0; j<samps_per_word && !over; ++j){
+	int samp = _samples[w*samps_per_word+j];
+	over = (channel.zs_polarity == TP_FALLING ?
+		samp < (int)channel.zs_threshold :
+		samp > (int)channel.zs_threshold);
+      }
+      if(over){
+	keep[std::max(0, w-npre)]++;
+	keep[std::min(nwords, w+npost+1)]--;
+      }
+    }
+    //channel size word, then a control word for each good or skipped run
+    long size_pos = pos++;
+    int running = 0;
+    int w = 0;
+    while(w < nwords){
+      running += keep[w];
+      bool good = running > 0;
+      int start = w;
+      while(++w < nwords && ((running + keep[w]) > 0) == good)
+	running += keep[w];
+      uint32_t nrun = w - start;
+      words[pos++] = (good ? 0x80000000 : 0) | (nrun & 0x1FFFFF);
+      if(good){
+	std::copy(packed.begin()+start, packed.begin()+w, words+pos);
+	pos += nrun;
+      }
+    }
+    words[size_pos] = pos - size_pos;
+  }
+
+  words[0] = 0xA0000000 | (pos & 0x0FFFFFFF);
+  words[1] = (mask & 0xFF) | (zle ? (1<<24) : 0) |
+    ((boardnum & 0x1F) << 27);
+  words[2] = (counter & 0xFFFFFF) | (((mask>>8) & 0xFF) << 24);
+  words[3] = timestamp & 0x7FFFFFFF;
+  return 4*pos;
+}
+
+void SimulatedV172X_Daq::DataAcquisitionLoop()
+{
+  _triggers = 0;
+  _lost_triggers = 0;
+  _burst_count = 0;
+  uint32_t counter = 0;
+  const steady_clock::time_point start = steady_clock::now();
+  steady_clock::time_point next_trigger = start;
+  const steady_clock::duration max_sleep = std::chrono::milliseconds(100);
+
+  while(_is_running){
+    steady_clock::time_point now = steady_clock::now();
+    if(next_trigger > now){
+      //don't sleep so long that we miss the end of the run
+      std::this_thread::sleep_until(std::min(next_trigger, now+max_sleep));
+      continue;
+    }
+    uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>
+      (next_trigger - start).count();
+
+    RawEventPtr next_event(new RawEvent);
+    size_t blocknum = AddEventBuffer(next_event, RawEvent::CAEN_V172X,
+				     _max_event_size);
+    unsigned char* buffer = next_event->GetRawDataBlock(blocknum);
+    long total_size = 0;
+    for(int i=0; i<_params->nboards; i++){
+      if(!_params->board[i].enabled) continue;
+      uint32_t timestamp = elapsed_ns / _params->board[i].ns_per_clocktick;
+      total_size += FillBoard(i, buffer+total_size, counter, timestamp);
+    }
+    next_event->SetDataBlockSize(blocknum, total_size);
+    steady_clock::time_point post_start = steady_clock::now();
+    PostEvent(next_event);
+    _triggers++;
+    counter++;
+    next_trigger += std::chrono::duration_cast<steady_clock::duration>
+      (std::chrono::duration<double>(NextTriggerInterval()));
+    if(_sim.trigger_rate <= 0)
+      continue;
+
+    //triggers already due are generated next, as if buffered on the
+    //boards, but any that arrived while we waited for space in the queue
+    //are lost.  The boards still count them.
+    now = steady_clock::now();
+    while(next_trigger >= post_start && next_trigger < now){
+      _lost_triggers++;
+      counter++;
+      next_trigger += std::chrono::duration_cast<steady_clock::duration>
+	(std::chrono::duration<double>(NextTriggerInterval()));
+    }
+  }
+
+  long total = _triggers + _lost_triggers;
+  Message(INFO)<<"Simulated "<<total<<" triggers; "<<_lost_triggers
+	       <<" ("<<(total ? 100.*_lost_triggers/total : 0.)
+	       <<"%) were lost to deadtime."<<std::endl;
+}
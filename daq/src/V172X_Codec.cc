@@ -0,0 +1,511 @@
+#include "V172X_Codec.hh"
+#include "V172X_Params.hh"
+#include "Message.hh"
+#include <zlib.h>
+#include <cstring>
+
+namespace {
+  //residuals are Rice coded in groups of this many samples
+  const size_t rice_group = 32;
+  //quotients this large are escaped and the value written in full
+  const uint32_t rice_escape = 16;
+  const int escape_bits = 18;
+  const int k_bits = 5;
+
+  inline uint32_t ReadWord(const unsigned char* p)
+  {
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+  }
+
+  inline uint32_t ZigZag(int32_t val)
+  { return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31); }
+
+  /// write <val> 7 bits at a time; returns bytes used
+  inline size_t PutVarint(unsigned char* p, uint32_t val)
+  {
+    size_t n = 0;
+    for( ; val >= 0x80; val >>= 7)
+      p[n++] = (val & 0x7F) | 0x80;
+    p[n++] = val;
+    return n;
+  }
+
+  /// read a varint at <p>, not past <end>; returns bytes used or 0 on error
+  inline size_t GetVarint(const unsigned char* p, const unsigned char* end,
+			  uint32_t& val)
+  {
+    val = 0;
+    for(size_t n=0; n<5 && p+n < end; ++n){
+      val |= (uint32_t)(p[n] & 0x7F) << (7*n);
+      if(!(p[n] & 0x80))
+	return n+1;
+    }
+    return 0;
+  }
+  inline int32_t UnZigZag(uint32_t val){ return (val >> 1) ^ -(int32_t)(val&1); }
+
+  /// Append bits LSB first to a bounded output buffer
+  class BitWriter{
+  public:
+    BitWriter(unsigned char* out, size_t cap) :
+      _out(out), _cap(cap), _pos(0), _acc(0), _nbits(0), _overflow(false) {}
+    /// append the low <nbits> (at most 32) of <val>
+    void Put(uint64_t val, int nbits)
+    {
+      _acc |= val << _nbits;
+      _nbits += nbits;
+      while(_nbits >= 8){
+	if(_pos >= _cap){
+	  _overflow = true;
+	  _nbits = 0;
+	  return;
+	}
+	_out[_pos++] = _acc & 0xFF;
+	_acc >>= 8;
+	_nbits -= 8;
+      }
+    }
+    void PutOnes(uint32_t n)
+    {
+      for( ; n >= 24; n -= 24)
+	Put(0xFFFFFF, 24);
+      if(n)
+	Put((1u<<n)-1, n);
+    }
+    /// flush remaining bits; returns bytes written
+    size_t Finish()
+    {
+      if(_nbits > 0)
+	Put(0, 8-_nbits);
+      return _pos;
+    }
+    bool Overflow() const { return _overflow; }
+  private:
+    unsigned char* _out;
+    size_t _cap;
+    size_t _pos;
+    uint64_t _acc;
+    int _nbits;
+    bool _overflow;
+  };
+
+  /// Read bits LSB first; reading past the end returns zeros and sets a flag
+  class BitReader{
+  public:
+    BitReader(const unsigned char* in, size_t len) :
+      _in(in), _len(len), _pos(0), _acc(0), _nbits(0), _overrun(false) {}
+    uint32_t Get(int nbits)
+    {
+      if(_nbits < nbits)
+	Fill();
+      uint32_t val = _acc & ((1ull<<nbits)-1);
+      Consume(nbits);
+      return val;
+    }
+    /// count and consume a run of 1 bits (up to <max>) and its terminating 0
+    uint32_t GetUnary(uint32_t max)
+    {
+      uint32_t count = 0;
+      while(count < max){
+	if(_nbits < 32)
+	  Fill();
+	uint64_t inv = ~_acc;
+	uint32_t run = (inv ? __builtin_ctzll(inv) : 64);
+	if(run > (uint32_t)_nbits)
+	  run = _nbits;
+	if(count + run >= max){
+	  Consume(max - count);
+	  return max;
+	}
+	count += run;
+	Consume(run);
+	if(_nbits > 0){
+	  Consume(1);
+	  return count;
+	}
+	if(_overrun)
+	  return max;
+      }
+      return count;
+    }
+    bool Overrun() const { return _overrun; }
+  private:
+    void Fill()
+    {
+      while(_nbits <= 56){
+	if(_pos < _len)
+	  _acc |= (uint64_t)_in[_pos++] << _nbits;
+	else if(_nbits == 0)
+	  _overrun = true;
+	else
+	  break;
+	_nbits += 8;
+      }
+    }
+    void Consume(int nbits)
+    {
+      _acc >>= nbits;
+      _nbits -= nbits;
+      if(_nbits < 0){
+	_overrun = true;
+	_nbits = 0;
+      }
+    }
+    const unsigned char* _in;
+    size_t _len;
+    size_t _pos;
+    uint64_t _acc;
+    int _nbits;
+    bool _overrun;
+  };
+
+  template<class T> inline T ReadSample(const unsigned char* p, size_t i)
+  {
+    T val;
+    memcpy(&val, p + i*sizeof(T), sizeof(T));
+    return val;
+  }
+
+  /// Rice code the differences between successive samples of type T
+  template<class T>
+  size_t RiceEncode(const unsigned char* src, size_t nsamps,
+		    unsigned char* dest, size_t cap)
+  {
+    BitWriter bits(dest, cap);
+    uint32_t z[rice_group];
+    int32_t prev = 0;
+    for(size_t first = 0; first < nsamps && !bits.Overflow();
+	first += rice_group){
+      size_t n = std::min(rice_group, nsamps - first);
+      uint64_t sum = 0;
+      for(size_t i=0; i<n; ++i){
+	int32_t samp = ReadSample<T>(src, first+i);
+	z[i] = ZigZag(samp - prev);
+	prev = samp;
+	sum += z[i];
+      }
+      //choose k close to log2 of the mean residual
+      uint32_t k = 0;
+      while(k < 16 && ((uint64_t)n << (k+1)) <= sum)
+	++k;
+      bits.Put(k, k_bits);
+      for(size_t i=0; i<n; ++i){
+	uint32_t q = z[i] >> k;
+	if(q >= rice_escape){
+	  bits.PutOnes(rice_escape);
+	  bits.Put(z[i], escape_bits);
+	}
+	else{
+	  //unary quotient, terminating zero, then the low k bits
+	  uint64_t code = ((1ull<<q)-1) | ((uint64_t)(z[i] & ((1u<<k)-1)) << (q+1));
+	  bits.Put(code, q+1+k);
+	}
+      }
+    }
+    size_t len = bits.Finish();
+    return bits.Overflow() ? cap+1 : len;
+  }
+
+  template<class T>
+  int RiceDecode(const unsigned char* src, size_t srclen,
+		 unsigned char* dest, size_t nsamps)
+  {
+    BitReader bits(src, srclen);
+    int32_t prev = 0;
+    for(size_t first = 0; first < nsamps; first += rice_group){
+      size_t n = std::min(rice_group, nsamps - first);
+      uint32_t k = bits.Get(k_bits);
+      if(k > 16)
+	return 1;
+      for(size_t i=0; i<n; ++i){
+	uint32_t q = bits.GetUnary(rice_escape);
+	uint32_t z;
+	if(q >= rice_escape)
+	  z = bits.Get(escape_bits);
+	else
+	  z = (q << k) | (k ? bits.Get(k) : 0);
+	prev += UnZigZag(z);
+	T samp = prev;
+	memcpy(dest + (first+i)*sizeof(T), &samp, sizeof(T));
+      }
+      if(bits.Overrun())
+	return 1;
+    }
+    return 0;
+  }
+
+  /// Guess whether 8- or 16-bit differences will be smaller
+  V172X_Codec::SEGMENT_TYPE ChooseSampleType(const unsigned char* src,
+					     size_t len)
+  {
+    if(len % 2)
+      return V172X_Codec::DELTA8;
+    size_t check = std::min(len, (size_t)512) & ~(size_t)1;
+    uint64_t bits8 = 0, bits16 = 0;
+    for(size_t i=1; i<check; ++i){
+      int32_t diff = (int32_t)src[i] - src[i-1];
+      bits8 += 32 - __builtin_clz(ZigZag(diff) | 1);
+    }
+    for(size_t i=1; i<check/2; ++i){
+      int32_t diff = (int32_t)ReadSample<uint16_t>(src,i) -
+	ReadSample<uint16_t>(src,i-1);
+      bits16 += 32 - __builtin_clz(ZigZag(diff) | 1);
+    }
+    //each sample also costs about one bit of unary terminator
+    bits8 += check;
+    bits16 += check/2;
+    return (bits16 <= bits8 ? V172X_Codec::DELTA16 : V172X_Codec::DELTA8);
+  }
+
+  /// Accumulates segments into the output buffer
+  class SegmentWriter{
+  public:
+    SegmentWriter(const unsigned char* src, unsigned char* dest, size_t cap) :
+      _src(src), _dest(dest), _cap(cap), _pos(0), _raw_start(0),
+      _overflow(false) {}
+
+    /// Encode samples in [start,end) of the source; data before start
+    /// not yet written is stored raw
+    void Samples(size_t start, size_t end)
+    {
+      if(end <= start)
+	return;
+      FlushRaw(start);
+      size_t len = end - start;
+      V172X_Codec::SEGMENT_TYPE type = ChooseSampleType(_src+start, len);
+      size_t hdr = V172X_Codec::segment_header_size;
+      if(_overflow || _pos + hdr > _cap){
+	_overflow = true;
+	return;
+      }
+      //never let a segment grow beyond its raw size
+      size_t room = std::min(_cap - _pos - hdr, len - 1);
+      size_t enclen = (type == V172X_Codec::DELTA16 ?
+		       RiceEncode<uint16_t>(_src+start, len/2,
+					    _dest+_pos+hdr, room) :
+		       RiceEncode<uint8_t>(_src+start, len,
+					   _dest+_pos+hdr, room) );
+      if(enclen > room){
+	//incompressible; leave it to be merged into the next raw segment
+	return;
+      }
+      else{
+	Commit(type, len, enclen);
+	_raw_start = end;
+      }
+    }
+
+    /// store everything before <end> not yet written as a raw segment
+    void FlushRaw(size_t end)
+    {
+      if(end <= _raw_start)
+	return;
+      size_t len = end - _raw_start;
+      if(_overflow ||
+	 _pos + V172X_Codec::segment_header_size + len > _cap){
+	_overflow = true;
+	return;
+      }
+      _dest[_pos++] = V172X_Codec::RAW;
+      _pos += PutVarint(_dest+_pos, len);
+      memcpy(_dest+_pos, _src+_raw_start, len);
+      _pos += len;
+      _raw_start = end;
+    }
+
+    /// zlib everything before <end> not yet written as one segment
+    void Deflate(size_t end)
+    {
+      size_t start = _raw_start;
+      size_t hdr = V172X_Codec::segment_header_size;
+      if(_pos + hdr > _cap){
+	_overflow = true;
+	return;
+      }
+      uLongf zlen = _cap - _pos - hdr;
+      if(compress2(_dest+_pos+hdr, &zlen, _src+start, end-start, 1) != Z_OK){
+	_overflow = true;
+	return;
+      }
+      Commit(V172X_Codec::DEFLATE, end-start, zlen);
+      _raw_start = end;
+    }
+
+    void Reset(){ _pos = 0; _raw_start = 0; _overflow = false; }
+    size_t GetSize() const { return _pos; }
+    bool Overflow() const { return _overflow; }
+  private:
+    /// write the header for a payload encoded after a maximum-size
+    /// header gap, then close the gap
+    void Commit(V172X_Codec::SEGMENT_TYPE type, uint32_t rawlen,
+		uint32_t enclen)
+    {
+      unsigned char head[V172X_Codec::segment_header_size];
+      size_t n = 0;
+      head[n++] = type;
+      n += PutVarint(head+n, rawlen);
+      n += PutVarint(head+n, enclen);
+      memmove(_dest+_pos+n, _dest+_pos+V172X_Codec::segment_header_size,
+	      enclen);
+      memcpy(_dest+_pos, head, n);
+      _pos += n + enclen;
+    }
+    const unsigned char* _src;
+    unsigned char* _dest;
+    size_t _cap;
+    size_t _pos;
+    size_t _raw_start;
+    bool _overflow;
+  };
+
+  /// Split one board into segments; returns false if the layout is
+  /// inconsistent with the header
+  bool EncodeBoard(SegmentWriter& out, const unsigned char* src,
+		   size_t board_start, size_t board_end)
+  {
+    const unsigned char* board = src + board_start;
+    uint32_t channel_mask = ((ReadWord(board+8) & 0xFF000000) >> 16) |
+      (ReadWord(board+4) & 0xFF);
+    bool zle = board[7] & 1;
+    int nchans = 0;
+    for(int ch=0; ch < V172X_BoardParams::MAXCHANS; ++ch)
+      if(channel_mask & (1<<ch))
+	++nchans;
+    if(nchans == 0)
+      return true;
+    size_t bytes_per_chan = (board_end - board_start - 16) / nchans;
+    size_t offset = board_start + 16;
+    for(int ch=0; ch < V172X_BoardParams::MAXCHANS; ++ch){
+      if(!(channel_mask & (1<<ch)))
+	continue;
+      if(!zle){
+	out.Samples(offset, offset + bytes_per_chan);
+	offset += bytes_per_chan;
+	continue;
+      }
+      //ZLE: size word, then control words each followed by good samples
+      if(offset + 4 > board_end)
+	return false;
+      size_t chan_end = offset + 4 * (size_t)ReadWord(src+offset);
+      if(chan_end > board_end || chan_end <= offset)
+	return false;
+      size_t pos = offset + 4;
+      while(pos < chan_end){
+	uint32_t control = ReadWord(src+pos);
+	pos += 4;
+	if(control & 0x80000000){
+	  size_t run = 4 * (size_t)(control & 0x001FFFFF);
+	  if(pos + run > chan_end)
+	    return false;
+	  out.Samples(pos, pos+run);
+	  pos += run;
+	}
+      }
+      offset = chan_end;
+    }
+    return true;
+  }
+}
+
+size_t V172X_Codec::GetMaxEncodedSize(size_t srclen)
+{
+  //we fall back to a single zlib segment if the segments don't fit
+  return compressBound(srclen) + segment_header_size;
+}
+
+int V172X_Codec::Encode(const unsigned char* src, size_t srclen,
+			unsigned char* dest, size_t& destlen)
+{
+  SegmentWriter out(src, dest, destlen);
+  size_t offset = 0;
+  while(offset + 16 <= srclen && !out.Overflow()){
+    size_t board_size = 4 * (size_t)(ReadWord(src+offset) & 0x0FFFFFFF);
+    if(board_size < 16 || offset + board_size > srclen)
+      break;
+    if(!EncodeBoard(out, src, offset, offset + board_size)){
+      Message(DEBUG)<<"V172X_Codec: inconsistent board layout at byte "
+		    <<offset<<"; storing the rest with zlib.\n";
+      out.Deflate(srclen);
+      offset = srclen;
+      break;
+    }
+    offset += board_size;
+  }
+  if(offset < srclen && !out.Overflow()){
+    //trailing bytes that aren't a V172X board
+    out.Deflate(srclen);
+  }
+  out.FlushRaw(srclen);
+  if(out.Overflow()){
+    //the segmented form doesn't fit; compress the whole block instead
+    out.Reset();
+    out.Deflate(srclen);
+    if(out.Overflow()){
+      Message(ERROR)<<"V172X_Codec: output buffer of "<<destlen
+		    <<" bytes is too small\n";
+      return 1;
+    }
+  }
+  destlen = out.GetSize();
+  return 0;
+}
+
+int V172X_Codec::Decode(const unsigned char* src, size_t srclen,
+			unsigned char* dest, size_t& destlen)
+{
+  size_t in = 0, out = 0;
+  while(in < srclen){
+    int type = src[in++];
+    uint32_t rawlen = 0, enclen = 0;
+    size_t n = GetVarint(src+in, src+srclen, rawlen);
+    in += n;
+    if(n && type != RAW){
+      n = GetVarint(src+in, src+srclen, enclen);
+      in += n;
+    }
+    else
+      enclen = rawlen;
+    if(!n){
+      Message(ERROR)<<"V172X_Codec: truncated segment header\n";
+      return 1;
+    }
+    if(in + enclen > srclen || out + rawlen > destlen){
+      Message(ERROR)<<"V172X_Codec: segment overruns the buffer\n";
+      return 1;
+    }
+    int err = 0;
+    switch(type){
+    case RAW:
+      memcpy(dest+out, src+in, rawlen);
+      break;
+    case DELTA8:
+      err = RiceDecode<uint8_t>(src+in, enclen, dest+out, rawlen);
+      break;
+    case DELTA16:
+      if(rawlen % 2)
+	err = 1;
+      else
+	err = RiceDecode<uint16_t>(src+in, enclen, dest+out, rawlen/2);
+      break;
+    case DEFLATE:{
+      uLongf len = rawlen;
+      err = (uncompress(dest+out, &len, src+in, enclen) != Z_OK ||
+	     len != rawlen);
+      break;
+    }
+    default:
+      err = 1;
+    }
+    if(err){
+      Message(ERROR)<<"V172X_Codec: unable to decode segment of type "
+		    <<type<<"\n";
+      return 1;
+    }
+    in += enclen;
+    out += rawlen;
+  }
+  destlen = out;
+  return 0;
+}
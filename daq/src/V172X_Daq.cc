@@ -21,10 +21,13 @@ which inherits from the WARP_VetoDAQ class.
 #include <chrono>
 #include <sstream>
 #include <numeric>
+#include <cstring>
 
 //declare some useful constants
 const int event_size_padding = 8;
 typedef CAEN_DGTZ_ErrorCode ErrC;
+typedef std::unique_lock<std::mutex> scoped_lock;
+typedef std::chrono::steady_clock steady_clock;
 enum VME_REGISTERS{
   VME_ChZSThresh =         0x1024,
   VME_ChZSNsamples =       0x1028,
@@ -84,7 +87,9 @@ void PrintAllRegisters(int handle)
 
 
 V172X_Daq::V172X_Daq() : BaseDaq(), _initialized(false), 
-			 _params(), _triggers(0), _vme_mutex()
+			 _params(), _triggers(0), _vme_mutex(),
+			 _reader_generation(0), _readers_busy(0), 
+			 _readers_stop(false)
 {
   ConfigHandler::GetInstance()->RegisterParameter(_params.GetDefaultKey(),
 						  _params);
@@ -574,8 +579,13 @@ int V172X_Daq::Update()
 	( board.usb ? 0 : 1 ); //interrupt level
       WriteDigitizerRegister(VME_VMEControl, vme_control, handle);
       //Interrupt num, BLT event num
-      WriteDigitizerRegister(VME_InterruptOnEvent, 0, handle);
-      WriteDigitizerRegister(VME_BLTEvents, 1, handle);
+      if(_params.events_per_blt < 1)
+	_params.events_per_blt = 1;
+      if(_params.irq_on_events < 0)
+	_params.irq_on_events = 0;
+      WriteDigitizerRegister(VME_InterruptOnEvent, _params.irq_on_events, 
+			     handle);
+      WriteDigitizerRegister(VME_BLTEvents, _params.events_per_blt, handle);
       //wait until the board is ready to take data
       uint32_t status = 0;
       int count = 0;
@@ -615,7 +625,12 @@ int V172X_Daq::Update()
   catch(...){ 
     return -3;
   }
-  return 0;
+  if(SetBufferPool(_params.event_size_bytes + event_size_padding,
+		   _params.pool_mem_size, _params.pool_hugepages, 
+		   _params.pool_mlock))
+    return -4;
+  return SetQueueLimits(_params.event_queue_depth, _params.max_mem_size,
+			_params.queue_spin_us, !_params.no_low_mem_warn);
 }
 
 //predicate for find_if function used to test if any board has data
@@ -698,6 +713,305 @@ int DownsampleEvent(unsigned char* buf, uint32_t& factor, long& eventsize,
 }
 
 
+int V172X_Daq::DownloadEvents(int boardnum)
+{
+  V172X_BoardParams& board = _params.board[boardnum];
+  size_t bufsize = _params.events_per_blt * 
+    (board.event_size_bytes + event_size_padding);
+  std::shared_ptr<std::vector<unsigned char> > 
+    buffer(new std::vector<unsigned char>(bufsize));
+  uint32_t dl_size = 0;
+  ErrC err = CAEN_DGTZ_ReadData(_handle_board[boardnum], 
+				CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT,
+				(char*)(&(*buffer)[0]), &dl_size);
+  if(err != CAEN_DGTZ_Success){
+    Message(ERROR)<<"Error generated while downloading events from board "
+		  <<boardnum<<": "<<err<<"\n";
+    return -1;
+  }
+  if(dl_size > bufsize){
+    Message(ERROR)<<"Board "<<boardnum<<" sent "<<dl_size
+		  <<" bytes, more than the "<<bufsize<<" expected!\n";
+    return -1;
+  }
+  //split the transfer at each board header
+  size_t pos = 0;
+  int nevents = 0;
+  while(dl_size - pos >= 16){
+    unsigned char* start = &(*buffer)[pos];
+    uint32_t word0 = ((uint32_t*)start)[0];
+    if((word0 >> 28) != 0xA)
+      break;
+    board_event event;
+    event.buffer = buffer;
+    event.offset = pos;
+    event.size = (word0 & 0x0FFFFFFF) * sizeof(uint32_t);
+    event.counter = ((uint32_t*)start)[2] & 0xFFFFFF;
+    if(event.size < 16 || pos + event.size > dl_size){
+      Message(ERROR)<<"Corrupt event header in transfer from board "
+		    <<boardnum<<"; event size "<<event.size<<"\n";
+      return -1;
+    }
+    pos += event.size;
+    if(board.downsample_factor > 1)
+      DownsampleEvent(start, board.downsample_factor, event.size,
+		      board.bytes_per_sample);
+    _pending[boardnum].push_back(event);
+    ++nevents;
+  }
+  //align64 may leave a filler word at the end
+  if(dl_size - pos > 8){
+    Message(ERROR)<<"Unable to parse "<<dl_size - pos<<" bytes at the end of "
+		  <<"transfer from board "<<boardnum<<"\n";
+    return -1;
+  }
+  return nevents;
+}
+
+int V172X_Daq::PostMatchedEvents()
+{
+  //don't let a board that stopped triggering eat all the memory
+  const size_t max_pending = 4 * _params.events_per_blt;
+  while(true){
+    int first = -1;
+    size_t most_pending = 0;
+    bool ready = true;
+    for(int i=0; i<_params.nboards; i++){
+      if(!_params.board[i].enabled) continue;
+      if(first < 0)
+	first = i;
+      if(_pending[i].empty())
+	ready = false;
+      most_pending = std::max(most_pending, _pending[i].size());
+    }
+    if(first < 0)
+      return 0;
+    if(!ready){
+      if(most_pending > max_pending){
+	Message(CRITICAL)<<most_pending<<" events are waiting for a board "
+			 <<"which has not sent data; Aborting run\n";
+	return 1;
+      }
+      return 0;
+    }
+    //every board has at least one event, so match the counters
+    uint32_t event_counter = _pending[first].front().counter;
+    long total_size = 0;
+    for(int i=0; i<_params.nboards; i++){
+      if(!_params.board[i].enabled) continue;
+      const board_event& event = _pending[i].front();
+      if(event.counter != event_counter){
+	Message(CRITICAL)<<"Mismatched event ID on board "<<i
+			 <<"; received "<<event.counter<<", expected "
+			 <<event_counter<<"; Aborting run\n";
+	return 1;
+      }
+      total_size += event.size;
+    }
+    RawEventPtr next_event(new RawEvent);
+    size_t blocknum = AddEventBuffer(next_event, RawEvent::CAEN_V172X,
+				     total_size+event_size_padding);
+    unsigned char* buffer = next_event->GetRawDataBlock(blocknum);
+    for(int i=0; i<_params.nboards; i++){
+      if(!_params.board[i].enabled) continue;
+      const board_event& event = _pending[i].front();
+      memcpy(buffer, &(*event.buffer)[event.offset], event.size);
+      buffer += event.size;
+      _pending[i].pop_front();
+    }
+    _triggers++;
+    next_event->SetDataBlockSize(blocknum, total_size);
+    PostEvent(next_event);
+  }
+}
+
+int V172X_Daq::ReadBoardEvent(int boardnum, unsigned char* buffer, 
+			      long& ev_size, uint32_t& counter)
+{
+  //wait until the event is ready on the board
+  int tries = 0;
+  const int maxtries = 50;
+  while(!DataAvailable(ReadDigitizerRegister(VME_AcquisitionStatus, 
+					     _handle_board[boardnum])) &&
+	tries++ < maxtries) {}
+  if(tries >= maxtries){
+    Message(DEBUG)<<"No trigger received on board "<<boardnum<<"\n";
+    return 1;
+  }
+  
+  uint32_t this_dl_size = 0;
+  tries=0;
+  ErrC err = CAEN_DGTZ_Success;
+  while(this_dl_size == 0 && ++tries<maxtries ){
+    err = CAEN_DGTZ_ReadData(_handle_board[boardnum], 
+			     CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT,
+			     (char*)(buffer), &this_dl_size);
+    if(err != CAEN_DGTZ_Success){
+      Message(ERROR)<<"Error generated while downloading event from board"
+		    <<boardnum<<": "<<err<<"\n";
+      continue;
+    }
+  }
+  
+  if(this_dl_size==0){
+    Message(ERROR)<<"0 bytes downloaded for board "<<boardnum<<std::endl;
+    Message(DEBUG)<<"Events stored on this board: "
+                  <<ReadDigitizerRegister(VME_EventsStored, 
+                                          _handle_board[boardnum])
+                  <<"\n";
+    uint32_t out;
+    out = ReadDigitizerRegister(VME_VMEStatus, _handle_board[boardnum]);
+    Message(DEBUG)<<"VME status:"
+                  <<"\n\tBERR flag: "<< (out&4)
+                  <<"\n\tOutput buffer full: "<< (out&2)
+                  <<"\n\tData ready: "<< (out&1)<<"\n";
+    out = ReadDigitizerRegister(VME_AcquisitionStatus, 
+                                _handle_board[boardnum]);
+    Message(DEBUG)<<"Acquisition status:"
+                  <<"\n\tReady for acquisition: "<< (out&256)
+                  <<"\n\tPLL Status: "<< (out&128)
+                  <<"\n\tPLL Bypass: "<< (out&64)
+                  <<"\n\tClock source: "<< (out&32)
+                  <<"\n\tEvents full: "<< (out&16)
+                  <<"\n\tEvent ready: "<< (out&8)
+                  <<"\n\t Run on: "<< (out&4) <<"\n";
+    out = ReadDigitizerRegister(VME_EventSize, _handle_board[boardnum]);
+    Message(DEBUG)<<"Next event size: "<<out<<"\n";
+    Message(DEBUG)<<"Expected event size "
+                  <<_params.board[boardnum].event_size_bytes/4<<"\n";
+    
+    
+    //free the buffer so we don't re-trigger spuriously
+    WriteDigitizerRegister(VME_BufferFree,1, 
+                           _handle_board[boardnum]);
+    Message(DEBUG)<<"Events stored on this board: "
+                  <<ReadDigitizerRegister(VME_EventsStored,_handle_board[boardnum])
+                  <<"\n";
+    WriteDigitizerRegister(VME_BufferFree,2, 
+                           _handle_board[boardnum]);
+    Message(DEBUG)<<"Events stored on this board: "
+                  <<ReadDigitizerRegister(VME_EventsStored,_handle_board[boardnum])
+                  <<"\n";
+    Message(ERROR)<<"Boards don't usually recover from this error! "
+                  <<"Aborting!\n";
+    return -1;
+  }
+  
+  //this could ignore potential align64 extra bits:
+  //data_transferred += this_dl_size;
+  //instead, we check the actual event
+  ev_size = (*((uint32_t*)(buffer)) & 0x0FFFFFFF) * sizeof(uint32_t);
+  if(std::abs(ev_size - (long)this_dl_size) > 5){
+    Message(WARNING)<<"Event size does not match download count!\n\t"
+		    <<"Event size: "<<ev_size<<"; download size: "
+		    <<this_dl_size<<"; requested download "
+		    <<_params.board[boardnum].event_size_bytes<<std::endl;
+    Message(ERROR)<<"Boards don't usually recover from this error! "
+		  <<"Aborting!\n";
+    return -1;
+  }
+  counter = (((uint32_t*)(buffer))[2])&0xFFFFFF;
+  
+  if(_params.board[boardnum].downsample_factor > 1){
+    DownsampleEvent(buffer, _params.board[boardnum].downsample_factor, 
+		    ev_size, _params.board[boardnum].bytes_per_sample);
+  }
+  return 0;
+}
+
+int V172X_Daq::ReadBoard(int boardnum)
+{
+  board_readout& readout = _readout[boardnum];
+  steady_clock::time_point start = steady_clock::now();
+  try{
+    if(_params.events_per_blt > 1)
+      readout.status = (DownloadEvents(boardnum) < 0 ? -1 : 0);
+    else
+      readout.status = ReadBoardEvent(boardnum, readout.dest, readout.size,
+				      readout.counter);
+  }
+  catch(std::exception& e){
+    Message(ERROR)<<"Unable to read out board "<<boardnum<<": "
+		  <<e.what()<<"\n";
+    readout.status = -1;
+  }
+  double us = std::chrono::duration<double, std::micro>
+    (steady_clock::now() - start).count();
+  readout.reads++;
+  readout.total_us += us;
+  if(us > readout.max_us)
+    readout.max_us = us;
+  return readout.status;
+}
+
+void V172X_Daq::BoardReaderLoop(int boardnum)
+{
+  uint64_t generation = 0;
+  while(true){
+    {
+      scoped_lock lock(_reader_mutex);
+      while(!_readers_stop && _reader_generation == generation)
+	_reader_start.wait(lock);
+      if(_readers_stop)
+	return;
+      generation = _reader_generation;
+    }
+    ReadBoard(boardnum);
+    if(--_readers_busy == 0){
+      scoped_lock lock(_reader_mutex);
+      _reader_done.notify_all();
+    }
+  }
+}
+
+void V172X_Daq::StartBoardReaders()
+{
+  _readers_stop = false;
+  _reader_generation = 0;
+  _readers_busy = 0;
+  //each board gets a slice of the event big enough for its largest event
+  long offset = 0;
+  for(int i=0; i<_params.nboards; i++){
+    if(!_params.board[i].enabled) continue;
+    _readout[i].offset = offset;
+    offset += _params.board[i].event_size_bytes;
+    _reader_threads.push_back(std::thread(&V172X_Daq::BoardReaderLoop, 
+					  this, i));
+  }
+}
+
+void V172X_Daq::StopBoardReaders()
+{
+  {
+    scoped_lock lock(_reader_mutex);
+    _readers_stop = true;
+  }
+  _reader_start.notify_all();
+  for(size_t i=0; i<_reader_threads.size(); ++i)
+    _reader_threads[i].join();
+  _reader_threads.clear();
+}
+
+void V172X_Daq::ReadBoardsParallel(unsigned char* buffer)
+{
+  {
+    scoped_lock lock(_reader_mutex);
+    for(int i=0; i<_params.nboards; i++){
+      if(_params.board[i].enabled)
+	_readout[i].dest = buffer + _readout[i].offset;
+    }
+    _readers_busy = _reader_threads.size();
+    ++_reader_generation;
+  }
+  _reader_start.notify_all();
+  //the transfers take a while, so a short spin usually isn't enough
+  for(int spin=0; spin < 100 && _readers_busy > 0; ++spin)
+    std::this_thread::yield();
+  scoped_lock lock(_reader_mutex);
+  while(_readers_busy > 0)
+    _reader_done.wait(lock);
+}
+
 void V172X_Daq::DataAcquisitionLoop()
 {
   if(!_initialized) Initialize();
@@ -744,6 +1058,19 @@ void V172X_Daq::DataAcquisitionLoop()
     return;
   }
   
+  for(int i=0; i<_params.nboards; i++){
+    _pending[i].clear();
+    _readout[i] = board_readout();
+  }
+  const bool parallel = _params.parallel_readout;
+  if(parallel){
+    Message(DEBUG)<<"Reading out boards in parallel.\n";
+    StartBoardReaders();
+  }
+  if(_params.events_per_blt > 1)
+    Message(DEBUG)<<"Downloading up to "<<_params.events_per_blt
+		  <<" events per block transfer.\n";
+  
   //and we're running!
   while(_is_running ){
 
@@ -798,131 +1125,68 @@ void V172X_Daq::DataAcquisitionLoop()
     }
     
     //if we get here, there is an event ready for download
+    if(_params.events_per_blt > 1){
+      //take whatever each board has stored, then pair up the triggers
+      if(parallel)
+        ReadBoardsParallel(0);
+      for(int i=0; i<_params.nboards && GetStatus() == NORMAL; i++){
+        if(_params.board[i].enabled && 
+           (parallel ? _readout[i].status : ReadBoard(i)) < 0)
+          _status = COMM_ERROR;
+      }
+      if(GetStatus() == NORMAL && PostMatchedEvents())
+        _status = GENERIC_ERROR;
+      if(GetStatus() != NORMAL){
+        _is_running = false;
+        break;
+      }
+      continue;
+    }
     //get a new event ready 
     RawEventPtr next_event(new RawEvent);
     size_t blocknum = 
-      next_event->AddDataBlock(RawEvent::CAEN_V172X,
-                               _params.event_size_bytes+event_size_padding);
+      AddEventBuffer(next_event, RawEvent::CAEN_V172X,
+		     _params.event_size_bytes+event_size_padding);
     unsigned char* buffer = next_event->GetRawDataBlock(blocknum);
     const uint32_t UNSET_EVENT_COUNTER = 0xFFFFFFFF;
     uint32_t event_counter = UNSET_EVENT_COUNTER;
     //get the data
     int data_transferred = 0;
+    if(parallel)
+      ReadBoardsParallel(buffer);
     for(int i=0; i<_params.nboards; i++){
       if(!_params.board[i].enabled) continue;
-      //wait until the event is ready on the board
-      
-      int tries = 0;
-      const int maxtries = 50;
-      while(!DataAvailable(ReadDigitizerRegister(VME_AcquisitionStatus, 
-                                                 _handle_board[i])) &&
-            tries++ < maxtries) {}
-      if(tries >= maxtries){
-        Message(DEBUG)<<"No trigger received on board "<<i<<"\n";
-        continue;
+      board_readout& readout = _readout[i];
+      if(parallel){
+        //close the gap left by the boards before this one
+        if(readout.status == 0 && readout.offset != data_transferred)
+          memmove(buffer+data_transferred, buffer+readout.offset, 
+                  readout.size);
       }
-      
-      uint32_t this_dl_size = 0;
-      tries=0;
-      ErrC err = CAEN_DGTZ_Success;
-      while(this_dl_size == 0 && ++tries<maxtries ){
-        err = CAEN_DGTZ_ReadData(_handle_board[i], 
-                                 CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT,
-                                 (char*)(buffer+data_transferred), 
-                                 &this_dl_size);
-        if(err != CAEN_DGTZ_Success){
-          Message(ERROR)<<"Error generated while downloading event from board"
-                        <<i<<": "<<err<<"\n";
-          continue;
-        }
+      else{
+        readout.dest = buffer+data_transferred;
+        ReadBoard(i);
       }
-      
-      if(this_dl_size==0){
-        Message(ERROR)<<"0 bytes downloaded for board "<<i<<std::endl;
-        Message(DEBUG)<<"Events stored on this board: "
-                      <<ReadDigitizerRegister(VME_EventsStored, 
-                                              _handle_board[i])
-                      <<"\n";
-        uint32_t out;
-        out = ReadDigitizerRegister(VME_VMEStatus, _handle_board[i]);
-        Message(DEBUG)<<"VME status:"
-                      <<"\n\tBERR flag: "<< (out&4)
-                      <<"\n\tOutput buffer full: "<< (out&2)
-                      <<"\n\tData ready: "<< (out&1)<<"\n";
-        out = ReadDigitizerRegister(VME_AcquisitionStatus, 
-                                    _handle_board[i]);
-        Message(DEBUG)<<"Acquisition status:"
-                      <<"\n\tReady for acquisition: "<< (out&256)
-                      <<"\n\tPLL Status: "<< (out&128)
-                      <<"\n\tPLL Bypass: "<< (out&64)
-                      <<"\n\tClock source: "<< (out&32)
-                      <<"\n\tEvents full: "<< (out&16)
-                      <<"\n\tEvent ready: "<< (out&8)
-                      <<"\n\t Run on: "<< (out&4) <<"\n";
-        out = ReadDigitizerRegister(VME_EventSize, _handle_board[i]);
-        Message(DEBUG)<<"Next event size: "<<out<<"\n";
-        Message(DEBUG)<<"Expected event size "
-                      <<_params.board[i].event_size_bytes/4<<"\n";
-        
-        
-        //free the buffer so we don't re-trigger spuriously
-        WriteDigitizerRegister(VME_BufferFree,1, 
-                               _handle_board[i]);
-        Message(DEBUG)<<"Events stored on this board: "
-                      <<ReadDigitizerRegister(VME_EventsStored,_handle_board[i])
-                      <<"\n";
-        WriteDigitizerRegister(VME_BufferFree,2, 
-                               _handle_board[i]);
-        Message(DEBUG)<<"Events stored on this board: "
-                      <<ReadDigitizerRegister(VME_EventsStored,_handle_board[i])
-                      <<"\n";
-        Message(ERROR)<<"Boards don't usually recover from this error! "
-                      <<"Aborting!\n";
+      if(readout.status > 0)
+        continue;
+      if(readout.status < 0){
         _status = COMM_ERROR;
         _is_running = false;
         break;
       }
-      else{
-        
-        //this could ignore potential align64 extra bits:
-        //data_transferred += this_dl_size;
-        //instead, we check the actual event
-        long ev_size = (*((uint32_t*)(buffer+data_transferred)) & 
-                        0x0FFFFFFF) * sizeof(uint32_t);
-        if(std::abs(ev_size - (long)this_dl_size) > 5){
-          Message(WARNING)<<"Event size does not match download count!\n\t"
-                          <<"Event size: "<<ev_size<<"; download size: "
-                          <<this_dl_size<<"; requested download "
-                          <<_params.board[i].event_size_bytes<<std::endl;
-          Message(ERROR)<<"Boards don't usually recover from this error! "
-                        <<"Aborting!\n";
-          _status = COMM_ERROR;
-          _is_running = false;
-          break;
-        }
-        //check for event ID misalignment
-        uint32_t evct = (((uint32_t*)(buffer+data_transferred))[2])&0xFFFFFF;
-        if(event_counter == UNSET_EVENT_COUNTER)
-          event_counter = evct;
-        else if(evct != event_counter){
-          Message(CRITICAL)<<"Mismatched event ID on board "<<i
-                           <<"; received "<<evct<<", expected "<<event_counter
-                           <<"; Aboring run\n";
-          _status = GENERIC_ERROR;
-          _is_running=false;
-          break;
-        }
-        
-        if(_params.board[i].downsample_factor > 1){
-          DownsampleEvent(buffer+data_transferred, 
-                          _params.board[i].downsample_factor, ev_size, 
-                          _params.board[i].bytes_per_sample);
-          
-        }
-        
-        data_transferred += ev_size;
-        
+      //check for event ID misalignment
+      uint32_t evct = readout.counter;
+      if(event_counter == UNSET_EVENT_COUNTER)
+        event_counter = evct;
+      else if(evct != event_counter){
+        Message(CRITICAL)<<"Mismatched event ID on board "<<i
+                         <<"; received "<<evct<<", expected "<<event_counter
+                         <<"; Aboring run\n";
+        _status = GENERIC_ERROR;
+        _is_running=false;
+        break;
       }
+      data_transferred += readout.size;
     }
     if(GetStatus() != NORMAL){
       _is_running = false;
@@ -938,6 +1202,25 @@ void V172X_Daq::DataAcquisitionLoop()
       PostEvent(next_event);
     }    
   }//end while(_is_running)
+  if(parallel)
+    StopBoardReaders();
+  for(int i=0; i<_params.nboards; i++){
+    const board_readout& readout = _readout[i];
+    if(_params.board[i].enabled && readout.reads > 0){
+      Message(INFO)<<"Board "<<i<<" readout took "
+                   <<readout.total_us / readout.reads<<" us on average, "
+                   <<readout.max_us<<" us at most, over "<<readout.reads
+                   <<" transfers.\n";
+    }
+  }
+  size_t unmatched = 0;
+  for(int i=0; i<_params.nboards; i++){
+    unmatched += _pending[i].size();
+    _pending[i].clear();
+  }
+  if(unmatched > 0)
+    Message(WARNING)<<unmatched<<" board events without a match on the other "
+                    <<"boards were discarded at the end of the run.\n";
    //We only reach here once the event has stopped, so clean up any mess
   //First, end the run, and clear the buffers
   if(_params.send_start_pulse)
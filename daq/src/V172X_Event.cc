@@ -14,12 +14,15 @@ V172X_BoardData::V172X_BoardData(const unsigned char* const raw_data) :
   event_counter( *((uint32_t*)(raw_data+8)) & 0x00FFFFFF ),
   timestamp( *((uint32_t*)(raw_data+12)) & 0x7FFFFFFF ) 
 {
-  Message(DEBUG2)<<"V172X Event Header: \n"<<std::hex<<std::setfill('0')
-                 <<std::setw(8)<<((uint32_t*)(raw_data))[0]<<'\n'
-                 <<std::setw(8)<<((uint32_t*)(raw_data))[1]<<'\n'
-                 <<std::setw(8)<<((uint32_t*)(raw_data))[2]<<'\n'
-                 <<std::setw(8)<<((uint32_t*)(raw_data))[3]<<'\n'
-                 <<std::dec<<std::endl;
+  //building even an ignored message allocates, and this runs for every board
+  if(MessageHandler::GetInstance()->GetDefaultMessageThreshold() <= DEBUG2){
+    Message(DEBUG2)<<"V172X Event Header: \n"<<std::hex<<std::setfill('0')
+		   <<std::setw(8)<<((uint32_t*)(raw_data))[0]<<'\n'
+		   <<std::setw(8)<<((uint32_t*)(raw_data))[1]<<'\n'
+		   <<std::setw(8)<<((uint32_t*)(raw_data))[2]<<'\n'
+		   <<std::setw(8)<<((uint32_t*)(raw_data))[3]<<'\n'
+		   <<std::dec<<std::endl;
+  }
                         
   /*
   std::cerr<<std::hex;
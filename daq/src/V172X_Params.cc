@@ -150,6 +150,22 @@ V172X_Params::V172X_Params() : ParameterList("V172X_Params")
 		    "Maximum amount of memory we're allowed to use for the raw event buffer");
   RegisterParameter("no_low_mem_warn",no_low_mem_warn = false,
 		    "Should we suppress the warning generated when the raw event buffer is full?");
+  RegisterParameter("event_queue_depth", event_queue_depth = 100,
+		    "Maximum number of events waiting to be processed; the raw event buffer is also limited to max_mem_size bytes");
+  RegisterParameter("queue_spin_us", queue_spin_us = 50,
+		    "Microseconds to poll the raw event buffer before sleeping when it is full or empty");
+  RegisterParameter("pool_mem_size", pool_mem_size = 0,
+		    "Memory in bytes to reserve up front for event buffers, held for the whole run; 0 allocates each event separately");
+  RegisterParameter("pool_hugepages", pool_hugepages = false,
+		    "Try to back the event buffer pool with huge pages");
+  RegisterParameter("pool_mlock", pool_mlock = false,
+		    "Lock the event buffer pool in RAM; needs a large enough ulimit -l");
+  RegisterParameter("events_per_blt", events_per_blt = 1,
+		    "Maximum number of events to download from each board in a single block transfer");
+  RegisterParameter("irq_on_events", irq_on_events = 0,
+		    "Number of events each board stores before raising an interrupt (0 disables board interrupts)");
+  RegisterParameter("parallel_readout", parallel_readout = false,
+		    "Read out each board in its own thread; only useful when the boards are on separate optical links");
   RegisterParameter("send_start_pulse",send_start_pulse = false,
 		    "Do we tell the digitizers to wait to start the event until a synchornize pulse is sent (true), or start immediately (false)");
   RegisterParameter("auto_trigger", auto_trigger = false,
@@ -0,0 +1,153 @@
+/** @file codecbench.cc
+    @brief Compare speed and compression ratio of the raw datablock codecs
+    @author bloer
+*/
+
+#include "Reader.hh"
+#include "BlockCodec.hh"
+#include "ConfigHandler.hh"
+#include "CommandSwitchFunctions.hh"
+#include "Message.hh"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+
+/// Result of running one codec over the sample blocks
+struct BenchResult{
+  BlockCodec::CODEC codec;
+  int level;
+  double raw_bytes;
+  double encoded_bytes;
+  double encode_seconds;
+  double decode_seconds;
+  bool ok;
+};
+
+/// Encode and decode every block with the given codec and level
+BenchResult RunCodec(BlockCodec::CODEC codec, int level,
+		     const vector<vector<unsigned char> >& blocks, int repeat)
+{
+  typedef chrono::steady_clock clock;
+  BenchResult result = {codec, level, 0, 0, 0, 0, true};
+  vector<vector<unsigned char> > encoded(blocks.size());
+  vector<unsigned char> decoded;
+  for(int rep=0; rep < repeat; ++rep){
+    clock::time_point start = clock::now();
+    for(size_t i=0; i<blocks.size(); ++i){
+      encoded[i].resize(BlockCodec::GetMaxEncodedSize(codec,blocks[i].size()));
+      size_t len = encoded[i].size();
+      if(BlockCodec::Encode(codec, level, &(blocks[i][0]), blocks[i].size(),
+			    &(encoded[i][0]), len)){
+	result.ok = false;
+	return result;
+      }
+      encoded[i].resize(len);
+    }
+    clock::time_point mid = clock::now();
+    for(size_t i=0; i<blocks.size(); ++i){
+      decoded.resize(blocks[i].size());
+      size_t len = decoded.size();
+      if(BlockCodec::Decode(codec, &(encoded[i][0]), encoded[i].size(),
+			    &(decoded[0]), len) ||
+	 len != blocks[i].size() ||
+	 memcmp(&(decoded[0]), &(blocks[i][0]), len) != 0){
+	Message(ERROR)<<BlockCodec::GetName(codec)
+		      <<" did not reproduce block "<<i<<"\n";
+	result.ok = false;
+	return result;
+      }
+    }
+    clock::time_point end = clock::now();
+    result.encode_seconds += chrono::duration<double>(mid-start).count();
+    result.decode_seconds += chrono::duration<double>(end-mid).count();
+  }
+  for(size_t i=0; i<blocks.size(); ++i){
+    result.raw_bytes += blocks[i].size();
+    result.encoded_bytes += encoded[i].size();
+  }
+  result.raw_bytes *= repeat;
+  result.encoded_bytes *= repeat;
+  return result;
+}
+
+int main(int argc, char** argv)
+{
+  int max_events = 1000;
+  int repeat = 3;
+  int zlib_level = 1, zstd_level = 1;
+  ConfigHandler* config = ConfigHandler::GetInstance();
+  config->SetProgramUsageString("codecbench [options] <rawfile>");
+  config->AddCommandSwitch('n',"events","Load at most <n> events",
+			   CommandSwitch::DefaultRead<int>(max_events),"n");
+  config->AddCommandSwitch('r',"repeat","Run each codec <n> times",
+			   CommandSwitch::DefaultRead<int>(repeat),"n");
+  config->AddCommandSwitch(' ',"zlib-level","zlib compression level",
+			   CommandSwitch::DefaultRead<int>(zlib_level),"level");
+  config->AddCommandSwitch(' ',"zstd-level","zstd compression level",
+			   CommandSwitch::DefaultRead<int>(zstd_level),"level");
+  if(config->ProcessCommandLine(argc, argv))
+    return -1;
+  if(config->GetNCommandArgs() != 1){
+    config->PrintSwitches(true);
+    return 1;
+  }
+
+  //load the raw blocks into memory so disk speed doesn't enter
+  Reader reader(argv[1]);
+  if(!reader.IsOk())
+    return 1;
+  vector<vector<unsigned char> > blocks;
+  RawEventPtr raw;
+  int nevents = 0;
+  while(nevents < max_events && (raw = reader.GetNextEvent())){
+    for(size_t i=0; i<raw->GetNumDataBlocks(); ++i){
+      if(raw->GetDataBlockSize(i) == 0)
+	continue;
+      const unsigned char* data = raw->GetRawDataBlock(i);
+      blocks.push_back(vector<unsigned char>(data,
+					     data+raw->GetDataBlockSize(i)));
+    }
+    ++nevents;
+  }
+  if(blocks.empty()){
+    Message(ERROR)<<"No data blocks found in "<<argv[1]<<"\n";
+    return 1;
+  }
+  Message(INFO)<<"Loaded "<<blocks.size()<<" blocks from "<<nevents
+	       <<" events.\n";
+
+  vector<BenchResult> results;
+  BlockCodec::CODEC codecs[] = { BlockCodec::STORED, BlockCodec::ZLIB,
+				 BlockCodec::LZ4, BlockCodec::ZSTD,
+				 BlockCodec::V172X };
+  for(size_t i=0; i < sizeof(codecs)/sizeof(codecs[0]); ++i){
+    if(!BlockCodec::IsAvailable(codecs[i])){
+      Message(INFO)<<BlockCodec::GetName(codecs[i])
+		   <<" is not compiled in; skipping.\n";
+      continue;
+    }
+    int level = (codecs[i] == BlockCodec::ZSTD ? zstd_level : zlib_level);
+    results.push_back(RunCodec(codecs[i], level, blocks, repeat));
+  }
+
+  cout<<setw(8)<<"codec"<<setw(7)<<"level"<<setw(9)<<"ratio"
+      <<setw(14)<<"encode MB/s"<<setw(14)<<"decode MB/s"<<endl;
+  for(size_t i=0; i<results.size(); ++i){
+    const BenchResult& res = results[i];
+    cout<<setw(8)<<BlockCodec::GetName(res.codec)<<setw(7)<<res.level;
+    if(!res.ok){
+      cout<<"   FAILED"<<endl;
+      continue;
+    }
+    cout<<fixed<<setprecision(3)
+	<<setw(9)<<res.raw_bytes / res.encoded_bytes
+	<<setprecision(1)
+	<<setw(14)<<res.raw_bytes / 1.e6 / res.encode_seconds
+	<<setw(14)<<res.raw_bytes / 1.e6 / res.decode_seconds<<endl;
+  }
+  return 0;
+}
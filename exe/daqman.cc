@@ -10,7 +10,11 @@
  *  @ingroup daqman
  */
 
+#ifndef NO_CAEN
 #include "V172X_Daq.hh"
+#endif
+#include "SimulatedV172X_Daq.hh"
+#include "ReplayDaq.hh"
 #include "V172X_Event.hh"
 #include "ConfigHandler.hh"
 #include "CommandSwitchFunctions.hh"
@@ -105,7 +109,8 @@ int main(int argc, char** argv)
   std::vector<AsyncEventHandler*> async_threads;
   
   //All analyzing modules run on a single asynchronous thread
-  AsyncEventHandler thread1;
+  AsyncEventHandler thread1("analysis_thread");
+  modules->RegisterParameter(thread1.GetDefaultKey(), thread1);
   modules->AddAsyncReceiver(&thread1);
   thread1.AddModule(new ConvertData);
   thread1.AddModule(new SumChannels);
@@ -116,7 +121,8 @@ int main(int argc, char** argv)
   // any more advanced functions?
   
   //ProcessedPlotter and RootGraphix share a thread and refresh speed
-  AsyncEventHandler thread2;
+  AsyncEventHandler thread2("graphics_thread");
+  modules->RegisterParameter(thread2.GetDefaultKey(), thread2);
   //add RootGraphix first so dependencies pass, but call afterward...
   RootGraphix* rootgraphix = new RootGraphix;
   modules->AddModule(rootgraphix, false, true);
@@ -128,7 +134,8 @@ int main(int argc, char** argv)
   async_threads.push_back(&thread2);
 
   //PSDs gets it's own thread, disabled by default
-  AsyncEventHandler thread4;
+  AsyncEventHandler thread4("psd_thread");
+  modules->RegisterParameter(thread4.GetDefaultKey(), thread4);
   thread1.AddReceiver(&thread4);
   AveragePSD* psd = new AveragePSD;
   psd->enabled = false;
@@ -155,7 +162,11 @@ int main(int argc, char** argv)
   runinfo* info = modules->GetRunInfo();
   std::string testmode_file="";
   int testmode_dt = 0;
+  int testmode_prefetch = 0;
   int graphics_refresh = 1;
+  bool simulate = false;
+  std::string replay_file="";
+  double replay_speed = 1;
   config->AddCommandSwitch('i', "info", "Set run database info to <info>",
 			   CommandSwitch::DefaultRead<runinfo>(*info),
 			   "info");
@@ -179,6 +190,19 @@ int main(int argc, char** argv)
 			   (testmode_file) ,"file");
   config->AddCommandSwitch(' ',"testmode-dt","Sleep <N> ms between each event",
 			   CommandSwitch::DefaultRead<int>(testmode_dt),"N");
+  config->AddCommandSwitch(' ',"testmode-prefetch",
+			   "Read up to <N> testmode or replay events ahead in background",
+			   CommandSwitch::DefaultRead<int>(testmode_prefetch),"N");
+  config->AddCommandSwitch(' ',"simulate",
+			   "Generate fake digitizer data instead of reading the boards",
+			   CommandSwitch::SetValue<bool>(simulate, true));
+  config->AddCommandSwitch(' ',"replay",
+			   "Replay <file> through the DAQ at its recorded pace",
+			   CommandSwitch::DefaultRead<std::string>
+			   (replay_file), "file");
+  config->AddCommandSwitch(' ',"replay-speed",
+			   "Replay at <x> times the recorded rate, 0 for max",
+			   CommandSwitch::DefaultRead<double>(replay_speed),"x");
   config->AddCommandSwitch(' ',"stat-time","Print stats every <secs> seconds",
 			   CommandSwitch::DefaultRead<int>(stattime),"secs");
   config->AddCommandSwitch(' ',"refresh","Time in s between graphics update",
@@ -193,7 +217,17 @@ int main(int argc, char** argv)
   config->RegisterParameter("stat-time",stattime,
 			    "Time between printing of event/data rates");
   config->RegisterReadFunction("require_comment",DeprecatedParameter<bool>());
-  V172X_Daq daq;
+#ifndef NO_CAEN
+  V172X_Daq hardware;
+  V172X_Params* params = hardware.GetParameters();
+#else
+  //no digitizer library, but we still need the board setup to simulate
+  V172X_Params board_params;
+  V172X_Params* params = &board_params;
+  config->RegisterParameter(params->GetDefaultKey(), *params);
+#endif
+  SimulatedV172X_Daq simdaq(params);
+  ReplayDaq replay(params);
     
   config->SetProgramUsageString("daqman [options]");
   config->SetDefaultCfgFile("daqman.cfg");
@@ -206,7 +240,22 @@ int main(int argc, char** argv)
     config->PrintSwitches(true);
   }
   
-  AsyncEventHandler thread3;
+  replay.SetFilename(replay_file);
+  replay.SetSpeed(replay_speed);
+  replay.SetPrefetch(testmode_prefetch);
+#ifndef NO_CAEN
+  BaseDaq& daq = replay_file != "" ? (BaseDaq&)replay : 
+    simulate ? (BaseDaq&)simdaq : (BaseDaq&)hardware;
+#else
+  if(!simulate && testmode_file == "" && replay_file == ""){
+    Message(ERROR)<<"daqman was built without the CAEN libraries; "
+		  <<"use --simulate, --replay, or --testmode."<<std::endl;
+    return 1;
+  }
+  BaseDaq& daq = replay_file != "" ? (BaseDaq&)replay : (BaseDaq&)simdaq;
+#endif
+  
+  AsyncEventHandler thread3("spectra_thread");
   if(spectra.size() > 0){
     //for right now, put the spectra all on one thread
     thread1.AddReceiver(&thread3);
@@ -239,6 +288,8 @@ int main(int argc, char** argv)
 		    <<testmode_file<<".\n";
       return 1;
     }
+    if(testmode_prefetch > 0)
+      reader->EnablePrefetch(testmode_prefetch);
   }
   if(!reader){
     Message(INFO)<<"Initializing DAQ...\n";
@@ -317,6 +368,11 @@ int main(int argc, char** argv)
 	    stop_run = true;
 	    break;
 	  }
+	  else if(replay.IsFinished() && !daq.GetEventsReady()){
+	    Message(INFO)<<"Reached end of file, ending replay.\n";
+	    stop_run = true;
+	    break;
+	  }
 	  else if(daq.GetStatus() != BaseDaq::NORMAL){
 	    Message(ERROR)<<"An error occurred while getting next event.\n";
 	    Message(ERROR)<<"Attempting to abort run...\n";
@@ -340,6 +396,10 @@ int main(int argc, char** argv)
 	stats.bytes_processed += evt->GetDataSize();
 	if(stattime>0 && time(0)-stats.last_print_time >= stattime){
 	  Message(INFO)<<stats<<std::endl;
+	  if(ModuleTimer::IsEnabled()){
+	    Message m(INFO);
+	    modules->PrintModuleTimes(m<<"Time spent in each module so far:\n");
+	  }
 	  stats.Clear();
 	}
       }
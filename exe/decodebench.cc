@@ -0,0 +1,175 @@
+/** @file decodebench.cc
+    @brief Compare the speed of the SampleDecoder versions for each format
+    @author bloer
+*/
+
+#include "SampleDecoder.hh"
+#include "ConfigHandler.hh"
+#include "CommandSwitchFunctions.hh"
+#include "Message.hh"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+/// A raw channel in one of the V172X formats
+struct RawFormat{
+  string name;
+  int sample_bits;
+  bool zle;
+  vector<uint32_t> words;
+};
+
+/// A baseline with noise and the occasional negative pulse
+static uint32_t NextSample(int sample_bits, int i)
+{
+  const int range = (1<<sample_bits) - 1;
+  int samp = range*4/5 + rand()%7 - 3;
+  if(i%1000 < 20)
+    samp -= (range/2) * (20 - i%1000) / 20;
+  return (samp < 0 ? 0 : samp);
+}
+
+/// Generate <nsamps> samples in the given format
+static RawFormat MakeFormat(const string& name, int sample_bits, bool zle,
+			    int nsamps)
+{
+  RawFormat format;
+  format.name = name;
+  format.sample_bits = sample_bits;
+  format.zle = zle;
+  if(sample_bits == 10){
+    for(int i=0; i<nsamps; i+=3){
+      uint32_t word = 3u<<30;
+      for(int j=0; j<3; ++j)
+	word |= NextSample(sample_bits, i+j) << (10*j);
+      format.words.push_back(word);
+    }
+    return format;
+  }
+  const int per_word = (sample_bits < 9 ? 4 : 2);
+  vector<uint32_t> samples;
+  for(int i=0; i<nsamps; i+=per_word){
+    uint32_t word = 0;
+    for(int j=0; j<per_word; ++j)
+      word |= NextSample(sample_bits, i+j) << (32/per_word*j);
+    samples.push_back(word);
+  }
+  if(!zle){
+    format.words = samples;
+    return format;
+  }
+  //keep 100 words around each pulse, skip the rest
+  format.words.push_back(0);
+  const uint32_t block = 1000/per_word;
+  for(size_t start=0; start<samples.size(); start+=block){
+    size_t good = min<size_t>(100, samples.size()-start);
+    format.words.push_back(0x80000000 | good);
+    format.words.insert(format.words.end(), samples.begin()+start,
+			samples.begin()+start+good);
+    if(samples.size()-start > good)
+      format.words.push_back(min<size_t>(block, samples.size()-start) - good);
+  }
+  format.words[0] = format.words.size();
+  return format;
+}
+
+/// Decode the format <repeat> times; return the samples per second
+static double RunFormat(const RawFormat& format, int repeat,
+			vector<sample_t>& wave, SampleDecoder::Extremes& ext)
+{
+  typedef chrono::steady_clock clock;
+  const char* start = (const char*)&(format.words[0]);
+  const char* end = start + 4*format.words.size();
+  const double range = (1<<format.sample_bits) - 1;
+  const int per_word = (format.sample_bits < 9 ? 4 : 2);
+  vector<pair<int,int> > regions;
+  int nsamps = 0;
+  clock::time_point begin = clock::now();
+  for(int rep=0; rep<repeat; ++rep){
+    if(format.zle){
+      nsamps = SampleDecoder::DecodeZLE(start, format.sample_bits, per_word,
+					true, range, wave, regions, &ext);
+    }
+    else{
+      wave.resize(SampleDecoder::CountSamples(start, end,
+					      format.sample_bits));
+      nsamps = SampleDecoder::Decode(start, end, format.sample_bits, true,
+				     range, &(wave[0]), &ext);
+    }
+  }
+  double seconds = chrono::duration<double>(clock::now()-begin).count();
+  return 1.*nsamps*repeat / seconds;
+}
+
+int main(int argc, char** argv)
+{
+  int nsamps = 100000;
+  int repeat = 1000;
+  ConfigHandler* config = ConfigHandler::GetInstance();
+  config->SetProgramUsageString("decodebench [options]");
+  config->AddCommandSwitch('n',"samples","Samples per channel",
+			   CommandSwitch::DefaultRead<int>(nsamps),"n");
+  config->AddCommandSwitch('r',"repeat","Decode each channel <n> times",
+			   CommandSwitch::DefaultRead<int>(repeat),"n");
+  if(config->ProcessCommandLine(argc, argv))
+    return -1;
+  if(config->GetNCommandArgs() != 0 || nsamps < 1 || repeat < 1){
+    config->PrintSwitches(true);
+    return 1;
+  }
+
+  vector<RawFormat> formats;
+  formats.push_back(MakeFormat("8-bit", 8, false, nsamps));
+  formats.push_back(MakeFormat("10-bit", 10, false, nsamps));
+  formats.push_back(MakeFormat("12-bit", 12, false, nsamps));
+  formats.push_back(MakeFormat("14-bit", 14, false, nsamps));
+  formats.push_back(MakeFormat("8-bit ZLE", 8, true, nsamps));
+  formats.push_back(MakeFormat("12-bit ZLE", 12, true, nsamps));
+
+  const SampleDecoder::INSTRUCTION_SET best =
+    SampleDecoder::GetBestInstructionSet();
+  Message(INFO)<<"Best instruction set on this machine is "<<best<<".\n";
+  cout<<setw(12)<<"format"<<setw(8)<<"set"<<setw(14)<<"Msamples/s"
+      <<setw(10)<<"speedup"<<endl;
+  int failed = 0;
+  for(size_t i=0; i<formats.size(); ++i){
+    //the plain loop gives the right answer for the others
+    vector<sample_t> scalar_wave, wave;
+    SampleDecoder::Extremes scalar_ext, ext;
+    double scalar_rate = 0;
+    for(int set = SampleDecoder::SCALAR; set <= best; ++set){
+      SampleDecoder::SetInstructionSet(SampleDecoder::INSTRUCTION_SET(set));
+      double rate = RunFormat(formats[i], repeat, wave, ext);
+      bool ok = true;
+      if(set == SampleDecoder::SCALAR){
+	scalar_rate = rate;
+	scalar_wave = wave;
+	scalar_ext = ext;
+      }
+      else{
+	ok = (wave == scalar_wave &&
+	      ext.max_index == scalar_ext.max_index &&
+	      ext.min_index == scalar_ext.min_index &&
+	      ext.max == scalar_ext.max && ext.min == scalar_ext.min);
+      }
+      cout<<setw(12)<<formats[i].name
+	  <<setw(8)<<SampleDecoder::INSTRUCTION_SET(set);
+      if(!ok){
+	cout<<"   FAILED"<<endl;
+	++failed;
+	continue;
+      }
+      cout<<fixed<<setprecision(1)
+	  <<setw(14)<<rate / 1.e6
+	  <<setprecision(2)
+	  <<setw(10)<<rate / scalar_rate<<endl;
+    }
+  }
+  SampleDecoder::SetInstructionSet(best);
+  return failed;
+}
@@ -0,0 +1,221 @@
+/** @file fusecheck.cc
+    @brief Check that BaselineFinder's fuse_downstream pass gives the same
+    results as running Integrator and EvalRois separately
+    @author bloer
+*/
+
+#include "EventHandler.hh"
+#include "BaselineFinder.hh"
+#include "Integrator.hh"
+#include "EvalRois.hh"
+#include "RawEvent.hh"
+#include "ConfigHandler.hh"
+#include "CommandSwitchFunctions.hh"
+#include "Message.hh"
+#include <vector>
+#include <sstream>
+#include <cstring>
+
+using namespace std;
+
+/// Samples in each synthetic channel, enough for several fused blocks
+static const int nsamps = 3000;
+/// Sample of the trigger in each channel
+static const int trigger_index = 500;
+
+/** @class SyntheticChannels
+    @brief Stands in for ConvertData, filling each event with made-up
+    channels.  The last channel never has a flat stretch, so no baseline
+    can be found on it.
+*/
+class SyntheticChannels : public BaseModule{
+public:
+  SyntheticChannels() : BaseModule("ConvertData", "Make up channels") {}
+  int Initialize(){ return 0; }
+  int Finalize(){ return 0; }
+  int Process(EventPtr event)
+  {
+    EventDataPtr data = event->GetEventData();
+    const int id = event->GetRawEvent()->GetID();
+    data->event_id = id;
+    data->ClearChannels();
+    for(int ch=0; ch<5; ch++){
+      ChannelData& chdata = data->AddChannel();
+      chdata.channel_id = ch;
+      chdata.channel_num = ch;
+      chdata.sample_bits = 12;
+      chdata.sample_rate = 250;
+      chdata.trigger_index = trigger_index;
+      chdata.nsamps = nsamps;
+      chdata.spe_mean = 1. + ch;
+      chdata.waveform.resize(nsamps);
+      for(int samp=0; samp<nsamps; samp++){
+	double val = 3000 + (samp*7 + ch*3 + id) % 3 - 1;
+	if(ch == 4){
+	  //jump around too much for any baseline
+	  val -= (samp%2 ? 0 : 60);
+	}
+	else{
+	  //a pulse after the trigger, and a smaller one later on
+	  int peak = trigger_index + 20 + (id*13 + ch*29) % 100;
+	  if(samp >= peak && samp < peak + 200)
+	    val -= (400. + ch*50) * (peak + 200 - samp) / 200.;
+	  if(samp >= 2100 && samp < 2130)
+	    val -= 30;
+	}
+	chdata.waveform[samp] = val;
+      }
+    }
+    return 0;
+  }
+};
+
+/** @class ChannelRecorder
+    @brief Keep a copy of every channel once all the modules have run
+*/
+class ChannelRecorder : public BaseModule{
+public:
+  ChannelRecorder() : BaseModule("ChannelRecorder", "Copy the channels")
+  {
+    AddDependency<EvalRois>();
+    AddDependency<Integrator>();
+  }
+  int Initialize(){ channels.clear(); return 0; }
+  int Finalize(){ return 0; }
+  int Process(EventPtr event)
+  {
+    const vector<ChannelData>& chans = event->GetEventData()->channels;
+    channels.insert(channels.end(), chans.begin(), chans.end());
+    return 0;
+  }
+  vector<ChannelData> channels;
+};
+
+/// Compare bit for bit, so that a NaN matches itself
+static bool SameBits(double a, double b)
+{
+  return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+/// Count the results of the modules that differ between <a> and <b>
+static int CountDifferences(const ChannelData& a, const ChannelData& b)
+{
+  int diffs = 0;
+  if(a.baseline.found_baseline != b.baseline.found_baseline)
+    diffs++;
+  if(a.integral.size() != b.integral.size())
+    diffs++;
+  else{
+    for(size_t samp=0; samp<a.integral.size(); samp++){
+      if(!SameBits(a.integral[samp], b.integral[samp]))
+	diffs++;
+    }
+  }
+  if(a.integral_max_index != b.integral_max_index ||
+     a.integral_min_index != b.integral_min_index ||
+     !SameBits(a.integral_max, b.integral_max) ||
+     !SameBits(a.integral_min, b.integral_min))
+    diffs++;
+  if(a.regions.size() != b.regions.size())
+    diffs++;
+  else{
+    for(size_t i=0; i<a.regions.size(); i++){
+      const Roi& ra = a.regions[i];
+      const Roi& rb = b.regions[i];
+      if(ra.start_index != rb.start_index || ra.end_index != rb.end_index ||
+	 ra.min_index != rb.min_index || !SameBits(ra.max, rb.max) ||
+	 !SameBits(ra.min, rb.min) || !SameBits(ra.integral, rb.integral) ||
+	 !SameBits(ra.npe, rb.npe))
+	diffs++;
+    }
+  }
+  return diffs;
+}
+
+/// Process <nevents> events and leave the channels in the recorder
+static int RunEvents(EventHandler* handler, int nevents)
+{
+  if(handler->Initialize()){
+    Message(ERROR)<<"Unable to initialize the modules.\n";
+    return 1;
+  }
+  int failed = 0;
+  for(int i=0; i<nevents; i++){
+    RawEventPtr raw(new RawEvent);
+    raw->SetID(i);
+    failed += handler->Process(raw);
+  }
+  return failed + handler->Finalize();
+}
+
+int main(int argc, char** argv)
+{
+  int nevents = 100;
+  ConfigHandler* config = ConfigHandler::GetInstance();
+  config->SetProgramUsageString("fusecheck [options]");
+  config->AddCommandSwitch('n',"events","Process <n> events per setting",
+			   CommandSwitch::DefaultRead<int>(nevents),"n");
+
+  EventHandler* handler = EventHandler::GetInstance();
+  handler->AllowDatabaseAccess(false);
+  handler->AddModule(new SyntheticChannels);
+  BaselineFinder* baseline = handler->AddModule<BaselineFinder>();
+  handler->AddModule<Integrator>();
+  EvalRois* rois = handler->AddModule<EvalRois>();
+  ChannelRecorder* recorder = new ChannelRecorder;
+  handler->AddModule(recorder);
+
+  if(config->ProcessCommandLine(argc, argv))
+    return -1;
+  if(config->GetNCommandArgs() != 0 || nevents < 1){
+    config->PrintSwitches(true);
+    return 1;
+  }
+  std::istringstream regions("[ ( -1 , 1 ) ( -0.5 , 4 ) ( 6 , 7 ) ]");
+  rois->GetParameter("regions")->ReadFrom(regions);
+
+  int failed = 0;
+  for(int fixed=0; fixed<2; fixed++){
+    baseline->fixed_baseline = fixed;
+    const char* mode = (fixed ? "fixed" : "drifting");
+    baseline->fuse_downstream = false;
+    failed += RunEvents(handler, nevents);
+    vector<ChannelData> separate;
+    separate.swap(recorder->channels);
+    baseline->fuse_downstream = true;
+    failed += RunEvents(handler, nevents);
+    const vector<ChannelData>& fused = recorder->channels;
+
+    if(fused.size() != separate.size()){
+      Message(ERROR)<<"Got "<<fused.size()<<" fused channels but "
+		    <<separate.size()<<" separate ones with the "<<mode
+		    <<" baseline.\n";
+      failed++;
+      continue;
+    }
+    int differ = 0, no_baseline = 0;
+    for(size_t i=0; i<fused.size(); i++){
+      if(CountDifferences(fused[i], separate[i]))
+	differ++;
+      if(!separate[i].baseline.found_baseline)
+	no_baseline++;
+    }
+    if(no_baseline == 0 || no_baseline == (int)fused.size()){
+      Message(ERROR)<<"Expected channels both with and without a baseline; "
+		    <<no_baseline<<" of "<<fused.size()<<" have none with the "
+		    <<mode<<" baseline.\n";
+      failed++;
+    }
+    if(differ){
+      Message(ERROR)<<differ<<" of "<<fused.size()<<" channels differ "
+		    <<"between the fused and separate modules with the "
+		    <<mode<<" baseline.\n";
+      failed++;
+    }
+    else{
+      Message(INFO)<<"All "<<fused.size()<<" channels match with the "
+		   <<mode<<" baseline, "<<no_baseline<<" without one.\n";
+    }
+  }
+  return failed;
+}
@@ -45,7 +45,8 @@ void SetOutputFile(RootWriter* writer, const char* inputfile){
 }
 
 /// Fully process a single raw data file
-int ProcessOneFile(const char* filename, std::string event_file, int max_event=-1, int min_event=0)
+int ProcessOneFile(const char* filename, std::string event_file, int max_event=-1, int min_event=0,
+		   int prefetch=0, int prefetch_threads=2)
 {
   Message(INFO)<<"\n***************************************\n"
 	       <<"  Processing File "<<filename
@@ -54,6 +55,8 @@ int ProcessOneFile(const char* filename, std::string event_file, int max_event=-
   Reader reader(filename);
   if(!reader.IsOk())
     return 2;
+  if(prefetch > 0 && reader.EnablePrefetch(prefetch, prefetch_threads))
+    return 2;
   if(modules->Initialize()){
     Message(ERROR)<<"Unable to initialize all modules.\n";
     return 1;
@@ -64,6 +67,7 @@ int ProcessOneFile(const char* filename, std::string event_file, int max_event=-
   RawEventPtr raw;
   
   //if the first event is not 0, read it to get start of run info
+  //only the sequential part of ConvertData cares about earlier events
   if(min_event != 0){
     ConvertData* converter = modules->GetModule<ConvertData>();
     if(converter){ 
@@ -74,7 +78,7 @@ int ProcessOneFile(const char* filename, std::string event_file, int max_event=-
 	return 1;
       }
       EventPtr evt(new Event(raw));
-      converter->Process(evt);
+      converter->Prologue(evt);
       //if the first event is not 1, read the event immediately before to get dt
       if(min_event > 1){
 	raw = reader.GetEventWithID(min_event-1);
@@ -84,7 +88,7 @@ int ProcessOneFile(const char* filename, std::string event_file, int max_event=-
 	  return 1;
 	}
 	evt.reset(new Event(raw));
-	converter->Process(evt);
+	converter->Prologue(evt);
       }
     }
   }
@@ -124,7 +128,7 @@ int ProcessOneFile(const char* filename, std::string event_file, int max_event=-
   }
   int evtnum = 0;
   while(raw){
-    if(max_event > 0 && raw->GetID() >= (uint32_t)max_event) 
+    if(max_event > 0 && raw->GetID() > (uint32_t)max_event) 
       break;
     //Message(DEBUG)<<"*************Event "<<evtnum<<"**************\n";
     if(evtnum%5000 == 0 && !use_elist)
@@ -159,12 +163,16 @@ int ProcessOneFile(const char* filename, std::string event_file, int max_event=-
   modules->Finalize();
   Message(INFO)<<"Processed "<<evtnum<<" events in "
 	       <<time(0) - start_time<<" seconds. \n";
+  if(reader.IsPrefetchEnabled())
+    Message(INFO)<<"Waited for the prefetch queue "<<reader.GetPrefetchStalls()
+		 <<" times.\n";
   return 0;
 }
 
 int main(int argc, char** argv)
 {
   int max_event=-1, min_event = 0;
+  int prefetch = 0, prefetch_threads = 2;
   ConfigHandler* config = ConfigHandler::GetInstance();
   config->SetProgramUsageString("genroot [options] <file1> [<file2>, ... ]");
   config->AddCommandSwitch(' ',"max","last event to process",
@@ -177,6 +185,14 @@ int main(int argc, char** argv)
   config->AddCommandSwitch(' ',"event-list","read events to process from <file>",
                            CommandSwitch::DefaultRead<std::string>(event_file),
                            "file");
+  config->AddCommandSwitch(' ',"prefetch",
+			   "read up to <n> events ahead on background threads",
+			   CommandSwitch::DefaultRead<int>(prefetch),
+			   "n");
+  config->AddCommandSwitch(' ',"prefetch-threads",
+			   "use <n> threads to decompress prefetched events",
+			   CommandSwitch::DefaultRead<int>(prefetch_threads),
+			   "n");
   
   EventHandler* modules = EventHandler::GetInstance();
   modules->AddCommonModules();
@@ -198,7 +214,8 @@ int main(int argc, char** argv)
     if(i > 1)
       writer->SetFilename(writer->GetDefaultFilename());
     SetOutputFile(writer, argv[i] );
-    if(ProcessOneFile(argv[i], event_file, max_event, min_event)){
+    if(ProcessOneFile(argv[i], event_file, max_event, min_event,
+		      prefetch, prefetch_threads)){
       Message(ERROR)<<"Error processing file "<<argv[i]<<"; aborting.\n";
       return 1;
     }
@@ -0,0 +1,101 @@
+/** @file poolcheck.cc
+    @brief Check that events recycled by the EventHandler give back the
+    buffers the DAQ lent their raw events
+    @author bloer
+*/
+
+#include "EventHandler.hh"
+#include "RawEvent.hh"
+#include "BufferPool.hh"
+#include "ConfigHandler.hh"
+#include "CommandSwitchFunctions.hh"
+#include "Message.hh"
+#include <vector>
+#include <cstring>
+
+using namespace std;
+
+/// Size of the buffers lent to the raw events
+static const size_t buffer_size = 4096;
+
+/// Build an event viewing a buffer from <buffers> and process it
+static int ProcessLent(EventHandler* handler, BufferPool& buffers, int id)
+{
+  shared_ptr<void> owner;
+  unsigned char* data = buffers.Borrow(owner);
+  if(!data){
+    Message(ERROR)<<"No buffer free for event "<<id<<"; "
+		  <<buffers.GetInUse()<<" are still held.\n";
+    return 1;
+  }
+  memset(data, 0, buffer_size);
+  RawEventPtr raw(new RawEvent);
+  raw->SetID(id);
+  raw->AddDataBlockView(RawEvent::CAEN_V172X, data, buffer_size, owner);
+  return handler->Process(raw);
+}
+
+int main(int argc, char** argv)
+{
+  int nevents = 1000;
+  int nkept = 8;
+  ConfigHandler* config = ConfigHandler::GetInstance();
+  config->SetProgramUsageString("poolcheck [options]");
+  config->AddCommandSwitch('n',"events","Process <n> events",
+			   CommandSwitch::DefaultRead<int>(nevents),"n");
+  config->AddCommandSwitch('k',"kept",
+			   "First keep <n> events alive at once to fill the "
+			   "event pool",
+			   CommandSwitch::DefaultRead<int>(nkept),"n");
+  if(config->ProcessCommandLine(argc, argv))
+    return -1;
+  if(config->GetNCommandArgs() != 0 || nevents < 1 || nkept < 1){
+    config->PrintSwitches(true);
+    return 1;
+  }
+
+  BufferPool buffers;
+  if(buffers.Allocate(buffer_size, (nkept+2)*buffer_size)){
+    Message(ERROR)<<"Unable to allocate the buffer pool.\n";
+    return 1;
+  }
+  EventHandler* handler = EventHandler::GetInstance();
+  handler->AllowDatabaseAccess(false);
+  if(handler->Initialize()){
+    Message(ERROR)<<"Unable to initialize the EventHandler.\n";
+    return 1;
+  }
+
+  int failed = 0;
+  //hold on to a burst of events, as a slow consumer would, so the pool
+  //has to make more of them
+  vector<EventPtr> kept;
+  for(int i=0; i<nkept && !failed; ++i){
+    failed += ProcessLent(handler, buffers, i);
+    kept.push_back(handler->GetCurrentEvent());
+  }
+  kept.clear();
+
+  //now only the current event and the one just finished may hold a buffer
+  size_t most_held = 0;
+  for(int i=nkept; i<nkept+nevents && !failed; ++i){
+    failed += ProcessLent(handler, buffers, i);
+    if(buffers.GetInUse() > most_held)
+      most_held = buffers.GetInUse();
+  }
+  if(most_held > 2){
+    Message(ERROR)<<most_held<<" buffers were held between events; "
+		  <<"idle events keep their raw data.\n";
+    ++failed;
+  }
+  failed += handler->Finalize();
+  if(buffers.GetInUse() != 0){
+    Message(ERROR)<<buffers.GetInUse()<<" of "<<buffers.GetNBuffers()
+		  <<" buffers did not come back after the run.\n";
+    ++failed;
+  }
+  if(!failed)
+    Message(INFO)<<"All "<<buffers.GetNBuffers()<<" buffers came back; "
+		 <<"at most "<<most_held<<" were held between events.\n";
+  return failed;
+}
@@ -0,0 +1,182 @@
+/** @file rawskim.cc
+    @brief Copy a subset of events to a new raw file without inflating them
+    @author bloer
+*/
+
+#include "Reader.hh"
+#include "RawWriter.hh"
+#include "ConfigHandler.hh"
+#include "CommandSwitchFunctions.hh"
+#include "EventHandler.hh"
+#include <time.h>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+/// Determine the filename of the output file
+void SetOutputFile(RawWriter* writer, const char* inputfile){
+ if( writer->GetFilename() == writer->GetDefaultFilename() ){
+    //set the filename to be the input filename + _skim
+    std::string fname(inputfile);
+    //remove leading directories
+    if(fname.rfind('/') != std::string::npos){
+      fname = fname.substr(fname.rfind('/')+1);
+    }
+    //remove filename suffix
+    fname = fname.substr(0, fname.find('.'));
+    fname.append("_skim.out");
+    writer->SetFilename(fname);
+  }
+}
+
+/// Copy the configuration saved with the input run next to the skim, so the
+/// skim can be processed like the original
+int CopyConfigFile(RawWriter* writer)
+{
+  const std::string& source = ConfigHandler::GetInstance()->GetSavedCfgFile();
+  if(source == ""){
+    Message(WARNING)<<"No saved configuration for the input file; "
+		    <<"the skim can't be converted without one!\n";
+    return 0;
+  }
+  std::string dest = writer->GetConfigFilename();
+  std::ifstream fin(source.c_str(), std::ios::binary);
+  std::ofstream fout(dest.c_str(), std::ios::binary);
+  if(!fin.is_open() || !fout.is_open() || !(fout<<fin.rdbuf())){
+    Message(ERROR)<<"Unable to copy configuration "<<source<<" to "
+		  <<dest<<"\n";
+    return 1;
+  }
+  Message(DEBUG)<<"Copied configuration "<<source<<" to "<<dest<<"\n";
+  return 0;
+}
+
+/// Copy the events with ids in [min_event, max_event] or in the list
+int SkimFile(const char* filename, RawWriter* writer,
+	     const std::string& event_file, int max_event, int min_event)
+{
+  EventHandler* modules = EventHandler::GetInstance();
+  modules->AllowDatabaseAccess(false);
+  Reader reader(filename);
+  if(!reader.IsOk())
+    return 1;
+
+  std::vector<uint32_t> event_list;
+  if(event_file != ""){
+    std::ifstream eventlist(event_file.c_str());
+    if(!eventlist.is_open()){
+      Message(ERROR)<<"Unable to open event-list file "<<event_file<<"\n";
+      return 1;
+    }
+    uint32_t id;
+    while(eventlist>>id){
+      if((int)id >= min_event && (max_event < 0 || (int)id <= max_event))
+	event_list.push_back(id);
+    }
+    std::sort(event_list.begin(), event_list.end());
+    event_list.erase(std::unique(event_list.begin(), event_list.end()),
+		     event_list.end());
+    if(event_list.empty()){
+      Message(INFO)<<"No events to copy!\n";
+      return 1;
+    }
+  }
+
+  if(modules->Initialize()){
+    Message(ERROR)<<"Unable to initialize all modules.\n";
+    return 1;
+  }
+
+  time_t start_time = time(0);
+  std::vector<char> buf;
+  long nevents = 0, nbytes = 0;
+  int err = 0;
+  if(!event_list.empty()){
+    for(size_t i=0; i<event_list.size() && !err; ++i){
+      if(reader.GetCompressedEventWithID(event_list[i], buf)){
+	Message(WARNING)<<"Skipping missing event "<<event_list[i]<<"\n";
+	continue;
+      }
+      if((err = writer->WriteCompressedEvent(buf))){
+	Message(ERROR)<<"Unable to write event "<<event_list[i]<<"\n";
+	break;
+      }
+      ++nevents;
+      nbytes += buf.size();
+    }
+  }
+  else{
+    bool more = !(min_event > 0 ? 
+		  reader.GetCompressedEventWithID(min_event, buf) :
+		  reader.GetNextCompressedEvent(buf));
+    if(!more){
+      Message(ERROR)<<"Unable to read event "<<min_event<<"\n";
+      err = 1;
+    }
+    while(more){
+      const Reader::event_header* ehead =
+	(const Reader::event_header*)(&buf[0]);
+      //event ids increase through a run, so stop at the first past max
+      if(max_event >= 0 && ehead->event_id > (uint32_t)max_event)
+	break;
+      if(nevents%5000 == 0)
+	Message(INFO)<<"Copying event "<<ehead->event_id<<std::endl;
+      if((err = writer->WriteCompressedEvent(buf))){
+	Message(ERROR)<<"Unable to write event "<<ehead->event_id<<"\n";
+	break;
+      }
+      ++nevents;
+      nbytes += buf.size();
+      more = !reader.GetNextCompressedEvent(buf);
+    }
+    //running out of events is fine, but a bad read is not
+    if(!reader.IsOk())
+      err = 1;
+  }
+
+  //finish up
+  if(modules->Finalize())
+    err = 1;
+  if(!err && CopyConfigFile(writer))
+    err = 1;
+  Message(INFO)<<"Copied "<<nevents<<" events ("<<nbytes/1024/1024
+	       <<" MiB) in "<<time(0) - start_time<<" seconds.\n";
+  return err;
+}
+
+int main(int argc, char** argv)
+{
+  int max_event=-1, min_event = 0;
+  std::string event_file = "";
+  ConfigHandler* config = ConfigHandler::GetInstance();
+  config->SetProgramUsageString("rawskim [options] <file>");
+  config->AddCommandSwitch(' ',"max","last event to copy",
+			   CommandSwitch::DefaultRead<int>(max_event),
+			   "event");
+  config->AddCommandSwitch(' ',"min","first event id to copy",
+			   CommandSwitch::DefaultRead<int>(min_event),
+			   "event");
+  config->AddCommandSwitch(' ',"event-list","copy the event ids listed in <file>",
+                           CommandSwitch::DefaultRead<std::string>(event_file),
+                           "file");
+
+  EventHandler* modules = EventHandler::GetInstance();
+  RawWriter* writer = modules->AddModule<RawWriter>();
+  if(config->ProcessCommandLine(argc,argv))
+    return -1;
+
+  if(argc != 2){
+    Message(ERROR)<<"Incorrect number of arguments: "<<argc<<std::endl;
+    config->PrintSwitches(true);
+    return 1;
+  }
+
+  SetOutputFile(writer, argv[1]);
+  //our own config doesn't describe the digitizers; copy the run's instead
+  writer->SetSaveConfig(false);
+  if(SkimFile(argv[1], writer, event_file, max_event, min_event)){
+    Message(ERROR)<<"Error skimming file "<<argv[1]<<"\n";
+    return 1;
+  }
+  return 0;
+}
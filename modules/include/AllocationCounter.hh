@@ -0,0 +1,29 @@
+/** @file AllocationCounter.hh
+    @brief Defines the AllocationCounter for counting heap allocations
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef ALLOCATIONCOUNTER_h
+#define ALLOCATIONCOUNTER_h
+
+/** @class AllocationCounter
+    @brief Counts calls to the global operator new, to find per-event
+    allocations
+
+    'make COUNT_ALLOCATIONS=true' defines COUNT_ALLOCATIONS, which replaces
+    the global operator new and delete with versions which count every
+    allocation on any thread, including the readout and writer threads.
+    EventHandler then reports the allocations per event after the first
+    few events at the end of the run.  Without it, nothing is counted.
+    @ingroup modules
+*/
+class AllocationCounter{
+public:
+  /// Were the counting operators compiled in?
+  static bool IsEnabled();
+  /// Number of calls to operator new so far; always 0 if not enabled
+  static long GetCount();
+};
+
+#endif
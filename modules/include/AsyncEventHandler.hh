@@ -14,65 +14,123 @@
 #endif
 
 #include "Event.hh"
+#include "ParameterList.hh"
 #include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
 
 class BaseModule;
 
 /** @class AsyncEventHandler
     @brief Class which processes events in asyncronous batches for real-time daq monitoring
+
+    Events passed to Process wait in a queue of up to queue_size events
+    until the handler's thread is free.  The queue policy decides what
+    happens to events the thread can't keep up with:
+    - BLOCK: Process waits for room in the queue, so nothing is lost
+    - DROP_OLDEST: the oldest waiting event makes room for the new one
+    - KEEP_NTH: only every keep_every'th event is queued at all
+    - RATE_LIMIT: at most max_rate events per second are queued
+    Except with BLOCK, Process never waits; a full queue drops its oldest
+    event.  Every event not processed is counted as dropped.
     @ingroup modules
 */
 
-class AsyncEventHandler{
+class AsyncEventHandler : public ParameterList{
 public:
-  AsyncEventHandler();
+  /// What to do with events that arrive faster than we process them
+  enum QUEUE_POLICY { BLOCK, DROP_OLDEST, KEEP_NTH, RATE_LIMIT };
+
+  AsyncEventHandler(const std::string& name="AsyncEventHandler");
   ~AsyncEventHandler();
-  
+
   /// Clear all registered modules and receivers
   void Reset();
-  
+
   /// Add a module to be handled by this process
   int AddModule(BaseModule* mod, bool register_to_eventhandler = true,
 		bool register_parameters = true);
-  
+
   /// Register another handler to receive processed events from this batch
   int AddReceiver(AsyncEventHandler* receiver);
-  
-  /// Process one event
+
+  /** Queue one event.  An empty pointer marks the end of the run: with
+      the BLOCK policy, wait until all queued events are processed;
+      otherwise, drop the events still waiting.
+  */
   int Process(EventPtr evt);
-  
+
   /// Start running in a new thread
   int StartRunning();
   /// Stop running in a separate thread
   int StopRunning();
   /// Are we running right now?
   bool IsRunning(){ return _running; }
-  
+
   ///Set the time to sleep in between event processing
   void SetSleepMillisec(int sleeptime){ _sleeptime = sleeptime;}
   ///Get the time to sleep between event processing
   int GetSleepMillisec() const { return _sleeptime; }
-  
-  ///Set the blocking status
-  void SetBlockingStatus(bool blocking){ _blocking = blocking; }
+
+  ///Set the blocking status; same as the BLOCK or DROP_OLDEST policy
+  void SetBlockingStatus(bool blocking)
+  { _policy = (blocking ? BLOCK : DROP_OLDEST); }
   ///Get the blocking status
-  bool GetBlockingStatus(){ return _blocking; }
-  
+  bool GetBlockingStatus(){ return _policy == BLOCK; }
+
+  /// Set what to do with events we can't keep up with
+  void SetQueuePolicy(QUEUE_POLICY policy){ _policy = policy; }
+  QUEUE_POLICY GetQueuePolicy() const { return _policy; }
+  /// Set the number of events which can wait to be processed
+  void SetQueueSize(int size){ _queue_size = size; }
+  int GetQueueSize() const { return _queue_size; }
+  /// With KEEP_NTH, queue only every <n>th event
+  void SetKeepEvery(int n){ _keep_every = n; }
+  int GetKeepEvery() const { return _keep_every; }
+  /// With RATE_LIMIT, queue at most <rate> events per second
+  void SetMaxRate(double rate){ _max_rate = rate; }
+  double GetMaxRate() const { return _max_rate; }
+
+  /// Number of events processed since the counters were reset
+  long GetProcessedCount() const { return _processed; }
+  /// Number of events dropped since the counters were reset
+  long GetDroppedCount() const { return _dropped; }
+  /// Reset the processed and dropped counters
+  void ResetCounters(){ _processed = _dropped = _offered = 0; }
+
   /// Should not be called directly; necessary for threading
-  void operator()();  
+  void operator()();
 
 private:
+  /// Decide whether the policy lets this event into the queue
+  bool AcceptEvent();
+
   bool _running;            ///< is our thread going?
   int _sleeptime;           ///< time to sleep in ms between events
-  bool _blocking;           ///< Do we block new process requests if busy?
+  QUEUE_POLICY _policy;     ///< what to do when we fall behind
+  int _queue_size;          ///< most events waiting to be processed
+  int _keep_every;          ///< with KEEP_NTH, queue one in this many
+  double _max_rate;         ///< with RATE_LIMIT, max events per second
+  long _offered;            ///< events passed to Process
+  long _processed;          ///< events processed by our modules
+  long _dropped;            ///< events thrown away
+  bool _busy;               ///< is our thread processing an event?
   std::vector<BaseModule*> _modules;          ///< modules to process with
   std::vector<AsyncEventHandler*> _receivers; ///< processors to receive events
-  EventPtr _next_event;                  ///< next event ready for processing
+  std::deque<EventPtr> _queue;          ///< events waiting for processing
+  std::chrono::steady_clock::time_point _next_accept; ///< for RATE_LIMIT
 #ifndef SINGLETHREAD
   std::condition_variable _event_ready; ///< signal wakeup
-  std::mutex _event_mutex;      ///< control access to next_event
+  std::condition_variable _event_taken; ///< signal room in the queue
+  std::mutex _event_mutex;      ///< control access to the queue
   std::shared_ptr<std::thread> _threadptr; ///< manage our own thread
 #endif
-};  
+};
+
+std::ostream& operator<<(std::ostream& out,
+			 const AsyncEventHandler::QUEUE_POLICY& policy);
+std::istream& operator>>(std::istream& in,
+			 AsyncEventHandler::QUEUE_POLICY& policy);
 
 #endif
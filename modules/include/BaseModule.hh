@@ -12,6 +12,7 @@
 #include "Event.hh"
 #include "ParameterList.hh"
 #include "ProcessingCut.hh"
+#include "ModuleTimer.hh"
 #include <iostream>
 #include <string>
 #include <set>
@@ -78,6 +79,21 @@ public:
   /// Finalize state after a run has processed. Return 0 if no error
   virtual int Finalize() {return 0;};
   
+  /** Do the part of the processing which depends on earlier events. 
+      EventHandler calls this for every event in order, before any module
+      processes it, even when events are processed on several threads.  
+      Cuts are not checked. Return 0 if no error
+  */
+  virtual int Prologue(EventPtr event) { return 0; }
+  
+  /** Make an independent copy of the module to process events on another
+      thread.  Modules which keep state between calls to Process, or touch
+      anything shared, should return 0 (the default): they see every event
+      in order after the worker threads are done with it.  The copy is made
+      after Initialize and is deleted without being finalized.
+  */
+  virtual BaseModule* Clone() const { return 0; }
+  
   /// This function is called to handle things like cuts before real processing
   int HandleEvent(EventPtr event, bool process_now = false);
   
@@ -87,6 +103,10 @@ public:
   /// Get the return value of the last Process() call
   int GetLastProcessReturn(){ return _last_process_return; }
   
+  /// Get the calls and time spent in HandleEvent while timing is enabled
+  ModuleTimer* GetTimer(){ return &_timer; }
+  const ModuleTimer* GetTimer() const { return &_timer; }
+  
   /// State that we want another module to run first
   int AddDependency(const std::string& module);
   
@@ -96,6 +116,24 @@ public:
 
   /// Get the list of modules which this module depends on
   const std::set<std::string>* GetDependencies(){ return &_dependencies; }
+  
+  /** State that Process writes <field> of the event, named as in EventData,
+      e.g. "pulses_aligned" or "channels.pulses".  Modules which declare
+      everything they write can run at the same time as other such modules
+      with ModuleScheduler; the others run strictly in order.
+  */
+  void AddOutput(const std::string& field)
+  { _outputs.insert(field); _outputs_declared = true; }
+  /// State that Process writes nothing to the event
+  void SetNoOutputs(){ _outputs_declared = true; }
+  /// State that Process reads <field> without depending on its writer
+  void AddInput(const std::string& field){ _inputs.insert(field); }
+  /// Has this module declared all the event fields it writes?
+  bool OutputsDeclared() const { return _outputs_declared; }
+  /// Get the event fields written by Process
+  const std::set<std::string>* GetOutputs() const { return &_outputs; }
+  /// Get the event fields read without a dependency on their writer
+  const std::set<std::string>* GetInputs() const { return &_inputs; }
     
   /// Add a condition to determine whether this module will process an event
   void AddProcessingCut(ProcessingCut* cut){ _cuts.push_back(cut); }
@@ -111,11 +149,21 @@ public:
   */
   
 protected:  
+  /// Copies share the cuts of the original without owning them
+  BaseModule(const BaseModule& right);
+  
   int _last_process_return; ///< Value returned from last Process call
   std::set<std::string> _dependencies; ///< list of modules we need to run first
+  std::set<std::string> _outputs; ///< event fields written by Process
+  std::set<std::string> _inputs;  ///< event fields read from non-dependencies
+  bool _outputs_declared; ///< are all the fields we write in _outputs?
   std::vector<ProcessingCut*> _cuts; ///< list of cuts to take before processing
   std::set<int> _skip_channels; ///< list of channels not to process
+  bool _owns_cuts; ///< do we delete the cuts when we're done?
+  ModuleTimer _timer; ///< time spent in HandleEvent; copies start from 0
   
+private:
+  BaseModule& operator=(const BaseModule& right);
 };
 
 
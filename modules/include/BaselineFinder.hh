@@ -10,6 +10,9 @@
 #include "ChannelModule.hh"
 
 #include <vector>
+
+class Integrator;
+class EvalRois;
 /** @class BaselineFinder
     @brief searches the beginning of a channel's waveform to determine baseline
     @ingroup modules
@@ -32,22 +35,35 @@
        from the nearest good points. 
     5) Finally we subtract the moving baseline from the signal and store it
        in the subtracted_waveform
+
+    With fuse_downstream set, the work of the Integrator and EvalRois
+    modules is done here too, in blocks of samples small enough to stay in
+    cache: each block is subtracted, then integrated, then every region
+    ending in it is evaluated.  The results are bit for bit those of the
+    separate modules, which validate_fused checks event by event.  Either
+    module is only fused if it selects the same channels as we do and has
+    no cuts; modules run between them must not change the waveform.
 */
 class BaselineFinder : public ChannelModule
 {
 public:
   BaselineFinder();
+  /// Copy the settings; the copy's nested parameter lists are left empty
+  BaselineFinder(const BaselineFinder& right);
   ~BaselineFinder();
   
   int Initialize();
   int Finalize();
   int Process(ChannelData* chdata);
+  BaseModule* Clone() const { return new BaselineFinder(*this); }
   
   static const std::string GetDefaultName(){ return "BaselineFinder";}
 
   //parameters
   bool fixed_baseline;         // use fixed baseline algorithm
   bool linear_interpolation;  // use few baseline estimates and interpolate
+  bool fuse_downstream;  ///< do the Integrator and EvalRois work here
+  bool validate_fused;   ///< check fused results against the modules
   
   ParameterList fixed_params;
   int segment_samps;
@@ -78,6 +94,15 @@ public:
 private:
   int FixedBaseline(ChannelData* chdata);
   int DriftingBaseline(ChannelData* chdata);
+  /** Subtract baseform from the waveform if asked, then do the fused work.
+      Called for every channel, whether or not a baseline was found.
+  */
+  void FinishChannel(ChannelData* chdata, bool subtract);
+  /// Redo the fused work with the modules; return the number of differences
+  int ValidateFused(ChannelData* chdata, size_t first_roi);
+  
+  Integrator* _fused_integrator; ///< Integrator we are integrating for
+  EvalRois* _fused_rois;         ///< EvalRois we are evaluating for
 
 };
 
@@ -8,9 +8,15 @@
 #define CHANNELMODULE_h
 
 #include "BaseModule.hh"
+#include <vector>
 
 /** @class ChannelModule 
     @brief abstract class that acts on each channel of an event
+
+    Modules whose Process(ChannelData*) only touches the channel it is given
+    can set _channels_independent in their constructor.  The user may then
+    turn on parallel_channels to spread the channels of each event over the
+    shared ThreadPool.
     @ingroup modules
 */
 class ChannelModule : public BaseModule{
@@ -24,11 +30,20 @@ public:
   
   /// See if this channel passes cuts
   bool CheckCuts(ChannelData* chdata);
+  /// See if this channel should be processed at all
+  bool SelectChannel(ChannelData* chdata);
+  /// Would <other> select exactly the channels we do, with no cuts?
+  bool SelectsSameChannels(const ChannelModule* other) const;
   
 protected:
   EventPtr _current_event;  ///< Pointer to current event
   bool _skip_sum;    ///< Do we skip processing the special sum channel?
   bool _sum_only;    ///< Do we process the sum channel only (and not others?)
+  bool _channels_independent; ///< Can channels be processed concurrently?
+  bool _parallel_channels; ///< Process channels on the thread pool?
+  int _min_parallel_channels; ///< Fewest channels worth using the pool for
+private:
+  std::vector<int> _channel_results; ///< return of each parallel channel
 };
 
 #endif
@@ -8,11 +8,26 @@
 #define CONVERTDATA_h
 
 #include "BaseModule.hh"
+#include "SampleDecoder.hh"
 #include <map>
 
 class V172X_Params;
+class V172X_BoardParams;
 /** @class ConvertData
     @brief Convert the raw data pointer to useable variables
+
+    The event times and run bookkeeping depend on the events before, so they
+    are filled in Prologue; Process only decodes the waveforms and can run 
+    on several events at once.
+
+    With lazy_decode, Process only records where each channel's samples are
+    in the raw buffer (still finding the extremes from there), and the 
+    waveform is filled by the first ChannelData::GetWaveform.  Modules 
+    skipped by their cuts then never pay for the conversion.  The raw event
+    must stay alive as long as the channels do, as it does inside the Event.
+    Zero-length-encoded channels are always decoded right away.  The 
+    conversion itself is done by SampleDecoder, using vector instructions
+    up to instruction_set where the CPU has them.
     @ingroup modules
 */
 
@@ -25,7 +40,9 @@ public:
 
   int Initialize();
   int Finalize();
+  int Prologue(EventPtr event);
   int Process(EventPtr event);
+  BaseModule* Clone() const { return new ConvertData(*this); }
   
   static const std::string GetDefaultName(){ return "ConvertData";}
   
@@ -37,8 +54,15 @@ public:
   std::map<int,double>* GetChOffsetMap(){ return &_offsets;}
 
 private:
+  int DecodeV172XTimes(const unsigned char* rawdata, uint32_t datasize, 
+		       EventDataPtr data);
   int DecodeV172XData(const unsigned char* rawdata, uint32_t datasize, 
 		       EventDataPtr data);
+  /// Get the parameters for the board at <offset> in a block of <datasize>
+  /// bytes, or null if the board header can't be trusted
+  const V172X_BoardParams* CheckBoard(const unsigned char* rawdata,
+				      uint32_t datasize, uint32_t offset,
+				      EventDataPtr data);
   
   uint64_t start_time;           ///< start time of the run
   uint64_t previous_event_time;  ///< time at which the previous event occurred
@@ -48,6 +72,8 @@ private:
   runinfo* _info;                  ///< database information for this run
   long _id_mismatches;             ///< Number of events with ID mismatch
   bool _headers_only;              ///< Only process data headers, not the bulk
+  bool _lazy_decode;               ///< Decode waveforms only when asked for
+  SampleDecoder::INSTRUCTION_SET _instruction_set; ///< fastest allowed
   std::set<int> _invert_channels;  ///< Invert converted data for a channel?
 public:
 
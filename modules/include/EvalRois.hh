@@ -10,12 +10,18 @@
 #include "ChannelModule.hh"
 #include <vector>
 
+class Roi;
+
 /** @class EvalRois
     @brief Evaluate statistics over defined regions of interest
     
     Regions are defined by a start and end time; these are converted to 
     sample indices.  Any number of regions can be defined.
     
+    BaselineFinder can evaluate the regions in the same pass as its baseline
+    subtraction (see BaselineFinder::fuse_downstream); it then marks us as
+    fused and Process does nothing.
+    
     @ingroup modules
 */
 class EvalRois : public ChannelModule{
@@ -26,6 +32,7 @@ public:
   int Initialize();
   int Finalize();
   int Process(ChannelData* chdata);
+  BaseModule* Clone() const { return new EvalRois(*this); }
   
   static const std::string GetDefaultName(){ return "EvalRois"; }
   
@@ -39,9 +46,22 @@ public:
   
   /// Get the number of regions defined so far
   int GetNRegions() const { return _regions.size(); }
+  
+  /// Evaluate all regions on one channel, whether or not we are fused
+  int Evaluate(ChannelData* chdata);
+  /// Fill the times and sample range of region <window> into <roi>
+  void SetRoiRange(const ChannelData* chdata, size_t window, Roi& roi) const;
+  /// Fill the rest of <roi>, whose range and samples must be ready
+  void EvalRoi(ChannelData* chdata, Roi& roi) const;
+  
+  /// Leave the evaluation to BaselineFinder
+  void SetFused(bool fused){ _fused = fused; }
+  /// Is BaselineFinder evaluating the regions for us?
+  bool IsFused() const { return _fused; }
 
 private:
   std::vector<std::pair<double, double> > _regions;
+  bool _fused; ///< is BaselineFinder evaluating the regions for us?
   
   
 };
@@ -30,6 +30,14 @@ public:
   RawEventPtr GetRawEvent(){ return _raw_event; }
   /// Get a pointer to the processed data portion
   EventDataPtr GetEventData(){ return _event_data; }
+  /** Reuse this event for <raw>, clearing the processed data but keeping
+      its buffers.  Only safe once nothing else holds the event or its data.
+  */
+  void Reset(RawEventPtr raw);
+  /// Let go of the raw event, e.g. while the event waits to be reused
+  void ReleaseRawEvent(){ _raw_event.reset(); }
+  /// Is the processed data held by anything besides this event?
+  bool IsDataShared() const { return _event_data.use_count() > 1; }
       
 private:
   RawEventPtr _raw_event;       ///< pointer to raw data segment
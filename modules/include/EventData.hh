@@ -12,6 +12,7 @@
 #include <string>
 #include <stdint.h>
 #include <iomanip>
+#include <utility>
 
 #include "Rtypes.h" //has the classdef macro
 #include "ChannelData.hh"
@@ -30,7 +31,7 @@ class EventData{
 public:
   EventData() { Clear(); }
   virtual ~EventData() {} //anything need cleaning up?
-  /// Reset all variables to defaults
+  /// Reset all variables to defaults, keeping the channels for reuse
   void Clear(); //inlined below
   static const char* GetBranchName(){ return "event"; }
   void Print (int verbosity);
@@ -90,6 +91,24 @@ public:
   double bary_x;     ///< position of the x barycenter in cm
   double bary_y;     ///< position of the z barycenter in cm
     
+  /** Decode every channel's waveform still waiting in the raw data.
+      Must be called before the event is shared between threads.
+  */
+  void DecodeWaveforms() const {
+    for(size_t i=0; i<channels.size(); ++i)
+      channels[i].DecodeWaveform();
+  }
+  
+  /** Empty channels, keeping the ChannelData objects (and their buffers)
+      for AddChannel to hand out again.
+  */
+  void ClearChannels(); //inlined below
+  /** Append a cleared channel to channels and return it, reusing one
+      dropped by ClearChannels if there is any.  As with push_back, this
+      invalidates pointers to the other channels.
+  */
+  ChannelData& AddChannel(); //inlined below
+  
   /// Return channel info pointer by id, rather than vector index
   ChannelData* GetChannelByID(int id){
     std::vector<ChannelData>::iterator it = channels.begin();
@@ -111,9 +130,33 @@ public:
     return 0;
   }
   
+private:
+  std::vector<ChannelData> _spare_channels; //! channels to reuse
+  
   ClassDef(EventData,14)
 };
 
+#ifndef __CINT__
+inline void EventData::ClearChannels()
+{
+  for(size_t i=0; i<channels.size(); ++i)
+    _spare_channels.push_back(std::move(channels[i]));
+  channels.clear();
+}
+
+inline ChannelData& EventData::AddChannel()
+{
+  if(_spare_channels.empty()){
+    channels.push_back(ChannelData());
+    return channels.back();
+  }
+  channels.push_back(std::move(_spare_channels.back()));
+  _spare_channels.pop_back();
+  channels.back().Clear();
+  return channels.back();
+}
+#endif
+
 
 
 inline void EventData::Clear()
@@ -130,8 +173,11 @@ inline void EventData::Clear()
   pulses_aligned = false;
   generic.clear();
   s1_valid = false;
+  s1_fixed_valid = false;
   s2_valid = false;
+  s2_fixed_valid = false;
   s1s2_valid = false;
+  s1s2_fixed_valid = false;
   s1_start_time = 0;
   s1_end_time = 0;
   s2_start_time = 0;
@@ -156,6 +202,8 @@ inline void EventData::Clear()
   bary_valid = false;
   bary_x = 0;
   bary_y = 0;
-  channels.clear();
+  sum_of_int.clear();
+  roi_sum_of_int.clear();
+  ClearChannels();
 }
 #endif
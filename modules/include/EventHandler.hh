@@ -9,16 +9,42 @@
 
 #include "ParameterList.hh"
 #include "Event.hh"
+#include "EventPool.hh"
 #include "runinfo.hh"
 #include "DatabaseConfigurator.hh"
 #include <string>
+#include <iostream>
 #include <vector>
+#include <deque>
+#include <map>
+#ifndef SINGLETHREAD
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 
 class BaseModule;
 class AsyncEventHandler;
+class ModuleScheduler;
 
 /** @class EventHandler
     @brief Master class which controls processing events by enabled modules
+
+    With event_threads > 1, several events are processed at once.  Every
+    module's Prologue still runs in the calling thread, in event order.  Then
+    the leading modules which can be cloned (see BaseModule::Clone) process
+    the event on one of the worker threads, each of which has its own copy
+    of them.  The events are put back in order before the remaining modules
+    and the async receivers see them, again on the calling thread, so 
+    writers and accumulators behave exactly as in serial processing.
+    
+    With module_threads > 0, the modules which would run one after the
+    other on the calling thread are handed to a ModuleScheduler instead,
+    which runs modules that don't depend on each other at the same time.
+    
+    Events made from raw events come from an EventPool, so once enough
+    events have been made the processed data of finished events is reused
+    rather than reallocated (see event_pool_size).
     @ingroup modules
 */
 class EventHandler : public ParameterList{
@@ -66,15 +92,28 @@ public:
   //return 0 if no errors
   /// Initialize all registered modules
   int Initialize();
-  /// Create an Event and process it with all enabled modules
+  /// Get a recycled or new Event and process it with all enabled modules
   int Process(RawEventPtr raw);
-  /// Process externally created event on all enabled modules
+  /** Process externally created event on all enabled modules.  When
+      processing on several threads, the event is only queued, and the 
+      return value counts the errors of the events finished in the meantime.
+  */
   int Process(EventPtr evt);
   /// Finalize all registered and enabled modules
   int Finalize();
   
+  /** Print the calls and time spent in each module, slowest first.  The
+      times are only recorded with time_modules set; this can be called
+      at any time during the run.
+  */
+  void PrintModuleTimes(std::ostream& out);
+  
   /// Get a pointer to the current event being processed
   EventPtr GetCurrentEvent(){ return _current_event; }
+  /// Set the number of events to process at once; 0 or 1 for serial
+  void SetEventThreads(int nthreads){ _event_threads = nthreads; }
+  /// Get the number of events to process at once
+  int GetEventThreads() const { return _event_threads; }
   /// Get the list of all defined modules const-ly
   const std::vector<BaseModule*>* GetListOfModules() const{ return &_modules; }
   /// Get the list of all defined modules
@@ -114,6 +153,56 @@ private:
   DatabaseConfigurator _dbconfig; ///configure a concrete database interface
   bool _run_parallel;   ///< process modules in parallel
   std::vector<AsyncEventHandler*> _para_handlers;
+  
+  int _event_threads;   ///< number of events to process at once
+  int _max_events_in_flight; ///< limit on events queued or being processed
+  int _channel_threads; ///< threads in the pool for channel-level loops
+  int _module_threads;  ///< threads in the pool for independent modules
+  bool _time_modules;   ///< record the time spent in each module
+  int _event_pool_size; ///< most finished events to keep for reuse
+  EventPool _event_pool; ///< makes the events for Process(RawEventPtr)
+  long _nevents;        ///< events processed since Initialize
+  long _warm_allocations; ///< heap allocations when warm-up finished
+  
+  /// Set up worker threads with copies of the modules; 0 if all is well
+  int StartWorkers();
+  /// Finish all outstanding events and stop the worker threads
+  int StopWorkers();
+  /// Work out which of the serial modules can run at once; 0 if all is well
+  int StartScheduler();
+  /// Queue <evt> for the workers and finish the events which are done
+  int QueueEvent(EventPtr evt);
+  /// Run the ordered modules and async receivers on a finished event
+  int FinishEvent(EventPtr evt, int proc_fail);
+  
+  std::vector<std::vector<BaseModule*> > _worker_chains; ///< copies per thread
+  std::vector<BaseModule*> _ordered_modules; ///< modules run in event order
+  /// An event handed to the workers, waiting to be finished in order
+  struct flight_slot{
+    EventPtr event; ///< the event, until it is finished
+    int proc_fail;  ///< sum of the workers' return values
+    bool done;      ///< have the workers finished with it?
+    flight_slot() : proc_fail(0), done(false) {}
+  };
+  /// Events queued, being processed or waiting to be finished, indexed by
+  /// sequence number modulo the size, so nothing is allocated per event
+  std::vector<flight_slot> _in_flight;
+  long _next_sequence; ///< sequence number of the next queued event
+  long _next_waiting;  ///< sequence number of the next event for the workers
+  long _next_ordered;  ///< sequence number of the next event to finish
+  ModuleScheduler* _scheduler; ///< runs independent modules at once
+#ifndef SINGLETHREAD
+  /// Process events from the queue with the copies in _worker_chains[chain]
+  void WorkerLoop(size_t chain);
+  /// Finish events in order until no more than <max_in_flight> are left
+  int CollectEvents(std::unique_lock<std::mutex>& lock, long max_in_flight);
+  
+  bool _stop_workers;                  ///< tell the workers to quit
+  std::mutex _workers_mutex;           ///< protects the event queues
+  std::condition_variable _event_waiting; ///< signal workers of a new event
+  std::condition_variable _event_done; ///< signal that a worker finished
+  std::vector<std::thread> _workers;   ///< the worker threads
+#endif
 };
 
 #include "BaseModule.hh"
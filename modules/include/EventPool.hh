@@ -0,0 +1,58 @@
+/** @file EventPool.hh
+    @brief Defines the EventPool class which recycles Events
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef EVENTPOOL_h
+#define EVENTPOOL_h
+
+#include "Event.hh"
+#include <vector>
+
+/** @class EventPool
+    @brief Hands out Events, reusing ones the modules have finished with
+
+    An event is reused once the pool holds the only reference to it and to
+    its EventData, so events kept by a module, a writer's queue or
+    EventHandler::GetCurrentEvent are left alone.  Reused events keep the
+    buffers of their channels, so once the pool has as many events as are
+    ever in flight at once, making an event allocates nothing.  The price
+    is that the pool keeps up to GetMaxSize events' worth of memory for
+    the whole run.  The raw events are not kept: GetEvent lets go of the
+    raw data of every idle event, so buffers lent out by the DAQ go back
+    as soon as the next event is requested.
+    
+    Only one thread may call GetEvent; the events can be released on any.
+    @ingroup modules
+*/
+class EventPool{
+public:
+  EventPool(size_t max_size = 0) : _max_size(max_size), _next(0),
+				   _created(0), _reused(0) {}
+  
+  /// Get an event holding <raw>, with empty EventData
+  EventPtr GetEvent(RawEventPtr raw);
+  /// Drop the raw events held by events nobody else is using
+  void ReleaseIdle();
+  /// Keep at most <max_size> events for reuse; 0 to allocate every event
+  void SetMaxSize(size_t max_size);
+  /// Get the most events kept for reuse
+  size_t GetMaxSize() const { return _max_size; }
+  /// Forget all the pooled events and reset the counts
+  void Clear();
+  
+  /// Number of events allocated by GetEvent
+  long GetCreated() const { return _created; }
+  /// Number of events recycled by GetEvent
+  long GetReused() const { return _reused; }
+  
+private:
+  std::vector<EventPtr> _events; ///< events which may be reused
+  size_t _max_size;              ///< most events to keep in _events
+  size_t _next;                  ///< where to look for a free event next
+  long _created;                 ///< events allocated
+  long _reused;                  ///< events recycled
+};
+
+#endif
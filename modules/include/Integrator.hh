@@ -8,8 +8,13 @@
 #define INTEGRATOR_h
 
 #include "ChannelModule.hh"
+#include <cmath>
 /** @class Integrator
     @brief Integrate a channel's waveform digitally
+
+    BaselineFinder can do the integration in the same pass as its baseline
+    subtraction (see BaselineFinder::fuse_downstream); it then marks us as
+    fused and Process does nothing.
     @ingroup modules
 */
 class Integrator : public ChannelModule
@@ -20,10 +25,27 @@ public:
   int Initialize();
   int Finalize();
   int Process(ChannelData* chdata);
+  BaseModule* Clone() const { return new Integrator(*this); }
   
   static const std::string GetDefaultName(){ return "Integrator"; }
+  
+  /// Integrate one channel, whether or not we are fused
+  int Integrate(ChannelData* chdata);
+  /// Add one sample to the integral up to the previous sample
+  double IntegralStep(double previous, double sample) const
+  { return previous + ( std::abs(sample) > threshold ? sample : 0 ); }
+  /// Fill the integral extremes and interpolation integrals from integral
+  void SetIntegralInfo(ChannelData* chdata, int max_index, 
+		       int min_index) const;
+  
+  /// Leave the integration to BaselineFinder
+  void SetFused(bool fused){ _fused = fused; }
+  /// Is BaselineFinder integrating for us?
+  bool IsFused() const { return _fused; }
+  
 private:
   double threshold; ///< minimum value about baseline to count integral
+  bool _fused;      ///< is BaselineFinder integrating for us?
   
 };
 
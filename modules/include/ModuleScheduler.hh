@@ -0,0 +1,92 @@
+/** @file ModuleScheduler.hh
+    @brief Defines the ModuleScheduler, which runs independent modules at once
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef MODULESCHEDULER_h
+#define MODULESCHEDULER_h
+
+#ifndef SINGLETHREAD
+#include <condition_variable>
+#include <mutex>
+#endif
+
+#include "Event.hh"
+#include <vector>
+#include <deque>
+#include <set>
+#include <string>
+
+class BaseModule;
+
+/** @class ModuleScheduler
+    @brief Runs the modules on an event in parallel where they don't interact
+
+    Build works out which modules have to wait for which, keeping the order
+    they were given in wherever it matters.  A module waits for an earlier
+    one if
+    - it lists the earlier module as a dependency, or
+    - either module hasn't declared which event fields it writes (see
+      BaseModule::AddOutput), or
+    - one writes a field the other reads or writes.  Fields are named
+      like "channels.pulses"; a field also overlaps everything inside it,
+      so "channels" overlaps "channels.pulses".
+    Two modules writing the same field without one depending on the other
+    are reported, since their relative order was probably never thought
+    about.
+
+    Process then hands each module to the ThreadPool as soon as all the
+    modules it waits for are done with the event.  Each module still sees
+    one event at a time, so modules need no locking of their own.  Any
+    waveforms ConvertData left undecoded are decoded before the first
+    modules start and whenever no module is running, since decoding on
+    first use is not thread-safe.
+    @ingroup modules
+*/
+class ModuleScheduler{
+public:
+  ModuleScheduler();
+  ~ModuleScheduler();
+
+  /// Work out the constraints between <modules>, in their serial order
+  int Build(const std::vector<BaseModule*>& modules);
+  /// Forget all modules
+  void Clear();
+  /// Has Build been given any modules?
+  bool Empty() const { return _nodes.empty(); }
+  /// Number of steps in the longest chain of modules waiting on each other
+  int GetNStages() const { return _nstages; }
+
+  /// Process <evt> with all modules; returns the sum of their return values
+  int Process(EventPtr evt);
+  /// Run one module whose inputs are ready; used by the thread pool
+  void RunNextModule();
+
+private:
+  ModuleScheduler(const ModuleScheduler& right);
+  ModuleScheduler& operator=(const ModuleScheduler& right);
+
+  /// A module and the modules which wait for it
+  struct node{
+    BaseModule* module;
+    std::vector<size_t> successors; ///< modules waiting for us
+    int npredecessors;               ///< number of modules we wait for
+    int stage;                       ///< longest chain of waits before us
+  };
+  std::vector<node> _nodes;  ///< all modules in their serial order
+  int _nstages;              ///< longest chain of waiting modules
+
+  //state for the event being processed
+  EventPtr _event;                 ///< the event being processed
+  std::vector<int> _waiting_for;   ///< unfinished predecessors of each module
+  std::deque<size_t> _ready;       ///< modules which can run now
+  int _proc_fail;                  ///< sum of return values so far
+  int _nrunning;                   ///< modules running right now
+#ifndef SINGLETHREAD
+  std::mutex _mutex;               ///< protects the event state
+  std::condition_variable _module_ready; ///< signal a module is ready
+#endif
+};
+
+#endif
@@ -0,0 +1,74 @@
+/** @file ModuleTimer.hh
+    @brief Defines the ModuleTimer class for timing module calls
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef MODULETIMER_h
+#define MODULETIMER_h
+
+#include <atomic>
+
+/** @class ModuleTimer
+    @brief Counts the calls of a module and how long they took
+
+    Every BaseModule owns one, filled by HandleEvent while timing is enabled.
+    The wall time of each call is also histogrammed in powers of 2 ns, so
+    quantiles are known to within a factor 2.  Only one thread may record
+    to a timer, but any thread can read it at any time; there are no locks
+    or read-modify-write instructions involved.
+    @ingroup modules
+*/
+class ModuleTimer{
+public:
+  /// Number of histogram bins; the last one holds everything over 2^39 ns
+  static const int NBINS = 40;
+
+  ModuleTimer(){ Reset(); }
+
+  /// Turn timing on or off for all modules
+  static void SetEnabled(bool enabled){ _enabled = enabled; }
+  /// Is timing turned on?
+  static bool IsEnabled(){ return _enabled; }
+  /// Get a monotonic wall clock time in ns
+  static long WallNow();
+  /// Get the CPU time used by the calling thread in ns
+  static long CpuNow();
+
+  /// Zero all counters
+  void Reset();
+  /// Record one call which passed cuts or not, and failed or not
+  void Record(bool processed, bool failed, long wall_ns, long cpu_ns);
+  /// Add in the counts of another timer, which must not be recording
+  void Add(const ModuleTimer& right);
+
+  long GetCalls() const { return _calls.load(std::memory_order_relaxed); }
+  /// Calls which passed the cuts and were processed
+  long GetProcessed() const
+  { return _processed.load(std::memory_order_relaxed); }
+  /// Calls rejected by the cuts
+  long GetRejected() const { return GetCalls() - GetProcessed(); }
+  /// Calls where Process returned an error
+  long GetFailed() const { return _failed.load(std::memory_order_relaxed); }
+  long GetWallNs() const { return _wall_ns.load(std::memory_order_relaxed); }
+  long GetCpuNs() const { return _cpu_ns.load(std::memory_order_relaxed); }
+  long GetMaxWallNs() const
+  { return _max_wall_ns.load(std::memory_order_relaxed); }
+  /// Upper bound on the wall time of the fastest <frac> of the calls
+  long GetWallQuantile(double frac) const;
+
+private:
+  ModuleTimer(const ModuleTimer& right);
+  ModuleTimer& operator=(const ModuleTimer& right);
+
+  static bool _enabled;            ///< are modules being timed?
+  std::atomic<long> _calls;        ///< calls to HandleEvent
+  std::atomic<long> _processed;    ///< calls which passed the cuts
+  std::atomic<long> _failed;       ///< calls which returned an error
+  std::atomic<long> _wall_ns;      ///< total wall time
+  std::atomic<long> _cpu_ns;       ///< total CPU time of the calling thread
+  std::atomic<long> _max_wall_ns;  ///< longest single call
+  std::atomic<long> _wall_hist[NBINS]; ///< calls binned by log2(wall ns)
+};
+
+#endif
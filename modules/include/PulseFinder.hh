@@ -20,6 +20,7 @@ public:
   int Initialize();
   int Finalize();
   int Process(EventPtr evt);
+  BaseModule* Clone() const { return new PulseFinder(*this); }
   
   /// Evaluate times, integral, fparams for pulse
   int EvaluatePulse(Pulse& pulse, ChannelData* chdata,
@@ -9,11 +9,28 @@
 
 #include <fstream>
 #include <string>
+#include <vector>
 #include "BaseModule.hh"
 #include "Reader.hh"
+#include "BlockCodec.hh"
+
+#ifndef SINGLETHREAD
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
 
 /** @class RawWriter
     @brief Stores the raw data buffer onto disk in gzip'ped format
+
+    If compression_threads is greater than 0, Process only queues the event;
+    a pool of workers compresses the datablocks and a single writer thread
+    puts them on disk in the order they arrived.  Process blocks only when
+    the queued events would use more than max_pending_bytes.
+
+    Each file is closed with a trailer listing the offset and id of every 
+    event, so that Reader can find events and totals without a full scan.
     @ingroup modules
 */
 class RawWriter : public BaseModule{
@@ -34,28 +51,72 @@ public:
   }
   /// Get the level of gzip compression being used
   int GetCompressionLevel(){ return _compression; }
+  /// Get the algorithm used to compress datablocks
+  BlockCodec::CODEC GetCompressionCodec(){ return _codec; }
   /// Check the status of the output file 
   bool IsOK(){ return _ok; }
-  /// Get the total number of uncompressed bytes written so far
-  long long GetBytesWritten(){ return _bytes_written; }
+  /// Get the total number of compressed bytes written so far
+  long long GetBytesWritten();
+  /// Get the number of worker threads compressing events
+  int GetCompressionThreads(){ return _compression_threads; }
+  /// Get the number of times Process waited for the queue to drain
+  long GetPipelineStalls(){ return _pipeline_stalls; }
   /// Get the default filename
   std::string GetDefaultFilename() const;
   std::string GetFilename() const { return _filename; }
   void SetFilename(const std::string& name){ _filename = name; }
   
+  /** Append an event that is already compressed, e.g. from 
+      Reader::GetNextCompressedEvent, without inflating it.  File splitting 
+      and the global_header counters are handled as in Process.
+  */
+  int WriteCompressedEvent(const std::vector<char>& buf);
+  
   void SetSaveConfig(bool save) { _save_config = save; }
   bool GetSaveConfig(){ return _save_config; }
+  /// Get the name of the config file saved next to the raw data
+  std::string GetConfigFilename() const;
 private:
+  /** @struct pending_write
+      @brief An event queued for the compression workers and the writer
+  */
+  struct pending_write{
+    RawEventPtr raw;        ///< the event to compress; released when done
+    std::vector<char> buf;  ///< the compressed event, ready for disk
+    long long cost;         ///< bytes charged against max_pending_bytes
+    bool done;              ///< has buf been filled?
+    int status;             ///< return value of CompressEvent
+    pending_write() : cost(0), done(false), status(0) {}
+  };
+  typedef std::shared_ptr<pending_write> PendingWritePtr;
+  
   ///Save config file to go with raw data
   void SaveConfigFile();
   int OpenNewFile();
   int CloseCurrentFile();
+  /// Compress the datablocks of <raw> into <buf> behind an event header
+  int CompressEvent(RawEventPtr raw, std::vector<char>& buf);
+  /// Write a compressed event to disk, starting a new file if needed
+  int WriteToFile(const std::vector<char>& buf);
+  /// Start the compression workers and the writer thread
+  int StartPipeline();
+  /// Write out everything queued and stop the threads
+  int StopPipeline();
+#ifndef SINGLETHREAD
+  /// Add an event to the pipeline, waiting for memory if necessary
+  int QueueEvent(PendingWritePtr pending);
+  /// Main loop for the compression workers
+  void CompressLoop();
+  /// Main loop for the writer thread
+  void WriterLoop();
+#endif
   
   std::string _filename;
   std::string _directory;
   bool _create_directory;
   std::string _autonamebase;
   int _compression;
+  BlockCodec::CODEC _codec;
   bool _save_config;
   bool _write_database;
 
@@ -67,8 +128,28 @@ private:
   long long _bytes_written;
   uint32_t _max_file_size;
   int _max_event_in_file;
+  int _compression_threads;
+  long long _max_pending_bytes;
   
   Reader::global_header _ghead;
+  /// offsets of the events in the current file, for its trailer
+  std::vector<Reader::trailer_entry> _offsets;
+  
+  bool _pipeline_running;  ///< are the compression threads active?
+  long _pipeline_stalls;   ///< times Process waited for memory
+#ifndef SINGLETHREAD
+  std::deque<PendingWritePtr> _write_queue;    ///< events in arrival order
+  std::deque<PendingWritePtr> _compress_queue; ///< events not yet compressed
+  long long _pending_bytes;  ///< memory held by queued events
+  int _pipeline_error;       ///< first error from the writer thread
+  bool _pipeline_stop;       ///< tell the threads to exit once drained
+  std::mutex _write_mutex;   ///< protects the queues and counters
+  std::condition_variable _work_ready;  ///< new event to compress
+  std::condition_variable _event_compressed; ///< a queued event is done
+  std::condition_variable _space_ready; ///< queued memory was released
+  std::vector<std::thread> _compress_threads; ///< compression workers
+  std::thread _writer_thread;           ///< writes events in order
+#endif
 };
 
 #endif
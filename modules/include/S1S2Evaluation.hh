@@ -23,6 +23,7 @@ public:
   int Initialize();
   int Finalize();
   int Process(EventPtr evt);
+  BaseModule* Clone() const { return new S1S2Evaluation(*this); }
   
   static std::string GetDefaultName(){ return "S1S2Evaluation"; }
 private:
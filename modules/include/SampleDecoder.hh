@@ -0,0 +1,88 @@
+/** @file SampleDecoder.hh
+    @brief Defines the SampleDecoder class to convert raw digitizer samples
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef SAMPLEDECODER_h
+#define SAMPLEDECODER_h
+
+#include "ChannelData.hh"
+#include <vector>
+#include <utility>
+#include <iostream>
+
+/** @class SampleDecoder
+    @brief Convert raw V172X samples to sample_t, finding the extremes as it goes
+
+    The raw formats are picked by sample_bits as in V172X_BoardData:
+    8-bit samples are single bytes, 10-bit samples are packed up to 3 to a
+    32-bit word (the top 2 bits say how many), samples up to 16 bits are
+    16-bit words and anything larger are 32-bit words.  Inverted samples
+    are stored as (range - sample).
+
+    On x86 the 8, 10 and 16-bit formats have SSE4.1 and AVX2 versions,
+    picked when first used according to what the CPU supports; everything
+    else, and every format on other CPUs, uses the plain loop.  All versions
+    give exactly the same results, including which of several equal extremes
+    is reported (always the first).
+    @ingroup modules
+*/
+class SampleDecoder{
+public:
+  /// Instruction sets the decoders can use, in increasing order of speed
+  enum INSTRUCTION_SET { SCALAR=0, SSE4=1, AVX2=2 };
+
+  /// The first largest and smallest samples of a waveform
+  struct Extremes{
+    int max_index;  ///< index of the first largest sample
+    int min_index;  ///< index of the first smallest sample
+    double max;     ///< value of the largest sample
+    double min;     ///< value of the smallest sample
+  };
+
+  /// Get the fastest instruction set supported by this CPU and compiler
+  static INSTRUCTION_SET GetBestInstructionSet();
+  /// Get the instruction set being used
+  static INSTRUCTION_SET GetInstructionSet();
+  /** Use <set> (or the best available, if that is slower) from now on.
+      Meant for comparing the versions; not safe while decoding.
+  */
+  static void SetInstructionSet(INSTRUCTION_SET set);
+  /// Get a printable name for the instruction set
+  static const char* GetName(INSTRUCTION_SET set);
+
+  /// Count the samples between <start> and <end>
+  static int CountSamples(const char* start, const char* end, int sample_bits);
+  /** Convert the samples between <start> and <end> into <out>, which must
+      have room for CountSamples of them.  If <out> is 0, only look for
+      the extremes.  If <extremes> is not 0, fill it.
+      @return the number of samples
+  */
+  static int Decode(const char* start, const char* end, int sample_bits,
+		    bool invert, double range,
+		    sample_t* out, Extremes* extremes);
+  /** Convert a zero-length-encoded channel starting at <start> into <wave>.
+      <samples_per_word> converts the sizes in the control words to samples.
+      Each good region is listed in <regions>; the samples in between are
+      set to those of the next region, or the previous for the last one.
+      @return the number of samples
+  */
+  static int DecodeZLE(const char* start, int sample_bits,
+		       int samples_per_word, bool invert, double range,
+		       std::vector<sample_t>& wave,
+		       std::vector<std::pair<int,int> >& regions,
+		       Extremes* extremes);
+
+private:
+  static INSTRUCTION_SET _instruction_set; ///< what Decode uses
+};
+
+/// INSTRUCTION_SET ostream overload
+std::ostream& operator<<(std::ostream& out,
+			 const SampleDecoder::INSTRUCTION_SET& set);
+/// INSTRUCTION_SET istream overload
+std::istream& operator>>(std::istream& in,
+			 SampleDecoder::INSTRUCTION_SET& set);
+
+#endif
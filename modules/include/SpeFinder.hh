@@ -22,6 +22,7 @@ public:
   int Initialize();
   int Finalize();
   int Process(ChannelData* chdata);
+  BaseModule* Clone() const { return new SpeFinder(*this); }
   
   static const std::string GetDefaultName(){ return "SpeFinder";}
   
@@ -11,6 +11,12 @@
 
 /** @class SumChannels
     @brief Creates an extra 'channel' which is the sum of all channels 
+    
+    The channels are lined up at their trigger samples, keeping only the
+    samples every channel has, and added in order straight into the sum's
+    waveform.  The adding uses AVX2 when SampleDecoder allows it (see
+    ConvertData's instruction_set), with the same results as the plain
+    loop.
     @ingroup modules
 */
 class SumChannels : public BaseModule
@@ -22,9 +28,13 @@ public:
   int Initialize();
   int Finalize();
   int Process(EventPtr event);
+  BaseModule* Clone() const { return new SumChannels(*this); }
   
   static const std::string GetDefaultName(){ return "SumChannels";}
   
+private:
+  /// Should <chdata> be added to the sum?
+  bool IsSummed(const ChannelData& chdata) const;
 };
 
 #endif
@@ -21,6 +21,7 @@ public:
   int Initialize();
   int Finalize();
   int Process(EventPtr evt);
+  BaseModule* Clone() const { return new SumOfIntegralEval(*this); }
   static const std::string GetDefaultName(){ return "SumOfIntegralEval"; }
 
 private:
@@ -0,0 +1,75 @@
+/** @file ThreadPool.hh
+    @brief Defines the ThreadPool shared by modules for parallel loops
+    @author bloer
+    @ingroup modules
+*/
+
+#ifndef THREADPOOL_h
+#define THREADPOOL_h
+
+#ifndef SINGLETHREAD
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#include <functional>
+#include <vector>
+#include <cstddef>
+
+/** @class ThreadPool
+    @brief Set of threads which help the caller run the iterations of a loop
+
+    ParallelFor hands out the indices one at a time to the pool threads and
+    to the calling thread, which keeps working instead of waiting, and
+    returns once every index is done.  Each index is processed exactly once,
+    so as long as the iterations only write to their own results the outcome
+    doesn't depend on the number of threads.  Only one loop runs on the pool
+    at a time; if another thread calls ParallelFor meanwhile, or an
+    iteration calls it again, that loop simply runs serially on its thread.
+    @ingroup modules
+*/
+class ThreadPool{
+private:
+  /// ThreadPool is singleton, so no public constructor
+  ThreadPool();
+  ThreadPool(const ThreadPool& right);
+  ThreadPool& operator=(const ThreadPool& right);
+public:
+  /// Get the global singleton pointer
+  static ThreadPool* GetInstance();
+  ~ThreadPool();
+
+  /// Set the number of threads helping the caller; 0 to run loops serially
+  int SetNThreads(int nthreads);
+  /// Get the number of threads helping the caller
+  int GetNThreads() const { return _nthreads; }
+
+  /// Call func(i) for every i in [0,n), returning when all are done
+  void ParallelFor(size_t n, const std::function<void(size_t)>& func);
+
+private:
+  int _nthreads;                 ///< number of running pool threads
+#ifndef SINGLETHREAD
+  /// Help with the current loop until told to stop
+  void WorkerLoop();
+  /// Run iterations of the current loop until there are none left
+  void RunIterations();
+
+  std::mutex _loop_mutex;        ///< held by the thread using the pool
+  std::mutex _mutex;             ///< protects the loop state below
+  std::condition_variable _start; ///< signal workers there's a new loop
+  std::condition_variable _finished; ///< signal a worker left the loop
+  const std::function<void(size_t)>* _func; ///< body of the current loop
+  size_t _n;                     ///< number of iterations in the loop
+  std::atomic<size_t> _next;     ///< next index to hand out
+  long _generation;              ///< counts the loops started
+  bool _open;                    ///< can workers still join the loop?
+  int _busy;                     ///< workers inside the current loop
+  bool _stop;                    ///< tell the workers to quit
+  std::vector<std::thread> _threads; ///< the pool threads
+#endif
+};
+
+#endif
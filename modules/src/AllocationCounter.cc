@@ -0,0 +1,67 @@
+#include "AllocationCounter.hh"
+
+#ifdef COUNT_ALLOCATIONS
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+//constant-initialized, so it works for allocations before main
+static std::atomic<long> allocations(0);
+
+void* operator new(std::size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size ? size : 1);
+  if(!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+bool AllocationCounter::IsEnabled()
+{
+  return true;
+}
+
+long AllocationCounter::GetCount()
+{
+  return allocations.load(std::memory_order_relaxed);
+}
+
+#else
+
+bool AllocationCounter::IsEnabled()
+{
+  return false;
+}
+
+long AllocationCounter::GetCount()
+{
+  return 0;
+}
+
+#endif
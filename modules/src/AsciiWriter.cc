@@ -49,7 +49,7 @@ int AsciiWriter::Process(ChannelData* chdata)
 	 <<chdata->trigger_index<<std::endl;
     _wrote_header = true;
   }
-  double* wave = chdata->GetWaveform();
+  sample_t* wave = chdata->GetWaveform();
   for(int samp = 0; samp < chdata->nsamps; samp++){
       _fout<<wave[samp]<<"\t";
   }
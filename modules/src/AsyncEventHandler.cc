@@ -1,6 +1,8 @@
 #include "AsyncEventHandler.hh"
 #include "BaseModule.hh"
 #include "EventHandler.hh"
+#include "Message.hh"
+#include <stdexcept>
 
 #ifndef SINGLETHREAD
 #include <thread>
@@ -9,9 +11,60 @@
 typedef std::unique_lock<std::mutex> scoped_lock;
 #endif
 
-AsyncEventHandler::AsyncEventHandler() : _running(false), _sleeptime(0), 
-					 _blocking(false)
-{}
+std::ostream& operator<<(std::ostream& out,
+			 const AsyncEventHandler::QUEUE_POLICY& policy)
+{
+  switch(policy){
+  case AsyncEventHandler::BLOCK:
+    out<<"BLOCK";
+    break;
+  case AsyncEventHandler::DROP_OLDEST:
+    out<<"DROP_OLDEST";
+    break;
+  case AsyncEventHandler::KEEP_NTH:
+    out<<"KEEP_NTH";
+    break;
+  case AsyncEventHandler::RATE_LIMIT:
+    out<<"RATE_LIMIT";
+    break;
+  }
+  return out;
+}
+
+std::istream& operator>>(std::istream& in,
+			 AsyncEventHandler::QUEUE_POLICY& policy)
+{
+  std::string dummy;
+  in>>dummy;
+  if(dummy == "BLOCK" || dummy == "block")
+    policy = AsyncEventHandler::BLOCK;
+  else if(dummy == "DROP_OLDEST" || dummy == "drop_oldest")
+    policy = AsyncEventHandler::DROP_OLDEST;
+  else if(dummy == "KEEP_NTH" || dummy == "keep_nth")
+    policy = AsyncEventHandler::KEEP_NTH;
+  else if(dummy == "RATE_LIMIT" || dummy == "rate_limit")
+    policy = AsyncEventHandler::RATE_LIMIT;
+  else{
+    throw std::invalid_argument(dummy+" is not a valid value for queue_policy!");
+  }
+  return in;
+}
+
+AsyncEventHandler::AsyncEventHandler(const std::string& name) :
+  ParameterList(name, "Process events on a separate thread"),
+  _running(false), _sleeptime(0), _offered(0), _processed(0), _dropped(0),
+  _busy(false)
+{
+  RegisterParameter("queue_policy", _policy = DROP_OLDEST,
+		    "What to do with events arriving faster than we process "
+		    "them: BLOCK, DROP_OLDEST, KEEP_NTH, or RATE_LIMIT");
+  RegisterParameter("queue_size", _queue_size = 1,
+		    "Number of events which can wait to be processed");
+  RegisterParameter("keep_every", _keep_every = 10,
+		    "With KEEP_NTH policy, process only one in this many events");
+  RegisterParameter("max_rate", _max_rate = 10,
+		    "With RATE_LIMIT policy, max events per second to process");
+}
 
 AsyncEventHandler::~AsyncEventHandler()
 {
@@ -47,23 +100,73 @@ int AsyncEventHandler::AddReceiver(AsyncEventHandler* receiver)
   return _receivers.size();
 }
 
+bool AsyncEventHandler::AcceptEvent()
+{
+  switch(_policy){
+  case KEEP_NTH:
+    return _keep_every <= 1 || (_offered-1) % _keep_every == 0;
+  case RATE_LIMIT:
+    if(_max_rate > 0){
+      std::chrono::steady_clock::time_point now =
+	std::chrono::steady_clock::now();
+      if(now < _next_accept)
+	return false;
+      _next_accept = now + std::chrono::duration_cast
+	<std::chrono::steady_clock::duration>
+	(std::chrono::duration<double>(1./_max_rate));
+    }
+    return true;
+  default:
+    return true;
+  }
+}
+
 int AsyncEventHandler::Process(EventPtr evt)
 {
   //noop if no multithread
 #ifdef SINGLETHREAD
   Message(WARNING)<<"Attempt to use AsyncEventHandler with multithreading disabled!\n";
 #else
-  if(_running){
-    scoped_lock lock(_event_mutex);
-    while(_blocking && _next_event){
-      //only go if _next_event is not filled
-      lock.unlock();
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
-      lock.lock();
+  scoped_lock lock(_event_mutex);
+  if(!_running)
+    return 0;
+  if(!evt){
+    //end of the run: either let the queue drain or throw it away
+    if(_policy == BLOCK){
+      while(_running && (_busy || !_queue.empty()))
+	_event_taken.wait(lock);
+    }
+    else{
+      _dropped += _queue.size();
+      _queue.clear();
+    }
+    return 0;
+  }
+  ++_offered;
+  if(!AcceptEvent()){
+    ++_dropped;
+    return 0;
+  }
+  size_t max_queued = (_queue_size > 0 ? _queue_size : 1);
+  if(_policy == BLOCK){
+    while(_running && _queue.size() >= max_queued)
+      _event_taken.wait(lock);
+    if(!_running){
+      ++_dropped;
+      return 0;
     }
-    _next_event = evt; 
-    _event_ready.notify_one();
   }
+  else{
+    while(_queue.size() >= max_queued){
+      _queue.pop_front();
+      ++_dropped;
+    }
+  }
+  //our thread and others may read the event from now on, so don't leave
+  //any waveform to be decoded on first use
+  evt->GetEventData()->DecodeWaveforms();
+  _queue.push_back(evt);
+  _event_ready.notify_one();
 #endif
   return 0;
 }
@@ -100,53 +203,62 @@ int AsyncEventHandler::StopRunning()
 {
   if(!_running)
     return 1;
-  _running = false;
 #ifndef SINGLETHREAD
-  //wake up the thread if it's sleeping
   Message(DEBUG)<<"Ending AsyncEventHandler on thread "<<_threadptr->get_id()
 		<<"...\n";
-  Process(EventPtr());
+  {
+    scoped_lock lock(_event_mutex);
+    _running = false;
+    _dropped += _queue.size();
+    _queue.clear();
+    //wake up the thread if it's waiting, and anyone waiting on it
+    _event_ready.notify_all();
+    _event_taken.notify_all();
+  }
   _threadptr->join();
+  Message(INFO)<<GetDefaultKey()<<" processed "<<_processed<<" events and "
+	       <<"dropped "<<_dropped<<".\n";
+#else
+  _running = false;
 #endif
   return 0;
-  
 }
 
 void AsyncEventHandler::operator()()
 {
 #ifndef SINGLETHREAD
-  //need a dummy mutex for condition_variable to work
-  std::mutex dummy_mutex;
-  EventPtr current_event;
-  while(_running){
-    scoped_lock lock(_event_mutex);
-    if(!_next_event || _next_event == current_event){
-      _event_ready.wait_for(lock,std::chrono::milliseconds(1000));
-      continue;
-    }
-    //if we get here, process the event
-    current_event = _next_event;
-    if(!_blocking)
-      lock.unlock();
+  scoped_lock lock(_event_mutex);
+  while(true){
+    while(_running && _queue.empty())
+      _event_ready.wait(lock);
+    if(!_running)
+      break;
+    EventPtr current_event = _queue.front();
+    _queue.pop_front();
+    _busy = true;
+    _event_taken.notify_all();
+    lock.unlock();
     for(size_t i=0; i<_modules.size(); ++i){
       if(_modules[i]->enabled){
 	_modules[i]->HandleEvent(current_event);
-	//std::this_thread::sleep_for(std::chrono::microseconds(2) );
       }
     }
     //done processing, hand off to receivers
     for(size_t i=0; i<_receivers.size(); ++i){
       _receivers[i]->Process(current_event);
     }
-    if(!_blocking){
-      if(_sleeptime>0){
-	std::this_thread::sleep_for(std::chrono::milliseconds(_sleeptime));
-      }
-      else
-	std::this_thread::yield();
-    }
-    else{
-      _next_event = EventPtr();
+    current_event.reset();
+    lock.lock();
+    _busy = false;
+    ++_processed;
+    _event_taken.notify_all();
+    if(_policy != BLOCK && _sleeptime > 0){
+      //rest, but wake up right away if we're told to stop
+      std::chrono::steady_clock::time_point wake =
+	std::chrono::steady_clock::now() +
+	std::chrono::milliseconds(_sleeptime);
+      while(_running && std::chrono::steady_clock::now() < wake)
+	_event_ready.wait_until(lock, wake);
     }
   }
 #endif
@@ -125,7 +125,10 @@ int AveragePSD::Process(ChannelData* chdata)
     Message(ERROR)<<"Can't load ROOT FFT module\n";
     return 1;
   }
-  fftgen->SetPoints(chdata->GetWaveform() + samp0);
+  //the FFT wants doubles, whatever the sample type
+  const sample_t* wave = chdata->GetWaveform() + samp0;
+  std::vector<double> points(wave, wave + nsamps);
+  fftgen->SetPoints(&(points[0]));
   fftgen->Transform();
   double re, im;
   //start at bin1 to suppress the large DC component
@@ -24,6 +24,7 @@ AverageWaveforms::AverageWaveforms() :
     AddDependency<SumChannels>();
     AddDependency<BaselineFinder>();
     AddDependency<PulseFinder>();
+    SetNoOutputs();
     //AddDependency<RootWriter>();
 
     //Register all the config handler parameters
@@ -215,7 +216,7 @@ int AverageWaveforms::Process(EventPtr evt)
       //Message(INFO) << "Processing run: " << event->run_id << " Event: " << event->event_id <<" Channel: "<<ch<<endl;
 
 	_num_event[chdata.channel_id]++;
-	const double* wave = chdata.GetBaselineSubtractedWaveform();
+	const sample_t* wave = chdata.GetBaselineSubtractedWaveform();
 	int start_samp; 
 	int end_samp; 
 	if (align_by_peak == true)
@@ -3,7 +3,8 @@
 
 
 BaseModule::BaseModule(const std::string& name, const std::string& helptext) : 
-  ParameterList(name, helptext), _last_process_return(0)
+  ParameterList(name, helptext), _last_process_return(0), 
+  _outputs_declared(false), _owns_cuts(true)
 {
   RegisterParameter("enabled", enabled = true,
 		    "Is this module enabled for this run?");
@@ -14,23 +15,46 @@ BaseModule::BaseModule(const std::string& name, const std::string& helptext) :
 		    "List of modules that need to process before us");
 }
 
+BaseModule::BaseModule(const BaseModule& right) : 
+  ParameterList(right), enabled(right.enabled), 
+  _last_process_return(0), _dependencies(right._dependencies),
+  _outputs(right._outputs), _inputs(right._inputs),
+  _outputs_declared(right._outputs_declared), _cuts(right._cuts),
+  _skip_channels(right._skip_channels), _owns_cuts(false)
+{}
+
 BaseModule::~BaseModule()
 {
   
   //delete cuts
-  for(size_t i=0; i < _cuts.size(); i++)
-    delete _cuts[i];
+  if(_owns_cuts){
+    for(size_t i=0; i < _cuts.size(); i++)
+      delete _cuts[i];
+  }
   _cuts.clear();
 }
 
 
 int BaseModule::HandleEvent(EventPtr event, bool process_now)
 {
+  //only look at the clocks if someone wants to know
+  const bool timed = ModuleTimer::IsEnabled();
+  long wall_start = 0, cpu_start = 0;
+  if(timed){
+    wall_start = ModuleTimer::WallNow();
+    cpu_start = ModuleTimer::CpuNow();
+  }
   // see if our cuts pass, and actually do the processing
-  if(CheckCuts(event))
+  const bool passed = CheckCuts(event);
+  if(passed)
     _last_process_return = Process(event);
   else
     _last_process_return = 0;
+  if(timed){
+    _timer.Record(passed, _last_process_return != 0,
+		  ModuleTimer::WallNow() - wall_start,
+		  ModuleTimer::CpuNow() - cpu_start);
+  }
   if(_last_process_return){
     Message(ERROR)<<"Module "<<GetName()<<" returns "
 		  <<_last_process_return
@@ -60,7 +84,7 @@ bool BaseModule::CheckCuts(EventPtr event){
 void BaseModule::ClearCuts()
 { 
   for(std::vector<ProcessingCut*>::iterator it = _cuts.begin(); 
-      it != _cuts.end(); it++){
+      it != _cuts.end() && _owns_cuts; it++){
     delete *it;
   }
   _cuts.clear();
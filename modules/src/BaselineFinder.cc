@@ -4,6 +4,10 @@
 #include "SumChannels.hh"
 #include "intarray.hh"
 #include "RootWriter.hh"
+#include "Integrator.hh"
+#include "EvalRois.hh"
+#include "Roi.hh"
+#include "EventHandler.hh"
 #include "TGraph.h"
 #include <vector>
 #include <cmath>
@@ -13,20 +17,30 @@
 #include <functional>
 #include <algorithm>
 #include <numeric>
+#include <cstring>
 
 BaselineFinder::BaselineFinder():
   ChannelModule(GetDefaultName(), "Find the baseline (zero) of the channel in the samples read before the trigger"),
   fixed_params("fixed_params","Parameters for fixed baseline search mode"),
   interp_params("interp_params","Parameters for linear interpolation mode"),
-  drifting_params("drifting params","Parameters for drifting baseline search")
+  drifting_params("drifting params","Parameters for drifting baseline search"),
+  _fused_integrator(0), _fused_rois(0)
 {
   AddDependency<ConvertData>();
+  _channels_independent = true;
   
   //Register all the config handler parameters
   RegisterParameter("fixed_baseline", fixed_baseline = false,
 		    "Search for a flat baseline in pre-trigger window, otherwise search for a drifting baseline");
   RegisterParameter("signal_begin_time", signal_begin_time = 0,
 		    "Search for baseline before this time [us] ");
+  RegisterParameter("fuse_downstream", fuse_downstream = false,
+		    "Integrate and evaluate ROIs in the same pass as the "
+		    "baseline subtraction, instead of in Integrator and "
+		    "EvalRois");
+  RegisterParameter("validate_fused", validate_fused = false,
+		    "Check the fuse_downstream results against Integrator "
+		    "and EvalRois on every channel (slow)");
   
   //parameters for fixed baseline
   RegisterParameter("fixed_params",fixed_params);
@@ -85,6 +99,39 @@ BaselineFinder::BaselineFinder():
 		     "Save identified interpolation regions as spe");
 }
 
+BaselineFinder::BaselineFinder(const BaselineFinder& right) :
+  ChannelModule(right), 
+  fixed_baseline(right.fixed_baseline),
+  linear_interpolation(right.linear_interpolation),
+  fuse_downstream(right.fuse_downstream),
+  validate_fused(right.validate_fused),
+  fixed_params(right.fixed_params.GetDefaultKey()),
+  segment_samps(right.segment_samps),
+  min_valid_samps(right.min_valid_samps),
+  max_sigma(right.max_sigma),
+  max_sigma_diff(right.max_sigma_diff),
+  max_mean_diff(right.max_mean_diff),
+  interp_params(right.interp_params.GetDefaultKey()),
+  avg_samps(right.avg_samps),
+  max_sigma_factor(right.max_sigma_factor),
+  pulse_threshold(right.pulse_threshold),
+  cooldown(right.cooldown),
+  pre_cooldown(right.pre_cooldown),
+  drifting_params(right.drifting_params.GetDefaultKey()),
+  max_amplitude(right.max_amplitude),
+  max_return_amplitude(right.max_return_amplitude),
+  max_sum_amplitude(right.max_sum_amplitude),
+  signal_begin_time(right.signal_begin_time),
+  pre_samps(right.pre_samps),
+  post_samps(right.post_samps),
+  save_interpolations(right.save_interpolations),
+  laserwindow_begin_time(right.laserwindow_begin_time),
+  laserwindow_end_time(right.laserwindow_end_time),
+  laserwindow_freeze(right.laserwindow_freeze),
+  _fused_integrator(right._fused_integrator),
+  _fused_rois(right._fused_rois)
+{}
+
 BaselineFinder::~BaselineFinder()
 {
   Finalize();
@@ -92,6 +139,41 @@ BaselineFinder::~BaselineFinder()
 
 int BaselineFinder::Initialize()
 {
+  _fused_integrator = 0;
+  _fused_rois = 0;
+  EventHandler* handler = EventHandler::GetInstance();
+  Integrator* integrator = handler->GetModule<Integrator>();
+  EvalRois* rois = handler->GetModule<EvalRois>();
+  if(integrator) integrator->SetFused(false);
+  if(rois) rois->SetFused(false);
+  if(!fuse_downstream)
+    return 0;
+  
+  if(integrator && integrator->enabled){
+    if(SelectsSameChannels(integrator))
+      _fused_integrator = integrator;
+    else
+      Message(WARNING)<<"Integrator selects different channels than "
+		      <<GetName()<<"; not fusing it.\n";
+  }
+  if(rois && rois->enabled){
+    if(!SelectsSameChannels(rois))
+      Message(WARNING)<<"EvalRois selects different channels than "
+		      <<GetName()<<"; not fusing it.\n";
+    //EvalRois uses the integral, so it can't run ahead of the Integrator
+    else if(integrator && integrator->enabled && !_fused_integrator)
+      Message(WARNING)<<"Integrator is not fused; not fusing EvalRois.\n";
+    else
+      _fused_rois = rois;
+  }
+  if(_fused_integrator){
+    _fused_integrator->SetFused(true);
+    Message(INFO)<<"Integrating in "<<GetName()<<".\n";
+  }
+  if(_fused_rois){
+    _fused_rois->SetFused(true);
+    Message(INFO)<<"Evaluating ROIs in "<<GetName()<<".\n";
+  }
   return 0;
 }
 
@@ -109,8 +191,8 @@ int BaselineFinder::Process(ChannelData* chdata)
 int BaselineFinder::DriftingBaseline(ChannelData* chdata)
 {
   Baseline& baseline = chdata->baseline;
-  double* wave = chdata->GetWaveform();
-  std::vector<double>& baseform = chdata->subtracted_waveform;
+  sample_t* wave = chdata->GetWaveform();
+  std::vector<sample_t>& baseform = chdata->subtracted_waveform;
   const int nsamps = chdata->nsamps;
   baseform.resize(nsamps);
   
@@ -119,8 +201,6 @@ int BaselineFinder::DriftingBaseline(ChannelData* chdata)
   if(pre_trig_samp < 0) pre_trig_samp = pre_samps+post_samps;
   if(pre_trig_samp >= nsamps) pre_trig_samp = nsamps-1;
   double max_pre_trig = *std::max_element(wave,wave+pre_trig_samp);
-  double mean_pre_trig = std::accumulate(wave,wave+pre_trig_samp,0.) /
-    pre_trig_samp;
   if( std::abs(chdata->GetVerticalRange() - max_pre_trig ) < 0.01)
     baseline.saturated = true;
   //loop through the data, calculating a moving average as we go,
@@ -216,6 +296,7 @@ int BaselineFinder::DriftingBaseline(ChannelData* chdata)
       sum_samps = 0;
       if(!baseline.found_baseline && samp > pre_trig_samp){
 	//can't find baseline in pre-trigger region! abort!
+	FinishChannel(chdata, false);
 	return 0;
       }
       //continue;
@@ -226,23 +307,169 @@ int BaselineFinder::DriftingBaseline(ChannelData* chdata)
     baseform[samp] = baseform[last_good_samp];
   }
   //subtract off the baseline
-  for(samp=0; samp<nsamps; samp++){
-    baseform[samp] = wave[samp]-baseform[samp];
-  }
+  FinishChannel(chdata, true);
       
   return 0;
 }
 
+/// Samples handled at once in the fused pass; a few blocks fit in L1 cache
+static const int fused_block_samps = 1024;
+
+/// Sort the indices of ROIs by the sample where they end
+class RoiEndsBefore{
+  const std::vector<Roi>& _regions;
+public:
+  RoiEndsBefore(const std::vector<Roi>& regions) : _regions(regions) {}
+  bool operator()(size_t a, size_t b) const
+  { return _regions[a].end_index < _regions[b].end_index; }
+};
+
+void BaselineFinder::FinishChannel(ChannelData* chdata, bool subtract)
+{
+  const int nsamps = chdata->nsamps;
+  if(!chdata->baseline.found_baseline || (!_fused_integrator && !_fused_rois)){
+    if(subtract){
+      const sample_t* wave = chdata->GetWaveform();
+      sample_t* baseform = chdata->GetBaselineSubtractedWaveform();
+      for(int samp=0; samp<nsamps; samp++)
+	baseform[samp] = wave[samp]-baseform[samp];
+    }
+    //nothing to stream through; do whatever the modules would have done
+    if(_fused_integrator)
+      _fused_integrator->Integrate(chdata);
+    if(_fused_rois)
+      _fused_rois->Evaluate(chdata);
+    return;
+  }
+  const sample_t* wave = chdata->GetWaveform();
+  sample_t* baseform = chdata->GetBaselineSubtractedWaveform();
+  
+  double* integral = 0;
+  if(_fused_integrator){
+    chdata->integral.resize(nsamps);
+    integral = &(chdata->integral[0]);
+  }
+  //regions are appended in order, but evaluated once we pass their end
+  std::vector<Roi>& regions = chdata->regions;
+  const size_t first_roi = regions.size();
+  std::vector<size_t> pending;
+  if(_fused_rois){
+    regions.resize(first_roi + _fused_rois->GetNRegions());
+    for(size_t roi = first_roi; roi < regions.size(); roi++){
+      _fused_rois->SetRoiRange(chdata, roi-first_roi, regions[roi]);
+      pending.push_back(roi);
+    }
+    std::sort(pending.begin(), pending.end(), RoiEndsBefore(regions));
+  }
+  
+  size_t next_roi = 0;
+  int max_index = 0, min_index = 0;
+  for(int start = 0; start < nsamps; start += fused_block_samps){
+    const int end = std::min(start + fused_block_samps, nsamps);
+    if(subtract){
+      for(int samp=start; samp<end; samp++)
+	baseform[samp] = wave[samp]-baseform[samp];
+    }
+    if(integral){
+      int samp = start;
+      if(samp == 0)
+	integral[samp++] = baseform[0];
+      for( ; samp<end; samp++){
+	integral[samp] = _fused_integrator->IntegralStep(integral[samp-1],
+							 baseform[samp]);
+	//keep the first of equal extremes, as std::max_element does
+	if(integral[max_index] < integral[samp]) max_index = samp;
+	if(integral[samp] < integral[min_index]) min_index = samp;
+      }
+    }
+    //a region needs its samples and the integral at its end
+    while(next_roi < pending.size() && 
+	  regions[pending[next_roi]].end_index < end){
+      _fused_rois->EvalRoi(chdata, regions[pending[next_roi++]]);
+    }
+  }
+  for( ; next_roi < pending.size(); next_roi++)
+    _fused_rois->EvalRoi(chdata, regions[pending[next_roi]]);
+  if(_fused_integrator)
+    _fused_integrator->SetIntegralInfo(chdata, max_index, min_index);
+  
+  if(validate_fused)
+    ValidateFused(chdata, first_roi);
+}
+
+/// Compare bit for bit, so that a NaN matches itself
+static bool SameBits(double a, double b)
+{
+  return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+int BaselineFinder::ValidateFused(ChannelData* chdata, size_t first_roi)
+{
+  ChannelData check(*chdata);
+  check.regions.resize(first_roi);
+  if(_fused_integrator){
+    check.integral.clear();
+    _fused_integrator->Integrate(&check);
+  }
+  if(_fused_rois)
+    _fused_rois->Evaluate(&check);
+  
+  int mismatches = 0;
+  if(check.integral.size() != chdata->integral.size())
+    mismatches++;
+  else{
+    for(size_t samp=0; samp<check.integral.size(); samp++){
+      if(!SameBits(check.integral[samp], chdata->integral[samp]))
+	mismatches++;
+    }
+  }
+  if(_fused_integrator){
+    if(check.integral_max_index != chdata->integral_max_index ||
+       check.integral_min_index != chdata->integral_min_index ||
+       !SameBits(check.integral_max, chdata->integral_max) ||
+       !SameBits(check.integral_min, chdata->integral_min))
+      mismatches++;
+    std::vector<Spe>& interps = chdata->baseline.interpolations;
+    for(size_t i=0; i<interps.size(); i++){
+      if(!SameBits(check.baseline.interpolations[i].integral,
+		   interps[i].integral))
+	mismatches++;
+    }
+  }
+  if(check.regions.size() != chdata->regions.size())
+    mismatches++;
+  else{
+    for(size_t i=first_roi; i<check.regions.size(); i++){
+      const Roi& a = check.regions[i];
+      const Roi& b = chdata->regions[i];
+      if(a.start_index != b.start_index || a.end_index != b.end_index ||
+	 a.min_index != b.min_index || !SameBits(a.max, b.max) ||
+	 !SameBits(a.min, b.min) || !SameBits(a.integral, b.integral) ||
+	 !SameBits(a.npe, b.npe))
+	mismatches++;
+    }
+  }
+  if(mismatches){
+    Message(ERROR)<<"Fused pass differs from Integrator and EvalRois in "
+		  <<mismatches<<" values on channel "<<chdata->channel_id
+		  <<"\n";
+  }
+  return mismatches;
+}
+
 //search for a flat baseline in the pre-trigger window
 int BaselineFinder::FixedBaseline(ChannelData* chdata){
 	
 	Baseline & baseline = chdata->baseline;
-	double * wave = chdata->GetWaveform();
+	sample_t* wave = chdata->GetWaveform();
 	const int nsamps = chdata->nsamps;
 	
 	//find the maximum sample value within the pre_trigger area
 	int pre_trig_samp = chdata->TimeToSample(signal_begin_time);
-	if(pre_trig_samp <= 0 || pre_trig_samp >= nsamps) return 0;
+	if(pre_trig_samp <= 0 || pre_trig_samp >= nsamps){
+		FinishChannel(chdata, false);
+		return 0;
+	}
 	double max_pre_trig = *std::max_element(wave,wave+pre_trig_samp);
 	double min_pre_trig = *std::min_element(wave,wave+pre_trig_samp);
 	if( std::abs(chdata->GetVerticalRange() - max_pre_trig ) < 0.01
@@ -310,7 +537,7 @@ int BaselineFinder::FixedBaseline(ChannelData* chdata){
 		baseline.variance = sigma*sigma;
 		baseline.length = sum_samps;
 		
-		std::vector<double>& baseform = chdata->subtracted_waveform;
+		std::vector<sample_t>& baseform = chdata->subtracted_waveform;
 		baseform.resize(nsamps);
 		
 		if(linear_interpolation){
@@ -385,9 +612,11 @@ int BaselineFinder::FixedBaseline(ChannelData* chdata){
 				baseform[samp] = wave[samp]-mean;
 			}
 		}
+		FinishChannel(chdata, false);
 		
 		return 0;
 	}
-	else return 0; 
+	FinishChannel(chdata, false);
+	return 0; 
 }
 
@@ -1,4 +1,5 @@
 #include "ChannelData.hh"
+#include "SampleDecoder.hh"
 #include "Message.hh"
 #include "TGraph.h"
 #include "TMultiGraph.h"
@@ -24,25 +25,38 @@ public:
   double operator()(double x){ return _stretch*x + _offset; }
 };
 
+int ChannelData::CountRawSamples() const
+{
+  return SampleDecoder::CountSamples(channel_start, channel_end, sample_bits);
+}
+
+void ChannelData::DecodeRawWaveform() const
+{
+  waveform.resize(CountRawSamples());
+  if(!waveform.empty())
+    SampleDecoder::Decode(channel_start, channel_end, sample_bits, invert_raw,
+			  GetVerticalRange(), &(waveform[0]), 0);
+  waveform_pending = false;
+}
+
 TGraph* ChannelData::GetTGraph(bool baseline_subtracted, int downsample) const
 {
+  DecodeWaveform();
   if( nsamps < 2 || waveform.empty())
     return 0;
   if( baseline_subtracted && subtracted_waveform.empty())
     return 0;
   if(downsample < 1) downsample = 1;
   std::vector<double> x(nsamps/downsample);
-  std::vector<double> ycpy( downsample>1 ? nsamps/downsample : 0);
-  //double y[(const int)nsamps];
-  const double* y = (baseline_subtracted ? GetBaselineSubtractedWaveform() :
-		     GetWaveform() );
+  //TGraph wants doubles, whatever the sample type
+  std::vector<double> ycpy(nsamps/downsample);
+  const sample_t* y = (baseline_subtracted ? GetBaselineSubtractedWaveform() :
+		       GetWaveform() );
   for(int i=0; i<nsamps/downsample; i++){
     x[i] = (i*downsample - trigger_index) / sample_rate;
-    if(downsample > 1)
-      ycpy[i] = y[i*downsample];
+    ycpy[i] = y[i*downsample];
   }
-  TGraph* graph = new TGraph(nsamps/downsample,&x[0],
-			     (downsample > 1 ? &(ycpy[0]) : y) );
+  TGraph* graph = new TGraph(nsamps/downsample,&x[0],&(ycpy[0]));
   char name[30];
   if(label != "")
     sprintf(name,"%i-%s",channel_id, label.c_str());
@@ -90,15 +104,10 @@ void ChannelData::Draw(bool baseline_subtracted, int downsample,
     
   if((int)smoothed_data.size() == nsamps){
     
-    TGraph* smoothgraph = 0;
-    if(downsample > 1 ){
-      std::vector<double> smoothcp(ns);
-      for(int i=0; i<ns; i++)
-	smoothcp[i] = smoothed_data[i*downsample];
-      smoothgraph = new TGraph(ns,x,&(smoothcp[0]));
-    }
-    else
-      smoothgraph = new TGraph(ns, x, &(smoothed_data[0]));
+    std::vector<double> smoothcp(ns);
+    for(int i=0; i<ns; i++)
+      smoothcp[i] = smoothed_data[i*downsample];
+    TGraph* smoothgraph = new TGraph(ns,x,&(smoothcp[0]));
     smoothgraph->SetLineColor(kTeal);
     smoothgraph->SetMarkerColor(kTeal);
     graphs->Add(smoothgraph);
@@ -1,43 +1,91 @@
 #include "ChannelModule.hh"
 #include "ConvertData.hh"
+#include "ThreadPool.hh"
 #include <algorithm>
+#include <functional>
+#include <vector>
 ChannelModule::ChannelModule(const std::string& name, 
 			     const std::string& helptext) :
-  BaseModule(name, helptext)
+  BaseModule(name, helptext), _channels_independent(false)
 {
   AddDependency("ConvertData");
   RegisterParameter("skip_sum",_skip_sum = false,
 		    "Skip processing the sum channel?");
   RegisterParameter("sum_only",_sum_only = false,
 		    "Process only the sum channel and not others?");
+  RegisterParameter("parallel_channels", _parallel_channels = false,
+		    "Process the channels of an event on the channel_threads "
+		    "pool? Ignored if the module can't do so safely");
+  RegisterParameter("min_parallel_channels", _min_parallel_channels = 4,
+		    "Process events with fewer channels than this serially");
 }
 
 ChannelModule::~ChannelModule()
 {
 }
 
+/// Process one channel of an event, storing the result by channel index
+class ProcessOneChannel{
+  ChannelModule* _module;
+  std::vector<ChannelData>& _channels;
+  std::vector<int>& _results;
+public:
+  ProcessOneChannel(ChannelModule* module, std::vector<ChannelData>& channels,
+		    std::vector<int>& results) : 
+    _module(module), _channels(channels), _results(results) {}
+  void operator()(size_t ch) const
+  {
+    if(_module->SelectChannel(&(_channels[ch])))
+      _results[ch] = _module->Process(&(_channels[ch]));
+  }
+};
+
 int ChannelModule::Process(EventPtr event)
 {
   int returnval = 0;
   _current_event = event;
   EventDataPtr data = event->GetEventData();
+  ThreadPool* pool = ThreadPool::GetInstance();
+  if(_parallel_channels && _channels_independent && pool->GetNThreads() > 0 &&
+     (int)data->channels.size() >= _min_parallel_channels){
+    //each channel reports into its own slot, so the sum doesn't depend
+    //on which thread got which channel
+    //kept between events so it doesn't need allocating every time
+    _channel_results.assign(data->channels.size(), 0);
+    const ProcessOneChannel body(this, data->channels, _channel_results);
+    pool->ParallelFor(data->channels.size(), std::cref(body));
+    for(size_t ch=0; ch < _channel_results.size(); ch++)
+      returnval += _channel_results[ch];
+    return returnval;
+  }
   for(size_t ch=0; ch < data->channels.size(); ch++){
     ChannelData* chdata = &(data->channels[ch]);
-    // did we ask to skip this channel manually?
-    if( _skip_channels.find( chdata->channel_id ) != _skip_channels.end())
-      continue;
-    if( _skip_sum && chdata->channel_id == ChannelData::CH_SUM)
-      continue;
-    if( _sum_only && chdata->channel_id != ChannelData::CH_SUM)
-      continue;
-    // Does this channel pass all cuts?
-    if(CheckCuts(chdata)){
+    if(SelectChannel(chdata))
       returnval += Process(chdata);
-    }
   }
   return returnval;
 }
 
+bool ChannelModule::SelectChannel(ChannelData* chdata)
+{
+  // did we ask to skip this channel manually?
+  if( _skip_channels.find( chdata->channel_id ) != _skip_channels.end())
+    return false;
+  if( _skip_sum && chdata->channel_id == ChannelData::CH_SUM)
+    return false;
+  if( _sum_only && chdata->channel_id != ChannelData::CH_SUM)
+    return false;
+  // Does this channel pass all cuts?
+  return CheckCuts(chdata);
+}
+
+bool ChannelModule::SelectsSameChannels(const ChannelModule* other) const
+{
+  return _cuts.empty() && other->_cuts.empty() &&
+    _skip_channels == other->_skip_channels &&
+    _skip_sum == other->_skip_sum && _sum_only == other->_sum_only;
+}
+
 bool ChannelModule::CheckCuts(ChannelData* chdata)
 {
   for(std::vector<ProcessingCut*>::iterator cutit = _cuts.begin();
@@ -1,4 +1,5 @@
 #include "ConvertData.hh"
+#include "SampleDecoder.hh"
 #include "V172X_Event.hh"
 #include "V172X_Params.hh"
 #include "RootWriter.hh"
@@ -6,6 +7,7 @@
 #include "runinfo.hh"
 #include "ConfigHandler.hh"
 #include <vector>
+#include <algorithm>
 
   
 ConvertData::ConvertData():
@@ -16,6 +18,11 @@ ConvertData::ConvertData():
 		    "map of channelid:offset time to apply for analysis");
   RegisterParameter("invert_channels",_invert_channels ,
 		    "Multiply the converted data by -1 for a channel?");
+  RegisterParameter("lazy_decode", _lazy_decode = false,
+		    "Leave waveforms raw until a module asks for them?");
+  RegisterParameter("instruction_set", _instruction_set = SampleDecoder::AVX2,
+		    "Fastest instruction set to convert and sum samples "
+		    "with: SCALAR, SSE4 or AVX2");
   _v172X_params = 0;
   _headers_only = false;
 }
@@ -67,6 +74,10 @@ int ConvertData::Initialize()
     if((it->second).count("spe_mean"))
       _spemeans[it->first] = atof((it->second)["spe_mean"].c_str());
   }
+  
+  SampleDecoder::SetInstructionSet(_instruction_set);
+  Message(DEBUG)<<"Converting samples with "
+		<<SampleDecoder::GetInstructionSet()<<" instructions.\n";
  
   return 0;
 }
@@ -81,20 +92,12 @@ int ConvertData::Finalize()
   return 0;
 }
 
-class InvertData{
-private:
-  double _max, _min;
-public:
-  InvertData(double max, double min=0) : _max(max), _min(min) {}
-  double operator()(double a){ return _max - (a-_min); }
-};
-
 static double invert(double a){ return -a; }
 
 
 
 const uint64_t ns_per_s = 1000000000;
-int ConvertData::Process(EventPtr event)
+int ConvertData::Prologue(EventPtr event)
 {
   RawEventPtr raw = event->GetRawEvent();
   EventDataPtr data = event->GetEventData();
@@ -108,14 +111,50 @@ int ConvertData::Process(EventPtr event)
   }
   //set the most basic first, other decoders can override
   data->event_time = 1000000000*(data->timestamp-start_time);
-  //get the real data from datablocks
-  data->channels.clear();
+  int err = 0;
+  for(size_t blocknum=0; blocknum<raw->GetNumDataBlocks(); blocknum++){
+    if(raw->GetDataBlockType(blocknum) == RawEvent::CAEN_V172X)
+      err += DecodeV172XTimes(raw->GetRawDataBlock(blocknum), 
+			      raw->GetDataBlockSize(blocknum), 
+			      data);
+  }
+  
+  data->dt = ( previous_event_time > 0 ? 
+	       data->event_time - previous_event_time : 0 );
+  previous_event_time = data->event_time;
+  
+  //since we don't know the last event, set info for each event
+  _info->starttime = start_time;
+  _info->endtime = data->timestamp;
+  _info->events = data->event_id+1;
+  _info->triggers = data->trigger_count+1;
+  /*
+  if(_info->trigger_veto > 0){
+    _info->livetime = 1.*data->event_time/ns_per_s - 
+      _info->trigger_veto/1000. * (1.*_info->events);
+    //should  the acquisition window be "live"????
+  }
+  else if(data->trigger_count)
+    _info->livetime = 1.*_info->events / data->trigger_count * 
+      data->event_time / ns_per_s;
+  */
+  return err;
+}
+
+int ConvertData::Process(EventPtr event)
+{
+  RawEventPtr raw = event->GetRawEvent();
+  EventDataPtr data = event->GetEventData();
+  
+  //get the real data from datablocks, reusing the old channels' buffers
+  data->ClearChannels();
   for(size_t blocknum=0; blocknum<raw->GetNumDataBlocks(); blocknum++){
     switch(raw->GetDataBlockType(blocknum)){
     case RawEvent::CAEN_V172X :
-      DecodeV172XData(raw->GetRawDataBlock(blocknum), 
-		      raw->GetDataBlockSize(blocknum), 
-		      data);
+      if(DecodeV172XData(raw->GetRawDataBlock(blocknum), 
+			 raw->GetDataBlockSize(blocknum), 
+			 data))
+	return 1;
       break;
     case RawEvent::MONTECARLO :
     default :
@@ -131,21 +170,8 @@ int ConvertData::Process(EventPtr event)
     for(int ch=0; ch<data->nchans; ch++)
       {
 	ChannelData& chdata = data->channels[ch];
-	double* wave = chdata.GetWaveform();
-	if(_invert_channels.count(chdata.channel_id) )
-	  std::transform(wave, wave+chdata.nsamps, wave,
-			 InvertData(chdata.GetVerticalRange()) );
-	
-	double* max_samp = std::max_element(wave, wave+chdata.nsamps);
-	double* min_samp = std::min_element(wave, wave+chdata.nsamps);
-	//data is saturated if it hit 0 or maximum range
-	chdata.saturated = (*min_samp == 0 || 
-			    *max_samp == chdata.GetVerticalRange());
+	//the extremes were found while decoding
 	if(chdata.saturated) data->saturated = true;
-	chdata.maximum = *max_samp;
-	chdata.minimum = *min_samp;
-	chdata.max_time = chdata.SampleToTime(max_samp - wave);
-	chdata.min_time = chdata.SampleToTime(min_samp - wave);
 	//find the single photoelectron peak for this channel
 	
 	chdata.spe_mean = _spemeans[chdata.channel_id];
@@ -173,47 +199,53 @@ int ConvertData::Process(EventPtr event)
     data->nchans = data->channels.size();
   }// end skipped section if headers only
 
-  data->dt = ( previous_event_time > 0 ? 
-	       data->event_time - previous_event_time : 0 );
-  previous_event_time = data->event_time;
-  
-  //since we don't know the last event, set info for each event
-  _info->starttime = start_time;
-  _info->endtime = data->timestamp;
-  _info->events = data->event_id+1;
-  _info->triggers = data->trigger_count+1;
-  /*
-  if(_info->trigger_veto > 0){
-    _info->livetime = 1.*data->event_time/ns_per_s - 
-      _info->trigger_veto/1000. * (1.*_info->events);
-    //should  the acquisition window be "live"????
-  }
-  else if(data->trigger_count)
-    _info->livetime = 1.*_info->events / data->trigger_count * 
-      data->event_time / ns_per_s;
-  */
   return 0;
 }
 
+const V172X_BoardParams* ConvertData::CheckBoard(const unsigned char* rawdata,
+						 uint32_t datasize,
+						 uint32_t offset,
+						 EventDataPtr data)
+{
+  const uint32_t header_size = 16;
+  if(datasize - offset < header_size){
+    Message(ERROR)<<"Truncated V172X board header at byte "<<offset
+		  <<" of event "<<data->event_id<<"\n";
+    return 0;
+  }
+  const V172X_BoardData board_data(rawdata+offset);
+  if(board_data.event_size*4 < header_size || 
+     board_data.event_size*4 > datasize - offset){
+    Message(ERROR)<<"V172X board at byte "<<offset<<" of event "
+		  <<data->event_id<<" claims "<<board_data.event_size*4
+		  <<" bytes, but the block has "<<datasize - offset
+		  <<" left\n";
+    return 0;
+  }
+  if(board_data.board_id >= _v172X_params->nboards ||
+     !_v172X_params->board[board_data.board_id].enabled){
+    Message(ERROR)<<"Data for unknown V172X board "<<(int)board_data.board_id
+		  <<" in event "<<data->event_id<<"\n";
+    return 0;
+  }
+  return &(_v172X_params->board[board_data.board_id]);
+}
 
-int ConvertData::DecodeV172XData(const unsigned char* rawdata, 
+int ConvertData::DecodeV172XTimes(const unsigned char* rawdata, 
 				  uint32_t datasize, 
 				  EventDataPtr data)
 {
-  V172XEventPtr v172X(new V172X_Event(rawdata,
-				      datasize, 
-				      _v172X_params) );
-  const V172X_Params* params = v172X->GetParameters(); 
-  int n_boards = v172X->GetNBoards();
-  //estimate the number of channels and reserve size in the vector
-  int reserve_size = (params->enabled_channels > 0 ? params->enabled_channels :
-		      n_boards * 10 );
-  data->channels.reserve( reserve_size + 5);
+  //walk the boards in place; this runs for every event, so don't allocate
   bool id_mismatch=false;
-  for(int i=0; i<n_boards; i++){
-    const V172X_BoardData& board_data = v172X->GetBoard(i);
-    const V172X_BoardParams& board_params = 
-	params->board[board_data.board_id];
+  uint32_t board_offset = 0;
+  for(int i=0; board_offset < datasize; i++){
+    const V172X_BoardParams* checked = 
+      CheckBoard(rawdata, datasize, board_offset, data);
+    if(!checked)
+      return 1;
+    const V172X_BoardParams& board_params = *checked;
+    const V172X_BoardData board_data(rawdata+board_offset);
+    board_offset += board_data.event_size*4;
     //check for ID mismatch
     if(i==0)
       data->trigger_count = board_data.event_counter;
@@ -238,6 +270,40 @@ int ConvertData::DecodeV172XData(const unsigned char* rawdata,
 	n_resets++;*/
     data->event_time = board_params.GetTimestampRange() * n_resets + 
       board_params.ns_per_clocktick * board_data.timestamp;
+  }
+  if(id_mismatch){
+    if(_id_mismatches==0){
+      Message(WARNING)<<"Event ID mismatch found on event "
+		      <<data->event_id<<"!\n";
+      Message(WARNING)<<"Further mismatches will be silent.\n";
+    }
+    
+    data->status |= EventData::ID_MISMATCH;
+    _id_mismatches++;
+  }	
+  return 0;
+}
+
+
+int ConvertData::DecodeV172XData(const unsigned char* rawdata, 
+				  uint32_t datasize, 
+				  EventDataPtr data)
+{
+  V172X_Params* params = _v172X_params;
+  //estimate the number of channels and reserve size in the vector
+  int reserve_size = (params->enabled_channels > 0 ? params->enabled_channels :
+		      params->GetEnabledBoards() * 10 );
+  data->channels.reserve( reserve_size + 5);
+  //walk the boards in place rather than building a V172X_Event
+  uint32_t board_offset = 0;
+  for(int i=0; board_offset < datasize; i++){
+    const V172X_BoardParams* checked = 
+      CheckBoard(rawdata, datasize, board_offset, data);
+    if(!checked)
+      return 1;
+    const V172X_BoardParams& board_params = *checked;
+    const V172X_BoardData board_data(rawdata+board_offset);
+    board_offset += board_data.event_size*4;
     for(int j=0; j<board_data.nchans; j++){
       if(board_data.channel_start[j] == NULL)
 	continue;
@@ -245,8 +311,7 @@ int ConvertData::DecodeV172XData(const unsigned char* rawdata,
       if( _skip_channels.find(channel_id) != _skip_channels.end())
 	continue;
       const V172X_ChannelParams& ch_params = board_params.channel[j];
-      data->channels.push_back(ChannelData());
-      ChannelData& chdata = data->channels.back();
+      ChannelData& chdata = data->AddChannel();
       chdata.board_id = board_data.board_id;
       chdata.board_num = i;
       chdata.channel_num = j;
@@ -262,110 +327,42 @@ int ConvertData::DecodeV172XData(const unsigned char* rawdata,
       if(_headers_only) continue;
       chdata.channel_start = (char*)(board_data.channel_start[j]);
       chdata.channel_end = (char*)(board_data.channel_end[j]);
+      const bool invert = _invert_channels.count(channel_id);
+      const double range = chdata.GetVerticalRange();
+      SampleDecoder::Extremes extremes;
       if(board_params.zs_type != ZLE){
-	// copy the data as a double 
-	if(chdata.sample_bits < 9)
-	  chdata.waveform.assign((uint8_t*)chdata.channel_start,
-				 (uint8_t*)chdata.channel_end);
-        else if (chdata.sample_bits == 10) {
-          chdata.waveform.clear ();
-          for (uint32_t* ptr = (uint32_t*)chdata.channel_start; 
-	       ptr < (uint32_t*)chdata.channel_end; ptr ++) {
-            uint32_t raw_v = *ptr;
-	    const int ns = (raw_v>>30)&3;
-            for (int i = 0; i < ns; i++) {
-              uint16_t sample = raw_v & 0x3ff;
-              raw_v = raw_v >> 10;
-              chdata.waveform.push_back (sample);
-	    }
-	  }
+	//the samples are converted straight from the raw buffer, now or
+	//when a module first asks for them; the extremes are found now
+	chdata.invert_raw = invert;
+	sample_t* wave = 0;
+	if(_lazy_decode)
+	  chdata.waveform_pending = true;
+	else{
+	  chdata.waveform.resize(chdata.CountRawSamples());
+	  if(!chdata.waveform.empty())
+	    wave = &(chdata.waveform[0]);
 	}
-	else if(chdata.sample_bits < 17)
-	  chdata.waveform.assign((uint16_t*)chdata.channel_start,
-				 (uint16_t*)chdata.channel_end);
-	else
-	  chdata.waveform.assign((uint32_t*)chdata.channel_start,
-				 (uint32_t*)chdata.channel_end);
+	chdata.nsamps = SampleDecoder::Decode(chdata.channel_start, 
+					      chdata.channel_end,
+					      chdata.sample_bits, invert, range,
+					      wave, &extremes);
       }
       else{
 	//we need to evaluate the zero skipped data
-	//first word is the size of this channel's data
-	uint32_t nwords = *((uint32_t*)(chdata.channel_start));
-	chdata.nsamps = 0;
-	uint32_t offset = 1;
-	std::vector<const char*> data_blocks;
-	while(offset < nwords){
-	  //get the control word
-	  uint32_t control = *( ((uint32_t*)(chdata.channel_start)) + offset);
-	  uint32_t subwords = control & 0x1FFFFF;
-	  uint32_t subsamps = subwords * board_params.bytes_per_sample;
-	  bool good = control & 0x80000000;
-	  
-	  if(good){
-	    data_blocks.push_back( chdata.channel_start + 4*(offset+1) );
-	    std::pair<int,int> region(chdata.nsamps,
-				      chdata.nsamps + subsamps);
-	    chdata.unsuppressed_regions.push_back(region);
-	    offset += subwords;
-	  }
-	  
-	  chdata.nsamps += subsamps;
-	  offset += 1;
-	}
-	//assign all the value of 1 by default so it doesn't show as saturated
-	chdata.waveform.assign(chdata.nsamps, 1);
-	std::vector<double>& wave = chdata.waveform;
-	//now try to fill all the valid samples
-	for(size_t block=0; block < data_blocks.size(); block++){
-	  int subsamps = chdata.unsuppressed_regions[block].second - 
-	      chdata.unsuppressed_regions[block].first;
-	  if(chdata.sample_bits < 9){
-	    std::copy( (uint8_t*)data_blocks[block],
-		       ((uint8_t*)data_blocks[block]) + subsamps,
-		       &(wave[chdata.unsuppressed_regions[block].first]) );
-	  }
-	  else if (chdata.sample_bits < 17){
-	    std::copy( (uint16_t*)data_blocks[block],
-		       ((uint16_t*)data_blocks[block]) + subsamps,
-		       &(wave[chdata.unsuppressed_regions[block].first]) );
-	  }
-	  else {
-	    std::copy( (uint32_t*)data_blocks[block],
-		       ((uint32_t*)data_blocks[block]) + subsamps,
-		       &(wave[chdata.unsuppressed_regions[block].first]) );
-	  }
-	}
-	//finally set the baseline to the nearest sample
-	for(size_t block=0; block < data_blocks.size(); block++){
-	  std::pair<int,int> region = chdata.unsuppressed_regions[block];
-	  int fill_start = (block > 0 ? 
-			    chdata.unsuppressed_regions[block-1].second : 0 );
-	  int fill_end = region.first;
-	  if(fill_end > fill_start)
-	    std::fill( &(wave[fill_start]), &(wave[fill_end]), wave[fill_end]);
-	}
-	//check the last region
-	if( !chdata.unsuppressed_regions.empty() && 
-	    chdata.unsuppressed_regions.back().second < chdata.nsamps){
-	  std::fill( &(wave[chdata.unsuppressed_regions.back().second]),
-		     &(wave[chdata.nsamps]), 
-		     wave[chdata.unsuppressed_regions.back().second-1] );
-	}
-      }// end check for zero suppressed data
-      
-      chdata.nsamps = chdata.waveform.size();
+	chdata.nsamps = 
+	  SampleDecoder::DecodeZLE(chdata.channel_start, chdata.sample_bits,
+				   board_params.bytes_per_sample, invert, range,
+				   chdata.waveform, chdata.unsuppressed_regions,
+				   &extremes);
+      }
+      //data is saturated if it hit 0 or maximum range
+      chdata.maximum = extremes.max;
+      chdata.minimum = extremes.min;
+      chdata.saturated = (chdata.minimum == 0 || chdata.maximum == range);
+      chdata.max_time = chdata.SampleToTime(extremes.max_index);
+      chdata.min_time = chdata.SampleToTime(extremes.min_index);
     }
   }
-  if(id_mismatch){
-    if(_id_mismatches==0){
-      Message(WARNING)<<"Event ID mismatch found on event "
-		      <<data->event_id<<"!\n";
-      Message(WARNING)<<"Further mismatches will be silent.\n";
-    }
-    
-    data->status |= EventData::ID_MISMATCH;
-    _id_mismatches++;
-  }	
   
   return 0;
 }
@@ -35,7 +35,7 @@ int CosmicMonitor::Process(ChannelData* chdata)
     return 0;
   
   //get the relevant variables
-  double* wave = chdata->GetBaselineSubtractedWaveform();
+  sample_t* wave = chdata->GetBaselineSubtractedWaveform();
   
   const int nsamps = chdata->nsamps;
   /*
@@ -39,12 +39,12 @@ int Differentiator::Process(ChannelData* chdata)
   const Baseline& baseline = chdata->baseline;
   if(!baseline.found_baseline)
     return 0;
-  double* wave = chdata->GetWaveform();
+  sample_t* wave = chdata->GetWaveform();
   
   const int& nsamps = chdata->nsamps;
   chdata->derivative.resize(nsamps);
   
-  std::vector<double>& derivative = chdata->derivative;
+  std::vector<sample_t>& derivative = chdata->derivative;
   double sample_interval = 1./(double)chdata->sample_rate;
   derivative[0] = 0;
   for(int index = 1; index < nsamps; index++)
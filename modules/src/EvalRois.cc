@@ -14,10 +14,15 @@
 
 EvalRois::EvalRois() : 
   ChannelModule(GetDefaultName(),
-		"Measure the max, min, and integral of samples over a set of regions of interest defined by start and end times in microseconds")
+		"Measure the max, min, and integral of samples over a set of regions of interest defined by start and end times in microseconds"),
+  _fused(false)
 {
   AddDependency<ConvertData>();
   AddDependency<BaselineFinder>();
+  AddOutput("channels.regions");
+  //uses the integral if Integrator ran, but doesn't need it
+  AddInput("channels.integral");
+  _channels_independent = true;
   RegisterParameter("regions", _regions, "Start/end time pairs to evaluate");
 }
 
@@ -38,6 +43,13 @@ int EvalRois::Initialize()
 int EvalRois::Finalize() { return 0; }
 
 int EvalRois::Process(ChannelData* chdata)
+{
+  if(_fused)
+    return 0;
+  return Evaluate(chdata);
+}
+
+int EvalRois::Evaluate(ChannelData* chdata)
 {
   
   Baseline& base = chdata->baseline;
@@ -45,36 +57,46 @@ int EvalRois::Process(ChannelData* chdata)
   for(size_t window = 0; window < _regions.size(); window++){
     chdata->regions.push_back(Roi());
     Roi& roi = chdata->regions.back();
-    roi.start_time = _regions[window].first;
-    roi.end_time = _regions[window].second;
-    roi.start_index = (int)std::max(roi.start_time * chdata->sample_rate + 
-				    chdata->trigger_index , 0.);
-    roi.end_index = (int)std::max(roi.end_time * chdata->sample_rate + 
-				  chdata->trigger_index, 0.);
-    roi.start_index = std::min(roi.start_index, chdata->nsamps);
-    roi.end_index = std::min(roi.end_index, chdata->nsamps);
-    
-    //double* wave = chdata->GetWaveform();
-    double* subtractedwave = chdata->GetBaselineSubtractedWaveform();
-    double* min_iter = std::min_element(subtractedwave+roi.start_index, subtractedwave+roi.end_index);
-    double* max_iter = std::max_element(subtractedwave+roi.start_index, subtractedwave+roi.end_index);
-    roi.max = *(max_iter);
-    roi.min = *(min_iter);
-    roi.min_index = min_iter-subtractedwave;
-    
-    if(! chdata->integral.empty()){
-      roi.integral = chdata->integral[roi.end_index] - 
-	chdata->integral[roi.start_index];
-    }
-    else{
-      
-      roi.integral = std::accumulate(subtractedwave+roi.start_index,
-				     subtractedwave+roi.end_index,
-				     0.);
-    }
-    roi.npe = -roi.integral / chdata->spe_mean;
+    SetRoiRange(chdata, window, roi);
+    EvalRoi(chdata, roi);
   }
   
   return 0;
 }
+
+void EvalRois::SetRoiRange(const ChannelData* chdata, size_t window, 
+			   Roi& roi) const
+{
+  roi.start_time = _regions[window].first;
+  roi.end_time = _regions[window].second;
+  roi.start_index = (int)std::max(roi.start_time * chdata->sample_rate + 
+				  chdata->trigger_index , 0.);
+  roi.end_index = (int)std::max(roi.end_time * chdata->sample_rate + 
+				chdata->trigger_index, 0.);
+  roi.start_index = std::min(roi.start_index, chdata->nsamps);
+  roi.end_index = std::min(roi.end_index, chdata->nsamps);
+}
+
+void EvalRois::EvalRoi(ChannelData* chdata, Roi& roi) const
+{
+  //sample_t* wave = chdata->GetWaveform();
+  sample_t* subtractedwave = chdata->GetBaselineSubtractedWaveform();
+  sample_t* min_iter = std::min_element(subtractedwave+roi.start_index, subtractedwave+roi.end_index);
+  sample_t* max_iter = std::max_element(subtractedwave+roi.start_index, subtractedwave+roi.end_index);
+  roi.max = *(max_iter);
+  roi.min = *(min_iter);
+  roi.min_index = min_iter-subtractedwave;
+  
+  if(! chdata->integral.empty()){
+    roi.integral = chdata->integral[roi.end_index] - 
+      chdata->integral[roi.start_index];
+  }
+  else{
+    
+    roi.integral = std::accumulate(subtractedwave+roi.start_index,
+				   subtractedwave+roi.end_index,
+				   0.);
+  }
+  roi.npe = -roi.integral / chdata->spe_mean;
+}
      
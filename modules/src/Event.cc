@@ -7,3 +7,9 @@ Event::Event(RawEventPtr raw) :  _raw_event(raw),
 Event::~Event() 
 { }
 
+void Event::Reset(RawEventPtr raw)
+{
+  _raw_event = raw;
+  _event_data->Clear();
+}
+
@@ -7,8 +7,35 @@
 #include "Message.hh"
 #include "BaseModule.hh"
 #include "AsyncEventHandler.hh"
+#include "ThreadPool.hh"
+#include "ModuleScheduler.hh"
+#include "AllocationCounter.hh"
 #include <stdexcept>
 #include <sstream>
+#include <iomanip>
+#include "RVersion.h"
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+#include "TROOT.h"
+#else
+#include "TThread.h"
+#endif
+
+#ifndef SINGLETHREAD
+typedef std::unique_lock<std::mutex> scoped_lock;
+#endif
+
+/// Events to process before counting allocations, while buffers grow
+static const long ALLOCATION_WARMUP_EVENTS = 100;
+
+/// Tell ROOT that it's being used from several threads
+static void EnableRootThreads()
+{
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+  ROOT::EnableThreadSafety();
+#else
+  TThread::Initialize();
+#endif
+}
 
 //These functions are used by the ConfigHandler as command switches
 class EnableModule{
@@ -41,7 +68,9 @@ int ListModules(const char*){
 
 EventHandler::EventHandler() : 
   ParameterList("modules","Takes raw events and delivers it to all enabled modules for processing"), 
-  _current_event(), _is_initialized(false), run_id(-1)
+  _current_event(), _is_initialized(false), run_id(-1),
+  _nevents(0), _warm_allocations(0), _next_sequence(0), _next_waiting(0),
+  _next_ordered(0), _scheduler(new ModuleScheduler)
 {
   ConfigHandler* config = ConfigHandler::GetInstance();
   config->RegisterParameter(this->GetDefaultKey(),*this);
@@ -56,6 +85,24 @@ EventHandler::EventHandler() :
 		    "Fail to initialize if unable to  find calibration data");
   RegisterParameter("run_parallel", _run_parallel=false,
 		    "Do we process modules in series, or give them threads?");
+  RegisterParameter("event_threads", _event_threads=0,
+		    "Number of events to process at once on separate threads; "
+		    "0 or 1 to process them one at a time");
+  RegisterParameter("max_events_in_flight", _max_events_in_flight=0,
+		    "Most events queued or being processed at once when "
+		    "using event_threads; 0 for 4 per thread");
+  RegisterParameter("channel_threads", _channel_threads=0,
+		    "Number of threads helping modules with parallel_channels "
+		    "set to process the channels of an event");
+  RegisterParameter("module_threads", _module_threads=0,
+		    "Number of threads helping to run modules which don't "
+		    "depend on each other at the same time");
+  RegisterParameter("time_modules", _time_modules=false,
+		    "Record the calls and time spent in each module, and "
+		    "print a summary at the end of the run");
+  RegisterParameter("event_pool_size", _event_pool_size=32,
+		    "Most finished events kept to reuse their memory for new "
+		    "ones; 0 to allocate every event afresh");
   config->AddCommandSwitch(' ',"enable","enable <module>",
 			   EnableModule(true),"module");
   config->AddCommandSwitch(' ',"disable","disable <module>",
@@ -65,6 +112,18 @@ EventHandler::EventHandler() :
   config->AddCommandSwitch(' ',"no-db","Skip attempts to access database",
 			   CommandSwitch::SetValue<bool>(_access_database,false)
 			   ); 
+  config->AddCommandSwitch(' ',"event-threads",
+			   "process <n> events at once on separate threads",
+			   CommandSwitch::DefaultRead<int>(_event_threads),"n");
+  config->AddCommandSwitch(' ',"channel-threads",
+			   "use <n> threads to process the channels of an event",
+			   CommandSwitch::DefaultRead<int>(_channel_threads),"n");
+  config->AddCommandSwitch(' ',"module-threads",
+			   "run independent modules at once on <n> threads",
+			   CommandSwitch::DefaultRead<int>(_module_threads),"n");
+  config->AddCommandSwitch(' ',"time-modules",
+			   "print the time spent in each module",
+			   CommandSwitch::SetValue<bool>(_time_modules,true));
   
 }
 //Copy, assignment constructors not provided
@@ -77,7 +136,7 @@ EventHandler::~EventHandler()
     delete _modules[i];
   }
   _modules.clear();
-  
+  delete _scheduler;
 }
 
 EventHandler* EventHandler::GetInstance()
@@ -167,6 +226,14 @@ int EventHandler::Initialize()
   //this info is in the raw file, so reset it:
   _runinfo.ResetRunStats();
   
+  _event_pool.SetMaxSize(std::max(_event_pool_size, 0));
+  _nevents = 0;
+  _warm_allocations = 0;
+  
+  ModuleTimer::SetEnabled(_time_modules);
+  for(size_t i=0; i<_modules.size(); ++i)
+    _modules[i]->GetTimer()->Reset();
+  
   //first initialize all enabled modules
   std::set<std::string> enabled_modules;
   
@@ -200,7 +267,7 @@ int EventHandler::Initialize()
     }
     if(_run_parallel){
       //give this module an AsyncEventHandler
-      AsyncEventHandler* ah = new AsyncEventHandler;
+      AsyncEventHandler* ah = new AsyncEventHandler(mod->GetName()+"_thread");
       ah->SetBlockingStatus(true);
       ah->AddModule(mod,false);
       if(_para_handlers.size()==0)
@@ -212,7 +279,221 @@ int EventHandler::Initialize()
     }
   }
   
+  ThreadPool::GetInstance()->SetNThreads(std::max(_channel_threads,
+						  _module_threads));
+  if(_event_threads > 1 && !_run_parallel && StartWorkers()){
+    _is_initialized = false;
+    return 1;
+  }
+  if(_module_threads > 0 && !_run_parallel && StartScheduler()){
+    _is_initialized = false;
+    return 1;
+  }
+  return 0;
+}
+
+int EventHandler::StartScheduler()
+{
+#ifdef SINGLETHREAD
+  Message(WARNING)<<"Multithreading disabled; running modules serially.\n";
+  return 0;
+#else
+  //schedule the modules which would otherwise run one after the other
+  std::vector<BaseModule*> modules;
+  if(_worker_chains.empty()){
+    for(size_t i=0; i<_processing_modules.size(); ++i){
+      if(_processing_modules[i]->enabled)
+	modules.push_back(_processing_modules[i]);
+    }
+  }
+  else
+    modules = _ordered_modules;
+  if(_scheduler->Build(modules))
+    return 1;
+  if(_scheduler->GetNStages() == (int)modules.size()){
+    Message(INFO)<<"No modules can run at the same time; "
+		 <<"running modules serially.\n";
+    _scheduler->Clear();
+    return 0;
+  }
+  EnableRootThreads();
+  Message(INFO)<<"Running "<<modules.size()<<" modules in "
+	       <<_scheduler->GetNStages()<<" steps on "<<_module_threads
+	       <<" threads.\n";
+  return 0;
+#endif
+}
+
+int EventHandler::StartWorkers()
+{
+#ifdef SINGLETHREAD
+  Message(WARNING)<<"Multithreading disabled; processing events serially.\n";
+  return 0;
+#else
+  _worker_chains.assign(_event_threads, std::vector<BaseModule*>());
+  _ordered_modules.clear();
+  //copy modules until the first one which has to see events in order
+  for(size_t i=0; i<_processing_modules.size(); ++i){
+    BaseModule* mod = _processing_modules[i];
+    if(!mod->enabled)
+      continue;
+    BaseModule* copy = (_ordered_modules.empty() ? mod->Clone() : 0);
+    if(!copy){
+      _ordered_modules.push_back(mod);
+      continue;
+    }
+    _worker_chains[0].push_back(copy);
+    for(int thread=1; thread<_event_threads; ++thread)
+      _worker_chains[thread].push_back(mod->Clone());
+  }
+  if(_worker_chains[0].empty()){
+    Message(WARNING)<<"No modules can process events in parallel; "
+		    <<"processing events serially.\n";
+    _worker_chains.clear();
+    _ordered_modules.clear();
+    return 0;
+  }
+  
+  EnableRootThreads();
+  
+  Message m(INFO);
+  m<<"Processing events on "<<_event_threads<<" threads with";
+  for(size_t i=0; i<_worker_chains[0].size(); ++i)
+    m<<" "<<_worker_chains[0][i]->GetName();
+  if(!_ordered_modules.empty()){
+    m<<"; in order with";
+    for(size_t i=0; i<_ordered_modules.size(); ++i)
+      m<<" "<<_ordered_modules[i]->GetName();
+  }
+  m<<".\n";
+  
+  if(_max_events_in_flight <= 0)
+    _max_events_in_flight = 4*_event_threads;
+  //never more than this many events queued, being processed or reordered
+  _in_flight.assign(_max_events_in_flight+1, flight_slot());
+  _next_sequence = _next_waiting = _next_ordered = 0;
+  _stop_workers = false;
+  for(int thread=0; thread<_event_threads; ++thread)
+    _workers.push_back(std::thread(&EventHandler::WorkerLoop, this, thread));
   return 0;
+#endif
+}
+
+int EventHandler::StopWorkers()
+{
+  int proc_fail = 0;
+#ifndef SINGLETHREAD
+  if(_workers.empty())
+    return 0;
+  scoped_lock lock(_workers_mutex);
+  proc_fail = CollectEvents(lock, 0);
+  _stop_workers = true;
+  _event_waiting.notify_all();
+  lock.unlock();
+  for(size_t i=0; i<_workers.size(); ++i)
+    _workers[i].join();
+  _workers.clear();
+  _in_flight.clear();
+  for(size_t i=0; i<_worker_chains.size(); ++i){
+    for(size_t j=0; j<_worker_chains[i].size(); ++j){
+      //keep the copies' timing with the original
+      BaseModule* original = GetModule(_worker_chains[i][j]->GetName());
+      if(original)
+	original->GetTimer()->Add(*(_worker_chains[i][j]->GetTimer()));
+      delete _worker_chains[i][j];
+    }
+  }
+  _worker_chains.clear();
+  _ordered_modules.clear();
+#endif
+  return proc_fail;
+}
+
+#ifndef SINGLETHREAD
+void EventHandler::WorkerLoop(size_t chain)
+{
+  const std::vector<BaseModule*>& modules = _worker_chains[chain];
+  scoped_lock lock(_workers_mutex);
+  while(true){
+    while(_next_waiting == _next_sequence && !_stop_workers)
+      _event_waiting.wait(lock);
+    if(_next_waiting == _next_sequence)
+      break;
+    const long sequence = _next_waiting++;
+    //the slot isn't reused until this event is finished in order
+    flight_slot& slot = _in_flight[sequence % _in_flight.size()];
+    EventPtr evt = slot.event;
+    lock.unlock();
+    
+    int proc_fail = 0;
+    for(size_t i=0; i<modules.size(); ++i){
+      if(modules[i]->enabled)
+	proc_fail += modules[i]->HandleEvent(evt);
+    }
+    
+    lock.lock();
+    slot.proc_fail = proc_fail;
+    slot.done = true;
+    //only the thread waiting on the next event in order cares
+    if(sequence == _next_ordered)
+      _event_done.notify_one();
+  }
+}
+
+int EventHandler::CollectEvents(scoped_lock& lock, long max_in_flight)
+{
+  int proc_fail = 0;
+  while(true){
+    flight_slot& next = _in_flight[_next_ordered % _in_flight.size()];
+    if(_next_ordered < _next_sequence && next.done){
+      EventPtr evt;
+      evt.swap(next.event);
+      const int fail = next.proc_fail;
+      next.done = false;
+      ++_next_ordered;
+      lock.unlock();
+      proc_fail += FinishEvent(evt, fail);
+      lock.lock();
+    }
+    else if(_next_sequence - _next_ordered > max_in_flight)
+      _event_done.wait(lock);
+    else
+      break;
+  }
+  return proc_fail;
+}
+#endif
+
+int EventHandler::QueueEvent(EventPtr evt)
+{
+#ifdef SINGLETHREAD
+  return 1;
+#else
+  scoped_lock lock(_workers_mutex);
+  //CollectEvents left room for one more
+  flight_slot& slot = _in_flight[_next_sequence++ % _in_flight.size()];
+  slot.event = evt;
+  slot.proc_fail = 0;
+  slot.done = false;
+  _event_waiting.notify_one();
+  return CollectEvents(lock, _max_events_in_flight);
+#endif
+}
+
+int EventHandler::FinishEvent(EventPtr evt, int proc_fail)
+{
+  _current_event = evt;
+  if(!_scheduler->Empty())
+    proc_fail += _scheduler->Process(evt);
+  else{
+    for(size_t i=0; i<_ordered_modules.size(); ++i){
+      if(_ordered_modules[i]->enabled)
+	proc_fail += _ordered_modules[i]->HandleEvent(evt);
+    }
+  }
+  for(size_t i=0; i < _async_receivers.size(); ++i)
+    _async_receivers[i]->Process(evt);
+  return proc_fail;
 }
 
 int EventHandler::Process(RawEventPtr raw)
@@ -221,7 +502,7 @@ int EventHandler::Process(RawEventPtr raw)
     Message(ERROR)<<"Attempted to process empty event pointer.\n";
     return 1;
   }
-  EventPtr evt(new Event(raw));
+  EventPtr evt = _event_pool.GetEvent(raw);
   return Process(evt);
 }
 
@@ -235,12 +516,33 @@ int EventHandler::Process(EventPtr evt)
   }
   
   int proc_fail = 0;
+  //the buffers have grown to their usual size by now
+  if(++_nevents == ALLOCATION_WARMUP_EVENTS)
+    _warm_allocations = AllocationCounter::GetCount();
   
-  _current_event = evt;
   //set the run id here
-  _current_event->GetEventData()->run_id = run_id;
-  if(!_run_parallel){
-    std::vector<BaseModule*>::iterator it;
+  evt->GetEventData()->run_id = run_id;
+  //anything that depends on earlier events has to happen in order
+  std::vector<BaseModule*>::iterator it;
+  for(it=_processing_modules.begin(); it!=_processing_modules.end(); it++){
+    BaseModule* mod = *it;
+    if(!mod->enabled)
+      continue;
+    int prologue_fail = mod->Prologue(evt);
+    if(prologue_fail){
+      Message(ERROR)<<"Module "<<mod->GetName()<<" prologue returns "
+		    <<prologue_fail<<" processing event "
+		    <<evt->GetRawEvent()->GetID()<<"\n";
+      proc_fail += prologue_fail;
+    }
+  }
+  if(!_worker_chains.empty())
+    return proc_fail + QueueEvent(evt);
+  
+  _current_event = evt;
+  if(!_scheduler->Empty())
+    proc_fail += _scheduler->Process(_current_event);
+  else if(!_run_parallel){
     for(it=_processing_modules.begin(); it!=_processing_modules.end(); it++){
       BaseModule* mod = *it;
       if(mod->enabled){
@@ -261,6 +563,9 @@ int EventHandler::Finalize()
     Message(WARNING)<<"EventHandler::Finalize() called uninitialized!\n";
   }
   _is_initialized = false;
+  //finish the events still being processed on worker threads
+  int final_fail = StopWorkers();
+  _scheduler->Clear();
   //make sure the modules have finished
   for(size_t i=0; i<_async_receivers.size(); ++i){
     _async_receivers[i]->Process(EventPtr());
@@ -276,7 +581,18 @@ int EventHandler::Finalize()
 	_async_receivers.pop_back();
     }
   }
-  int final_fail = 0;
+  if(AllocationCounter::IsEnabled() && _nevents > ALLOCATION_WARMUP_EVENTS){
+    Message(INFO)<<"Heap allocations per event after the first "
+		 <<ALLOCATION_WARMUP_EVENTS<<": "
+		 <<1.*(AllocationCounter::GetCount() - _warm_allocations) /
+      (_nevents - ALLOCATION_WARMUP_EVENTS)
+		 <<"; "<<_event_pool.GetReused()<<" events reused, "
+		 <<_event_pool.GetCreated()<<" allocated.\n";
+  }
+  if(ModuleTimer::IsEnabled()){
+    Message m(INFO);
+    PrintModuleTimes(m<<"Time spent in each module:\n");
+  }
   Message(DEBUG)<<"Finalizing "<<_modules.size()<<" modules..."<<std::endl;
   //finalization should go in opposite order of initialization
   //but that messes up root file writing, so go in same order...                
@@ -288,6 +604,10 @@ int EventHandler::Finalize()
       final_fail += mod->Finalize();
     }
   }
+  //let go of the last event and the events kept for reuse, and with them
+  //of any buffers the daq lent their raw data
+  _current_event.reset();
+  _event_pool.Clear();
   //reset the run info
   _runinfo.Init(true);
   Message(DEBUG)<<"Done finalizing modules.\n";
@@ -296,6 +616,74 @@ int EventHandler::Finalize()
   return final_fail;
 }   
  
+/// One line of the module timing summary
+struct ModuleTimeRow{
+  std::string name;
+  long calls, processed, rejected, failed;
+  long wall_ns, cpu_ns, p99_ns, max_ns;
+};
+
+/// Sort the timing summary with the most expensive modules first
+class SlowerModule{
+public:
+  bool operator()(const ModuleTimeRow& a, const ModuleTimeRow& b) const
+  { return a.wall_ns > b.wall_ns; }
+};
+
+void EventHandler::PrintModuleTimes(std::ostream& out)
+{
+  std::vector<ModuleTimeRow> rows;
+  long total_wall = 0;
+  for(size_t i=0; i<_modules.size(); ++i){
+    BaseModule* mod = _modules[i];
+    //include the copies working on other threads
+    ModuleTimer timer;
+    timer.Add(*(mod->GetTimer()));
+    for(size_t chain=0; chain<_worker_chains.size(); ++chain){
+      for(size_t j=0; j<_worker_chains[chain].size(); ++j){
+	if(_worker_chains[chain][j]->GetName() == mod->GetName())
+	  timer.Add(*(_worker_chains[chain][j]->GetTimer()));
+      }
+    }
+    if(timer.GetCalls() == 0)
+      continue;
+    ModuleTimeRow row;
+    row.name = mod->GetName();
+    row.calls = timer.GetCalls();
+    row.processed = timer.GetProcessed();
+    row.rejected = timer.GetRejected();
+    row.failed = timer.GetFailed();
+    row.wall_ns = timer.GetWallNs();
+    row.cpu_ns = timer.GetCpuNs();
+    row.p99_ns = timer.GetWallQuantile(0.99);
+    row.max_ns = timer.GetMaxWallNs();
+    rows.push_back(row);
+    total_wall += row.wall_ns;
+  }
+  std::sort(rows.begin(), rows.end(), SlowerModule());
+  
+  out<<std::left<<std::setw(20)<<"module"<<std::right
+     <<std::setw(10)<<"calls"<<std::setw(10)<<"processed"
+     <<std::setw(9)<<"rejected"<<std::setw(7)<<"failed"
+     <<std::setw(10)<<"wall[s]"<<std::setw(10)<<"cpu[s]"
+     <<std::setw(10)<<"mean[us]"<<std::setw(10)<<"p99[us]"
+     <<std::setw(10)<<"max[us]"<<std::setw(7)<<"share"<<"\n";
+  out<<std::fixed;
+  for(size_t i=0; i<rows.size(); ++i){
+    const ModuleTimeRow& row = rows[i];
+    out<<std::left<<std::setw(20)<<row.name<<std::right
+       <<std::setw(10)<<row.calls<<std::setw(10)<<row.processed
+       <<std::setw(9)<<row.rejected<<std::setw(7)<<row.failed
+       <<std::setprecision(3)
+       <<std::setw(10)<<row.wall_ns*1.e-9<<std::setw(10)<<row.cpu_ns*1.e-9
+       <<std::setprecision(1)
+       <<std::setw(10)<<row.wall_ns*1.e-3/row.calls
+       <<std::setw(10)<<row.p99_ns*1.e-3<<std::setw(10)<<row.max_ns*1.e-3
+       <<std::setw(6)<<(total_wall ? 100.*row.wall_ns/total_wall : 0.)<<"%"
+       <<"\n";
+  }
+}
+
 int EventHandler::SetRunIDFromFilename(const std::string& filename)
 {
   run_id = -1;
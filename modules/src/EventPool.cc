@@ -0,0 +1,56 @@
+#include "EventPool.hh"
+#include <atomic>
+
+/// Is <evt> held only by the pool?
+static bool IsIdle(const EventPtr& evt)
+{
+  if(evt.use_count() != 1 || evt->IsDataShared())
+    return false;
+  //make sure we see everything done by whoever released it last
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return true;
+}
+
+EventPtr EventPool::GetEvent(RawEventPtr raw)
+{
+  ReleaseIdle();
+  //events are usually released in the order they were handed out, so
+  //start looking after the last one reused
+  for(size_t tried=0; tried<_events.size(); ++tried){
+    if(_next >= _events.size())
+      _next = 0;
+    EventPtr& evt = _events[_next++];
+    if(IsIdle(evt)){
+      evt->Reset(raw);
+      ++_reused;
+      return evt;
+    }
+  }
+  EventPtr evt(new Event(raw));
+  ++_created;
+  if(_events.size() < _max_size)
+    _events.push_back(evt);
+  return evt;
+}
+
+void EventPool::ReleaseIdle()
+{
+  for(size_t i=0; i<_events.size(); ++i){
+    if(IsIdle(_events[i]))
+      _events[i]->ReleaseRawEvent();
+  }
+}
+
+void EventPool::SetMaxSize(size_t max_size)
+{
+  _max_size = max_size;
+  if(_events.size() > _max_size)
+    _events.resize(_max_size);
+}
+
+void EventPool::Clear()
+{
+  _events.clear();
+  _next = 0;
+  _created = _reused = 0;
+}
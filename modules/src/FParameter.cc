@@ -32,7 +32,7 @@ int FParameter::Process(ChannelData* chdata)
 {
   //Calculate F parameter for  each channel on each board that is enabled
   
-  double* wave = chdata->GetWaveform();
+  sample_t* wave = chdata->GetWaveform();
   for (size_t j = 0; j < chdata->pulses.size(); j++)
     {
       Pulse& pulse = chdata->pulses[j];
@@ -38,7 +38,7 @@ int Fitter::Process(ChannelData* chdata)
   if( chdata->pulses.size()==0) 
     return 0;
   
-  double* wave = chdata->GetWaveform();
+  sample_t* wave = chdata->GetWaveform();
   
   for(size_t j=0; j < chdata->pulses.size(); j++){
     Pulse& pulse = chdata->pulses[j];
@@ -58,7 +58,7 @@ int GenericAnalysis::Process(EventPtr event)
     //to get access to the channel's waveform, use an intarray object 
     //we don't know a priori what the depth of the digitizer is
     //int nsamps = chdata->nsamps;
-    //double* wave = chdata->GetWaveform();
+    //sample_t* wave = chdata->GetWaveform();
     //if you want the integral (make sure to include Integrator as a dependency!) it's in
     //chdata->integral_start;
     
@@ -9,9 +9,11 @@
 
 Integrator::Integrator() : 
   ChannelModule(GetDefaultName(), 
-		"Numerically integrate each channel's waveform")
+		"Numerically integrate each channel's waveform"),
+  _fused(false)
 {
   AddDependency<BaselineFinder>();
+  _channels_independent = true;
   RegisterParameter("threshold" , threshold = 0,
 		    "Assume samples less than threshold away from baseline are zero");
 }
@@ -29,13 +31,20 @@ int Integrator::Initialize()
 int Integrator::Finalize() { return 0; }
 
 int Integrator::Process(ChannelData* chdata)
+{
+  if(_fused)
+    return 0;
+  return Integrate(chdata);
+}
+
+int Integrator::Integrate(ChannelData* chdata)
 {
   Baseline& baseline = chdata->baseline;
   if(!baseline.found_baseline)
     return 0;
   
   //get the relevant variables
-  const double* wave = chdata->GetBaselineSubtractedWaveform();
+  const sample_t* wave = chdata->GetBaselineSubtractedWaveform();
   
   const int nsamps = chdata->nsamps;
   std::vector<double>& integral = chdata->integral;
@@ -44,27 +53,33 @@ int Integrator::Process(ChannelData* chdata)
   //perform the integration
   integral[0] = wave[0] ;
   for(int samp = 1; samp < nsamps; samp++){
-    double onestep = wave[samp] ;
-    integral[samp] = integral[samp-1]
-      + ( std::abs(onestep) > threshold ? onestep : 0 );
+    integral[samp] = IntegralStep(integral[samp-1], wave[samp]);
   }
   
   //find the min/max
-  chdata->integral_max_index = std::max_element(integral.begin(), 
-						integral.end())
+  int max_index = std::max_element(integral.begin(), integral.end())
     - integral.begin();
-  chdata->integral_min_index = std::min_element(integral.begin(),
-						integral.end())
+  int min_index = std::min_element(integral.begin(), integral.end())
     - integral.begin();
+  SetIntegralInfo(chdata, max_index, min_index);
+  return 0;
+}
+
+void Integrator::SetIntegralInfo(ChannelData* chdata, int max_index,
+				 int min_index) const
+{
+  std::vector<double>& integral = chdata->integral;
+  chdata->integral_max_index = max_index;
+  chdata->integral_min_index = min_index;
   chdata->integral_max = integral[chdata->integral_max_index];
   chdata->integral_min = integral[chdata->integral_min_index];
   chdata->integral_max_time = chdata->SampleToTime(chdata->integral_max_index);
   chdata->integral_min_time = chdata->SampleToTime(chdata->integral_min_index);
 
   //baseline interpolation integral
+  Baseline& baseline = chdata->baseline;
   for(int i=0; i<(int)baseline.interpolations.size(); i++){
     Spe* pe = &baseline.interpolations[i];
     pe->integral = integral[chdata->TimeToSample(pe->start_time)]-integral[chdata->TimeToSample(pe->start_time+pe->length)];
   }
-  return 0;
 }
@@ -0,0 +1,176 @@
+#include "ModuleScheduler.hh"
+#include "BaseModule.hh"
+#include "ThreadPool.hh"
+#include "Message.hh"
+#include <algorithm>
+
+#ifndef SINGLETHREAD
+typedef std::unique_lock<std::mutex> scoped_lock;
+#endif
+
+/// Do two fields overlap, i.e. is one the same as or inside the other?
+static bool FieldsOverlap(const std::string& a, const std::string& b)
+{
+  if(a.size() == b.size())
+    return a == b;
+  const std::string& inner = (a.size() > b.size() ? a : b);
+  const std::string& outer = (a.size() > b.size() ? b : a);
+  return inner.compare(0, outer.size(), outer) == 0 &&
+    inner[outer.size()] == '.';
+}
+
+/// Find a field in <a> which overlaps one in <b>; return "" if none
+static std::string FindOverlap(const std::set<std::string>* a,
+			       const std::set<std::string>* b)
+{
+  std::set<std::string>::const_iterator i, j;
+  for(i = a->begin(); i != a->end(); ++i){
+    for(j = b->begin(); j != b->end(); ++j){
+      if(FieldsOverlap(*i, *j))
+	return *i;
+    }
+  }
+  return "";
+}
+
+/// Functor for the thread pool; every call runs one module
+class RunModule{
+  ModuleScheduler* _scheduler;
+public:
+  RunModule(ModuleScheduler* scheduler) : _scheduler(scheduler) {}
+  void operator()(size_t){ _scheduler->RunNextModule(); }
+};
+
+ModuleScheduler::ModuleScheduler() : _nstages(0), _proc_fail(0), 
+				     _nrunning(0) {}
+
+ModuleScheduler::~ModuleScheduler() {}
+
+void ModuleScheduler::Clear()
+{
+  _nodes.clear();
+  _nstages = 0;
+  _waiting_for.clear();
+  _ready.clear();
+  _event.reset();
+}
+
+int ModuleScheduler::Build(const std::vector<BaseModule*>& modules)
+{
+  Clear();
+  const size_t n = modules.size();
+  _nodes.resize(n);
+  //before[j][i]: does module j have to wait for module i, even indirectly?
+  std::vector<std::vector<bool> > before(n, std::vector<bool>(n, false));
+  for(size_t j=0; j<n; ++j){
+    BaseModule* mod = modules[j];
+    _nodes[j].module = mod;
+    _nodes[j].npredecessors = 0;
+    _nodes[j].stage = 0;
+    std::vector<size_t> preds;
+    //the constraints which don't depend on the fields
+    for(size_t i=0; i<j; ++i){
+      BaseModule* earlier = modules[i];
+      if(mod->GetDependencies()->count(earlier->GetName()) ||
+	 !mod->OutputsDeclared() || !earlier->OutputsDeclared())
+	preds.push_back(i);
+    }
+    for(size_t p=0; p<preds.size(); ++p){
+      before[j][preds[p]] = true;
+      for(size_t i=0; i<j; ++i){
+	if(before[preds[p]][i])
+	  before[j][i] = true;
+      }
+    }
+    //now look for field conflicts with modules which could run alongside
+    for(size_t i=0; i<j; ++i){
+      if(before[j][i])
+	continue;
+      BaseModule* earlier = modules[i];
+      std::string field = FindOverlap(earlier->GetOutputs(),mod->GetOutputs());
+      if(field != ""){
+	Message(WARNING)<<"Modules "<<earlier->GetName()<<" and "
+			<<mod->GetName()<<" both write "<<field
+			<<" but neither depends on the other; running "
+			<<earlier->GetName()<<" first.\n";
+      }
+      else{
+	field = FindOverlap(earlier->GetOutputs(), mod->GetInputs());
+	if(field == "")
+	  field = FindOverlap(earlier->GetInputs(), mod->GetOutputs());
+	if(field == "")
+	  continue;
+	Message(DEBUG)<<"Module "<<mod->GetName()<<" waits for "
+		      <<earlier->GetName()<<" because of "<<field<<".\n";
+      }
+      preds.push_back(i);
+      before[j][i] = true;
+      for(size_t k=0; k<i; ++k){
+	if(before[i][k])
+	  before[j][k] = true;
+      }
+    }
+    for(size_t p=0; p<preds.size(); ++p){
+      _nodes[preds[p]].successors.push_back(j);
+      _nodes[j].stage = std::max(_nodes[j].stage, _nodes[preds[p]].stage+1);
+    }
+    _nodes[j].npredecessors = preds.size();
+    _nstages = std::max(_nstages, _nodes[j].stage+1);
+  }
+  _waiting_for.resize(n);
+  return 0;
+}
+
+int ModuleScheduler::Process(EventPtr evt)
+{
+  _event = evt;
+  _proc_fail = 0;
+  _nrunning = 0;
+  //the first modules may run at once, so decode whatever is still pending
+  _event->GetEventData()->DecodeWaveforms();
+  _ready.clear();
+  for(size_t i=0; i<_nodes.size(); ++i){
+    _waiting_for[i] = _nodes[i].npredecessors;
+    if(_waiting_for[i] == 0)
+      _ready.push_back(i);
+  }
+  //every call runs exactly one module, so this runs them all
+  ThreadPool::GetInstance()->ParallelFor(_nodes.size(), RunModule(this));
+  _event.reset();
+  return _proc_fail;
+}
+
+void ModuleScheduler::RunNextModule()
+{
+#ifndef SINGLETHREAD
+  scoped_lock lock(_mutex);
+  //something is always ready or running, so this can't wait forever
+  while(_ready.empty())
+    _module_ready.wait(lock);
+#endif
+  size_t next = _ready.front();
+  _ready.pop_front();
+  ++_nrunning;
+#ifndef SINGLETHREAD
+  lock.unlock();
+#endif
+  BaseModule* mod = _nodes[next].module;
+  int fail = (mod->enabled ? mod->HandleEvent(_event) : 0);
+#ifndef SINGLETHREAD
+  lock.lock();
+#endif
+  _proc_fail += fail;
+  //nothing else can be touching the event, so decode any new waveforms
+  //before the next modules can read them at once
+  if(--_nrunning == 0)
+    _event->GetEventData()->DecodeWaveforms();
+  const std::vector<size_t>& successors = _nodes[next].successors;
+  for(size_t i=0; i<successors.size(); ++i){
+    if(--_waiting_for[successors[i]] == 0){
+      _ready.push_back(successors[i]);
+#ifndef SINGLETHREAD
+      _module_ready.notify_one();
+#endif
+    }
+  }
+}
@@ -0,0 +1,87 @@
+#include "ModuleTimer.hh"
+#include <time.h>
+
+bool ModuleTimer::_enabled = false;
+
+//only the recording thread writes, so a plain load and store is enough
+static inline void Increment(std::atomic<long>& counter, long val)
+{
+  counter.store(counter.load(std::memory_order_relaxed) + val,
+		std::memory_order_relaxed);
+}
+
+long ModuleTimer::WallNow()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000L + ts.tv_nsec;
+}
+
+long ModuleTimer::CpuNow()
+{
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec*1000000000L + ts.tv_nsec;
+}
+
+void ModuleTimer::Reset()
+{
+  _calls = 0;
+  _processed = 0;
+  _failed = 0;
+  _wall_ns = 0;
+  _cpu_ns = 0;
+  _max_wall_ns = 0;
+  for(int i=0; i<NBINS; ++i)
+    _wall_hist[i] = 0;
+}
+
+void ModuleTimer::Record(bool processed, bool failed, long wall_ns,
+			 long cpu_ns)
+{
+  Increment(_calls, 1);
+  if(processed)
+    Increment(_processed, 1);
+  if(failed)
+    Increment(_failed, 1);
+  Increment(_wall_ns, wall_ns);
+  Increment(_cpu_ns, cpu_ns);
+  if(wall_ns > _max_wall_ns.load(std::memory_order_relaxed))
+    _max_wall_ns.store(wall_ns, std::memory_order_relaxed);
+  //bin i holds times in [2^(i-1), 2^i) ns
+  int bin = (wall_ns > 0 ? 64 - __builtin_clzl(wall_ns) : 0);
+  Increment(_wall_hist[bin < NBINS ? bin : NBINS-1], 1);
+}
+
+void ModuleTimer::Add(const ModuleTimer& right)
+{
+  Increment(_calls, right.GetCalls());
+  Increment(_processed, right.GetProcessed());
+  Increment(_failed, right.GetFailed());
+  Increment(_wall_ns, right.GetWallNs());
+  Increment(_cpu_ns, right.GetCpuNs());
+  if(right.GetMaxWallNs() > GetMaxWallNs())
+    _max_wall_ns.store(right.GetMaxWallNs(), std::memory_order_relaxed);
+  for(int i=0; i<NBINS; ++i)
+    Increment(_wall_hist[i],
+	      right._wall_hist[i].load(std::memory_order_relaxed));
+}
+
+long ModuleTimer::GetWallQuantile(double frac) const
+{
+  long counts[NBINS];
+  long total = 0;
+  for(int i=0; i<NBINS; ++i){
+    counts[i] = _wall_hist[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if(total == 0)
+    return 0;
+  long sum = 0;
+  for(int i=0; i<NBINS-1; ++i){
+    sum += counts[i];
+    if(sum >= frac*total)
+      return 1L<<i;
+  }
+  return GetMaxWallNs();
+}
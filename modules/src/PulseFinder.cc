@@ -55,6 +55,9 @@ PulseFinder::PulseFinder() :
   AddDependency<ConvertData>();
   AddDependency<BaselineFinder>();
   AddDependency<Integrator>();
+  AddOutput("pulses_aligned");
+  AddOutput("channels.pulses");
+  AddOutput("channels.npulses");
   
   ///@todo Provide helptext for PulseFinder parameters
   RegisterParameter("align_pulses", align_pulses = true,
@@ -166,7 +169,7 @@ int PulseFinder::Process(EventPtr evt)
 
 	//Start check for wheteher the start found is too far from the peak when the pulse is s1 ***************************
 	//(Messy code! Should eventually be moved to search functions)
-	double* subtracted = sum_ch->GetBaselineSubtractedWaveform();
+	sample_t* subtracted = sum_ch->GetBaselineSubtractedWaveform();
 	double* integral = sum_ch->GetIntegralWaveform();
 	int ratio_samps = (int)(0.02*sum_ch->sample_rate);
 	for (size_t i = 0; i < start_index[ChannelData::CH_SUM].size();  i++)
@@ -245,7 +248,7 @@ int PulseFinder::Process(EventPtr evt)
 
 	    //Start check for wheteher the start found is too far from the peak when the pulse is s1 ***************************
 	    //(Messy code! Should eventually be moved to search functions)
-	    double* subtracted = chdata.GetBaselineSubtractedWaveform();
+	    sample_t* subtracted = chdata.GetBaselineSubtractedWaveform();
 	    double* integral = chdata.GetIntegralWaveform();
 	    int ratio_samps = (int)(0.02*chdata.sample_rate);
 	    for (size_t i = 0; i < start_index[chdata.channel_id].size();  i++)
@@ -350,7 +353,7 @@ int PulseFinder::EvaluatePulse(Pulse& pulse, ChannelData* chdata,
 {
   if(!chdata->baseline.found_baseline)
     return 1;
-  double* subtracted = chdata->GetBaselineSubtractedWaveform();
+  sample_t* subtracted = chdata->GetBaselineSubtractedWaveform();
   int min_index = std::min_element(subtracted + start_index, 
 				   subtracted + end_index) - subtracted;
   pulse.found_start = true;
@@ -415,7 +418,7 @@ int PulseFinder::EvaluatePulse(Pulse& pulse, ChannelData* chdata,
   }
   pulse.npe = -pulse.integral/chdata->spe_mean;
   //Check to see if peak is saturated
-  double* wave = chdata->GetWaveform();
+  sample_t* wave = chdata->GetWaveform();
   if(wave[min_index] == 0){
     pulse.peak_saturated = true;
     int min_end_index = min_index + 1;
@@ -435,7 +438,7 @@ void PulseFinder::VarianceSearch(ChannelData* chdata,
 {
   Baseline& baseline = chdata->baseline;
   int index=start_window;
-  double* wave = chdata->GetWaveform();
+  sample_t* wave = chdata->GetWaveform();
   double start_baseline;
   bool found_start;
   for(index = start_window; index < chdata->nsamps; index++)
@@ -493,7 +496,7 @@ void PulseFinder::DiscriminatorSearch( ChannelData* chdata,
 				       std::vector<int>& start_index,
 				       std::vector<int>& end_index)
 {
-  double* wave = chdata->GetWaveform();
+  sample_t* wave = chdata->GetWaveform();
   double check_val = discriminator_value;
   if(discriminator_relative)
     wave = chdata->GetBaselineSubtractedWaveform();
@@ -537,7 +540,7 @@ void PulseFinder::IntegralSearch( ChannelData* chdata,
   double scale_factor = normalize ? chdata->spe_mean : 1;
   
   double* integral = chdata->GetIntegralWaveform();
-  double* wave = chdata->GetBaselineSubtractedWaveform();
+  sample_t* wave = chdata->GetBaselineSubtractedWaveform();
   int start_samps = (int)(integral_start_time * chdata->sample_rate); 
   int end_samps = (int)(integral_end_time * chdata->sample_rate);
   int min_pulse_samps = (int)(min_pulse_time * chdata->sample_rate);
@@ -651,7 +654,7 @@ void PulseFinder::CurvatureSearch( ChannelData* chdata,
 	int loopcount=0;
 	int maxloop = df;
 	if(i<n-2) maxloop+= df;
-	double* sub = chdata->GetBaselineSubtractedWaveform();
+	sample_t* sub = chdata->GetBaselineSubtractedWaveform();
 	while( ++loopcount<maxloop && -sub[start] < amplitude_start_threshold)
 	  start++;
 	start_index.push_back(start-2 > 0 ? start-2 : 0);
@@ -193,7 +193,7 @@ int PulseShapeEval::Process(EventPtr evt)
 	if(!(chdata.baseline.found_baseline) || chdata.baseline.saturated)
 	    continue;
 	
-	const double* wave = chdata.GetBaselineSubtractedWaveform();
+	const sample_t* wave = chdata.GetBaselineSubtractedWaveform();
 	int n_bins = gatti_weights[chdata.channel_id]->GetNbinsX();
 
 	for (size_t pulse_num = 0; pulse_num < chdata.pulses.size(); pulse_num++)
@@ -10,11 +10,20 @@
 #include <sstream>
 #include <sys/stat.h> //needed for mkdir
 #include <zlib.h>
+#include <cstring>
+
+#ifndef SINGLETHREAD
+typedef std::unique_lock<std::mutex> scoped_lock;
+#endif
 
 RawWriter::RawWriter() : 
   BaseModule(RawWriter::GetDefaultName(),
 	     "Saves the (gzip'ped) raw data from the digitizers to disk"), 
-  _fout(), _logout(), _log_messenger(0), _ok(true), _bytes_written(0)
+  _fout(), _logout(), _log_messenger(0), _ok(true), _bytes_written(0),
+  _pipeline_running(false), _pipeline_stalls(0)
+#ifndef SINGLETHREAD
+  , _pending_bytes(0), _pipeline_error(0), _pipeline_stop(false)
+#endif
 {
   RegisterParameter("filename",_filename = "",
 		    "Name of the output file; if it doesn't contain a /, assumed relative to <directory>");
@@ -26,6 +35,8 @@ RawWriter::RawWriter() :
 		    "Base for automatic filenames <base>_yymmddHHMM.###.out");
   RegisterParameter("compression", _compression = Z_BEST_SPEED,
 		    "zip compression level of the event structures");
+  RegisterParameter("compression_codec", _codec = BlockCodec::ZLIB,
+		    "Algorithm to compress datablocks: STORED, ZLIB, LZ4, ZSTD, V172X");
   RegisterParameter("save_config", _save_config = true,
 		    "Do we save the configuration along with the data?");
   RegisterParameter("write_database", _write_database = false, 
@@ -35,6 +46,10 @@ RawWriter::RawWriter() :
 		    "Maximum file size before making a new file");
   RegisterParameter("max_event_in_file", _max_event_in_file = 10000 , 
 		    "Maximum number of events before making a new file");
+  RegisterParameter("compression_threads", _compression_threads = 0,
+		    "Compress events in this many background threads; 0 compresses in Process");
+  RegisterParameter("max_pending_bytes", _max_pending_bytes = 256*1024*1024,
+		    "Memory budget for events waiting to be compressed and written");
 
   ConfigHandler* config = ConfigHandler::GetInstance();
   config->AddCommandSwitch('f',"filename", "File for saving raw data",
@@ -46,14 +61,30 @@ RawWriter::RawWriter() :
   config->AddCommandSwitch('c',"compression","Raw data compression level",
 			   CommandSwitch::DefaultRead<int>(_compression),
 			   "level");
+  config->AddCommandSwitch(' ',"codec","Raw data compression algorithm",
+			   CommandSwitch::DefaultRead<BlockCodec::CODEC>(_codec),
+			   "codec");
+  config->AddCommandSwitch(' ',"compression-threads",
+			   "Number of threads compressing raw data",
+			   CommandSwitch::DefaultRead<int>(_compression_threads),
+			   "n");
 }
 
 RawWriter::~RawWriter()
 {
+  StopPipeline();
   if(_fout.is_open())
     CloseCurrentFile();
 }
 
+long long RawWriter::GetBytesWritten()
+{
+#ifndef SINGLETHREAD
+  scoped_lock lock(_write_mutex);
+#endif
+  return _bytes_written;
+}
+
 std::string RawWriter::GetDefaultFilename() const
 {
   //create the default filename
@@ -69,6 +100,11 @@ std::string RawWriter::GetDefaultFilename() const
 
 int RawWriter::Initialize()
 {
+  if(!BlockCodec::IsAvailable(_codec)){
+    Message(ERROR)<<"Compression codec "<<_codec
+		  <<" was not compiled into this version of daqman.\n";
+    return 1;
+  }
   //query user for run metadata
   runinfo* info = EventHandler::GetInstance()->GetRunInfo();
   if(info){
@@ -133,68 +169,133 @@ int RawWriter::Initialize()
   //write the partial config file
   if(_save_config)
     SaveConfigFile();
-  return OpenNewFile();
+  int err = OpenNewFile();
+  if(!err && _compression_threads > 0)
+    err = StartPipeline();
+  return err;
 }
 
 int RawWriter::Process(EventPtr event)
 {
+#ifndef SINGLETHREAD
+  //the writer thread owns the file; errors come back through _pipeline_error
+  if(_pipeline_running){
+    RawEventPtr raw = event->GetRawEvent();
+    PendingWritePtr pending(new pending_write);
+    pending->raw = raw;
+    //the uncompressed event plus the worst case compressed copy
+    for(size_t i=0; i<raw->GetNumDataBlocks(); ++i)
+      pending->cost += raw->GetDataBlockSize(i) + 
+	BlockCodec::GetMaxEncodedSize(_codec, raw->GetDataBlockSize(i));
+    return QueueEvent(pending);
+  }
+#endif
   if(!_ok){
     Message(ERROR)<<"Attempt to write to file in bad state!\n";
     return 1;
   }
-  
+  std::vector<char> buf;
+  int err = CompressEvent(event->GetRawEvent(), buf);
+  if(!err)
+    err = WriteToFile(buf);
+  if(!err)
+    _bytes_written += buf.size();
+  return err;
+}
+
+int RawWriter::WriteCompressedEvent(const std::vector<char>& buf)
+{
+  if(buf.size() < sizeof(Reader::event_header) || 
+     ((const Reader::event_header*)(&buf[0]))->event_size != buf.size()){
+    Message(ERROR)<<"RawWriter: compressed event buffer is inconsistent\n";
+    return 1;
+  }
+#ifndef SINGLETHREAD
+  if(_pipeline_running){
+    //nothing to compress; just keep it in order with the other events
+    PendingWritePtr pending(new pending_write);
+    pending->buf = buf;
+    pending->cost = buf.size();
+    pending->done = true;
+    return QueueEvent(pending);
+  }
+#endif
+  if(!_ok){
+    Message(ERROR)<<"Attempt to write to file in bad state!\n";
+    return 1;
+  }
+  int err = WriteToFile(buf);
+  if(!err)
+    _bytes_written += buf.size();
+  return err;
+}
+
+int RawWriter::CompressEvent(RawEventPtr raw, std::vector<char>& buf)
+{
   typedef Reader::datablock_header datablock_header;
   //compress all of the datablocks into a separate buffer
   //each block has compressed size, including header, uncompressed data size, 
   //and type as header
   //determine the total size of the output buffer
   uint32_t bufsize = sizeof(Reader::event_header);
-  for(size_t i = 0; i<event->GetRawEvent()->GetNumDataBlocks(); i++){
-    bufsize += compressBound(event->GetRawEvent()->GetDataBlockSize(i)) + 
+  for(size_t i = 0; i<raw->GetNumDataBlocks(); i++){
+    bufsize += BlockCodec::GetMaxEncodedSize(_codec, 
+					     raw->GetDataBlockSize(i)) + 
       sizeof(datablock_header);
   }
   //zip the data into the buffer
-  std::vector<char> buf(bufsize);
+  buf.resize(bufsize);
   size_t zipsize=sizeof(Reader::event_header);
-  for(size_t i = 0;i<event->GetRawEvent()->GetNumDataBlocks(); i++){
+  for(size_t i = 0;i<raw->GetNumDataBlocks(); i++){
     //write the data into a space after the header
-    uLong thistransfer = bufsize-zipsize-sizeof(datablock_header);
-    int err = 0;
-    if(_compression == Z_DEFAULT_COMPRESSION){
-      err = compress((Bytef*)(&buf[zipsize+sizeof(datablock_header)]),
-		     &thistransfer,
-		     event->GetRawEvent()->GetRawDataBlock(i),
-		     event->GetRawEvent()->GetDataBlockSize(i));
-    }
-    else{
-      err = compress2((Bytef*)(&buf[zipsize+sizeof(datablock_header)]),
-		      &thistransfer,
-		      event->GetRawEvent()->GetRawDataBlock(i),
-		      event->GetRawEvent()->GetDataBlockSize(i),
-		      _compression);
-    }
-    if(err != Z_OK){
+    const unsigned char* data = raw->GetRawDataBlock(i);
+    uint32_t datasize = raw->GetDataBlockSize(i);
+    unsigned char* dest = (unsigned char*)(&buf[zipsize+sizeof(datablock_header)]);
+    size_t thistransfer = bufsize-zipsize-sizeof(datablock_header);
+    BlockCodec::CODEC codec = _codec;
+    //the waveform codec only understands digitizer blocks
+    if(codec == BlockCodec::V172X && 
+       raw->GetDataBlockType(i) != RawEvent::CAEN_V172X)
+      codec = BlockCodec::ZLIB;
+    if(BlockCodec::Encode(codec, _compression, data, datasize, 
+			  dest, thistransfer)){
       Message(ERROR)<<"Unable to compress event datablocks in memory\n";
       return -1;
     }
+    //don't bother keeping the compressed version if it didn't help
+    if(codec != BlockCodec::STORED && thistransfer >= datasize){
+      codec = BlockCodec::STORED;
+      thistransfer = datasize;
+      memcpy(dest, data, datasize);
+    }
     //write the header
     datablock_header* db_head = (datablock_header*)(&buf[zipsize]);
     db_head->total_blocksize_disk = sizeof(datablock_header)+thistransfer;
-    db_head->datasize = event->GetRawEvent()->GetDataBlockSize(i);
-    db_head->type = event->GetRawEvent()->GetDataBlockType(i);
+    db_head->datasize = datasize;
+    db_head->type = raw->GetDataBlockType(i);
+    db_head->codec = codec;
     zipsize += db_head->total_blocksize_disk;
     
   }
+  buf.resize(zipsize);
   //set values in the event header
   Reader::event_header* ehead = (Reader::event_header*)(&buf[0]);
   ehead->event_size = zipsize;
-  ehead->event_id = event->GetRawEvent()->GetID();
-  ehead->timestamp = event->GetRawEvent()->GetTimestamp();
-  ehead->nblocks = event->GetRawEvent()->GetNumDataBlocks();
+  ehead->event_id = raw->GetID();
+  ehead->timestamp = raw->GetTimestamp();
+  ehead->nblocks = raw->GetNumDataBlocks();
+  return 0;
+}
 
+int RawWriter::WriteToFile(const std::vector<char>& buf)
+{
+  const Reader::event_header* ehead = (const Reader::event_header*)(&buf[0]);
   //see if we need to make a new file
+  //leave room for the trailer written at close
+  uint64_t trailer_size = sizeof(Reader::file_trailer) + 
+    (_offsets.size()+1) * sizeof(Reader::trailer_entry);
   if(_ghead.nevents>=(uint32_t)_max_event_in_file || 
-     _ghead.file_size + ehead->event_size > _max_file_size){
+     _ghead.file_size + ehead->event_size + trailer_size > _max_file_size){
     if( CloseCurrentFile() || OpenNewFile() ){
       Message(ERROR)<<"Error occurred when trying to open new file!\n";
       return 1;
@@ -202,13 +303,16 @@ int RawWriter::Process(EventPtr event)
   }
   
   //actually write the event
-  if(!_fout.write((const char*)(&buf[0]), zipsize)){
+  if(!_fout.write((const char*)(&buf[0]), ehead->event_size)){
     Message(ERROR)<<"Error occurred when writing event "<<ehead->event_id
 		  <<"to disk!\n";
     return -1;
   }
-  _bytes_written += ehead->event_size;
-  //update info for global header
+  //update info for global header and trailer
+  Reader::trailer_entry entry;
+  entry.offset = _ghead.file_size;
+  entry.event_id = ehead->event_id;
+  _offsets.push_back(entry);
   _ghead.nevents++;
   if(_ghead.event_id_min > ehead->event_id)
     _ghead.event_id_min = ehead->event_id;
@@ -218,9 +322,133 @@ int RawWriter::Process(EventPtr event)
   return 0;
 }
 
+int RawWriter::StartPipeline()
+{
+#ifndef SINGLETHREAD
+  if(_pipeline_running)
+    return 0;
+  _pipeline_stop = false;
+  _pipeline_error = 0;
+  _pending_bytes = 0;
+  _pipeline_running = true;
+  for(int i=0; i<_compression_threads; ++i)
+    _compress_threads.push_back(std::thread(&RawWriter::CompressLoop, this));
+  _writer_thread = std::thread(&RawWriter::WriterLoop, this);
+  Message(DEBUG)<<"RawWriter compressing with "<<_compression_threads
+		<<" threads.\n";
+#else
+  Message(WARNING)<<"RawWriter: compression_threads requires multithreading;"
+		  <<" compressing in Process instead.\n";
+#endif
+  return 0;
+}
+
+int RawWriter::StopPipeline()
+{
+  if(!_pipeline_running)
+    return 0;
+  int err = 0;
+#ifndef SINGLETHREAD
+  {
+    scoped_lock lock(_write_mutex);
+    _pipeline_stop = true;
+  }
+  _work_ready.notify_all();
+  _event_compressed.notify_all();
+  for(size_t i=0; i<_compress_threads.size(); ++i)
+    _compress_threads[i].join();
+  _compress_threads.clear();
+  _writer_thread.join();
+  err = _pipeline_error;
+  if(_pipeline_stalls > 0)
+    Message(DEBUG)<<"RawWriter waited for the compression queue "
+		  <<_pipeline_stalls<<" times.\n";
+#endif
+  _pipeline_running = false;
+  return err;
+}
+
+#ifndef SINGLETHREAD
+int RawWriter::QueueEvent(PendingWritePtr pending)
+{
+  scoped_lock lock(_write_mutex);
+  if(_pending_bytes > 0 && 
+     _pending_bytes + pending->cost > _max_pending_bytes){
+    ++_pipeline_stalls;
+    while(!_pipeline_error && _pending_bytes > 0 &&
+	  _pending_bytes + pending->cost > _max_pending_bytes)
+      _space_ready.wait(lock);
+  }
+  if(_pipeline_error){
+    Message(ERROR)<<"RawWriter: writer thread stopped after an error\n";
+    return _pipeline_error;
+  }
+  _pending_bytes += pending->cost;
+  _write_queue.push_back(pending);
+  if(pending->done){
+    _event_compressed.notify_all();
+  }
+  else{
+    _compress_queue.push_back(pending);
+    _work_ready.notify_one();
+  }
+  return 0;
+}
+
+void RawWriter::CompressLoop()
+{
+  scoped_lock lock(_write_mutex);
+  while(true){
+    while(_compress_queue.empty() && !_pipeline_stop)
+      _work_ready.wait(lock);
+    //only exit once everything queued has been compressed
+    if(_compress_queue.empty())
+      break;
+    PendingWritePtr next = _compress_queue.front();
+    _compress_queue.pop_front();
+    lock.unlock();
+    int status = CompressEvent(next->raw, next->buf);
+    next->raw.reset();
+    lock.lock();
+    next->status = status;
+    next->done = true;
+    _event_compressed.notify_all();
+  }
+}
+
+void RawWriter::WriterLoop()
+{
+  scoped_lock lock(_write_mutex);
+  while(true){
+    while(!(!_write_queue.empty() && _write_queue.front()->done) &&
+	  !(_pipeline_stop && _write_queue.empty()))
+      _event_compressed.wait(lock);
+    if(_write_queue.empty())
+      break;
+    PendingWritePtr next = _write_queue.front();
+    _write_queue.pop_front();
+    int status = next->status;
+    //after an error, drain the queue without writing
+    if(!status && !_pipeline_error){
+      lock.unlock();
+      status = WriteToFile(next->buf);
+      lock.lock();
+      if(!status)
+	_bytes_written += next->buf.size();
+    }
+    if(status && !_pipeline_error)
+      _pipeline_error = status;
+    _pending_bytes -= next->cost;
+    _space_ready.notify_all();
+  }
+}
+#endif
+
 int RawWriter::Finalize()
 {
-  int status = 0;
+  int status = StopPipeline();
+  if(status)
+    Message(ERROR)<<"RawWriter: errors occurred writing queued events\n";
 
   if(_fout.is_open()){
     CloseCurrentFile();
@@ -301,6 +529,9 @@ int RawWriter::OpenNewFile()
   _ghead.event_id_max = 0;
   //reset the file_size 
   _ghead.file_size = _ghead.global_header_size;
+  _offsets.clear();
+  //until the trailer is written, mark the file as having none
+  _ghead.global_header_version = 1;
   
   if(!_fout.write((const char*)(&_ghead), _ghead.global_header_size)){
     Message(ERROR)<<"RawWriter: Error writing header to file "<<fname.str()<<"\n";
@@ -314,8 +545,28 @@ int RawWriter::CloseCurrentFile()
 {
   if(!_fout.is_open())
     return 0;
-  //save the completed global header
   _ghead.end_time = time(0);
+  //append the trailer so readers can index the file without scanning it
+  Reader::file_trailer trailer;
+  trailer.trailer_size += _offsets.size() * sizeof(Reader::trailer_entry);
+  trailer.nevents = _ghead.nevents;
+  trailer.event_id_min = _ghead.event_id_min;
+  trailer.event_id_max = _ghead.event_id_max;
+  trailer.start_time = _ghead.start_time;
+  trailer.end_time = _ghead.end_time;
+  trailer.run_id = _ghead.run_id;
+  _fout.write((const char*)(&trailer), sizeof(trailer));
+  if(!_offsets.empty())
+    _fout.write((const char*)(&_offsets[0]), 
+		_offsets.size()*sizeof(Reader::trailer_entry));
+  if(_fout)
+    _ghead.global_header_version = Reader::latest_global_version;
+  else
+    Message(WARNING)<<"Unable to write the trailer for raw file "
+		    <<_ghead.file_index<<"\n";
+  _offsets.clear();
+  //save the completed global header
+  _fout.clear();
   _fout.seekp(0);
   _fout.write((const char*)(&_ghead), _ghead.global_header_size);
   _fout.close();
@@ -324,7 +575,7 @@ int RawWriter::CloseCurrentFile()
   return 0;
 }
 
-void RawWriter::SaveConfigFile()
+std::string RawWriter::GetConfigFilename() const
 {
   //strip the '.gz' off the end of the file
   std::string cfgfile(_filename);
@@ -333,6 +584,11 @@ void RawWriter::SaveConfigFile()
   //strip off .out
   if(_filename.rfind(".out") != std::string::npos)
     cfgfile.resize(cfgfile.size()-4);
-  ConfigHandler::GetInstance()->SaveToFile((cfgfile+".cfg").c_str());
+  return cfgfile+".cfg";
+}
+
+void RawWriter::SaveConfigFile()
+{
+  ConfigHandler::GetInstance()->SaveToFile(GetConfigFilename().c_str());
   
 }
@@ -0,0 +1,645 @@
+#include "SampleDecoder.hh"
+#include "Message.hh"
+#include <algorithm>
+#include <cstring>
+#include <climits>
+#include <string>
+#include <stdexcept>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SAMPLEDECODER_X86
+#include <immintrin.h>
+#endif
+
+SampleDecoder::INSTRUCTION_SET SampleDecoder::_instruction_set =
+  SampleDecoder::GetBestInstructionSet();
+
+/// The first largest and smallest of a series of values, and where they were
+template<class V> struct ArgExtremes{
+  V max, min;
+  int max_index, min_index;
+  bool any;
+  ArgExtremes() : max(0), min(0), max_index(0), min_index(0), any(false) {}
+  /// Add the next value in the series
+  void Update(V val, int index)
+  {
+    if(!any){
+      max = min = val;
+      max_index = min_index = index;
+      any = true;
+      return;
+    }
+    if(max < val){ max = val; max_index = index; }
+    if(val < min){ min = val; min_index = index; }
+  }
+  /// Add the extremes of other values, from anywhere in the series
+  void Merge(const ArgExtremes& right)
+  {
+    if(!right.any)
+      return;
+    if(!any){
+      *this = right;
+      return;
+    }
+    if(max < right.max || (max == right.max && right.max_index < max_index)){
+      max = right.max;
+      max_index = right.max_index;
+    }
+    if(right.min < min || (right.min == min && right.min_index < min_index)){
+      min = right.min;
+      min_index = right.min_index;
+    }
+  }
+};
+
+/// Convert one raw sample; the vector versions must agree with this
+static inline sample_t ToSample(uint32_t raw, bool invert, double range)
+{
+  const sample_t samp = raw;
+  return (invert ? sample_t(range - samp) : samp);
+}
+
+/// Convert samples stored one per word, starting at out[index]
+template<class T>
+static int DecodeWordsScalar(const T* in, const T* end, bool invert,
+			     double range, sample_t* out, int index,
+			     ArgExtremes<double>& ext)
+{
+  for(; in < end; ++in, ++index){
+    const sample_t samp = ToSample(*in, invert, range);
+    if(out)
+      out[index] = samp;
+    ext.Update(samp, index);
+  }
+  return index;
+}
+
+/// Convert 10-bit samples packed up to 3 per word, starting at out[index]
+static int DecodePackedScalar(const uint32_t* in, const uint32_t* end,
+			      bool invert, double range, sample_t* out,
+			      int index, ArgExtremes<double>& ext)
+{
+  for(; in < end; ++in){
+    uint32_t raw_v = *in;
+    const int ns = (raw_v>>30)&3;
+    for(int i=0; i<ns; ++i, ++index){
+      const sample_t samp = ToSample(raw_v & 0x3ff, invert, range);
+      if(out)
+	out[index] = samp;
+      ext.Update(samp, index);
+      raw_v = raw_v >> 10;
+    }
+  }
+  return index;
+}
+
+#ifdef SAMPLEDECODER_X86
+/* The vector versions work on samples of at most 16 bits as 32-bit ints,
+   which convert exactly to sample_t.  Each lane keeps its own first
+   largest and smallest sample; merging the lanes picks the earliest of
+   equal extremes, so the result is the same as the plain loop.
+*/
+
+/// Extremes of each of 4 lanes
+struct Lanes4{ __m128i max, max_index, min, min_index; };
+
+__attribute__((target("sse4.1")))
+static inline void ClearLanes(Lanes4& lanes)
+{
+  //every sample is larger than -1 and smaller than INT_MAX
+  lanes.max = _mm_set1_epi32(-1);
+  lanes.min = _mm_set1_epi32(INT_MAX);
+  lanes.max_index = lanes.min_index = _mm_setzero_si128();
+}
+
+__attribute__((target("sse4.1")))
+static inline void UpdateLanes(Lanes4& lanes, __m128i v, __m128i index)
+{
+  const __m128i gt = _mm_cmpgt_epi32(v, lanes.max);
+  lanes.max = _mm_blendv_epi8(lanes.max, v, gt);
+  lanes.max_index = _mm_blendv_epi8(lanes.max_index, index, gt);
+  const __m128i lt = _mm_cmplt_epi32(v, lanes.min);
+  lanes.min = _mm_blendv_epi8(lanes.min, v, lt);
+  lanes.min_index = _mm_blendv_epi8(lanes.min_index, index, lt);
+}
+
+__attribute__((target("sse4.1")))
+static void MergeLanes(const Lanes4& lanes, ArgExtremes<double>& ext)
+{
+  int32_t max[4], max_index[4], min[4], min_index[4];
+  _mm_storeu_si128((__m128i*)max, lanes.max);
+  _mm_storeu_si128((__m128i*)max_index, lanes.max_index);
+  _mm_storeu_si128((__m128i*)min, lanes.min);
+  _mm_storeu_si128((__m128i*)min_index, lanes.min_index);
+  for(int i=0; i<4; ++i){
+    ArgExtremes<double> lane;
+    lane.max = max[i];
+    lane.max_index = max_index[i];
+    lane.min = min[i];
+    lane.min_index = min_index[i];
+    lane.any = true;
+    ext.Merge(lane);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i Load4(const uint8_t* in)
+{
+  int32_t word;
+  memcpy(&word, in, sizeof(word));
+  return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(word));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i Load4(const uint16_t* in)
+{
+  return _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)in));
+}
+
+__attribute__((target("sse4.1")))
+static inline void Store4(sample_t* out, __m128i v)
+{
+#ifdef FLOAT_SAMPLES
+  _mm_storeu_ps(out, _mm_cvtepi32_ps(v));
+#else
+  _mm_storeu_pd(out, _mm_cvtepi32_pd(v));
+  _mm_storeu_pd(out+2, _mm_cvtepi32_pd(_mm_unpackhi_epi64(v,v)));
+#endif
+}
+
+template<class T> __attribute__((target("sse4.1")))
+static int DecodeWordsSSE4(const T* in, const T* end, bool invert,
+			   double range, sample_t* out, int index,
+			   ArgExtremes<double>& ext)
+{
+  const __m128i vrange = _mm_set1_epi32((int)range);
+  const __m128i step = _mm_set1_epi32(4);
+  __m128i vindex = _mm_setr_epi32(index, index+1, index+2, index+3);
+  Lanes4 lanes;
+  ClearLanes(lanes);
+  bool any = false;
+  for(; end - in >= 4; in += 4, index += 4){
+    __m128i v = Load4(in);
+    if(invert)
+      v = _mm_sub_epi32(vrange, v);
+    if(out)
+      Store4(out+index, v);
+    UpdateLanes(lanes, v, vindex);
+    vindex = _mm_add_epi32(vindex, step);
+    any = true;
+  }
+  if(any)
+    MergeLanes(lanes, ext);
+  return DecodeWordsScalar(in, end, invert, range, out, index, ext);
+}
+
+__attribute__((target("sse4.1")))
+static int DecodePackedSSE4(const uint32_t* in, const uint32_t* end,
+			    bool invert, double range, sample_t* out,
+			    int index, ArgExtremes<double>& ext)
+{
+  const __m128i vrange = _mm_set1_epi32((int)range);
+  const __m128i mask = _mm_set1_epi32(0x3ff);
+  const __m128i full = _mm_set1_epi32(3);
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i lane_offset = _mm_setr_epi32(0, 3, 6, 9);
+  Lanes4 lanes;
+  ClearLanes(lanes);
+  bool any = false;
+  //words with fewer than 3 samples are done one at a time
+  ArgExtremes<double> partial;
+  for(; end - in >= 4; in += 4){
+    const __m128i w = _mm_loadu_si128((const __m128i*)in);
+    const __m128i nfull = _mm_cmpeq_epi32(_mm_srli_epi32(w, 30), full);
+    if(_mm_movemask_ps(_mm_castsi128_ps(nfull)) != 0xF){
+      index = DecodePackedScalar(in, in+4, invert, range, out, index, partial);
+      continue;
+    }
+    __m128i a = _mm_and_si128(w, mask);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(w, 10), mask);
+    __m128i c = _mm_and_si128(_mm_srli_epi32(w, 20), mask);
+    if(invert){
+      a = _mm_sub_epi32(vrange, a);
+      b = _mm_sub_epi32(vrange, b);
+      c = _mm_sub_epi32(vrange, c);
+    }
+    if(out){
+      //a0 b0 c0 a1 | b1 c1 a2 b2 | c2 a3 b3 c3
+      __m128 pa = _mm_castsi128_ps(_mm_shuffle_epi32(a, _MM_SHUFFLE(1,0,0,0)));
+      __m128 pb = _mm_castsi128_ps(_mm_shuffle_epi32(b, _MM_SHUFFLE(1,0,0,0)));
+      __m128 pc = _mm_castsi128_ps(_mm_shuffle_epi32(c, _MM_SHUFFLE(1,0,0,0)));
+      Store4(out+index, _mm_castps_si128(
+        _mm_blend_ps(_mm_blend_ps(pa, pb, 0x2), pc, 0x4)));
+      pa = _mm_castsi128_ps(_mm_shuffle_epi32(a, _MM_SHUFFLE(2,2,1,1)));
+      pb = _mm_castsi128_ps(_mm_shuffle_epi32(b, _MM_SHUFFLE(2,2,1,1)));
+      pc = _mm_castsi128_ps(_mm_shuffle_epi32(c, _MM_SHUFFLE(2,2,1,1)));
+      Store4(out+index+4, _mm_castps_si128(
+        _mm_blend_ps(_mm_blend_ps(pa, pb, 0x9), pc, 0x2)));
+      pa = _mm_castsi128_ps(_mm_shuffle_epi32(a, _MM_SHUFFLE(3,3,3,2)));
+      pb = _mm_castsi128_ps(_mm_shuffle_epi32(b, _MM_SHUFFLE(3,3,3,2)));
+      pc = _mm_castsi128_ps(_mm_shuffle_epi32(c, _MM_SHUFFLE(3,3,3,2)));
+      Store4(out+index+8, _mm_castps_si128(
+        _mm_blend_ps(_mm_blend_ps(pa, pb, 0x4), pc, 0x9)));
+    }
+    //each lane sees its samples in order
+    __m128i vindex = _mm_add_epi32(_mm_set1_epi32(index), lane_offset);
+    UpdateLanes(lanes, a, vindex);
+    vindex = _mm_add_epi32(vindex, one);
+    UpdateLanes(lanes, b, vindex);
+    vindex = _mm_add_epi32(vindex, one);
+    UpdateLanes(lanes, c, vindex);
+    index += 12;
+    any = true;
+  }
+  if(any)
+    MergeLanes(lanes, ext);
+  ext.Merge(partial);
+  return DecodePackedScalar(in, end, invert, range, out, index, ext);
+}
+
+/// Extremes of each of 8 lanes
+struct Lanes8{ __m256i max, max_index, min, min_index; };
+
+__attribute__((target("avx2")))
+static inline void ClearLanes(Lanes8& lanes)
+{
+  lanes.max = _mm256_set1_epi32(-1);
+  lanes.min = _mm256_set1_epi32(INT_MAX);
+  lanes.max_index = lanes.min_index = _mm256_setzero_si256();
+}
+
+__attribute__((target("avx2")))
+static inline void UpdateLanes(Lanes8& lanes, __m256i v, __m256i index)
+{
+  const __m256i gt = _mm256_cmpgt_epi32(v, lanes.max);
+  lanes.max = _mm256_blendv_epi8(lanes.max, v, gt);
+  lanes.max_index = _mm256_blendv_epi8(lanes.max_index, index, gt);
+  const __m256i lt = _mm256_cmpgt_epi32(lanes.min, v);
+  lanes.min = _mm256_blendv_epi8(lanes.min, v, lt);
+  lanes.min_index = _mm256_blendv_epi8(lanes.min_index, index, lt);
+}
+
+__attribute__((target("avx2")))
+static void MergeLanes(const Lanes8& lanes, ArgExtremes<double>& ext)
+{
+  int32_t max[8], max_index[8], min[8], min_index[8];
+  _mm256_storeu_si256((__m256i*)max, lanes.max);
+  _mm256_storeu_si256((__m256i*)max_index, lanes.max_index);
+  _mm256_storeu_si256((__m256i*)min, lanes.min);
+  _mm256_storeu_si256((__m256i*)min_index, lanes.min_index);
+  for(int i=0; i<8; ++i){
+    ArgExtremes<double> lane;
+    lane.max = max[i];
+    lane.max_index = max_index[i];
+    lane.min = min[i];
+    lane.min_index = min_index[i];
+    lane.any = true;
+    ext.Merge(lane);
+  }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Load8(const uint8_t* in)
+{
+  return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)in));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Load8(const uint16_t* in)
+{
+  return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)in));
+}
+
+__attribute__((target("avx2")))
+static inline void Store8(sample_t* out, __m256i v)
+{
+#ifdef FLOAT_SAMPLES
+  _mm256_storeu_ps(out, _mm256_cvtepi32_ps(v));
+#else
+  _mm256_storeu_pd(out, _mm256_cvtepi32_pd(_mm256_castsi256_si128(v)));
+  _mm256_storeu_pd(out+4, _mm256_cvtepi32_pd(_mm256_extracti128_si256(v,1)));
+#endif
+}
+
+template<class T> __attribute__((target("avx2")))
+static int DecodeWordsAVX2(const T* in, const T* end, bool invert,
+			   double range, sample_t* out, int index,
+			   ArgExtremes<double>& ext)
+{
+  const __m256i vrange = _mm256_set1_epi32((int)range);
+  const __m256i step = _mm256_set1_epi32(8);
+  __m256i vindex = _mm256_add_epi32(_mm256_set1_epi32(index),
+				    _mm256_setr_epi32(0,1,2,3,4,5,6,7));
+  Lanes8 lanes;
+  ClearLanes(lanes);
+  bool any = false;
+  for(; end - in >= 8; in += 8, index += 8){
+    __m256i v = Load8(in);
+    if(invert)
+      v = _mm256_sub_epi32(vrange, v);
+    if(out)
+      Store8(out+index, v);
+    UpdateLanes(lanes, v, vindex);
+    vindex = _mm256_add_epi32(vindex, step);
+    any = true;
+  }
+  if(any)
+    MergeLanes(lanes, ext);
+  return DecodeWordsScalar(in, end, invert, range, out, index, ext);
+}
+
+/// Pick the lanes <perm> of a, b and c for interleaving them
+__attribute__((target("avx2")))
+static inline void Permute3(__m256i a, __m256i b, __m256i c, __m256i perm,
+			    __m256i& pa, __m256i& pb, __m256i& pc)
+{
+  pa = _mm256_permutevar8x32_epi32(a, perm);
+  pb = _mm256_permutevar8x32_epi32(b, perm);
+  pc = _mm256_permutevar8x32_epi32(c, perm);
+}
+
+__attribute__((target("avx2")))
+static int DecodePackedAVX2(const uint32_t* in, const uint32_t* end,
+			    bool invert, double range, sample_t* out,
+			    int index, ArgExtremes<double>& ext)
+{
+  const __m256i vrange = _mm256_set1_epi32((int)range);
+  const __m256i mask = _mm256_set1_epi32(0x3ff);
+  const __m256i full = _mm256_set1_epi32(3);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i lane_offset = _mm256_setr_epi32(0,3,6,9,12,15,18,21);
+  //a0 b0 c0 a1 b1 c1 a2 b2 | c2 a3 b3 c3 a4 b4 c4 a5 | b5 c5 a6 b6 c6 a7 b7 c7
+  const __m256i perm0 = _mm256_setr_epi32(0,0,0,1,1,1,2,2);
+  const __m256i perm1 = _mm256_setr_epi32(2,3,3,3,4,4,4,5);
+  const __m256i perm2 = _mm256_setr_epi32(5,5,6,6,6,7,7,7);
+  Lanes8 lanes;
+  ClearLanes(lanes);
+  bool any = false;
+  //words with fewer than 3 samples are done one at a time
+  ArgExtremes<double> partial;
+  for(; end - in >= 8; in += 8){
+    const __m256i w = _mm256_loadu_si256((const __m256i*)in);
+    const __m256i nfull = _mm256_cmpeq_epi32(_mm256_srli_epi32(w, 30), full);
+    if(_mm256_movemask_ps(_mm256_castsi256_ps(nfull)) != 0xFF){
+      index = DecodePackedScalar(in, in+8, invert, range, out, index, partial);
+      continue;
+    }
+    __m256i a = _mm256_and_si256(w, mask);
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(w, 10), mask);
+    __m256i c = _mm256_and_si256(_mm256_srli_epi32(w, 20), mask);
+    if(invert){
+      a = _mm256_sub_epi32(vrange, a);
+      b = _mm256_sub_epi32(vrange, b);
+      c = _mm256_sub_epi32(vrange, c);
+    }
+    if(out){
+      __m256i pa, pb, pc;
+      Permute3(a, b, c, perm0, pa, pb, pc);
+      Store8(out+index, _mm256_blend_epi32(_mm256_blend_epi32(pa, pb, 0x92),
+					   pc, 0x24));
+      Permute3(a, b, c, perm1, pa, pb, pc);
+      Store8(out+index+8, _mm256_blend_epi32(_mm256_blend_epi32(pa, pb, 0x24),
+					     pc, 0x49));
+      Permute3(a, b, c, perm2, pa, pb, pc);
+      Store8(out+index+16, _mm256_blend_epi32(_mm256_blend_epi32(pa, pb, 0x49),
+					      pc, 0x92));
+    }
+    //each lane sees its samples in order
+    __m256i vindex = _mm256_add_epi32(_mm256_set1_epi32(index), lane_offset);
+    UpdateLanes(lanes, a, vindex);
+    vindex = _mm256_add_epi32(vindex, one);
+    UpdateLanes(lanes, b, vindex);
+    vindex = _mm256_add_epi32(vindex, one);
+    UpdateLanes(lanes, c, vindex);
+    index += 24;
+    any = true;
+  }
+  if(any)
+    MergeLanes(lanes, ext);
+  ext.Merge(partial);
+  return DecodePackedScalar(in, end, invert, range, out, index, ext);
+}
+#endif //SAMPLEDECODER_X86
+
+/// Convert one-per-word samples with the fastest allowed version
+template<class T>
+static int DecodeWords(SampleDecoder::INSTRUCTION_SET set,
+		       const T* in, const T* end, bool invert, double range,
+		       sample_t* out, int index, ArgExtremes<double>& ext)
+{
+#ifdef SAMPLEDECODER_X86
+  if(set == SampleDecoder::AVX2)
+    return DecodeWordsAVX2(in, end, invert, range, out, index, ext);
+  if(set == SampleDecoder::SSE4)
+    return DecodeWordsSSE4(in, end, invert, range, out, index, ext);
+#endif
+  return DecodeWordsScalar(in, end, invert, range, out, index, ext);
+}
+
+/// Convert packed 10-bit samples with the fastest allowed version
+static int DecodePacked(SampleDecoder::INSTRUCTION_SET set,
+			const uint32_t* in, const uint32_t* end, bool invert,
+			double range, sample_t* out, int index,
+			ArgExtremes<double>& ext)
+{
+#ifdef SAMPLEDECODER_X86
+  if(set == SampleDecoder::AVX2)
+    return DecodePackedAVX2(in, end, invert, range, out, index, ext);
+  if(set == SampleDecoder::SSE4)
+    return DecodePackedSSE4(in, end, invert, range, out, index, ext);
+#endif
+  return DecodePackedScalar(in, end, invert, range, out, index, ext);
+}
+
+/// Copy the extremes found into the public struct
+static void SetExtremes(const ArgExtremes<double>& ext,
+			SampleDecoder::Extremes* extremes)
+{
+  if(!extremes)
+    return;
+  extremes->max_index = ext.max_index;
+  extremes->min_index = ext.min_index;
+  extremes->max = ext.max;
+  extremes->min = ext.min;
+}
+
+SampleDecoder::INSTRUCTION_SET SampleDecoder::GetBestInstructionSet()
+{
+#ifdef SAMPLEDECODER_X86
+  //we may be called before main, when the cpu info isn't filled in yet
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return AVX2;
+  if(__builtin_cpu_supports("sse4.1"))
+    return SSE4;
+#endif
+  return SCALAR;
+}
+
+SampleDecoder::INSTRUCTION_SET SampleDecoder::GetInstructionSet()
+{
+  return _instruction_set;
+}
+
+void SampleDecoder::SetInstructionSet(INSTRUCTION_SET set)
+{
+  _instruction_set = std::min(set, GetBestInstructionSet());
+}
+
+const char* SampleDecoder::GetName(INSTRUCTION_SET set)
+{
+  switch(set){
+  case SCALAR: return "SCALAR";
+  case SSE4:   return "SSE4";
+  case AVX2:   return "AVX2";
+  }
+  return "UNKNOWN";
+}
+
+int SampleDecoder::CountSamples(const char* start, const char* end,
+				int sample_bits)
+{
+  if(!start || !end)
+    return 0;
+  const long nbytes = end - start;
+  if(sample_bits < 9)
+    return nbytes;
+  else if(sample_bits != 10)
+    return nbytes / (sample_bits < 17 ? 2 : 4);
+  //packed samples have to be counted one word at a time
+  int count = 0;
+  for(const uint32_t* ptr = (const uint32_t*)start;
+      ptr < (const uint32_t*)end; ++ptr)
+    count += ((*ptr)>>30)&3;
+  return count;
+}
+
+int SampleDecoder::Decode(const char* start, const char* end, int sample_bits,
+			  bool invert, double range,
+			  sample_t* out, Extremes* extremes)
+{
+  ArgExtremes<double> ext;
+  int nsamps = 0;
+  if(start && end){
+    if(sample_bits < 9)
+      nsamps = DecodeWords(_instruction_set, (const uint8_t*)start,
+			   (const uint8_t*)end, invert, range, out, 0, ext);
+    else if(sample_bits == 10)
+      nsamps = DecodePacked(_instruction_set, (const uint32_t*)start,
+			    (const uint32_t*)end, invert, range, out, 0, ext);
+    else if(sample_bits < 17)
+      nsamps = DecodeWords(_instruction_set, (const uint16_t*)start,
+			   (const uint16_t*)end, invert, range, out, 0, ext);
+    else
+      nsamps = DecodeWordsScalar((const uint32_t*)start, (const uint32_t*)end,
+				 invert, range, out, 0, ext);
+  }
+  SetExtremes(ext, extremes);
+  return nsamps;
+}
+
+int SampleDecoder::DecodeZLE(const char* start, int sample_bits,
+			     int samples_per_word, bool invert, double range,
+			     std::vector<sample_t>& wave,
+			     std::vector<std::pair<int,int> >& regions,
+			     Extremes* extremes)
+{
+  const uint32_t* words = (const uint32_t*)start;
+  //first word is the size of this channel's data
+  const uint32_t nwords = words[0];
+  //find the good regions and the total size from the control words
+  int nsamps = 0;
+  regions.clear();
+  for(uint32_t offset = 1; offset < nwords; ++offset){
+    const uint32_t control = words[offset];
+    const uint32_t subwords = control & 0x1FFFFF;
+    const int subsamps = subwords * samples_per_word;
+    if(control & 0x80000000){
+      regions.push_back(std::make_pair(nsamps, nsamps + subsamps));
+      offset += subwords;
+    }
+    nsamps += subsamps;
+  }
+  ArgExtremes<double> ext;
+  //assign all the value of 1 by default so it doesn't show as saturated
+  wave.assign(nsamps, ToSample(1, invert, range));
+  if(nsamps == 0){
+    SetExtremes(ext, extremes);
+    return 0;
+  }
+  sample_t* out = &(wave[0]);
+  //now fill all the valid samples; 10-bit samples are not packed here
+  const INSTRUCTION_SET set = (sample_bits < 17 ? _instruction_set : SCALAR);
+  size_t block = 0;
+  for(uint32_t offset = 1; offset < nwords; ++offset){
+    const uint32_t control = words[offset];
+    if(!(control & 0x80000000))
+      continue;
+    const char* data = (const char*)(words + offset + 1);
+    const int first = regions[block].first;
+    const int subsamps = regions[block].second - first;
+    ArgExtremes<double> region;
+    if(sample_bits < 9)
+      DecodeWords(set, (const uint8_t*)data, (const uint8_t*)data + subsamps,
+		  invert, range, out, first, region);
+    else if(sample_bits < 17)
+      DecodeWords(set, (const uint16_t*)data, (const uint16_t*)data+subsamps,
+		  invert, range, out, first, region);
+    else
+      DecodeWordsScalar((const uint32_t*)data, (const uint32_t*)data+subsamps,
+			invert, range, out, first, region);
+    ext.Merge(region);
+    offset += control & 0x1FFFFF;
+    ++block;
+  }
+  //set the gaps to the nearest sample; each gap holds a single value
+  for(block=0; block < regions.size(); block++){
+    int fill_start = (block > 0 ? regions[block-1].second : 0 );
+    int fill_end = regions[block].first;
+    if(fill_end > fill_start){
+      std::fill( &(wave[fill_start]), &(wave[fill_end]), wave[fill_end]);
+      ArgExtremes<double> gap;
+      gap.Update(wave[fill_start], fill_start);
+      ext.Merge(gap);
+    }
+  }
+  //check the last region
+  if( !regions.empty() && regions.back().second < nsamps){
+    std::fill( &(wave[regions.back().second]), &(wave[nsamps]),
+	       wave[regions.back().second-1] );
+  }
+  //with no good regions at all, everything is the default
+  if(regions.empty() || regions.back().second < nsamps){
+    ArgExtremes<double> gap;
+    const int gap_start = (regions.empty() ? 0 : regions.back().second);
+    gap.Update(wave[gap_start], gap_start);
+    ext.Merge(gap);
+  }
+  SetExtremes(ext, extremes);
+  return nsamps;
+}
+
+std::ostream& operator<<(std::ostream& out,
+			 const SampleDecoder::INSTRUCTION_SET& set)
+{
+  return out<<SampleDecoder::GetName(set);
+}
+
+std::istream& operator>>(std::istream& in,
+			 SampleDecoder::INSTRUCTION_SET& set)
+{
+  std::string temp;
+  in>>temp;
+  if(temp == "SCALAR" || temp == "scalar")
+    set = SampleDecoder::SCALAR;
+  else if(temp == "SSE4" || temp == "sse4")
+    set = SampleDecoder::SSE4;
+  else if(temp == "AVX2" || temp == "avx2")
+    set = SampleDecoder::AVX2;
+  else{
+    Message e(EXCEPTION);
+    e<<temp<<" is not a valid value for INSTRUCTION_SET"<<std::endl;
+    throw std::invalid_argument(e.str());
+  }
+  return in;
+}
@@ -33,9 +33,9 @@ int Smoother::Process(ChannelData* chdata)
 {
   const int nsamps = chdata->nsamps;
   chdata->smoothed_data.resize(nsamps);
-  double* smoothdata = &(chdata->smoothed_data[0]);
+  sample_t* smoothdata = &(chdata->smoothed_data[0]);
   //double* smoothdata = new double[nsamps];
-  double* wave = chdata->GetWaveform();
+  sample_t* wave = chdata->GetWaveform();
   double running_sum = 0;
   double samps_in_sum = post_samples;
   for(int j = 0; j<post_samples && j<nsamps; j++)
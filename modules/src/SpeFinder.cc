@@ -12,6 +12,8 @@ SpeFinder::SpeFinder():
 {
   //AddDependency<S1S2Evaluation>();
   AddDependency<BaselineFinder>();
+  AddOutput("channels.single_pe");
+  AddInput("s1_valid");
   RegisterParameter("search_start_time", search_start_time = 5.,
                     "Time from start of pulse to begin search [us]");
   RegisterParameter("rough_threshold", rough_threshold = 7,
@@ -85,7 +87,7 @@ int SpeFinder::Process(ChannelData* chdata)
   //end the search at the end of the DAQ window
   int nsamps = chdata->nsamps-3;
   //chdata->TimeToSample(curr_ev_data->s1_end_time); to end of s1
-  double* wave = chdata->GetBaselineSubtractedWaveform();
+  sample_t* wave = chdata->GetBaselineSubtractedWaveform();
   double start_wave=wave[winscan];
   //previous is the sample index of the last located pulse
   int previous=0;
@@ -1,9 +1,16 @@
 #include "SumChannels.hh"
 #include "ConvertData.hh"
 #include "EventHandler.hh"
+#include "SampleDecoder.hh"
 #include <algorithm>
+#include <stdint.h>
 #include "RootWriter.hh"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SUMCHANNELS_X86
+#include <immintrin.h>
+#endif
+
 SumChannels::SumChannels() :
   BaseModule(GetDefaultName(),"Create a virtual channel whose waveform is the sum of all other channels in the event")
 {
@@ -25,83 +32,150 @@ int SumChannels::Finalize()
   return 0;
 }
 
-class add_with_scaling{
-  double _scale_factor;
-public:
-  add_with_scaling(double scale_factor) : _scale_factor(scale_factor) {}
-  double operator()(double x, double y) { return x + y*_scale_factor; }
-};
+/// Add <scale> times in[i] to sum[i]; the vector versions must agree with this
+static inline void AddScaledScalar(const sample_t* in, int n, double scale,
+				   sample_t* sum)
+{
+  for(int i=0; i<n; ++i)
+    sum[i] = sum[i] + in[i]*scale;
+}
+
+#ifdef SUMCHANNELS_X86
+//The compiler already vectorizes the plain loop with SSE2, so only AVX2 is
+//worth writing out.  Multiply and add separately; a fused multiply-add
+//would round differently from the plain loop and from sums made before.
+//The sum is in double even for float samples, again like the plain loop.
+
+/// Number of samples to add before sum+i is aligned to <align> bytes
+static int SamplesToAlign(const sample_t* sum, int n, uintptr_t align)
+{
+  const uintptr_t offset = (uintptr_t)sum % align;
+  if(offset == 0 || offset % sizeof(sample_t))
+    return 0;
+  return std::min<int>(n, (align - offset) / sizeof(sample_t));
+}
+
+__attribute__((target("avx2")))
+static void AddScaledAVX2(const sample_t* in, int n, double scale,
+			  sample_t* sum)
+{
+  int i = SamplesToAlign(sum, n, 32);
+  AddScaledScalar(in, i, scale, sum);
+  const __m256d s = _mm256_set1_pd(scale);
+#ifdef FLOAT_SAMPLES
+  for(; i+8 <= n; i += 8){
+    const __m256 a = _mm256_load_ps(sum+i);
+    const __m256 b = _mm256_loadu_ps(in+i);
+    const __m256d lo = 
+      _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(a)),
+		    _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(b)),s));
+    const __m256d hi = 
+      _mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(a,1)),
+		    _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(b,1)),s));
+    _mm256_store_ps(sum+i, 
+		    _mm256_insertf128_ps(_mm256_castps128_ps256(
+					   _mm256_cvtpd_ps(lo)),
+					 _mm256_cvtpd_ps(hi), 1));
+  }
+#else
+  for(; i+4 <= n; i += 4){
+    _mm256_store_pd(sum+i, _mm256_add_pd(_mm256_load_pd(sum+i),
+					 _mm256_mul_pd(_mm256_loadu_pd(in+i),
+						       s)));
+  }
+#endif
+  AddScaledScalar(in+i, n-i, scale, sum+i);
+}
+#endif //SUMCHANNELS_X86
+
+/// Add a scaled channel to the sum with the version ConvertData allows
+static void AddScaled(const sample_t* in, int n, double scale, sample_t* sum)
+{
+#ifdef SUMCHANNELS_X86
+  const SampleDecoder::INSTRUCTION_SET set = SampleDecoder::GetInstructionSet();
+  if(set == SampleDecoder::AVX2)
+    return AddScaledAVX2(in, n, scale, sum);
+#endif
+  AddScaledScalar(in, n, scale, sum);
+}
+
+bool SumChannels::IsSummed(const ChannelData& chdata) const
+{
+  //skip the channels we were told to, and other virtual channels
+  return _skip_channels.find(chdata.channel_id) == _skip_channels.end() &&
+    chdata.channel_id >= 0;
+}
 
 int SumChannels::Process(EventPtr event)
 {
-  ChannelData sumdata;
-  sumdata.channel_id = ChannelData::CH_SUM;
-  sumdata.label = "sum";
-  sumdata.sample_bits = 32;
-  int n_channels_summed = 0;
   EventDataPtr data = event->GetEventData();
   if (data->channels.size() < 2)
     //No point in summing channels
     return 0;
   
-  for(size_t i=0; i<data->channels.size(); i++){
+  //line up the waveforms of the channels at their triggers, keeping only
+  //the samples every channel has
+  const size_t nchans = data->channels.size();
+  int n_channels_summed = 0;
+  int presamps = 0, postsamps = 0, last_nsamps = 0;
+  double sample_rate = 0;
+  for(size_t i=0; i<nchans; i++){
     const ChannelData& chdata = data->channels[i];
-    if( _skip_channels.find( chdata.channel_id) != _skip_channels.end() ||
-	chdata.channel_id < 0 ){
-      // we told it to skip this channel
+    if(!IsSummed(chdata))
       continue;
-    }
     if(n_channels_summed == 0){
-      sumdata.sample_rate = chdata.sample_rate;
-      sumdata.trigger_index = chdata.trigger_index;
-      sumdata.nsamps = chdata.nsamps;
-      
-      sumdata.waveform.resize(chdata.nsamps);
-      
+      sample_rate = chdata.sample_rate;
+      presamps = chdata.trigger_index;
+      postsamps = chdata.nsamps - chdata.trigger_index;
     }
-    
-    //line up the waveforms of the channels
-    const int presamps = std::min(sumdata.trigger_index, chdata.trigger_index);
-    const int postsamps = std::min(sumdata.nsamps - sumdata.trigger_index,
-				   chdata.nsamps - chdata.trigger_index);
-    //load the scale factor from the calibration database
-    double scale_factor = 1./chdata.spe_mean;;
-    
-    //sum the two channels into a temporary vector
-    std::vector<double> tempsum(presamps+postsamps);
-    std::vector<double>::const_iterator sumit = sumdata.waveform.begin();
-    std::vector<double>::const_iterator chit = chdata.waveform.begin();
-    //sum from trigger_index - presamps to trigger_index+postsamps
-    std::transform(sumit+sumdata.trigger_index-presamps,
-		   sumit+sumdata.trigger_index+postsamps, 
-		   chit+chdata.trigger_index-presamps,
-		   tempsum.begin(),
-		   add_with_scaling(scale_factor));
-    //copy the temporary into the sumdata waveform vector
-    sumdata.waveform.assign(tempsum.begin(), tempsum.end());
-       
-    //reset the historical channel_start and end pointers
-    sumdata.trigger_index = presamps;
-    sumdata.nsamps = presamps+postsamps;
-    sumdata.channel_start = (char*)(sumdata.GetWaveform());
-    sumdata.channel_end = (char*)( sumdata.GetWaveform() + chdata.nsamps );
+    presamps = std::min(presamps, chdata.trigger_index);
+    postsamps = std::min(postsamps, chdata.nsamps - chdata.trigger_index);
+    last_nsamps = chdata.nsamps;
     n_channels_summed++;
+  }
+  if(n_channels_summed == 0)
+    return 0;
+  
+  //build the sum in place in a channel recycled from earlier events, if
+  //possible.  This invalidates references to the other channels.
+  ChannelData& sumdata = data->AddChannel();
+  sumdata.channel_id = ChannelData::CH_SUM;
+  sumdata.label = "sum";
+  sumdata.sample_bits = 32;
+  sumdata.sample_rate = sample_rate;
+  sumdata.trigger_index = presamps;
+  sumdata.nsamps = presamps+postsamps;
+  sumdata.waveform.assign(sumdata.nsamps, 0);
+  sample_t* wave = sumdata.waveform.data();
+  //add the channels one at a time, in order
+  for(size_t i=0; i<nchans; i++){
+    const ChannelData& chdata = data->channels[i];
+    if(!IsSummed(chdata))
+      continue;
+    //load the scale factor from the calibration database
+    double scale_factor = 1./chdata.spe_mean;
+    const sample_t* chit = 
+      chdata.GetWaveform() + chdata.trigger_index - presamps;
+    AddScaled(chit, sumdata.nsamps, scale_factor, wave);
     // the sum is "saturated" if any single channel is
     if(chdata.saturated) sumdata.saturated = true;
   } //end loop over channels
-  if (n_channels_summed > 0){
-    //find the max and min of the channel
-    double* wave = sumdata.GetWaveform();
-    double* max_samp = std::max_element(wave, wave+sumdata.nsamps);
-    double* min_samp = std::min_element(wave, wave+sumdata.nsamps);
-    //data is saturated if it hit 0 or maximum range
-    sumdata.maximum = *max_samp;
-    sumdata.minimum = *min_samp;
-    sumdata.max_time = sumdata.SampleToTime(max_samp - wave);
-    sumdata.min_time = sumdata.SampleToTime(min_samp - wave);
-    data->channels.push_back(sumdata);
+  
+  //reset the historical channel_start and end pointers
+  sumdata.channel_start = (char*)(wave);
+  sumdata.channel_end = (char*)(wave + last_nsamps);
+  //find the first max and min of the channel in one pass
+  sample_t* max_samp = wave;
+  sample_t* min_samp = wave;
+  for(sample_t* samp = wave+1; samp < wave+sumdata.nsamps; ++samp){
+    if(*max_samp < *samp) max_samp = samp;
+    if(*samp < *min_samp) min_samp = samp;
   }
+  //data is saturated if it hit 0 or maximum range
+  sumdata.maximum = *max_samp;
+  sumdata.minimum = *min_samp;
+  sumdata.max_time = sumdata.SampleToTime(max_samp - wave);
+  sumdata.min_time = sumdata.SampleToTime(min_samp - wave);
   return 0;
   
 }
-
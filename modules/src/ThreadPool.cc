@@ -0,0 +1,126 @@
+#include "ThreadPool.hh"
+#include "Message.hh"
+
+#ifndef SINGLETHREAD
+typedef std::unique_lock<std::mutex> scoped_lock;
+
+/// Is this thread running iterations of a loop on the pool?
+static thread_local bool inside_loop = false;
+
+/// Mark this thread as inside a loop for as long as we exist
+class InsideLoop{
+  bool _was_inside;
+public:
+  InsideLoop() : _was_inside(inside_loop) { inside_loop = true; }
+  ~InsideLoop(){ inside_loop = _was_inside; }
+};
+#endif
+
+ThreadPool::ThreadPool() : _nthreads(0)
+#ifndef SINGLETHREAD
+			 , _func(0), _n(0), _next(0), _generation(0),
+			 _open(false), _busy(0), _stop(false)
+#endif
+{}
+
+ThreadPool::~ThreadPool()
+{
+  SetNThreads(0);
+}
+
+ThreadPool* ThreadPool::GetInstance()
+{
+  static ThreadPool pool;
+  return &pool;
+}
+
+int ThreadPool::SetNThreads(int nthreads)
+{
+  if(nthreads < 0)
+    nthreads = 0;
+#ifdef SINGLETHREAD
+  if(nthreads > 0)
+    Message(WARNING)<<"Multithreading disabled; loops will run serially.\n";
+  return 0;
+#else
+  if(nthreads == _nthreads)
+    return 0;
+  //wait for the loop in progress, if any, then replace the threads
+  scoped_lock loop_lock(_loop_mutex);
+  {
+    scoped_lock lock(_mutex);
+    _stop = true;
+    _start.notify_all();
+  }
+  for(size_t i=0; i<_threads.size(); ++i)
+    _threads[i].join();
+  _threads.clear();
+  _stop = false;
+  for(int i=0; i<nthreads; ++i)
+    _threads.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+  _nthreads = nthreads;
+  if(nthreads > 0)
+    Message(DEBUG)<<"Thread pool running with "<<nthreads<<" threads.\n";
+  return 0;
+#endif
+}
+
+void ThreadPool::ParallelFor(size_t n,
+			     const std::function<void(size_t)>& func)
+{
+#ifndef SINGLETHREAD
+  //if someone else has the pool, it's quicker to do the work ourselves.
+  //A loop started from inside a loop would be waiting on itself, so it
+  //runs serially too
+  scoped_lock loop_lock(_loop_mutex, std::defer_lock);
+  if(n > 1 && _nthreads > 0 && !inside_loop && loop_lock.try_lock()){
+    {
+      scoped_lock lock(_mutex);
+      _func = &func;
+      _n = n;
+      _next = 0;
+      _open = true;
+      ++_generation;
+    }
+    _start.notify_all();
+    RunIterations();
+    //all indices are handed out; wait for the workers still busy with one
+    scoped_lock lock(_mutex);
+    _open = false;
+    while(_busy > 0)
+      _finished.wait(lock);
+    _func = 0;
+    return;
+  }
+#endif
+  for(size_t i=0; i<n; ++i)
+    func(i);
+}
+
+#ifndef SINGLETHREAD
+void ThreadPool::RunIterations()
+{
+  InsideLoop guard;
+  for(size_t i = _next++; i < _n; i = _next++)
+    (*_func)(i);
+}
+
+void ThreadPool::WorkerLoop()
+{
+  scoped_lock lock(_mutex);
+  long joined = _generation;
+  while(true){
+    while(!_stop && (_generation == joined || !_open))
+      _start.wait(lock);
+    if(_stop)
+      break;
+    joined = _generation;
+    ++_busy;
+    lock.unlock();
+    RunIterations();
+    lock.lock();
+    if(--_busy == 0)
+      _finished.notify_all();
+  }
+}
+#endif
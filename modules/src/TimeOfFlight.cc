@@ -7,6 +7,7 @@
 TimeOfFlight::TimeOfFlight() : ChannelModule(GetDefaultName(), "finds the number of particles detected in the channel and the arrive time of the earliest particle detected"){
   AddDependency<BaselineFinder>();
   AddDependency<Integrator>();
+  AddOutput("channels.tof");
   RegisterParameter("search_begin_time" , search_begin_time = -0.5, "time in us to start searching for particle signal");
   RegisterParameter("search_end_time" , search_end_time = 0.5, "time in us to end searching for particle signal");
   RegisterParameter("ref_threshold" , ref_threshold = 2500, "reference trigger threshold");
@@ -33,7 +34,7 @@ int TimeOfFlight::Process(ChannelData* chdata)
   int start = chdata->TimeToSample(search_begin_time, true);
   // reference channel, SCENE proton beam trigger
   if (chdata->channel_id == ref_ch){
-    const double* ref_wave = chdata->GetWaveform();
+    const sample_t* ref_wave = chdata->GetWaveform();
     // Move start index to region below ref_threshold
     while (ref_wave[start] > ref_threshold){
       start--; 
@@ -62,7 +63,7 @@ int TimeOfFlight::Process(ChannelData* chdata)
       tof.peak_time = pulse.peak_time;
       tof.length = pulse.length;
       double cf_threshold = constant_fraction * tof.amplitude;
-      const double* wave = chdata->GetBaselineSubtractedWaveform();
+      const sample_t* wave = chdata->GetBaselineSubtractedWaveform();
       int j=chdata->TimeToSample(tof.peak_time)-1; 
       while(j>chdata->TimeToSample(tof.start_time) && -wave[j]>cf_threshold){
 	j--;
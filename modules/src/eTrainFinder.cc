@@ -33,6 +33,7 @@ eTrainFinder::eTrainFinder():
   RegisterParameter("eMax", eMax = 100,
                     "Maximum number of spikes for a bad event");
   AddDependency("BaselineFinder");
+  AddOutput("channels.unspikes");
 }
 
 eTrainFinder::~eTrainFinder()
@@ -132,7 +133,7 @@ int eTrainFinder::Process(ChannelData* chdata)
   const int min_sep = distance;  //separation in samples for a new hit
   const int eventID = current_event_data->event_id;
   const int channelID = chdata->channel_id;
-  double* wave = chdata->GetBaselineSubtractedWaveform();
+  sample_t* wave = chdata->GetBaselineSubtractedWaveform();
   int lastbad = startscan;
 
   if(channelID<0)
@@ -0,0 +1,52 @@
+#!/bin/bash
+# Skim the first events of a raw file and make sure genroot can convert the
+# skim, i.e. that rawskim left the run's configuration next to it
+
+print_usage(){
+    echo "Usage: ./checkskim.sh <raw datafile> [<nevents>]"
+    exit 1
+}
+
+[ $# -ge 1 ] && [ $# -le 2 ] || print_usage
+rawfile=$1
+nevents=${2:-10}
+[ "$nevents" -ge 1 ] 2>/dev/null || print_usage
+
+workdir=$(mktemp -d)
+trap "rm -rf $workdir" EXIT
+
+#rawskim names the skim after the input up to the first '.'
+skimbase=$(basename $rawfile)
+skimbase="${skimbase%%.*}_skim"
+
+echo "Skimming the first $nevents events of $rawfile..."
+if ! rawskim --directory $workdir --max $((nevents-1)) $rawfile \
+    >$workdir/rawskim.log 2>&1 ; then
+    cat $workdir/rawskim.log
+    echo "FAILED: rawskim returned an error"
+    exit 2
+fi
+
+if [ ! -f $workdir/$skimbase.cfg ] ; then
+    echo "FAILED: no configuration saved with the skim"
+    exit 3
+fi
+if ! grep -q "V172X_Params" $workdir/$skimbase.cfg ; then
+    echo "FAILED: the configuration saved with the skim has no V172X_Params"
+    exit 3
+fi
+
+echo "Converting the skim with genroot..."
+if ! genroot --rootdir $workdir --rootfile $skimbase.root \
+    $workdir/$skimbase.000.out >$workdir/genroot.log 2>&1 ; then
+    cat $workdir/genroot.log
+    echo "FAILED: genroot could not process the skim"
+    exit 4
+fi
+if [ ! -s $workdir/$skimbase.root ] ; then
+    cat $workdir/genroot.log
+    echo "FAILED: genroot wrote no output"
+    exit 4
+fi
+
+echo "Done!"